@@ -0,0 +1,50 @@
+/*
+    The parts of the Adafruit BME680 library used by the node, for the native
+    environment. Measurements take the time set in the simulator, and give
+    readings that follow a daily cycle.
+ */
+
+#include "Arduino.h"
+#include "Wire.h"
+
+#ifndef ADAFRUIT_BME680_H
+#define ADAFRUIT_BME680_H
+
+#define BME680_OS_NONE 0
+#define BME680_OS_1X 1
+#define BME680_OS_2X 2
+#define BME680_OS_4X 3
+#define BME680_OS_8X 4
+#define BME680_OS_16X 5
+
+class Adafruit_BME680
+{
+private:
+    uint8_t address = 0x77;
+    uint8_t humidity_os = BME680_OS_2X;
+    uint8_t temperature_os = BME680_OS_8X;
+    uint8_t pressure_os = BME680_OS_4X;
+    unsigned long end_time = 0;
+
+public:
+    float temperature = 0;
+    float humidity = 0;
+    float pressure = 0;
+    uint32_t gas_resistance = 0;
+
+    Adafruit_BME680(TwoWire* = &Wire) { }
+
+    bool begin(uint8_t = 0x77, bool = true);
+    bool setTemperatureOversampling(uint8_t value) { temperature_os = value; return true; }
+    bool setHumidityOversampling(uint8_t value) { humidity_os = value; return true; }
+    bool setPressureOversampling(uint8_t value) { pressure_os = value; return true; }
+    bool setIIRFilterSize(uint8_t) { return true; }
+    bool setGasHeater(uint16_t, uint16_t) { return true; }
+
+    unsigned long beginReading();
+    bool endReading();
+    int remainingReadingMillis();
+    bool performReading() { return beginReading() != 0 && endReading(); }
+};
+
+#endif
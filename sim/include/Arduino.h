@@ -0,0 +1,69 @@
+/*
+    The parts of the Arduino core used by the node, for the native environment.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+#include "esp_attr.h"
+#include "esp_sleep.h"
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define ANALOG 0xC0
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t);
+void yield();
+
+void pinMode(uint8_t, uint8_t);
+uint16_t analogRead(uint8_t);
+uint32_t analogReadMilliVolts(uint8_t);
+
+void esp_efuse_mac_get_default(uint8_t*);
+
+class String
+{
+private:
+    std::string value;
+
+public:
+    String(const char* text = "") : value(text) { }
+    const char* c_str() const { return value.c_str(); }
+    size_t length() const { return value.length(); }
+};
+
+class HardwareSerial
+{
+public:
+    void begin(unsigned long) { }
+    void end() { }
+    void updateBaudRate(unsigned long) { }
+    void flush() { }
+    void setTimeout(unsigned long) { }
+    int available() { return 0; }
+    int read() { return -1; }
+    size_t readBytes(uint8_t*, size_t) { return 0; }
+    size_t write(uint8_t value) { return write(&value, 1); }
+    size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t write(const uint8_t*, size_t);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,65 @@
+#include <functional>
+
+#include "Arduino.h"
+
+#ifndef ASYNC_MQTT_CLIENT_H
+#define ASYNC_MQTT_CLIENT_H
+
+struct AsyncMqttClientMessageProperties
+{
+    uint8_t qos;
+    bool dup;
+    bool retain;
+};
+
+typedef std::function<void(bool)> OnConnectCallback;
+typedef std::function<void(uint16_t, uint8_t)> OnSubscribeCallback;
+typedef std::function<void(char*, char*, AsyncMqttClientMessageProperties,
+    size_t, size_t, size_t)> OnMessageCallback;
+
+class AsyncMqttClient
+{
+public:
+    OnConnectCallback connect_callback;
+    OnSubscribeCallback subscribe_callback;
+    OnMessageCallback message_callback;
+    bool clean_session = true;
+    bool is_connected = false;
+    uint16_t packet_id = 0;
+    char client_id[32] = { '\0' };
+
+    AsyncMqttClient& onConnect(OnConnectCallback callback)
+    {
+        connect_callback = callback;
+        return *this;
+    }
+
+    AsyncMqttClient& onSubscribe(OnSubscribeCallback callback)
+    {
+        subscribe_callback = callback;
+        return *this;
+    }
+
+    AsyncMqttClient& onMessage(OnMessageCallback callback)
+    {
+        message_callback = callback;
+        return *this;
+    }
+
+    AsyncMqttClient& setServer(const char*, uint16_t) { return *this; }
+    AsyncMqttClient& setClientId(const char*);
+    AsyncMqttClient& setCleanSession(bool clean)
+    {
+        clean_session = clean;
+        return *this;
+    }
+
+    void connect();
+    void disconnect(bool = false);
+    bool connected() const { return is_connected; }
+    uint16_t subscribe(const char*, uint8_t);
+    uint16_t publish(const char*, uint8_t, bool, const char* = NULL,
+        size_t = 0, bool = false, uint16_t = 0);
+};
+
+#endif
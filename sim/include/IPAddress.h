@@ -0,0 +1,21 @@
+#include <stdint.h>
+
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+class IPAddress
+{
+private:
+    uint32_t address;
+
+public:
+    IPAddress() : address(0) { }
+    IPAddress(uint32_t address) : address(address) { }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+        : address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) { }
+    operator uint32_t() const { return address; }
+};
+
+#define INADDR_NONE IPAddress((uint32_t)0)
+
+#endif
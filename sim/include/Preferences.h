@@ -0,0 +1,38 @@
+#include "Arduino.h"
+
+#ifndef PREFERENCES_H
+#define PREFERENCES_H
+
+class Preferences
+{
+private:
+    size_t get(const char*, void*, size_t);
+    size_t put(const char*, const void*, size_t);
+
+public:
+    bool begin(const char*, bool = false) { return true; }
+    void end() { }
+    bool clear();
+    bool remove(const char*);
+    bool isKey(const char*);
+
+    String getString(const char*, const String& = String());
+    bool getBool(const char* key, bool value = false) { get(key, &value, 1); return value; }
+    uint8_t getUChar(const char* key, uint8_t value = 0) { get(key, &value, 1); return value; }
+    uint16_t getUShort(const char* key, uint16_t value = 0) { get(key, &value, 2); return value; }
+    uint32_t getUInt(const char* key, uint32_t value = 0) { get(key, &value, 4); return value; }
+    uint64_t getULong64(const char* key, uint64_t value = 0) { get(key, &value, 8); return value; }
+    float getFloat(const char* key, float value = 0) { get(key, &value, 4); return value; }
+    size_t getBytes(const char* key, void* data, size_t length) { return get(key, data, length); }
+
+    size_t putString(const char* key, const char* value) { return put(key, value, strlen(value) + 1); }
+    size_t putBool(const char* key, bool value) { return put(key, &value, 1); }
+    size_t putUChar(const char* key, uint8_t value) { return put(key, &value, 1); }
+    size_t putUShort(const char* key, uint16_t value) { return put(key, &value, 2); }
+    size_t putUInt(const char* key, uint32_t value) { return put(key, &value, 4); }
+    size_t putULong64(const char* key, uint64_t value) { return put(key, &value, 8); }
+    size_t putFloat(const char* key, float value) { return put(key, &value, 4); }
+    size_t putBytes(const char* key, const void* data, size_t length) { return put(key, data, length); }
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+    The parts of the RTC library (Michael Miller) used by the node, for the
+    native environment. The RTC is accessed through the simulated I2C bus.
+ */
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "sim.h"
+
+#ifndef RTC_DS3231_H
+#define RTC_DS3231_H
+
+class RtcDateTime
+{
+private:
+    uint32_t seconds; // Since 2000-01-01
+
+    static uint32_t days_from_date(uint16_t year, uint8_t month, uint8_t day)
+    {
+        // Days since 2000-01-01 (civil calendar, March-based year)
+        int y = year - (month <= 2);
+        int era = y / 400;
+        int year_of_era = y - era * 400;
+        int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+            day_of_year;
+        return era * 146097 + day_of_era - 730425;
+    }
+
+    void date(uint16_t* year, uint8_t* month, uint8_t* day) const
+    {
+        int z = seconds / 86400 + 730425;
+        int era = z / 146097;
+        int day_of_era = z - era * 146097;
+        int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+            day_of_era / 146096) / 365;
+        int day_of_year = day_of_era -
+            (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        int mp = (5 * day_of_year + 2) / 153;
+
+        *day = day_of_year - (153 * mp + 2) / 5 + 1;
+        *month = mp < 10 ? mp + 3 : mp - 9;
+        *year = year_of_era + era * 400 + (*month <= 2);
+    }
+
+public:
+    RtcDateTime(uint32_t seconds = 0) : seconds(seconds) { }
+    RtcDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour,
+        uint8_t minute, uint8_t second)
+    {
+        seconds = days_from_date(year, month, day) * 86400 + hour * 3600 +
+            minute * 60 + second;
+    }
+
+    uint16_t Year() const { uint16_t y; uint8_t m, d; date(&y, &m, &d); return y; }
+    uint8_t Month() const { uint16_t y; uint8_t m, d; date(&y, &m, &d); return m; }
+    uint8_t Day() const { uint16_t y; uint8_t m, d; date(&y, &m, &d); return d; }
+    uint8_t Hour() const { return (seconds / 3600) % 24; }
+    uint8_t Minute() const { return (seconds / 60) % 60; }
+    uint8_t Second() const { return seconds % 60; }
+    uint8_t DayOfWeek() const { return (seconds / 86400 + 6) % 7; }
+    uint32_t TotalSeconds() const { return seconds; }
+    bool IsValid() const { return true; }
+
+    operator uint32_t() const { return seconds; }
+    void operator+=(uint32_t value) { seconds += value; }
+    RtcDateTime operator+(uint32_t value) const { return RtcDateTime(seconds + value); }
+    RtcDateTime operator+(int value) const { return RtcDateTime(seconds + value); }
+};
+
+enum DS3231SquareWavePinMode
+{
+    DS3231SquareWavePin_ModeNone,
+    DS3231SquareWavePin_ModeAlarmOne,
+    DS3231SquareWavePin_ModeAlarmTwo,
+    DS3231SquareWavePin_ModeAlarmBoth,
+    DS3231SquareWavePin_ModeClock
+};
+
+// Bits 0 to 3 are the A1M1 to A1M4 mask bits, bit 4 selects the day of week
+enum DS3231AlarmOneControl
+{
+    DS3231AlarmOneControl_HoursMinutesSecondsDayOfMonthMatch = 0x00,
+    DS3231AlarmOneControl_OncePerSecond = 0x0F,
+    DS3231AlarmOneControl_SecondsMatch = 0x0E,
+    DS3231AlarmOneControl_MinutesSecondsMatch = 0x0C,
+    DS3231AlarmOneControl_HoursMinutesSecondsMatch = 0x08,
+    DS3231AlarmOneControl_HoursMinutesSecondsDayOfWeekMatch = 0x10
+};
+
+enum DS3231AlarmFlag
+{
+    DS3231AlarmFlag_Alarm1 = 0x01,
+    DS3231AlarmFlag_Alarm2 = 0x02,
+    DS3231AlarmFlag_AlarmBoth = 0x03
+};
+
+class DS3231AlarmOne
+{
+public:
+    uint8_t day, hour, minute, second;
+    DS3231AlarmOneControl control;
+
+    DS3231AlarmOne(uint8_t day, uint8_t hour, uint8_t minute, uint8_t second,
+        DS3231AlarmOneControl control)
+        : day(day), hour(hour), minute(minute), second(second), control(control) { }
+};
+
+template <typename T> class RtcDS3231
+{
+private:
+    static uint8_t to_bcd(uint8_t value) { return ((value / 10) << 4) | (value % 10); }
+
+    void write_register(uint8_t reg, uint8_t value)
+    {
+        uint8_t data[2] = { reg, value };
+        sim_i2c_write(0x68, data, 2);
+    }
+
+    uint8_t read_register(uint8_t reg)
+    {
+        uint8_t value = 0;
+        sim_i2c_write(0x68, &reg, 1);
+        sim_i2c_read(0x68, &value, 1);
+        return value;
+    }
+
+public:
+    RtcDS3231(T&) { }
+
+    void Begin() { }
+    uint8_t LastError() { return 0; }
+    bool IsDateTimeValid() { return (read_register(0x0F) & 0x80) == 0; }
+    bool GetIsRunning() { return true; }
+
+    // The time is latched at the start of the transfer, which takes as long as
+    // setting the register pointer and reading the seven time registers
+    RtcDateTime GetDateTime()
+    {
+        RtcDateTime time(sim_rtc_seconds());
+        sim_advance(SIM_RTC_READ_US);
+        return time;
+    }
+
+    void SetDateTime(const RtcDateTime& time)
+    {
+        world->rtc_offset += (int64_t)(uint32_t)time - (int64_t)sim_rtc_seconds();
+        write_register(0x0F, read_register(0x0F) & ~0x80);
+    }
+
+    void SetSquareWavePin(DS3231SquareWavePinMode mode)
+    {
+        uint8_t control = read_register(0x0E) & ~0x07;
+        if (mode == DS3231SquareWavePin_ModeAlarmOne) control |= 0x05;
+        else if (mode == DS3231SquareWavePin_ModeAlarmTwo) control |= 0x06;
+        else if (mode == DS3231SquareWavePin_ModeAlarmBoth) control |= 0x07;
+        write_register(0x0E, control);
+    }
+
+    void SetAlarmOne(const DS3231AlarmOne& alarm)
+    {
+        uint8_t data[5] = { 0x07,
+            (uint8_t)(to_bcd(alarm.second) | ((alarm.control & 0x01) << 7)),
+            (uint8_t)(to_bcd(alarm.minute) | ((alarm.control & 0x02) << 6)),
+            (uint8_t)(to_bcd(alarm.hour) | ((alarm.control & 0x04) << 5)),
+            (uint8_t)(to_bcd(alarm.day) | ((alarm.control & 0x08) << 4) |
+                ((alarm.control & 0x10) << 2)) };
+        sim_i2c_write(0x68, data, 5);
+    }
+
+    DS3231AlarmFlag LatchAlarmsTriggeredFlags()
+    {
+        uint8_t status = read_register(0x0F);
+        write_register(0x0F, status & ~0x03);
+        return (DS3231AlarmFlag)(status & 0x03);
+    }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "Arduino.h"
+#include "IPAddress.h"
+
+#ifndef WIFI_H
+#define WIFI_H
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1 } wifi_mode_t;
+
+typedef enum
+{
+    SYSTEM_EVENT_STA_CONNECTED = 4,
+    SYSTEM_EVENT_STA_DISCONNECTED = 5,
+    SYSTEM_EVENT_STA_GOT_IP = 7
+} system_event_id_t;
+
+typedef system_event_id_t WiFiEvent_t;
+typedef void (*WiFiEventCb)(system_event_id_t);
+
+class WiFiClass
+{
+public:
+    wl_status_t begin(const char*, const char* = NULL, int32_t = 0,
+        const uint8_t* = NULL, bool = true);
+    bool config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress(),
+        IPAddress = IPAddress());
+    bool disconnect(bool = false, bool = false);
+    bool mode(wifi_mode_t);
+    void persistent(bool) { }
+    bool setSleep(bool) { return true; }
+    int onEvent(WiFiEventCb, system_event_id_t);
+    wl_status_t status();
+
+    uint8_t* BSSID();
+    int32_t channel();
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t = 0);
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,28 @@
+#include "Arduino.h"
+
+#ifndef WIRE_H
+#define WIRE_H
+
+class TwoWire
+{
+private:
+    uint8_t address = 0;
+    uint8_t buffer[64];
+    int length = 0;
+    int position = 0;
+
+public:
+    bool begin(int = -1, int = -1, uint32_t = 0) { return true; }
+    void setClock(uint32_t) { }
+    void beginTransmission(uint8_t);
+    size_t write(uint8_t);
+    size_t write(const uint8_t*, size_t);
+    uint8_t endTransmission(bool = true);
+    uint8_t requestFrom(uint8_t, uint8_t, bool = true);
+    int available();
+    int read();
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,16 @@
+/*
+    Variables in RTC memory are gathered into their own sections so that the
+    simulator can keep them between wakes while everything else is reset. The
+    RTC_NOINIT_ATTR variables are also kept when the node is reset.
+ */
+
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
+#define RTC_IRAM_ATTR
+#define RTC_RODATA_ATTR
+#define IRAM_ATTR
+
+#endif
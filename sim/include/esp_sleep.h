@@ -0,0 +1,34 @@
+#include <stdint.h>
+
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+
+typedef int esp_err_t;
+#define ESP_OK 0
+
+typedef enum
+{
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_22 = 22,
+    GPIO_NUM_34 = 34,
+    GPIO_NUM_35 = 35
+} gpio_num_t;
+
+typedef enum
+{
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_EXT0 = 2,
+    ESP_SLEEP_WAKEUP_TIMER = 4
+} esp_sleep_wakeup_cause_t;
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t, int);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t);
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_wakeup_cause_t);
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+[[noreturn]] void esp_deep_sleep_start();
+esp_err_t esp_light_sleep_start();
+void esp_default_wake_deep_sleep();
+void esp_wake_deep_sleep();
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1 @@
+#include "esp_sleep.h"
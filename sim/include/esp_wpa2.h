@@ -0,0 +1,13 @@
+#include <stdint.h>
+
+#ifndef ESP_WPA2_H
+#define ESP_WPA2_H
+
+typedef struct { int unused; } esp_wpa2_config_t;
+#define WPA2_CONFIG_INIT_DEFAULT() { 0 }
+
+inline int esp_wifi_sta_wpa2_ent_set_username(const uint8_t*, int) { return 0; }
+inline int esp_wifi_sta_wpa2_ent_set_password(const uint8_t*, int) { return 0; }
+inline int esp_wifi_sta_wpa2_ent_enable(const esp_wpa2_config_t*) { return 0; }
+
+#endif
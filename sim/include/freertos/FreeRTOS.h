@@ -0,0 +1,23 @@
+/*
+    The parts of FreeRTOS used by the node, for the native environment. Tasks
+    run one at a time in virtual time (see sim/src/kernel.cpp).
+ */
+
+#include <stdint.h>
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#endif
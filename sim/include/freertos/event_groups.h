@@ -0,0 +1,16 @@
+#include "FreeRTOS.h"
+
+#ifndef EVENT_GROUPS_H
+#define EVENT_GROUPS_H
+
+typedef uint32_t EventBits_t;
+typedef struct sim_event_group_t* EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate();
+EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t);
+EventBits_t xEventGroupWaitBits(
+    EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t);
+
+#endif
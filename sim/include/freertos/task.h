@@ -0,0 +1,18 @@
+#include "FreeRTOS.h"
+
+#ifndef TASK_H
+#define TASK_H
+
+typedef struct sim_task_t* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*,
+    UBaseType_t, TaskHandle_t*, BaseType_t);
+void vTaskDelete(TaskHandle_t);
+void vTaskSuspend(TaskHandle_t);
+void vTaskDelay(TickType_t);
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+
+#endif
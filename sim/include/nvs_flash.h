@@ -0,0 +1,6 @@
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+inline int nvs_flash_init() { return 0; }
+
+#endif
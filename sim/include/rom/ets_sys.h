@@ -0,0 +1,8 @@
+#include <stdint.h>
+
+#ifndef ROM_ETS_SYS_H
+#define ROM_ETS_SYS_H
+
+void ets_delay_us(uint32_t);
+
+#endif
@@ -0,0 +1,11 @@
+#include <stdint.h>
+
+#ifndef ROM_GPIO_H
+#define ROM_GPIO_H
+
+void gpio_output_set(uint32_t, uint32_t, uint32_t, uint32_t);
+uint32_t gpio_input_get();
+void gpio_pad_select_gpio(uint8_t);
+void gpio_pad_pullup(uint8_t);
+
+#endif
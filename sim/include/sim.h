@@ -0,0 +1,200 @@
+/*
+    The simulated hardware and environment that the node runs in when built for
+    the native environment. The state that must survive across wakes (the
+    hardware, the network and the statistics) is held in a sim_world_t that is
+    shared between the simulator and the process running each wake.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef SIM_H
+#define SIM_H
+
+#define SIM_FLASH_SIZE 0x270000 // Number of bytes in the simulated spool partition
+#define SIM_RTC_MEMORY 16384 // Maximum number of bytes of RTC_DATA_ATTR variables
+#define SIM_NVS_ENTRIES 32 // Maximum number of keys in the simulated NVS
+#define SIM_MAX_SECONDS (60UL * 86400) // Maximum length of a simulation in seconds
+#define SIM_RTC_READ_US 900 // Number of microseconds to read the time from the
+// RTC (ten bytes on the I2C bus at 100 kHz)
+
+// Settings for a simulation
+struct sim_config_t
+{
+    uint32_t seconds; // Length of the simulation
+    uint64_t seed;
+    bool verbose;
+
+    // The session served by the logging server
+    uint16_t session_id;
+    uint8_t interval;
+    uint8_t batch_size;
+    uint8_t encoding;
+    uint8_t sample_period; // Seconds between samples (0 for one per report)
+    float airt_deadband; // Send-on-delta deadbands (none if max_silence is 0)
+    float relh_deadband;
+    uint8_t max_silence;
+    bool newest_first; // Transmit the newest reports ahead of a backlog
+    uint8_t report_period; // Seconds between reports in high-frequency mode (0
+    // for one report per interval)
+
+    // Latencies in milliseconds
+    uint32_t boot_ms; // Full boot up to setup()
+    uint32_t stub_boot_ms; // Wake up to the wake stub
+    uint32_t sensor_ms; // BME680 measurement
+    uint32_t wifi_ms; // Full WiFi connection (scan, association and DHCP)
+    uint32_t wifi_fast_ms; // WiFi connection with a known access point and IP
+    uint32_t mqtt_ms; // MQTT connection
+    uint32_t rtt_ms; // Round trip to the logging server
+    uint32_t flash_erase_ms; // Flash sector erase
+
+    // Parts per million that the light sleep timer runs fast by
+    float clock_drift;
+
+    // Probabilities of failure in percent
+    float wifi_fail;
+    float wifi_fast_fail;
+    float mqtt_fail;
+    float reply_loss; // A response from the logging server is lost
+
+    // A period with no network at all, in seconds from the start
+    uint32_t outage_start;
+    uint32_t outage_length;
+
+    // A change to the session interval sent along with the first response to
+    // a batch after a time (none if zero)
+    uint32_t update_time;
+    uint8_t update_interval;
+
+    // A reset of the node while asleep, in seconds from the start (none if
+    // zero)
+    uint32_t reset_time;
+};
+
+struct sim_stats_t
+{
+    uint64_t awake_us;
+    uint64_t radio_us;
+    uint32_t wakes;
+    uint32_t full_boots;
+    uint32_t stub_wakes;
+    uint32_t generated; // Reports the node should have taken
+    uint32_t delivered; // Unique reports received by the logging server
+    uint32_t duplicates;
+    uint32_t connections; // Successful WiFi connections
+    uint32_t missing_readings; // Delivered reports without a temperature
+    float max_airt_error; // Largest difference from the true temperature (or
+    // its mean over the samples, for summaries)
+    uint32_t summaries; // Delivered reports that summarise several samples
+    uint32_t bad_spreads; // Summaries whose mean is outside their minimum and
+    // maximum
+    uint32_t reconstructed; // Suppressed reports filled in by the logging server
+    uint32_t bad_reconstructions; // Suppressed reports that could not be placed
+    // on the interval, or whose true temperature was outside the deadband
+    uint32_t telemetry_records; // Trace records received by the logging server
+    uint32_t traced_losses; // Reports that the node recorded as dropped in its
+    // telemetry (see trace_lost())
+    uint64_t staleness_total; // Sum over the wakes that connected of the age of
+    // the newest report held by the logging server once the wake ended
+    uint32_t staleness_samples;
+    uint32_t max_staleness;
+    uint64_t sample_delay_total; // Sum over the measurements started after
+    // light sleep of the time since the start of their RTC second
+    uint32_t sample_delay_samples;
+    uint32_t max_sample_delay;
+};
+
+struct sim_nvs_entry_t
+{
+    char key[16];
+    uint8_t length;
+    uint8_t value[64];
+};
+
+struct sim_world_t
+{
+    sim_config_t config;
+    sim_stats_t stats;
+    uint64_t random;
+    uint64_t time_us; // Virtual time since the start of the simulation
+    uint64_t wake_us; // Virtual time the current wake started
+
+    // DS3231
+    uint32_t rtc_start; // RTC time at the start in seconds since 2000-01-01
+    int64_t rtc_offset; // Seconds added to the RTC time by setting it
+    uint32_t rtc_checked; // RTC time up to which the alarm has been checked
+    uint8_t rtc_alarm[4]; // Alarm 1 registers
+    uint8_t rtc_control;
+    uint8_t rtc_status;
+    uint8_t rtc_pointer;
+
+    // BME680
+    uint8_t bme680_ctrl_hum;
+    uint8_t bme680_ctrl_meas;
+    uint8_t bme680_pointer;
+    uint64_t bme680_ready_us;
+    uint32_t bme680_temp_adc;
+    uint16_t bme680_hum_adc;
+
+    // Sleep and wake sources
+    int wake_cause;
+    bool ext0_enabled;
+    bool timer_enabled;
+    uint64_t timer_us;
+    bool radio_on;
+    uint64_t radio_start_us;
+
+    // MQTT broker and logging server
+    bool broker_session; // The broker holds a persistent session for the node
+    bool broker_subscribed; // The session includes the inbound subscription
+    bool session_active; // The logging server has an active session
+    uint32_t first_report; // Time of the earliest report that could be delivered
+    uint32_t last_time; // Time of the latest report received, and its
+    float last_airt; // temperature, which suppressed reports are filled in from
+    uint32_t newest_delivered; // Time of the newest report delivered
+    uint8_t delivered[SIM_MAX_SECONDS / 8]; // One bit per second of report time
+
+    sim_nvs_entry_t nvs[SIM_NVS_ENTRIES];
+    uint8_t flash[SIM_FLASH_SIZE];
+
+    size_t rtc_size;
+    uint8_t rtc_memory[SIM_RTC_MEMORY]; // The RTC_DATA_ATTR variables
+    size_t noinit_size;
+    uint8_t noinit_memory[SIM_RTC_MEMORY]; // The RTC_NOINIT_ATTR variables
+};
+
+extern sim_world_t* world;
+
+
+// Kernel (virtual time and tasks, see kernel.cpp)
+typedef void (*sim_event_fn)(void*);
+
+void sim_kernel_begin();
+uint64_t sim_now();
+void sim_advance(uint64_t);
+void sim_schedule(uint64_t, sim_event_fn, void*);
+void sim_wait_until(uint64_t);
+uint32_t sim_random();
+bool sim_chance(float);
+uint32_t sim_jitter(uint32_t);
+bool sim_in_outage();
+void sim_log(const char*, ...);
+[[noreturn]] void sim_sleep();
+[[noreturn]] void sim_fail(const char*);
+
+// Devices (see devices.cpp)
+void sim_devices_begin();
+uint32_t sim_rtc_seconds();
+void sim_rtc_update_alarm();
+bool sim_rtc_alarm_matches(uint32_t);
+void sim_environment(uint32_t, float*, float*);
+void sim_i2c_write(uint8_t, const uint8_t*, int);
+int sim_i2c_read(uint8_t, uint8_t*, int);
+bool sim_i2c_present(uint8_t);
+
+// Network (see network.cpp)
+void sim_radio_on();
+void sim_radio_off();
+bool sim_server_deliver(const char*, const char*, size_t, char*);
+
+#endif
@@ -0,0 +1,22 @@
+/*
+    Register access for the wake stub. Setting the sleep enable bit puts the
+    simulated device back to sleep, other registers are ignored.
+ */
+
+#include <stdint.h>
+
+#ifndef SOC_RTC_CNTL_REG_H
+#define SOC_RTC_CNTL_REG_H
+
+#define RTC_ENTRY_ADDR_REG 0x3FF480B0
+#define RTC_CNTL_STATE0_REG 0x3FF48018
+#define RTC_CNTL_SLEEP_EN (1U << 31)
+
+void sim_register_write(uint32_t, uint32_t);
+void sim_register_set(uint32_t, uint32_t);
+
+#define REG_WRITE(reg, value) sim_register_write((reg), (uint32_t)(value))
+#define SET_PERI_REG_MASK(reg, mask) sim_register_set((reg), (mask))
+#define CLEAR_PERI_REG_MASK(reg, mask) ((void)0)
+
+#endif
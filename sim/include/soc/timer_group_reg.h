@@ -0,0 +1,6 @@
+#ifndef SOC_TIMER_GROUP_REG_H
+#define SOC_TIMER_GROUP_REG_H
+
+#define TIMG_WDTFEED_REG(i) (0x3FF5F060 + (i) * 0x1000)
+
+#endif
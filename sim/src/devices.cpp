@@ -0,0 +1,584 @@
+/*
+    Models of the devices on the I2C bus (the DS3231 RTC and the BME680 sensor)
+    at the register level, so that the node's libraries and the wake stub (which
+    bit-bangs the bus) see the same hardware. Also models the environment that
+    the sensor measures.
+ */
+
+#include <math.h>
+
+#include <Wire.h>
+#include <RtcDS3231.h>
+#include <Adafruit_BME680.h>
+#include <rom/gpio.h>
+#include <rom/ets_sys.h>
+#include <soc/rtc_cntl_reg.h>
+
+#include "sim.h"
+
+
+#define DS3231_ADDRESS 0x68
+#define BME680_ADDRESS 0x76
+#define BME680_CHIP_ID 0x61
+#define I2C_BYTE_US 90 // Number of microseconds to transfer a byte at 100 kHz
+#define SDA_PIN 21
+#define SCL_PIN 22
+
+// Calibration values of the simulated BME680 (taken from a real sensor)
+const uint16_t par_t1 = 26120;
+const int16_t par_t2 = 26479;
+const int8_t par_t3 = 3;
+const uint16_t par_h1 = 770;
+const uint16_t par_h2 = 1012;
+const int8_t par_h3 = 0;
+const int8_t par_h4 = 45;
+const int8_t par_h5 = 20;
+const uint8_t par_h6 = 120;
+const int8_t par_h7 = -100;
+
+TwoWire Wire;
+
+
+void sim_devices_begin()
+{
+    world->rtc_control = 0x1C; // Interrupt output, alarms disabled
+    world->rtc_status = 0x08; // Oscillator has not stopped
+    world->rtc_checked = sim_rtc_seconds();
+}
+
+/*
+    Returns the RTC time in seconds since 2000-01-01.
+ */
+uint32_t sim_rtc_seconds()
+{
+    return world->rtc_start + world->rtc_offset + world->time_us / 1000000;
+}
+
+static uint8_t from_bcd(uint8_t value)
+{
+    return (value >> 4) * 10 + (value & 0x0F);
+}
+
+static uint8_t to_bcd(uint8_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+/*
+    Returns a boolean indicating whether alarm 1 matches an RTC time (following
+    the mask bits in the alarm registers).
+ */
+bool sim_rtc_alarm_matches(uint32_t seconds)
+{
+    RtcDateTime time(seconds);
+    const uint8_t* alarm = world->rtc_alarm;
+
+    if (!(alarm[0] & 0x80) && from_bcd(alarm[0] & 0x7F) != time.Second())
+        return false;
+    if (!(alarm[1] & 0x80) && from_bcd(alarm[1] & 0x7F) != time.Minute())
+        return false;
+    if (!(alarm[2] & 0x80) && from_bcd(alarm[2] & 0x3F) != time.Hour())
+        return false;
+
+    if (!(alarm[3] & 0x80))
+    {
+        if (alarm[3] & 0x40)
+            return (alarm[3] & 0x0F) == time.DayOfWeek() + 1;
+        return from_bcd(alarm[3] & 0x3F) == time.Day();
+    }
+
+    return true;
+}
+
+/*
+    Sets the alarm 1 flag if the alarm has matched since it was last checked.
+ */
+void sim_rtc_update_alarm()
+{
+    uint32_t now = sim_rtc_seconds();
+    if (now - world->rtc_checked > 86400) world->rtc_checked = now - 86400;
+
+    while (world->rtc_checked < now)
+    {
+        if (sim_rtc_alarm_matches(++world->rtc_checked))
+            world->rtc_status |= 0x01;
+    }
+}
+
+/*
+    Gets the true temperature and relative humidity at a time, which follow a
+    daily cycle with some noise.
+ */
+void sim_environment(uint32_t time, float* airt_out, float* relh_out)
+{
+    double phase = 2 * M_PI * ((time % 86400) / 86400.0 - 0.375);
+    uint32_t noise = (time / 60) * 2654435761U;
+
+    *airt_out = 12 + 7 * sin(phase) + ((noise >> 8) % 100) / 200.0;
+    *relh_out = 70 - 20 * sin(phase) + ((noise >> 16) % 100) / 50.0;
+}
+
+
+// Compensation formulas (floating point) from the BME680 datasheet
+static double compensate_temperature(uint32_t temp_adc)
+{
+    double var1 = (temp_adc / 16384.0 - par_t1 / 1024.0) * par_t2;
+    double var2 = (temp_adc / 131072.0 - par_t1 / 8192.0);
+    var2 = var2 * var2 * (par_t3 * 16.0);
+    return (var1 + var2) / 5120.0;
+}
+
+static double compensate_humidity(uint16_t hum_adc, double airt)
+{
+    double var1 = hum_adc - (par_h1 * 16.0 + (par_h3 / 2.0) * airt);
+    double var2 = var1 * (par_h2 / 262144.0 *
+        (1 + par_h4 / 16384.0 * airt + par_h5 / 1048576.0 * airt * airt));
+    double var3 = par_h6 / 16384.0;
+    double var4 = par_h7 / 2097152.0;
+    return var2 + (var3 + var4 * airt) * var2 * var2;
+}
+
+/*
+    Starts a forced mode measurement, working out the uncompensated readings
+    that the sensor will give for the true conditions.
+ */
+static void bme680_start_measurement()
+{
+    float airt, relh;
+    sim_environment(sim_rtc_seconds(), &airt, &relh);
+
+    uint32_t low = 0, high = 0xFFFFF;
+    while (low < high)
+    {
+        uint32_t middle = (low + high) / 2;
+        if (compensate_temperature(middle) < airt) low = middle + 1;
+        else high = middle;
+    }
+    world->bme680_temp_adc = low;
+
+    double actual_airt = compensate_temperature(low);
+    uint32_t hum_low = 0, hum_high = 0xFFFF;
+    while (hum_low < hum_high)
+    {
+        uint32_t middle = (hum_low + hum_high) / 2;
+        if (compensate_humidity(middle, actual_airt) < relh) hum_low = middle + 1;
+        else hum_high = middle;
+    }
+    world->bme680_hum_adc = hum_low;
+
+    world->bme680_ready_us = world->time_us +
+        sim_jitter(world->config.sensor_ms) * 1000ULL;
+
+    // How closely high-frequency reports follow the seconds they are due at
+    if (world->config.report_period != 0 &&
+        world->wake_cause == ESP_SLEEP_WAKEUP_TIMER)
+    {
+        uint32_t delay = world->time_us % 1000000;
+        world->stats.sample_delay_total += delay;
+        world->stats.sample_delay_samples++;
+        if (delay > world->stats.max_sample_delay)
+            world->stats.max_sample_delay = delay;
+    }
+}
+
+static uint8_t bme680_read_register(uint8_t reg)
+{
+    bool ready = world->time_us >= world->bme680_ready_us;
+    if (ready && (world->bme680_ctrl_meas & 0x03) == 0x01)
+        world->bme680_ctrl_meas &= ~0x03; // Back to sleep mode
+
+    uint8_t coeff2[16] = { (uint8_t)(par_h2 >> 4),
+        (uint8_t)((par_h2 << 4) | (par_h1 & 0x0F)), (uint8_t)(par_h1 >> 4),
+        (uint8_t)par_h3, (uint8_t)par_h4, (uint8_t)par_h5, par_h6,
+        (uint8_t)par_h7, (uint8_t)par_t1, (uint8_t)(par_t1 >> 8) };
+    uint8_t coeff1[25] = { 0, (uint8_t)par_t2, (uint8_t)(par_t2 >> 8),
+        (uint8_t)par_t3 };
+
+    uint32_t temp_adc = world->bme680_temp_adc;
+    uint16_t hum_adc = world->bme680_hum_adc;
+
+    if (reg >= 0x89 && reg < 0x89 + 25) return coeff1[reg - 0x89];
+    if (reg >= 0xE1 && reg < 0xE1 + 16) return coeff2[reg - 0xE1];
+
+    switch (reg)
+    {
+    case 0xD0: return BME680_CHIP_ID;
+    case 0x72: return world->bme680_ctrl_hum;
+    case 0x74: return world->bme680_ctrl_meas;
+    case 0x1D: return ready ? 0x80 : 0x20; // New data, or measuring
+    case 0x1F: return 0x80;
+    case 0x22: return temp_adc >> 12;
+    case 0x23: return temp_adc >> 4;
+    case 0x24: return temp_adc << 4;
+    case 0x25: return hum_adc >> 8;
+    case 0x26: return hum_adc;
+    default: return 0;
+    }
+}
+
+static void bme680_write_register(uint8_t reg, uint8_t value)
+{
+    if (reg == 0x72) world->bme680_ctrl_hum = value;
+    else if (reg == 0x74)
+    {
+        world->bme680_ctrl_meas = value;
+        if ((value & 0x03) == 0x01) bme680_start_measurement();
+    }
+}
+
+static uint8_t ds3231_read_register(uint8_t reg)
+{
+    RtcDateTime now(sim_rtc_seconds());
+
+    switch (reg)
+    {
+    case 0x00: return to_bcd(now.Second());
+    case 0x01: return to_bcd(now.Minute());
+    case 0x02: return to_bcd(now.Hour());
+    case 0x03: return now.DayOfWeek() + 1;
+    case 0x04: return to_bcd(now.Day());
+    case 0x05: return to_bcd(now.Month());
+    case 0x06: return to_bcd(now.Year() - 2000);
+    case 0x07: case 0x08: case 0x09: case 0x0A:
+        return world->rtc_alarm[reg - 0x07];
+    case 0x0E: return world->rtc_control;
+    case 0x0F:
+        sim_rtc_update_alarm();
+        return world->rtc_status;
+    default: return 0;
+    }
+}
+
+static void ds3231_write_register(uint8_t reg, uint8_t value)
+{
+    if (reg >= 0x07 && reg <= 0x0A) world->rtc_alarm[reg - 0x07] = value;
+    else if (reg == 0x0E) world->rtc_control = value;
+    else if (reg == 0x0F)
+    {
+        // The alarm flags can only be cleared
+        sim_rtc_update_alarm();
+        world->rtc_status = (value & 0x88) | (world->rtc_status & value & 0x03);
+    }
+}
+
+bool sim_i2c_present(uint8_t address)
+{
+    return address == DS3231_ADDRESS || address == BME680_ADDRESS;
+}
+
+/*
+    Writes to a device: the first byte sets the register pointer and any others
+    are written to consecutive registers.
+ */
+void sim_i2c_write(uint8_t address, const uint8_t* data, int length)
+{
+    if (length == 0) return;
+    uint8_t* pointer = address == DS3231_ADDRESS ?
+        &world->rtc_pointer : &world->bme680_pointer;
+    *pointer = data[0];
+
+    for (int i = 1; i < length; i++)
+    {
+        if (address == DS3231_ADDRESS)
+            ds3231_write_register((*pointer)++, data[i]);
+        else bme680_write_register((*pointer)++, data[i]);
+    }
+}
+
+/*
+    Reads from consecutive registers of a device, starting at the register
+    pointer. Returns the number of bytes read.
+ */
+int sim_i2c_read(uint8_t address, uint8_t* data, int length)
+{
+    if (!sim_i2c_present(address)) return 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        if (address == DS3231_ADDRESS)
+            data[i] = ds3231_read_register(world->rtc_pointer++);
+        else data[i] = bme680_read_register(world->bme680_pointer++);
+    }
+
+    return length;
+}
+
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+    this->address = address;
+    length = 0;
+}
+
+size_t TwoWire::write(uint8_t value)
+{
+    if (length >= (int)sizeof(buffer)) return 0;
+    buffer[length++] = value;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!write(data[i])) return i;
+    }
+
+    return count;
+}
+
+uint8_t TwoWire::endTransmission(bool)
+{
+    sim_advance((length + 1) * I2C_BYTE_US);
+    if (!sim_i2c_present(address)) return 2;
+
+    sim_i2c_write(address, buffer, length);
+    length = 0;
+    return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t count, bool)
+{
+    sim_advance((count + 1) * I2C_BYTE_US);
+    position = 0;
+    length = 0;
+    if (count > sizeof(buffer) || !sim_i2c_present(address)) return 0;
+
+    length = sim_i2c_read(address, buffer, count);
+    return length;
+}
+
+int TwoWire::available()
+{
+    return length - position;
+}
+
+int TwoWire::read()
+{
+    return position < length ? buffer[position++] : -1;
+}
+
+
+bool Adafruit_BME680::begin(uint8_t address, bool)
+{
+    this->address = address;
+    sim_advance(5000); // Soft reset and reading the calibration
+
+    Wire.beginTransmission(address);
+    Wire.write(0xD0);
+    if (Wire.endTransmission() != 0) return false;
+    return Wire.requestFrom(address, (uint8_t)1) == 1 && Wire.read() == BME680_CHIP_ID;
+}
+
+unsigned long Adafruit_BME680::beginReading()
+{
+    uint8_t data[4] = { 0x72, humidity_os, 0x74,
+        (uint8_t)((temperature_os << 5) | (pressure_os << 2) | 0x01) };
+
+    Wire.beginTransmission(address);
+    Wire.write(data, 2);
+    if (Wire.endTransmission() != 0) return 0;
+    Wire.beginTransmission(address);
+    Wire.write(data + 2, 2);
+    if (Wire.endTransmission() != 0) return 0;
+
+    end_time = millis() + world->config.sensor_ms;
+    return end_time;
+}
+
+int Adafruit_BME680::remainingReadingMillis()
+{
+    if (world->time_us >= world->bme680_ready_us) return 0;
+    return (world->bme680_ready_us - world->time_us + 999) / 1000;
+}
+
+bool Adafruit_BME680::endReading()
+{
+    // Wait for the measurement to finish (as the library does, with delay())
+    int remaining = remainingReadingMillis();
+    if (remaining > 0) delay(remaining);
+
+    uint8_t data[10];
+    Wire.beginTransmission(address);
+    Wire.write(0x1D);
+    if (Wire.endTransmission() != 0) return false;
+    if (Wire.requestFrom(address, (uint8_t)10) != 10) return false;
+    for (int i = 0; i < 10; i++) data[i] = Wire.read();
+    if (!(data[0] & 0x80)) return false;
+
+    uint32_t temp_adc = ((uint32_t)data[5] << 12) | ((uint32_t)data[6] << 4) |
+        (data[7] >> 4);
+    uint16_t hum_adc = ((uint16_t)data[8] << 8) | data[9];
+
+    temperature = compensate_temperature(temp_adc);
+    humidity = compensate_humidity(hum_adc, temperature);
+    if (humidity > 100) humidity = 100;
+    else if (humidity < 0) humidity = 0;
+    return true;
+}
+
+
+// The I2C bus as seen by the wake stub, which drives the lines directly. The
+// lines are open drain: either side can pull one low
+struct i2c_bus_t
+{
+    bool master_sda = true;
+    bool master_scl = true;
+    bool slave_sda = true;
+
+    enum Phase { Idle, Address, Write, Read, Done } phase = Idle;
+    uint8_t address;
+    int bits;
+    uint8_t value;
+    bool acknowledging; // In the acknowledgement clock cycle
+    bool master_ack;
+    uint8_t data[64];
+    int length;
+};
+
+i2c_bus_t bus;
+
+
+static void bus_flush()
+{
+    if (bus.length > 0) sim_i2c_write(bus.address, bus.data, bus.length);
+    bus.length = 0;
+}
+
+static void bus_load_byte()
+{
+    sim_i2c_read(bus.address, &bus.value, 1);
+    bus.bits = 0;
+    bus.slave_sda = (bus.value & 0x80) != 0;
+}
+
+// The clock has risen: the receiver samples the data line
+static void bus_clock_rise(bool sda)
+{
+    if (bus.acknowledging)
+    {
+        if (bus.phase == i2c_bus_t::Read) bus.master_ack = !sda;
+        return;
+    }
+
+    if (bus.phase == i2c_bus_t::Address || bus.phase == i2c_bus_t::Write)
+    {
+        bus.value = (bus.value << 1) | sda;
+        bus.bits++;
+    }
+}
+
+// The clock has fallen: the transmitter moves on to the next bit
+static void bus_clock_fall()
+{
+    if (bus.acknowledging)
+    {
+        bus.acknowledging = false;
+        bus.slave_sda = true;
+
+        if (bus.phase == i2c_bus_t::Read)
+        {
+            if (bus.master_ack || bus.bits == -1) bus_load_byte();
+            else bus.phase = i2c_bus_t::Done;
+        }
+        return;
+    }
+
+    if (bus.phase == i2c_bus_t::Read)
+    {
+        if (++bus.bits < 8) bus.slave_sda = (bus.value >> (7 - bus.bits)) & 1;
+        else
+        {
+            bus.slave_sda = true;
+            bus.acknowledging = true;
+            bus.master_ack = false;
+        }
+        return;
+    }
+
+    if (bus.bits < 8 ||
+        (bus.phase != i2c_bus_t::Address && bus.phase != i2c_bus_t::Write))
+    { return; }
+
+    bus.bits = 0;
+    if (bus.phase == i2c_bus_t::Address)
+    {
+        bus.address = bus.value >> 1;
+        if (!sim_i2c_present(bus.address))
+        {
+            bus.phase = i2c_bus_t::Done;
+            return;
+        }
+
+        if (bus.value & 1)
+        {
+            bus.phase = i2c_bus_t::Read;
+            bus.bits = -1; // Load the first byte after the acknowledgement
+        } else bus.phase = i2c_bus_t::Write;
+    }
+    else if (bus.length < (int)sizeof(bus.data)) bus.data[bus.length++] = bus.value;
+
+    bus.slave_sda = false;
+    bus.acknowledging = true;
+}
+
+static void bus_update(bool master_sda, bool master_scl)
+{
+    bool old_sda = bus.master_sda && bus.slave_sda;
+    bool old_scl = bus.master_scl;
+    bus.master_sda = master_sda;
+    bus.master_scl = master_scl;
+    bool sda = bus.master_sda && bus.slave_sda;
+
+    if (old_scl && master_scl && old_sda != sda)
+    {
+        // Start (or repeated start) and stop conditions
+        bus_flush();
+        bus.acknowledging = false;
+        bus.slave_sda = true;
+        bus.phase = sda ? i2c_bus_t::Idle : i2c_bus_t::Address;
+        bus.bits = 0;
+        bus.value = 0;
+    }
+    else if (!old_scl && master_scl) bus_clock_rise(sda);
+    else if (old_scl && !master_scl) bus_clock_fall();
+}
+
+void gpio_output_set(uint32_t set, uint32_t clear, uint32_t enable,
+    uint32_t disable)
+{
+    bool sda = bus.master_sda;
+    bool scl = bus.master_scl;
+    uint32_t low = clear & enable;
+
+    if (low & (1 << SDA_PIN)) sda = false;
+    if (low & (1 << SCL_PIN)) scl = false;
+    if ((disable | set) & (1 << SDA_PIN)) sda = true;
+    if ((disable | set) & (1 << SCL_PIN)) scl = true;
+
+    bus_update(sda, scl);
+}
+
+uint32_t gpio_input_get()
+{
+    bool sda = bus.master_sda && bus.slave_sda;
+    return ((uint32_t)sda << SDA_PIN) | ((uint32_t)bus.master_scl << SCL_PIN);
+}
+
+void gpio_pad_select_gpio(uint8_t) { }
+void gpio_pad_pullup(uint8_t) { }
+
+void ets_delay_us(uint32_t us)
+{
+    sim_advance(us);
+}
+
+/*
+    Register writes from the wake stub. Only entering sleep has any effect.
+ */
+void sim_register_write(uint32_t, uint32_t) { }
+
+void sim_register_set(uint32_t reg, uint32_t mask)
+{
+    if (reg == RTC_CNTL_STATE0_REG && (mask & RTC_CNTL_SLEEP_EN)) sim_sleep();
+}
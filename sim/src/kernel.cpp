@@ -0,0 +1,454 @@
+/*
+    A cooperative kernel that runs the node's FreeRTOS tasks in virtual time. Each
+    task is a thread, but only one runs at a time: a task runs until it blocks
+    (waits for a notification, an event bit or some time to pass), then the next
+    ready task runs, or virtual time jumps to the next timed event. Since tasks
+    only give up control when they block, virtual time does not pass while code
+    runs, which is as if each task had a core to itself.
+ */
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <map>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include "sim.h"
+
+
+#define SIM_FOREVER UINT64_MAX
+
+struct sim_event_group_t
+{
+    EventBits_t bits;
+};
+
+struct sim_task_t
+{
+    std::condition_variable wake;
+    bool running;
+    bool waiting; // Blocked until signalled or timed out
+    bool signalled;
+    uint32_t generation; // Invalidates timed wakes from earlier waits
+    uint32_t notifications;
+    bool waiting_notification;
+    sim_event_group_t* waiting_group;
+    TaskFunction_t function;
+    void* parameters;
+};
+
+// A timed event either wakes a task or calls a function
+struct sim_event_t
+{
+    sim_task_t* task;
+    uint32_t generation;
+    sim_event_fn function;
+    void* parameters;
+};
+
+std::mutex kernel_mutex;
+std::multimap<uint64_t, sim_event_t>* timed_events;
+std::deque<sim_task_t*>* ready_tasks;
+std::vector<sim_task_t*>* all_tasks;
+sim_task_t* current_task;
+
+
+/*
+    Resets the kernel for a new wake, making the calling thread the main task.
+ */
+void sim_kernel_begin()
+{
+    timed_events = new std::multimap<uint64_t, sim_event_t>();
+    ready_tasks = new std::deque<sim_task_t*>();
+    all_tasks = new std::vector<sim_task_t*>();
+
+    current_task = new sim_task_t();
+    current_task->running = true;
+    all_tasks->push_back(current_task);
+}
+
+/*
+    Returns the virtual time in microseconds since the start of the simulation.
+ */
+uint64_t sim_now()
+{
+    return world->time_us;
+}
+
+/*
+    Makes a blocked task ready to run.
+ */
+static void wake_task(sim_task_t* task)
+{
+    if (!task->waiting) return;
+
+    task->waiting = false;
+    task->signalled = true;
+    task->generation++;
+    ready_tasks->push_back(task);
+}
+
+/*
+    Hands control from the current task to another and waits until control is
+    handed back. Must be called with the kernel mutex held.
+ */
+static void switch_to(sim_task_t* task, std::unique_lock<std::mutex>& lock)
+{
+    sim_task_t* self = current_task;
+    if (task == self) return;
+
+    self->running = false;
+    task->running = true;
+    current_task = task;
+    task->wake.notify_one();
+
+    self->wake.wait(lock, [self] { return self->running; });
+}
+
+/*
+    Runs other tasks and timed events until the current task is ready again.
+    Must be called with the kernel mutex held.
+ */
+static void schedule(std::unique_lock<std::mutex>& lock)
+{
+    sim_task_t* self = current_task;
+
+    while (self->waiting)
+    {
+        if (!ready_tasks->empty())
+        {
+            sim_task_t* task = ready_tasks->front();
+            ready_tasks->pop_front();
+            switch_to(task, lock);
+            continue;
+        }
+
+        if (timed_events->empty()) sim_fail("all tasks are blocked forever");
+
+        auto next = timed_events->begin();
+        uint64_t time = next->first;
+        sim_event_t event = next->second;
+        timed_events->erase(next);
+
+        if (time > world->time_us) world->time_us = time;
+
+        if (event.function != NULL)
+        {
+            lock.unlock();
+            event.function(event.parameters);
+            lock.lock();
+        }
+        else if (event.task->waiting && event.task->generation == event.generation)
+        {
+            event.task->waiting = false;
+            event.task->signalled = false;
+            event.task->generation++;
+            ready_tasks->push_back(event.task);
+        }
+    }
+
+    // A timed event may have readied this task while it was still running
+    auto position = std::find(ready_tasks->begin(), ready_tasks->end(), self);
+    if (position != ready_tasks->end()) ready_tasks->erase(position);
+}
+
+/*
+    Blocks the current task until it is signalled or the time is reached.
+    Returns a boolean indicating whether it was signalled.
+ */
+static bool block_until(uint64_t time, std::unique_lock<std::mutex>& lock)
+{
+    sim_task_t* self = current_task;
+    self->waiting = true;
+    self->signalled = false;
+
+    if (time != SIM_FOREVER)
+    {
+        sim_event_t event = { self, self->generation, NULL, NULL };
+        timed_events->insert(std::make_pair(time, event));
+    }
+
+    schedule(lock);
+    return self->signalled;
+}
+
+/*
+    Lets a number of microseconds pass for the current task.
+ */
+void sim_advance(uint64_t us)
+{
+    sim_wait_until(world->time_us + us);
+}
+
+/*
+    Blocks the current task until a virtual time.
+ */
+void sim_wait_until(uint64_t time)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+
+    // Nothing else can happen before then, so skip straight to it
+    if (ready_tasks->empty() &&
+        (timed_events->empty() || timed_events->begin()->first > time))
+    {
+        if (time > world->time_us) world->time_us = time;
+        return;
+    }
+
+    block_until(time, lock);
+}
+
+/*
+    Calls a function at a virtual time, from whichever task is running. The
+    function must not block.
+ */
+void sim_schedule(uint64_t time, sim_event_fn function, void* parameters)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    sim_event_t event = { NULL, 0, function, parameters };
+    timed_events->insert(std::make_pair(time, event));
+}
+
+
+static uint64_t timeout_time(TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) return SIM_FOREVER;
+    return world->time_us + (uint64_t)ticks * 1000;
+}
+
+static void task_entry(sim_task_t* task)
+{
+    {
+        std::unique_lock<std::mutex> lock(kernel_mutex);
+        task->wake.wait(lock, [task] { return task->running; });
+    }
+
+    task->function(task->parameters);
+    sim_fail("a task returned without deleting itself");
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char*,
+    uint32_t, void* parameters, UBaseType_t, TaskHandle_t* handle_out, BaseType_t)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+
+    sim_task_t* task = new sim_task_t();
+    task->function = function;
+    task->parameters = parameters;
+    all_tasks->push_back(task);
+    if (handle_out != NULL) *handle_out = task;
+
+    std::thread(task_entry, task).detach();
+    ready_tasks->push_back(task);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t handle)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    if (handle != NULL && handle != current_task)
+    {
+        // Another task is blocked, since only one runs at a time. Its thread is
+        // left blocked for good, and ends with the wake
+        handle->waiting = true;
+        handle->waiting_notification = false;
+        handle->waiting_group = NULL;
+        handle->generation++;
+        ready_tasks->erase(std::remove(ready_tasks->begin(), ready_tasks->end(),
+            handle), ready_tasks->end());
+        return;
+    }
+
+    // The thread is left blocked for good, and ends with the wake
+    current_task->waiting = true;
+    current_task->generation++;
+    schedule(lock);
+    sim_fail("a deleted task was resumed");
+}
+
+void vTaskSuspend(TaskHandle_t handle)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    if (handle != NULL && handle != current_task)
+        sim_fail("suspending another task is not supported");
+
+    // Blocked until deleted, since nothing resumes a task
+    current_task->waiting = true;
+    current_task->generation++;
+    schedule(lock);
+    sim_fail("a suspended task was resumed");
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    sim_advance((uint64_t)ticks * 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    task->notifications++;
+    if (task->waiting_notification) wake_task(task);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    sim_task_t* self = current_task;
+
+    if (self->notifications == 0)
+    {
+        self->waiting_notification = true;
+        block_until(timeout_time(ticks), lock);
+        self->waiting_notification = false;
+    }
+
+    uint32_t value = self->notifications;
+    if (value > 0) self->notifications = clear ? 0 : value - 1;
+    return value;
+}
+
+
+EventGroupHandle_t xEventGroupCreate()
+{
+    return new sim_event_group_t();
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    group->bits |= bits;
+
+    for (sim_task_t* task : *all_tasks)
+    {
+        if (task->waiting_group == group) wake_task(task);
+    }
+
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+    BaseType_t clear, BaseType_t all, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(kernel_mutex);
+    sim_task_t* self = current_task;
+    uint64_t timeout = timeout_time(ticks);
+
+    while (true)
+    {
+        EventBits_t value = group->bits;
+        bool satisfied = all ? (value & bits) == bits : (value & bits) != 0;
+
+        if (satisfied)
+        {
+            if (clear) group->bits &= ~bits;
+            return value;
+        }
+
+        if (world->time_us >= timeout) return value;
+
+        self->waiting_group = group;
+        block_until(timeout, lock);
+        self->waiting_group = NULL;
+    }
+}
+
+
+/*
+    Returns a pseudorandom number (xorshift), from a sequence that carries on
+    across wakes so that a simulation is repeatable for a given seed.
+ */
+uint32_t sim_random()
+{
+    uint64_t x = world->random;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    world->random = x;
+    return (uint32_t)(x >> 32);
+}
+
+/*
+    Returns true with a probability given in percent.
+ */
+bool sim_chance(float percent)
+{
+    return sim_random() % 10000 < percent * 100;
+}
+
+/*
+    Returns a latency varied randomly by up to a quarter either way.
+ */
+uint32_t sim_jitter(uint32_t value)
+{
+    uint32_t range = value / 2;
+    if (range == 0) return value;
+    return value - range / 2 + sim_random() % (range + 1);
+}
+
+/*
+    Returns a boolean indicating whether the network is currently down.
+ */
+bool sim_in_outage()
+{
+    uint64_t second = world->time_us / 1000000;
+    return second >= world->config.outage_start &&
+        second < (uint64_t)world->config.outage_start + world->config.outage_length;
+}
+
+/*
+    Prints a message prefixed with the virtual time, if verbose output is on.
+ */
+void sim_log(const char* format, ...)
+{
+    if (!world->config.verbose) return;
+
+    uint64_t ms = world->time_us / 1000;
+    fprintf(stderr, "[%7llu.%03llu] ", (unsigned long long)(ms / 1000),
+        (unsigned long long)(ms % 1000));
+
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+    fputc('\n', stderr);
+}
+
+/*
+    Stops the simulation because the node did something it should never do.
+ */
+void sim_fail(const char* reason)
+{
+    fprintf(stderr, "simulation failed at %llu ms: %s\n",
+        (unsigned long long)(world->time_us / 1000), reason);
+    fflush(stderr);
+    _exit(2);
+}
@@ -0,0 +1,547 @@
+/*
+    Models of the WiFi network, the MQTT broker and the logging server. Every
+    step of a connection takes a (jittered) latency and may fail, and all of it
+    stops during an outage. The broker keeps a persistent session for the node
+    between connections, and the logging server records every report that
+    reaches it so that the simulator can count lost and duplicate reports.
+ */
+
+#include <string>
+
+#include <WiFi.h>
+#include <AsyncMqttClient.h>
+#include <RtcDS3231.h>
+
+#include "sim.h"
+#include "helpers/encoding.h"
+#include "trace.h"
+
+
+#define MAX_BATCH 255 // Largest number of reports the logging server decodes at once
+
+WiFiClass WiFi;
+
+// Only lasts for a wake, like the WiFi stack
+bool wifi_connected = false;
+bool wifi_static_ip = false;
+uint32_t wifi_generation = 0; // Invalidates pending events of earlier connections
+WiFiEventCb wifi_callback = NULL;
+uint64_t publish_arrival_us = 0; // Messages arrive in the order they were sent
+
+struct mqtt_message_t
+{
+    AsyncMqttClient* client;
+    uint32_t generation;
+    std::string topic;
+    std::string payload;
+    uint16_t packet_id; // Of a subscription
+};
+
+
+void sim_radio_on()
+{
+    if (world->radio_on) return;
+    world->radio_on = true;
+    world->radio_start_us = world->time_us;
+}
+
+void sim_radio_off()
+{
+    if (!world->radio_on) return;
+    world->radio_on = false;
+    world->stats.radio_us += world->time_us - world->radio_start_us;
+}
+
+
+static void wifi_on_connected(void* parameters)
+{
+    if ((uintptr_t)parameters != wifi_generation) return;
+
+    wifi_connected = true;
+    world->stats.connections++;
+    sim_log("wifi: connected");
+    if (wifi_callback != NULL) wifi_callback(SYSTEM_EVENT_STA_GOT_IP);
+}
+
+wl_status_t WiFiClass::begin(const char*, const char*, int32_t channel,
+    const uint8_t* bssid, bool)
+{
+    sim_radio_on();
+    wifi_connected = false;
+    wifi_generation++;
+
+    // Reconnecting to a known access point with a known IP address skips the
+    // scan and DHCP
+    bool fast = channel != 0 && bssid != NULL && wifi_static_ip;
+    if (sim_in_outage() ||
+        sim_chance(fast ? world->config.wifi_fast_fail : world->config.wifi_fail))
+    {
+        sim_log("wifi: %s connection will fail", fast ? "fast" : "full");
+        return WL_DISCONNECTED;
+    }
+
+    uint32_t latency = sim_jitter(
+        fast ? world->config.wifi_fast_ms : world->config.wifi_ms);
+    sim_schedule(world->time_us + latency * 1000ULL, wifi_on_connected,
+        (void*)(uintptr_t)wifi_generation);
+    return WL_DISCONNECTED;
+}
+
+bool WiFiClass::config(IPAddress ip, IPAddress, IPAddress, IPAddress, IPAddress)
+{
+    wifi_static_ip = (uint32_t)ip != 0;
+    return true;
+}
+
+bool WiFiClass::disconnect(bool, bool)
+{
+    wifi_connected = false;
+    wifi_generation++;
+    return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+    if (mode == WIFI_OFF) sim_radio_off();
+    return true;
+}
+
+int WiFiClass::onEvent(WiFiEventCb callback, system_event_id_t)
+{
+    wifi_callback = callback;
+    return 0;
+}
+
+wl_status_t WiFiClass::status()
+{
+    return wifi_connected ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+uint8_t* WiFiClass::BSSID()
+{
+    static uint8_t bssid[6] = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60 };
+    return bssid;
+}
+
+int32_t WiFiClass::channel() { return 6; }
+IPAddress WiFiClass::localIP() { return IPAddress(192, 168, 1, 50); }
+IPAddress WiFiClass::gatewayIP() { return IPAddress(192, 168, 1, 1); }
+IPAddress WiFiClass::subnetMask() { return IPAddress(255, 255, 255, 0); }
+IPAddress WiFiClass::dnsIP(uint8_t) { return IPAddress(192, 168, 1, 1); }
+
+
+static void mqtt_on_connected(void* parameters)
+{
+    AsyncMqttClient* client = (AsyncMqttClient*)parameters;
+    if (!wifi_connected) return;
+
+    // A clean session discards the persistent one
+    bool session_present = !client->clean_session && world->broker_session;
+    if (client->clean_session) world->broker_session = false;
+    else world->broker_session = true;
+    if (!session_present) world->broker_subscribed = false;
+
+    client->is_connected = true;
+    sim_log("mqtt: connected (session %s)", session_present ? "present" : "new");
+    if (client->connect_callback) client->connect_callback(session_present);
+}
+
+static void mqtt_on_subscribed(void* parameters)
+{
+    mqtt_message_t* message = (mqtt_message_t*)parameters;
+    AsyncMqttClient* client = message->client;
+
+    if (message->generation == wifi_generation && client->is_connected)
+    {
+        world->broker_subscribed = true;
+        if (client->subscribe_callback)
+            client->subscribe_callback(message->packet_id, 0);
+    }
+
+    delete message;
+}
+
+static void mqtt_on_reply(void* parameters)
+{
+    mqtt_message_t* message = (mqtt_message_t*)parameters;
+    AsyncMqttClient* client = message->client;
+
+    // Messages for a client that is not connected are dropped (QoS 0)
+    if (message->generation == wifi_generation && client->is_connected &&
+        world->broker_subscribed && client->message_callback)
+    {
+        AsyncMqttClientMessageProperties properties = { 0, false, false };
+        size_t length = message->payload.length();
+        client->message_callback(&message->topic[0], &message->payload[0],
+            properties, length, 0, length);
+    }
+
+    delete message;
+}
+
+static void mqtt_on_published(void* parameters)
+{
+    mqtt_message_t* message = (mqtt_message_t*)parameters;
+
+    char reply[256];
+    if (message->generation == wifi_generation && !sim_in_outage() &&
+        sim_server_deliver(message->topic.c_str(), message->payload.data(),
+            message->payload.length(), reply))
+    {
+        if (sim_chance(world->config.reply_loss))
+            sim_log("mqtt: reply lost");
+        else
+        {
+            // Reply on the inbound topic with the same message ID
+            std::string topic = message->topic;
+            size_t kind_start = topic.find('/', 6) + 1;
+            size_t kind_end = topic.find('/', kind_start);
+            message->topic = topic.substr(0, kind_start) + "inbound" +
+                topic.substr(kind_end);
+            message->payload = reply;
+
+            sim_schedule(world->time_us + world->config.rtt_ms * 500ULL,
+                mqtt_on_reply, message);
+            return;
+        }
+    }
+
+    delete message;
+}
+
+AsyncMqttClient& AsyncMqttClient::setClientId(const char* client_id)
+{
+    strncpy(this->client_id, client_id, sizeof(this->client_id) - 1);
+    return *this;
+}
+
+void AsyncMqttClient::connect()
+{
+    if (!wifi_connected || sim_in_outage() || sim_chance(world->config.mqtt_fail))
+    {
+        sim_log("mqtt: connection will fail");
+        return;
+    }
+
+    uint32_t latency = sim_jitter(world->config.mqtt_ms);
+    sim_schedule(world->time_us + latency * 1000ULL, mqtt_on_connected, this);
+}
+
+void AsyncMqttClient::disconnect(bool)
+{
+    is_connected = false;
+}
+
+uint16_t AsyncMqttClient::subscribe(const char* topic, uint8_t)
+{
+    if (!is_connected || !wifi_connected) return 0;
+    if (++packet_id == 0) packet_id = 1;
+
+    mqtt_message_t* message =
+        new mqtt_message_t { this, wifi_generation, topic, "", packet_id };
+    sim_schedule(world->time_us + sim_jitter(world->config.rtt_ms) * 1000ULL,
+        mqtt_on_subscribed, message);
+    return packet_id;
+}
+
+uint16_t AsyncMqttClient::publish(const char* topic, uint8_t, bool,
+    const char* payload, size_t length, bool, uint16_t)
+{
+    if (!is_connected || !wifi_connected) return 0;
+    if (payload != NULL && length == 0) length = strlen(payload);
+
+    mqtt_message_t* message = new mqtt_message_t
+        { this, wifi_generation, topic, std::string(payload, length) };
+    publish_arrival_us = max<uint64_t>(publish_arrival_us,
+        world->time_us + sim_jitter(world->config.rtt_ms) * 500ULL);
+    sim_schedule(publish_arrival_us, mqtt_on_published, message);
+    return 1; // QoS 0 messages have no packet ID
+}
+
+
+/*
+    Returns the true temperature that a report should hold: the temperature at
+    its time, or the mean over the times it was sampled at for a summary.
+ */
+static float server_expected_airt(uint32_t time, int samples)
+{
+    if (samples < 1) samples = 1;
+
+    double expected = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        float airt, relh;
+        sim_environment(time - i * world->config.sample_period, &airt, &relh);
+        expected += airt / samples;
+    }
+
+    return expected;
+}
+
+/*
+    Marks a report time as delivered. Returns a boolean indicating whether it
+    was already delivered (or is out of range).
+ */
+static bool server_mark_delivered(uint32_t time)
+{
+    uint32_t second = time - world->rtc_start;
+    if (time < world->rtc_start || second >= SIM_MAX_SECONDS) return true;
+
+    uint8_t bit = 1 << (second % 8);
+    if (world->delivered[second / 8] & bit) return true;
+
+    world->delivered[second / 8] |= bit;
+    world->stats.delivered++;
+    return false;
+}
+
+/*
+    Fills in the reports suppressed before a report, which were due evenly
+    between it and the previous report, from the values of the previous report.
+    Each must have been within the deadband of the truth. If the previous report
+    has not been received yet (reports can arrive newest first), it is taken to
+    be on the session interval (or report period) and its true temperature is
+    compared with.
+ */
+static void server_reconstruct(const report_t& report)
+{
+    int count = report.suppressed;
+    uint32_t span = report.time - world->last_time;
+    uint32_t interval = world->config.report_period != 0 ?
+        world->config.report_period : world->config.interval * 60;
+    float previous_airt = world->last_airt;
+
+    if (world->last_time == 0 || report.time <= world->last_time ||
+        span % (count + 1) != 0 || span / (count + 1) > interval)
+    {
+        span = interval * (count + 1);
+        previous_airt = server_expected_airt(report.time - span, report.samples);
+    }
+
+    // The comparison on the node is between measurements, so allow for the
+    // error of both
+    float tolerance = world->config.airt_deadband + 0.1f;
+    uint32_t previous_time = report.time - span;
+    interval = span / (count + 1);
+
+    for (int i = 1; i <= count; i++)
+    {
+        uint32_t time = previous_time + i * interval;
+        if (server_mark_delivered(time))
+        {
+            world->stats.duplicates++;
+            continue;
+        }
+
+        world->stats.reconstructed++;
+        if (previous_airt == -99) continue;
+
+        float expected = server_expected_airt(time, report.samples);
+        if (fabs(previous_airt - expected) > tolerance)
+            world->stats.bad_reconstructions++;
+    }
+}
+
+/*
+    Records a report received by the logging server.
+ */
+static void server_record(const report_t& report)
+{
+    if (server_mark_delivered(report.time))
+    {
+        world->stats.duplicates++;
+        return;
+    }
+
+    if (report.suppressed > 0) server_reconstruct(report);
+    world->last_time = report.time;
+    if (report.time > world->newest_delivered)
+        world->newest_delivered = report.time;
+    world->last_airt = report.airt;
+
+    if (report.airt == -99)
+    {
+        world->stats.missing_readings++;
+        return;
+    }
+
+    float expected = server_expected_airt(report.time, report.samples);
+    float error = fabs(report.airt - expected);
+    if (error > world->stats.max_airt_error) world->stats.max_airt_error = error;
+
+    if (report.samples > 1)
+    {
+        world->stats.summaries++;
+        if (report.airt < report.airt_stats.minimum - 0.01f ||
+            report.airt > report.airt_stats.maximum + 0.01f)
+        { world->stats.bad_spreads++; }
+    }
+}
+
+/*
+    Parses the reports in a JSON array. Returns the number of reports, or -1 if
+    any is malformed.
+ */
+static int server_parse_json(const std::string& text, report_t* reports_out)
+{
+    int count = 0;
+    size_t position = 0;
+
+    while (count < MAX_BATCH &&
+        (position = text.find("\"time\":\"", position)) != std::string::npos)
+    {
+        int year, month, day, hour, minute, second;
+        if (sscanf(text.c_str() + position + 8, "%d-%d-%dT%d:%d:%dZ",
+            &year, &month, &day, &hour, &minute, &second) != 6)
+        { return -1; }
+
+        report_t* report = &reports_out[count++];
+        report->time = RtcDateTime(year, month, day, hour, minute, second);
+        report->airt = report->relh = report->batv = -99;
+        report->samples = 0;
+        report->suppressed = 0;
+
+        // Only look within this report for its values
+        size_t end = text.find('}', position);
+        std::string fields = text.substr(position, end - position);
+
+        size_t airt = fields.find("\"airt\":");
+        if (airt != std::string::npos && fields[airt + 7] != 'n')
+            report->airt = atof(fields.c_str() + airt + 7);
+
+        size_t suppressed = fields.find("\"suppressed\":");
+        if (suppressed != std::string::npos)
+            report->suppressed = atoi(fields.c_str() + suppressed + 13);
+
+        size_t samples = fields.find("\"samples\":");
+        if (samples != std::string::npos)
+        {
+            report->samples = atoi(fields.c_str() + samples + 10);
+            size_t minimum = fields.find("\"airt_min\":");
+            size_t maximum = fields.find("\"airt_max\":");
+            if (minimum != std::string::npos && maximum != std::string::npos)
+            {
+                report->airt_stats.minimum = atof(fields.c_str() + minimum + 11);
+                report->airt_stats.maximum = atof(fields.c_str() + maximum + 11);
+            }
+        }
+        position += 8;
+    }
+
+    return count;
+}
+
+/*
+    Handles a message published by the node. Returns a boolean indicating
+    whether the logging server replies, and if so the reply.
+
+    - topic: the topic of the message
+    - payload: the message
+    - length: the number of bytes in the message
+    - reply_out: will be set to the reply
+ */
+bool sim_server_deliver(const char* topic, const char* payload, size_t length,
+    char* reply_out)
+{
+    const sim_config_t& config = world->config;
+    std::string message(payload, length);
+
+    if (strstr(topic, "/outbound/") != NULL)
+    {
+        if (message != "get_session") strcpy(reply_out, "error");
+        else if (!world->session_active) strcpy(reply_out, "no_session");
+        else
+        {
+            int length = sprintf(reply_out,
+                "{\"session_id\":%u,\"interval\":%u,\"batch_size\":%u,\"encoding\":%u",
+                config.session_id, config.interval, config.batch_size,
+                config.encoding);
+            if (config.sample_period != 0)
+            {
+                length += sprintf(reply_out + length, ",\"sample_period\":%u",
+                    config.sample_period);
+            }
+            if (config.max_silence != 0)
+            {
+                length += sprintf(reply_out + length,
+                    ",\"airt_deadband\":%.2f,\"relh_deadband\":%.2f,"
+                    "\"max_silence\":%u", config.airt_deadband,
+                    config.relh_deadband, config.max_silence);
+            }
+            if (config.newest_first)
+                length += sprintf(reply_out + length, ",\"upload_order\":1");
+            if (config.report_period != 0)
+            {
+                length += sprintf(reply_out + length, ",\"report_period\":%u",
+                    config.report_period);
+            }
+            strcpy(reply_out + length, "}");
+        }
+
+        return true;
+    }
+
+    // Telemetry gets no response
+    if (strstr(topic, "/telemetry/") != NULL)
+    {
+        if (length < TRACE_HEADER_SIZE) return false;
+        world->stats.telemetry_records += (uint8_t)payload[1];
+
+        const uint8_t* record = (const uint8_t*)payload + TRACE_HEADER_SIZE;
+        for (int i = 0; i < (uint8_t)payload[1] &&
+            record + TRACE_RECORD_SIZE <= (const uint8_t*)payload + length; i++)
+        {
+            if (record[0] == TracePhase::ReportsLost)
+            {
+                world->stats.traced_losses += record[6] | record[7] << 8 |
+                    record[8] << 16 | (uint32_t)record[9] << 24;
+            }
+            record += TRACE_RECORD_SIZE;
+        }
+        return false;
+    }
+
+    if (strstr(topic, "/reports/") == NULL) return false;
+    if (!world->session_active)
+    {
+        strcpy(reply_out, "no_session");
+        return true;
+    }
+
+    static report_t reports[MAX_BATCH];
+    uint16_t session_id = config.session_id;
+    int count;
+
+    if (config.encoding == 1)
+    {
+        count = decode_reports_binary((const uint8_t*)payload, length,
+            &session_id, reports, MAX_BATCH);
+    }
+    else if (config.encoding == 2)
+    {
+        count = decode_reports_delta((const uint8_t*)payload, length,
+            &session_id, reports, MAX_BATCH);
+    }
+    else count = server_parse_json(message, reports);
+
+    if (count < 0 || session_id != config.session_id)
+    {
+        sim_log("server: rejected a batch");
+        strcpy(reply_out, "error");
+        return true;
+    }
+
+    for (int i = 0; i < count; i++)
+        server_record(reports[i]);
+    sim_log("server: received %d reports", count);
+
+    // Send the session change along with every response from then on, in case
+    // a response is lost (the node ignores a change it already has)
+    if (config.update_time != 0 && world->time_us / 1000000 >= config.update_time)
+    {
+        world->config.interval = config.update_interval;
+        sprintf(reply_out, "ok {\"interval\":%u}", config.update_interval);
+    }
+    else strcpy(reply_out, "ok");
+    return true;
+}
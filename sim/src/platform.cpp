@@ -0,0 +1,256 @@
+/*
+    The parts of the Arduino core and ESP-IDF that the node uses for timing,
+    storage and sleep, for the native environment.
+ */
+
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sim.h"
+
+
+#define FLASH_SECTOR_SIZE 4096
+#define FLASH_WRITE_US 20 // Number of microseconds to write a few bytes of flash
+
+extern char __start_rtc_data[];
+extern char __stop_rtc_data[];
+extern char __start_rtc_noinit[];
+
+HardwareSerial Serial;
+uint64_t light_sleep_us = 0; // Time spent in light sleep during this wake
+int64_t clock_error_us = 0; // Time the local clock has gained on the true time
+// in light sleep during this wake
+
+const esp_partition_t spool_partition =
+    { ESP_PARTITION_TYPE_DATA, 0x40, 0x190000, SIM_FLASH_SIZE, "spool" };
+
+
+uint32_t millis()
+{
+    return (world->time_us - world->wake_us + clock_error_us) / 1000;
+}
+
+uint32_t micros()
+{
+    return world->time_us - world->wake_us + clock_error_us;
+}
+
+int64_t esp_timer_get_time()
+{
+    return world->time_us - world->wake_us + clock_error_us;
+}
+
+void delay(uint32_t ms)
+{
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+void yield() { }
+void pinMode(uint8_t, uint8_t) { }
+
+// The battery sits behind a divider that halves its voltage
+uint32_t analogReadMilliVolts(uint8_t)
+{
+    return 1950 + sim_random() % 20;
+}
+
+uint16_t analogRead(uint8_t pin)
+{
+    return analogReadMilliVolts(pin) * 4095 / 3300;
+}
+
+void esp_efuse_mac_get_default(uint8_t* mac_out)
+{
+    const uint8_t mac[6] = { 0x24, 0x6f, 0x28, 0xa1, 0xb2, 0xc3 };
+    memcpy(mac_out, mac, 6);
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t length)
+{
+    if (world->config.verbose) fwrite(data, 1, length, stderr);
+    return length;
+}
+
+
+static sim_nvs_entry_t* find_entry(const char* key, bool create)
+{
+    sim_nvs_entry_t* empty = NULL;
+    for (int i = 0; i < SIM_NVS_ENTRIES; i++)
+    {
+        sim_nvs_entry_t* entry = &world->nvs[i];
+        if (entry->key[0] == '\0')
+        {
+            if (empty == NULL) empty = entry;
+        }
+        else if (strcmp(entry->key, key) == 0) return entry;
+    }
+
+    if (!create || empty == NULL || strlen(key) >= sizeof(empty->key)) return NULL;
+    strcpy(empty->key, key);
+    return empty;
+}
+
+size_t Preferences::get(const char* key, void* data, size_t length)
+{
+    sim_nvs_entry_t* entry = find_entry(key, false);
+    if (entry == NULL || entry->length > length) return 0;
+
+    memcpy(data, entry->value, entry->length);
+    return entry->length;
+}
+
+size_t Preferences::put(const char* key, const void* data, size_t length)
+{
+    sim_nvs_entry_t* entry = find_entry(key, true);
+    if (entry == NULL || length > sizeof(entry->value)) return 0;
+
+    memcpy(entry->value, data, length);
+    entry->length = length;
+    sim_advance(FLASH_WRITE_US * 10);
+    return length;
+}
+
+bool Preferences::clear()
+{
+    memset(world->nvs, 0, sizeof(world->nvs));
+    return true;
+}
+
+bool Preferences::remove(const char* key)
+{
+    sim_nvs_entry_t* entry = find_entry(key, false);
+    if (entry != NULL) memset(entry, 0, sizeof(*entry));
+    return entry != NULL;
+}
+
+bool Preferences::isKey(const char* key)
+{
+    return find_entry(key, false) != NULL;
+}
+
+String Preferences::getString(const char* key, const String& value)
+{
+    char text[64];
+    if (get(key, text, sizeof(text)) == 0) return value;
+
+    text[sizeof(text) - 1] = '\0';
+    return String(text);
+}
+
+
+const esp_partition_t* esp_partition_find_first(
+    esp_partition_type_t type, esp_partition_subtype_t, const char* label)
+{
+    if (type != ESP_PARTITION_TYPE_DATA || label == NULL ||
+        strcmp(label, "spool") != 0)
+    { return NULL; }
+
+    return &spool_partition;
+}
+
+esp_err_t esp_partition_read(
+    const esp_partition_t*, size_t address, void* data, size_t length)
+{
+    if (address + length > SIM_FLASH_SIZE) return -1;
+    memcpy(data, world->flash + address, length);
+    return ESP_OK;
+}
+
+// NOR flash: writing can only clear bits
+esp_err_t esp_partition_write(
+    const esp_partition_t*, size_t address, const void* data, size_t length)
+{
+    if (address + length > SIM_FLASH_SIZE) return -1;
+
+    for (size_t i = 0; i < length; i++)
+        world->flash[address + i] &= ((const uint8_t*)data)[i];
+
+    sim_advance(FLASH_WRITE_US * (1 + length / 32));
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(
+    const esp_partition_t*, size_t address, size_t length)
+{
+    if (address % FLASH_SECTOR_SIZE != 0 || length % FLASH_SECTOR_SIZE != 0 ||
+        address + length > SIM_FLASH_SIZE)
+    { return -1; }
+
+    memset(world->flash + address, 0xFF, length);
+    sim_advance(sim_jitter(world->config.flash_erase_ms) * 1000ULL *
+        (length / FLASH_SECTOR_SIZE));
+    return ESP_OK;
+}
+
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t, int)
+{
+    world->ext0_enabled = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us)
+{
+    world->timer_enabled = true;
+    world->timer_us = us;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_wakeup_cause_t source)
+{
+    if (source == ESP_SLEEP_WAKEUP_TIMER) world->timer_enabled = false;
+    if (source == ESP_SLEEP_WAKEUP_EXT0) world->ext0_enabled = false;
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return (esp_sleep_wakeup_cause_t)world->wake_cause;
+}
+
+void esp_default_wake_deep_sleep() { }
+
+/*
+    Goes into deep sleep: keeps the RTC memory and ends the process running this
+    wake (the simulator works out when the next one is).
+ */
+void esp_deep_sleep_start()
+{
+    sim_sleep();
+}
+
+void sim_sleep()
+{
+    sim_radio_off();
+    world->stats.awake_us += world->time_us - world->wake_us - light_sleep_us;
+    memcpy(world->rtc_memory, __start_rtc_data, world->rtc_size);
+    memcpy(world->noinit_memory, __start_rtc_noinit, world->noinit_size);
+
+    fflush(stdout);
+    fflush(stderr);
+    _exit(0);
+}
+
+/*
+    Light sleep pauses the node until the timer wakes it. The radio and memory
+    stay powered. The sleep timer runs fast by the configured drift, so the
+    sleep is shorter than asked for while the local clock counts it in full.
+ */
+esp_err_t esp_light_sleep_start()
+{
+    if (!world->timer_enabled) sim_fail("light sleep without a wake source");
+
+    uint64_t start = world->time_us;
+    uint64_t duration = world->timer_us /
+        (1 + world->config.clock_drift / 1e6);
+    sim_advance(duration);
+    clock_error_us += world->timer_us - duration;
+    light_sleep_us += world->time_us - start;
+    world->wake_cause = ESP_SLEEP_WAKEUP_TIMER;
+    return ESP_OK;
+}
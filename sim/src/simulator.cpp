@@ -0,0 +1,479 @@
+/*
+    Runs the node firmware against the simulated hardware and network over a
+    period of virtual time, then prints how much energy it used and what
+    happened to the reports it took. Each wake runs in a child process started
+    from a copy of the freshly loaded program, so RAM is reset at every wake as
+    on the device. Only the RTC memory and the world (hardware, network and
+    statistics) carry over.
+
+    Usage: see print_usage().
+ */
+
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <Arduino.h>
+
+#include "sim.h"
+#include "main.h"
+#include "wake_stub.h"
+#include "helpers/deadband.h"
+
+
+extern char __start_rtc_data[];
+extern char __stop_rtc_data[];
+extern char __start_rtc_noinit[];
+extern char __stop_rtc_noinit[];
+extern int boot_mode;
+extern bool slot_alarm;
+extern deadband_t deadband;
+
+sim_world_t* world = NULL;
+
+
+static void print_usage()
+{
+    fprintf(stderr,
+        "usage: simulator [options]\n"
+        "  --days N            length of the simulation (default 2)\n"
+        "  --seed N            random seed (default 1)\n"
+        "  --interval N        session interval in minutes (default 5)\n"
+        "  --batch-size N      session batch size (default 1)\n"
+        "  --encoding N        0 JSON, 1 binary, 2 delta (default 0)\n"
+        "  --sample-period N   seconds between samples summarised by each report\n"
+        "                      (default 0, one sample per report)\n"
+        "  --deadband T,H,N    suppress reports within T degrees and H percent of\n"
+        "                      the last stored one, up to N in a row (default none)\n"
+        "  --newest-first      transmit the newest reports ahead of a backlog\n"
+        "  --report-period N   seconds between reports in high-frequency mode\n"
+        "                      (default 0, one report per interval)\n"
+        "  --clock-drift P     parts per million the light sleep timer runs fast\n"
+        "                      by (default 0)\n"
+        "  --wifi-fail P       full WiFi connection failure percent (default 2)\n"
+        "  --fast-fail P       fast WiFi reconnection failure percent (default 5)\n"
+        "  --mqtt-fail P       MQTT connection failure percent (default 1)\n"
+        "  --reply-loss P      lost logging server reply percent (default 1)\n"
+        "  --wifi-ms N         full WiFi connection latency (default 3000)\n"
+        "  --rtt-ms N          logging server round trip (default 80)\n"
+        "  --outage S,L        no network from second S for L seconds\n"
+        "  --update S,N        change the interval to N after second S\n"
+        "  --reset S           reset the node at second S, while it is asleep\n"
+        "  --verbose           log every wake and network event\n");
+}
+
+static void set_defaults(sim_config_t* config)
+{
+    config->seconds = 2 * 86400;
+    config->seed = 1;
+    config->session_id = 1;
+    config->interval = 5;
+    config->batch_size = 1;
+    config->encoding = 0;
+    config->boot_ms = 180;
+    config->stub_boot_ms = 1;
+    config->sensor_ms = 120;
+    config->wifi_ms = 3000;
+    config->wifi_fast_ms = 400;
+    config->mqtt_ms = 150;
+    config->rtt_ms = 80;
+    config->flash_erase_ms = 45;
+    config->wifi_fail = 2;
+    config->wifi_fast_fail = 5;
+    config->mqtt_fail = 1;
+    config->reply_loss = 1;
+}
+
+static bool parse_arguments(int argc, char** argv, sim_config_t* config)
+{
+    const option options[] = {
+        { "days", required_argument, NULL, 'd' },
+        { "seed", required_argument, NULL, 's' },
+        { "interval", required_argument, NULL, 'i' },
+        { "batch-size", required_argument, NULL, 'b' },
+        { "encoding", required_argument, NULL, 'e' },
+        { "sample-period", required_argument, NULL, 'p' },
+        { "deadband", required_argument, NULL, 'D' },
+        { "newest-first", no_argument, NULL, 'N' },
+        { "report-period", required_argument, NULL, 'P' },
+        { "clock-drift", required_argument, NULL, 'c' },
+        { "wifi-fail", required_argument, NULL, 'w' },
+        { "fast-fail", required_argument, NULL, 'f' },
+        { "mqtt-fail", required_argument, NULL, 'm' },
+        { "reply-loss", required_argument, NULL, 'r' },
+        { "wifi-ms", required_argument, NULL, 'W' },
+        { "rtt-ms", required_argument, NULL, 'R' },
+        { "outage", required_argument, NULL, 'o' },
+        { "update", required_argument, NULL, 'u' },
+        { "reset", required_argument, NULL, 'x' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        unsigned int first, second;
+        float airt, relh;
+        switch (option)
+        {
+        case 'd': config->seconds = atof(optarg) * 86400; break;
+        case 's': config->seed = strtoull(optarg, NULL, 10); break;
+        case 'i': config->interval = atoi(optarg); break;
+        case 'b': config->batch_size = atoi(optarg); break;
+        case 'e': config->encoding = atoi(optarg); break;
+        case 'p': config->sample_period = atoi(optarg); break;
+        case 'w': config->wifi_fail = atof(optarg); break;
+        case 'f': config->wifi_fast_fail = atof(optarg); break;
+        case 'm': config->mqtt_fail = atof(optarg); break;
+        case 'r': config->reply_loss = atof(optarg); break;
+        case 'W': config->wifi_ms = atoi(optarg); break;
+        case 'R': config->rtt_ms = atoi(optarg); break;
+        case 'N': config->newest_first = true; break;
+        case 'P': config->report_period = atoi(optarg); break;
+        case 'c': config->clock_drift = atof(optarg); break;
+        case 'x': config->reset_time = atoi(optarg); break;
+        case 'v': config->verbose = true; break;
+
+        case 'D':
+            if (sscanf(optarg, "%f,%f,%u", &airt, &relh, &first) != 3) return false;
+            config->airt_deadband = airt;
+            config->relh_deadband = relh;
+            config->max_silence = first;
+            break;
+
+        case 'o':
+        case 'u':
+            if (sscanf(optarg, "%u,%u", &first, &second) != 2) return false;
+            if (option == 'o')
+            {
+                config->outage_start = first;
+                config->outage_length = second;
+            }
+            else
+            {
+                config->update_time = first;
+                config->update_interval = second;
+            }
+            break;
+
+        default: return false;
+        }
+    }
+
+    return config->seconds > 0 && config->seconds <= SIM_MAX_SECONDS &&
+        config->interval > 0;
+}
+
+/*
+    Stores the configuration that would have been entered over serial.
+ */
+static void store_configuration()
+{
+    const char* strings[][2] = { { "nnam", "sensor-net" }, { "npwd", "password" },
+        { "ladr", "192.168.1.10" } };
+
+    for (int i = 0; i < 3; i++)
+    {
+        sim_nvs_entry_t* entry = &world->nvs[i];
+        strcpy(entry->key, strings[i][0]);
+        strcpy((char*)entry->value, strings[i][1]);
+        entry->length = strlen(strings[i][1]) + 1;
+    }
+}
+
+/*
+    Runs one wake of the node in a child process, which ends when the node goes
+    to sleep. Returns a boolean indicating whether the node went to sleep
+    normally.
+ */
+static bool run_wake(bool power_on)
+{
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (child == 0)
+    {
+        if (!power_on)
+            memcpy(__start_rtc_data, world->rtc_memory, world->rtc_size);
+        memcpy(__start_rtc_noinit, world->noinit_memory, world->noinit_size);
+
+        world->wake_us = world->time_us;
+        sim_kernel_begin();
+
+        // The wake stub runs before the application is loaded, and returns to
+        // let it boot
+        if (!power_on)
+        {
+            sim_advance(world->config.stub_boot_ms * 1000ULL);
+            esp_wake_deep_sleep();
+        }
+
+        // The wake sources stay set up for the wake stub going back to sleep,
+        // but not once the application boots
+        world->ext0_enabled = false;
+        world->timer_enabled = false;
+        world->stats.full_boots++;
+        sim_advance(world->config.boot_ms * 1000ULL);
+        setup();
+        sim_fail("setup() returned without going to sleep");
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+    Works out when the node will next wake up. Returns a boolean indicating
+    whether it will at all.
+
+    - time_out: the virtual time of the wake in microseconds
+ */
+static bool next_wake(uint64_t* time_out)
+{
+    bool waking = false;
+    uint64_t time = UINT64_MAX;
+
+    if (world->timer_enabled)
+    {
+        time = world->time_us + world->timer_us;
+        world->wake_cause = ESP_SLEEP_WAKEUP_TIMER;
+        waking = true;
+    }
+
+    // The RTC pulls the pin low while the alarm flag is set and the alarm
+    // interrupt is enabled
+    if (world->ext0_enabled && (world->rtc_control & 0x05) == 0x05)
+    {
+        sim_rtc_update_alarm();
+        uint32_t now = sim_rtc_seconds();
+        uint64_t alarm = UINT64_MAX;
+
+        if (world->rtc_status & 0x01) alarm = world->time_us;
+        else
+        {
+            for (uint32_t second = now + 1; second <= now + 86400; second++)
+            {
+                if (sim_rtc_alarm_matches(second))
+                {
+                    alarm = (second - world->rtc_start - world->rtc_offset) *
+                        1000000ULL;
+                    break;
+                }
+            }
+        }
+
+        if (alarm < time)
+        {
+            time = alarm;
+            world->wake_cause = ESP_SLEEP_WAKEUP_EXT0;
+            waking = true;
+        }
+    }
+
+    *time_out = time;
+    return waking;
+}
+
+static void print_results(bool asleep_forever)
+{
+    // Restore the node's state as it was at the end, to count what it holds
+    memcpy(__start_rtc_data, world->rtc_memory, world->rtc_size);
+    memcpy(__start_rtc_noinit, world->noinit_memory, world->noinit_size);
+    // Pending reports also stand for the reports suppressed before them, and
+    // so does the next report to be stored
+    int pending = 0;
+    if (boot_mode == 2)
+    {
+        pending = pending_count() + stub_count() + deadband.suppressed;
+        for (int i = 0; i < pending_count(); i++)
+        {
+            report_t report;
+            uint16_t session_id;
+            if (peek_pending(i, &report, &session_id)) pending += report.suppressed;
+        }
+    }
+
+    const sim_stats_t& stats = world->stats;
+    double days = world->config.seconds / 86400.0;
+    int lost = (int)stats.generated - (int)stats.delivered - pending;
+
+    printf("simulated %.2f days (seed %llu)\n", days,
+        (unsigned long long)world->config.seed);
+    printf("wakes: %u (%u full boots, %u wake stub)\n",
+        stats.wakes, stats.full_boots, stats.stub_wakes);
+    printf("awake: %.1f s (%.2f s per day)\n",
+        stats.awake_us / 1e6, stats.awake_us / 1e6 / days);
+    printf("radio on: %.1f s (%.2f s per day), %u WiFi connections\n",
+        stats.radio_us / 1e6, stats.radio_us / 1e6 / days, stats.connections);
+    printf("reports: %u generated, %u delivered, %d pending, %d lost, %u duplicates\n",
+        stats.generated, stats.delivered, pending, lost, stats.duplicates);
+    printf("readings: %u missing, largest temperature error %.2f C\n",
+        stats.missing_readings, stats.max_airt_error);
+    if (world->config.sample_period != 0)
+    {
+        printf("summaries: %u delivered, %u with the mean outside the range\n",
+            stats.summaries, stats.bad_spreads);
+    }
+    if (world->config.max_silence != 0)
+    {
+        printf("suppressed: %u reconstructed, %u outside the deadband or off the "
+            "interval\n", stats.reconstructed, stats.bad_reconstructions);
+    }
+    if (stats.staleness_samples > 0)
+    {
+        printf("freshness: newest report at the logging server %.0f s old on "
+            "average after connecting, %u s at most\n",
+            (double)stats.staleness_total / stats.staleness_samples,
+            stats.max_staleness);
+    }
+    if (stats.sample_delay_samples > 0)
+    {
+        printf("timing: measurements after light sleep started %.1f ms after "
+            "their second on average, %.1f ms at most\n",
+            stats.sample_delay_total / 1e3 / stats.sample_delay_samples,
+            stats.max_sample_delay / 1e3);
+    }
+    printf("telemetry: %u trace records received, %u reports recorded as lost\n",
+        stats.telemetry_records, stats.traced_losses);
+    if (asleep_forever) printf("node went to sleep without a wake source\n");
+}
+
+int main(int argc, char** argv)
+{
+    sim_config_t config = sim_config_t();
+    set_defaults(&config);
+    if (!parse_arguments(argc, argv, &config))
+    {
+        print_usage();
+        return 1;
+    }
+
+    // Shared with the child process running each wake
+    world = (sim_world_t*)mmap(NULL, sizeof(sim_world_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (world == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    world->config = config;
+    world->random = config.seed * 0x9E3779B97F4A7C15ULL + 1;
+    world->rtc_start = RtcDateTime(2024, 3, 1, 8, 0, 0);
+    world->session_active = true;
+    world->rtc_size = __stop_rtc_data - __start_rtc_data;
+    world->noinit_size = __stop_rtc_noinit - __start_rtc_noinit;
+    if (world->rtc_size > SIM_RTC_MEMORY || world->noinit_size > SIM_RTC_MEMORY)
+    {
+        fprintf(stderr, "too many RTC_DATA_ATTR variables\n");
+        return 1;
+    }
+
+    memset(world->flash, 0xFF, SIM_FLASH_SIZE);
+    memcpy(world->rtc_memory, __start_rtc_data, world->rtc_size);
+    memset(world->noinit_memory, 0x5A, world->noinit_size); // Whatever it
+    // powered up holding
+    sim_devices_begin();
+    store_configuration();
+
+    bool power_on = true;
+    bool asleep_forever = false;
+    uint64_t end = config.seconds * 1000000ULL;
+
+    while (world->time_us < end)
+    {
+        world->stats.wakes++;
+
+        // Every alarm at the end of an interval while reporting is a report,
+        // whether the wake stub or a full boot takes it, apart from alarms only
+        // for the transmit slot. In high-frequency mode, the wake takes the
+        // reports due up to the next alarm instead
+        uint32_t interval = world->config.interval * 60;
+        uint32_t period = world->config.sample_period != 0 ?
+            world->config.sample_period : interval;
+        int mode = 0;
+        bool slot_only = false;
+        if (!power_on)
+        {
+            memcpy(&mode, world->rtc_memory +
+                ((char*)&boot_mode - __start_rtc_data), sizeof(mode));
+            memcpy(&slot_only, world->rtc_memory +
+                ((char*)&slot_alarm - __start_rtc_data), sizeof(slot_only));
+        }
+        bool reporting = mode == 2 && !slot_only &&
+            world->wake_cause == ESP_SLEEP_WAKEUP_EXT0 &&
+            sim_rtc_seconds() % interval < period;
+        uint32_t report_period = world->config.report_period;
+        uint32_t wake_second = sim_rtc_seconds();
+        if (reporting && report_period == 0) world->stats.generated++;
+
+        uint32_t full_boots = world->stats.full_boots;
+        uint32_t connections = world->stats.connections;
+        if (!run_wake(power_on)) return 1;
+        if (!power_on && world->stats.full_boots == full_boots)
+            world->stats.stub_wakes++;
+        power_on = false;
+
+        // How out of date the readings the logging server shows are
+        if (world->stats.connections != connections && world->newest_delivered != 0)
+        {
+            uint32_t staleness = sim_rtc_seconds() - world->newest_delivered;
+            world->stats.staleness_total += staleness;
+            world->stats.staleness_samples++;
+            if (staleness > world->stats.max_staleness)
+                world->stats.max_staleness = staleness;
+        }
+
+        sim_log("asleep after %llu ms", (unsigned long long)
+            ((world->time_us - world->wake_us) / 1000));
+
+        uint64_t wake;
+        if (!next_wake(&wake))
+        {
+            asleep_forever = true;
+            break;
+        }
+
+        if (wake < world->time_us) wake = world->time_us;
+
+        // A reset boots the node as from power off, but keeps the
+        // RTC_NOINIT_ATTR variables
+        bool reset = config.reset_time != 0 &&
+            world->time_us < config.reset_time * 1000000ULL &&
+            wake >= config.reset_time * 1000000ULL;
+        if (reset) wake = config.reset_time * 1000000ULL;
+        if (reporting && report_period != 0)
+        {
+            uint32_t alarm_second = world->rtc_start + world->rtc_offset +
+                wake / 1000000;
+            world->stats.generated +=
+                (alarm_second - 1) / report_period - (wake_second - 1) / report_period;
+        }
+        if (wake >= end)
+        {
+            world->time_us = end;
+            break;
+        }
+
+        world->time_us = wake;
+        if (reset) power_on = true;
+        else if (world->wake_cause == ESP_SLEEP_WAKEUP_EXT0)
+        {
+            sim_rtc_update_alarm();
+            world->rtc_status |= 0x01;
+        }
+    }
+
+    print_results(asleep_forever);
+    return 0;
+}
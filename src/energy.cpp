@@ -0,0 +1,177 @@
+/*
+    Estimates the charge used by the node, by multiplying the time it spends in
+    each state (deep sleep, CPU active, radio on and transmitting, wake stub,
+    light sleep) by an estimate of the current drawn in that state. The running
+    totals are kept in sleep memory that is not cleared by a reset, so they last
+    until the battery is disconnected and can be read in serial mode.
+ */
+
+#include <Arduino.h>
+#include <esp_attr.h>
+
+#include "energy.h"
+
+
+RTC_NOINIT_ATTR energy_t energy;
+
+
+/*
+    Adds the charge used by drawing a current for a period of time.
+
+    - use: the way the charge was used
+    - current: the current in milliamps
+    - time: the time in microseconds
+ */
+static void add_charge(EnergyUse use, double current, double time)
+{
+    energy.charge[use] += current * time / 3600e6;
+}
+
+
+/*
+    Measures the battery voltage, averaging a number of readings (which are
+    calibrated by the ADC driver). Returns the voltage, or -99 if it is outside
+    the range a lithium battery can have, as when the pin is floating because
+    no divider is connected.
+ */
+float sample_battery_voltage()
+{
+    uint32_t total = 0;
+    for (int i = 0; i < BATTERY_SAMPLES; i++)
+        total += analogReadMilliVolts(BATTERY_PIN);
+
+    float voltage = total / (float)BATTERY_SAMPLES / 1000 * BATTERY_DIVIDER;
+    return voltage >= BATTERY_MIN_VOLTAGE && voltage <= BATTERY_MAX_VOLTAGE ?
+        voltage : -99;
+}
+
+/*
+    Accounts for the time spent asleep since the last wake. Should be called
+    early in each wake. Starts the accounts if they have not been set up.
+
+    - now: the RTC time
+ */
+void energy_begin(uint32_t now)
+{
+    if (energy.magic != ENERGY_MAGIC)
+    {
+        memset(&energy, 0, sizeof(energy));
+        energy.magic = ENERGY_MAGIC;
+        energy.start = now;
+        energy.batv = -99;
+        return;
+    }
+
+    // The time may have been changed while asleep
+    if (energy.last_sleep != 0 && now >= energy.last_sleep)
+        add_charge(DeepSleep, DEEP_SLEEP_CURRENT,
+            (now - energy.last_sleep) * 1e6);
+    energy.last_sleep = 0;
+}
+
+/*
+    Accounts for the wakes handled by the wake stub.
+
+    - wakes: the number of wakes
+    - reports: the number of reports taken in those wakes
+ */
+void energy_add_stub_wakes(int wakes, int reports)
+{
+    add_charge(WakeStub, WAKE_STUB_CURRENT, (double)wakes * WAKE_STUB_TIME);
+    energy.reports += reports;
+}
+
+/*
+    Counts a report taken in this wake, and remembers the conditions that the
+    battery life is projected from.
+
+    - period: the number of seconds between reports (the session interval, or
+    the report period in high-frequency mode)
+    - batv: the battery voltage, or -99 if unknown
+ */
+void energy_add_report(uint16_t period, float batv)
+{
+    energy.reports++;
+    energy.period = period;
+    if (batv != -99) energy.batv = batv;
+}
+
+/*
+    Counts a full boot that only transmits in the transmit slot (see slots.cpp),
+    so that the cost of the slots can be told apart in the totals.
+ */
+void energy_add_slot_wake()
+{
+    energy.slot_wakes++;
+}
+
+/*
+    Accounts for the time spent awake in this wake, including the boot before
+    the program's clock started. Should be called just before going to sleep.
+
+    - now: the RTC time
+    - awake_time: the number of microseconds since waking
+    - light_sleep_time: the number of those spent in light sleep
+    - radio_time: the number of microseconds the radio has been on for
+    - transmitted: the number of bytes of messages transmitted
+ */
+void energy_end(uint32_t now, uint32_t awake_time, uint32_t light_sleep_time,
+    uint32_t radio_time, uint32_t transmitted)
+{
+    add_charge(CpuActive, CPU_ACTIVE_CURRENT,
+        FULL_BOOT_TIME + awake_time - light_sleep_time);
+    add_charge(LightSleep, LIGHT_SLEEP_CURRENT, light_sleep_time);
+    add_charge(RadioReceive, RADIO_RECEIVE_CURRENT, radio_time);
+    add_charge(RadioTransmit, RADIO_TRANSMIT_CURRENT,
+        transmitted * 8.0 / RADIO_TRANSMIT_RATE);
+    energy.last_sleep = now;
+}
+
+
+/*
+    Gets the running totals. Returns a boolean indicating whether the accounts
+    have been started.
+
+    - energy_out: will be set to the totals
+ */
+bool energy_read(energy_t* energy_out)
+{
+    if (energy.magic != ENERGY_MAGIC) return false;
+
+    *energy_out = energy;
+    return true;
+}
+
+/*
+    Returns the total charge used in milliamp hours.
+
+    - totals: the running totals
+ */
+double energy_total(const energy_t& totals)
+{
+    double total = 0;
+    for (int i = 0; i < ENERGY_USES; i++)
+        total += totals.charge[i];
+    return total;
+}
+
+/*
+    Returns the number of days the battery is projected to last from now if
+    reports continue at the same rate, using the average charge used per report
+    so far (which includes any wakes to transmit in the slot). Returns -1 if
+    there are no reports to project from.
+
+    - totals: the running totals
+ */
+double energy_projected_days(const energy_t& totals)
+{
+    if (totals.reports == 0 || totals.period == 0) return -1;
+
+    double per_report = (energy_total(totals) - totals.charge[DeepSleep]) /
+        totals.reports;
+    double per_day = DEEP_SLEEP_CURRENT * 24 +
+        per_report * (86400.0 / totals.period);
+
+    double remaining = BATTERY_CAPACITY - energy_total(totals);
+    return remaining > 0 ? remaining / per_day : 0;
+}
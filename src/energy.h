@@ -0,0 +1,74 @@
+#include <stdint.h>
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#define BATTERY_PIN 34 // The ADC1 pin connected to the battery voltage
+// divider
+#define BATTERY_DIVIDER 2.0 // Ratio of the battery voltage to the voltage at
+// the pin
+#define BATTERY_MIN_VOLTAGE 2.5 // Lowest plausible battery voltage (lower
+// readings are taken to mean that the pin is floating)
+#define BATTERY_MAX_VOLTAGE 4.5 // Highest plausible battery voltage
+#define BATTERY_SAMPLES 16 // Number of ADC readings to average per measurement
+#define BATTERY_CAPACITY 2000 // Capacity of the battery in milliamp hours
+
+// Estimated current draw of the board in milliamps for each way it uses energy
+#define DEEP_SLEEP_CURRENT 0.15 // ESP32, RTC, sensor and regulator quiescent
+#define LIGHT_SLEEP_CURRENT 0.95 // ESP32 with memory kept powered, plus the
+// rest of the board
+#define CPU_ACTIVE_CURRENT 45
+#define RADIO_RECEIVE_CURRENT 100 // Extra draw while the radio is on
+#define RADIO_TRANSMIT_CURRENT 90 // Extra draw on top of receiving while
+// transmitting
+#define WAKE_STUB_CURRENT 12 // CPU running the wake stub before clocks are set
+// up
+
+#define RADIO_TRANSMIT_RATE 6 // Number of bits per microsecond the radio
+// transmits
+#define MESSAGE_OVERHEAD 100 // Number of bytes of protocol headers per message
+#define WAKE_STUB_TIME 25000 // Number of microseconds a wake stub wake takes
+#define FULL_BOOT_TIME 180000 // Number of microseconds from waking to the program
+// starting in a full boot, which its clock does not count
+#define ENERGY_MAGIC 0x50534E47 // Marks the energy accounts as set up (changes
+// with their layout)
+
+// The ways the node uses energy, which are accounted separately
+enum EnergyUse
+{
+    DeepSleep,
+    CpuActive,
+    RadioReceive,
+    RadioTransmit,
+    WakeStub,
+    LightSleep
+};
+#define ENERGY_USES 6
+
+// Running totals of the energy used since the battery was connected
+struct energy_t
+{
+    uint32_t magic;
+    uint32_t start; // RTC time the accounts were started
+    uint32_t last_sleep; // RTC time of going to sleep (0 if unknown)
+    double charge[ENERGY_USES]; // Milliamp hours used in each way
+    uint32_t reports; // Number of reports taken
+    uint32_t slot_wakes; // Number of full boots only to transmit in the slot
+    uint16_t period; // Number of seconds between reports at the last report
+    float batv; // Battery voltage at the last report
+};
+
+
+float sample_battery_voltage();
+
+void energy_begin(uint32_t);
+void energy_add_stub_wakes(int, int);
+void energy_add_report(uint16_t, float);
+void energy_add_slot_wake();
+void energy_end(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
+
+bool energy_read(energy_t*);
+double energy_total(const energy_t&);
+double energy_projected_days(const energy_t&);
+
+#endif
@@ -1,17 +1,34 @@
 /*
     A limited implementation of a circular buffer, designed specifically for
     storage in the ESP32's sleep memory. Elements are added to the front and
-    removed fron the rear.
+    removed fron the rear (or as a range, which is cheap near the front).
 
-    Before usage, prepare an array of size BUFFER_CAPACITY to store the elements
+    Elements are stored in packed form (see packed_report_t) to fit more of them
+    into the available sleep memory, and are packed and unpacked by the buffer.
+    Times are stored relative to a base time held by the buffer, which moves
+    forward when a time no longer fits. Elements only hold the number of samples
+    and their spread (see packed_summary_t) and the number of reports suppressed
+    before them if a report in the buffer needs them, so that single samples
+    take a third of the space of summaries. The buffer widens its elements in
+    place when such a report is pushed, and goes back to the narrowest elements
+    once it is empty.
+
+    Before usage, prepare an array of BUFFER_MEMORY bytes to store the elements
     in. This must be passed into any functions that require the elements.
  */
 
+#include <string.h>
+#include <algorithm>
+
 #include "helpers.h"
 
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#define BUFFER_SUMMARIES 1 // Elements hold the number of samples and their spread
+#define BUFFER_SUPPRESSED 2 // Elements hold the number of reports suppressed
+// before them
+
 struct report_buffer_t
 {
 private:
@@ -27,6 +44,248 @@ private:
      */
     int rear = 0;
 
+    /*
+        The time that the times of the elements are stored relative to.
+     */
+    uint32_t base_time = 0;
+
+    /*
+        The fields that the elements hold beyond a packed_report_t (see the
+        BUFFER_ values).
+     */
+    uint8_t layout = 0;
+
+
+    /*
+        Returns the number of bytes in an element with a layout.
+     */
+    static int element_size(uint8_t layout)
+    {
+        return sizeof(packed_report_t) +
+            (layout & BUFFER_SUMMARIES ? sizeof(packed_summary_t) : 0) +
+            (layout & BUFFER_SUPPRESSED ? 1 : 0);
+    }
+
+    /*
+        Returns the number of elements that fit in the buffer's memory with a
+        layout, including the one that is kept free.
+     */
+    static int slots(uint8_t layout)
+    {
+        return BUFFER_MEMORY / element_size(layout);
+    }
+
+    /*
+        Returns the layout that an element needs to hold a report without losing
+        anything. A single sample's spread follows from its value.
+     */
+    static uint8_t required_layout(const report_t& report)
+    {
+        uint8_t layout = report.suppressed > 0 ? BUFFER_SUPPRESSED : 0;
+        if (report.samples > 1) return layout | BUFFER_SUMMARIES;
+
+        packed_summary_t summary = pack_summary(report);
+        packed_summary_t single = pack_summary(single_summary(report));
+        if (memcmp(&summary, &single, sizeof(summary)) != 0)
+            layout |= BUFFER_SUMMARIES;
+        return layout;
+    }
+
+    /*
+        Returns a report with the number of samples and the spread that a
+        report with the same values would have if it held a single sample (or
+        none, if the values are missing).
+     */
+    static report_t single_summary(report_t report)
+    {
+        value_stats_t none = { -99, -99, -99 };
+        report.samples = report.airt != -99 && report.relh != -99 ? 1 : 0;
+        report.airt_stats = none;
+        report.relh_stats = none;
+
+        if (report.samples == 1)
+        {
+            report.airt_stats = { report.airt, report.airt, 0 };
+            report.relh_stats = { report.relh, report.relh, 0 };
+        }
+
+        return report;
+    }
+
+    /*
+        Converts the number of samples and spread of a report to the form used
+        for storage.
+     */
+    static packed_summary_t pack_summary(const report_t& report)
+    {
+        packed_summary_t summary;
+        summary.samples = report.samples;
+        summary.airt_stats = pack_stats(report.airt_stats);
+        summary.relh_stats = pack_stats(report.relh_stats);
+        return summary;
+    }
+
+    /*
+        Returns the address of the element at an index, in the current layout.
+     */
+    uint8_t* element(uint8_t* elements, int index)
+    {
+        return elements + index * element_size(layout);
+    }
+
+    /*
+        Returns the time of a stored element.
+     */
+    uint32_t unpack_time(const packed_report_t& element)
+    {
+        return base_time + (element.time[0] | (element.time[1] << 8) |
+            ((uint32_t)element.time[2] << 16));
+    }
+
+    /*
+        Sets the time of a stored element, as an offset from the base time (must
+        be no more than PACKED_MAX_TIME).
+     */
+    void pack_time(packed_report_t& element, uint32_t offset)
+    {
+        element.time[0] = offset & 0xFF;
+        element.time[1] = (offset >> 8) & 0xFF;
+        element.time[2] = (offset >> 16) & 0xFF;
+    }
+
+    /*
+        Writes a report into an element in a layout, with its time as an offset
+        from the base time.
+     */
+    void pack(uint8_t* data, const report_t& report, uint8_t layout)
+    {
+        packed_report_t element;
+        pack_time(element, report.time - base_time);
+        element.airt = pack_value(report.airt);
+        element.relh = pack_value(report.relh);
+        element.batv = pack_batv(report.batv);
+        memcpy(data, &element, sizeof(element));
+        data += sizeof(element);
+
+        if (layout & BUFFER_SUMMARIES)
+        {
+            packed_summary_t summary = pack_summary(report);
+            memcpy(data, &summary, sizeof(summary));
+            data += sizeof(summary);
+        }
+
+        if (layout & BUFFER_SUPPRESSED) *data = report.suppressed;
+    }
+
+    /*
+        Reads a report from an element in a layout.
+     */
+    report_t unpack(const uint8_t* data, uint8_t layout)
+    {
+        packed_report_t element;
+        memcpy(&element, data, sizeof(element));
+        data += sizeof(element);
+
+        report_t report;
+        report.time = unpack_time(element);
+        report.airt = unpack_value(element.airt);
+        report.relh = unpack_value(element.relh);
+        report.batv = unpack_batv(element.batv);
+        report.suppressed = 0;
+
+        if (layout & BUFFER_SUMMARIES)
+        {
+            packed_summary_t summary;
+            memcpy(&summary, data, sizeof(summary));
+            data += sizeof(summary);
+
+            report.samples = summary.samples;
+            report.airt_stats = unpack_stats(summary.airt_stats);
+            report.relh_stats = unpack_stats(summary.relh_stats);
+        }
+        else report = single_summary(report);
+
+        if (layout & BUFFER_SUPPRESSED) report.suppressed = *data;
+        return report;
+    }
+
+    /*
+        Widens the elements to hold more fields, moving them to the start of the
+        memory. Drops elements from the rear of the buffer if they no longer fit
+        (callers should make room first).
+
+        - elements: array containing the elements of the buffer
+        - layout: the fields to add (see the BUFFER_ values)
+     */
+    void widen(uint8_t* elements, uint8_t layout)
+    {
+        layout |= this->layout;
+        if (layout == this->layout) return;
+
+        int count = std::min(this->count(), slots(layout) - 1);
+        discard_rear(this->count() - count);
+
+        // Put the oldest element first, then spread the elements out from the
+        // newest, so that none is overwritten before it is moved
+        int size = element_size(this->layout);
+        std::rotate(elements, elements + rear * size,
+            elements + slots(this->layout) * size);
+
+        for (int i = count - 1; i >= 0; i--)
+        {
+            report_t report = unpack(elements + i * size, this->layout);
+            pack(elements + i * element_size(layout), report, layout);
+        }
+
+        this->layout = layout;
+        rear = 0;
+        front = count;
+    }
+
+    /*
+        Moves the base time to the earliest time held by the buffer or the time
+        of a new element, so that the new element's time fits. Drops elements
+        from the rear of the buffer if they are too far apart from the new
+        element to fit (only happens if the clock jumps).
+
+        - elements: array containing the elements of the buffer
+        - time: the time of the new element
+     */
+    void rebase(uint8_t* elements, uint32_t time)
+    {
+        while (!is_empty())
+        {
+            uint32_t earliest = time;
+            uint32_t latest = time;
+
+            for (int i = 0; i < count(); i++)
+            {
+                uint32_t element_time = peek(elements, i).time;
+                if (element_time < earliest) earliest = element_time;
+                if (element_time > latest) latest = element_time;
+            }
+
+            if (latest - earliest <= PACKED_MAX_TIME)
+            {
+                for (int i = 0; i < count(); i++)
+                {
+                    packed_report_t packed;
+                    uint8_t* data = element(elements, (rear + i) % slots(layout));
+                    memcpy(&packed, data, sizeof(packed));
+                    pack_time(packed, unpack_time(packed) - earliest);
+                    memcpy(data, &packed, sizeof(packed));
+                }
+
+                base_time = earliest;
+                return;
+            }
+
+            rear = (rear + 1) % slots(layout);
+        }
+
+        base_time = time;
+    }
+
 public:
     /*
         Returns the number of elements in the buffer.
@@ -37,7 +296,16 @@ public:
             return 0;
         else if (rear < front)
             return front - rear;
-        else return ((BUFFER_CAPACITY + 1) - rear) + front;
+        else return (slots(layout) - rear) + front;
+    }
+
+    /*
+        Returns the maximum number of elements the buffer can hold in its current
+        layout (BUFFER_CAPACITY at most).
+     */
+    const int capacity()
+    {
+        return slots(layout) - 1;
     }
 
     /*
@@ -53,28 +321,52 @@ public:
      */
     const bool is_full()
     {
-        return count() == (BUFFER_CAPACITY + 1) - 1 ? true : false;
+        return count() == capacity() ? true : false;
+    }
+
+    /*
+        Returns a boolean indicating whether a report can be pushed onto the
+        buffer without dropping any elements, including any widening of the
+        elements that it needs.
+
+        - report: the report to push
+     */
+    const bool has_room(const report_t& report)
+    {
+        if (is_empty()) return true;
+        return count() < slots(layout | required_layout(report)) - 1;
     }
 
 
     /*
-        Pushes a report onto the front of the buffer.
+        Pushes a report onto the front of the buffer, widening the elements first
+        if the report needs it.
 
         - elements: array containing the elements of the buffer
         - report: the report to push onto the buffer
      */
-    void push_front(report_t* elements, const report_t& report)
+    void push_front(uint8_t* elements, const report_t& report)
     {
-        elements[front].time = report.time;
-        elements[front].airt = report.airt;
-        elements[front].relh = report.relh;
-        elements[front].batv = report.batv;
+        if (is_empty())
+        {
+            front = rear = 0;
+            layout = required_layout(report);
+            base_time = report.time;
+        }
+        else
+        {
+            widen(elements, required_layout(report));
+            if (report.time < base_time || report.time - base_time > PACKED_MAX_TIME)
+                rebase(elements, report.time);
+        }
+
+        pack(element(elements, front), report, layout);
 
         bool full = is_full();
-        front = (front + 1) % (BUFFER_CAPACITY + 1);
+        front = (front + 1) % slots(layout);
 
         if (full)
-            rear = (rear + 1) % (BUFFER_CAPACITY + 1);
+            rear = (rear + 1) % slots(layout);
     }
 
     /*
@@ -82,10 +374,10 @@ public:
 
         - elements: array containing the elements of the buffer
      */
-    report_t pop_rear(report_t* elements)
+    report_t pop_rear(uint8_t* elements)
     {
-        report_t report = elements[rear];
-        rear = (rear + 1) % (BUFFER_CAPACITY + 1);
+        report_t report = peek_rear(elements);
+        rear = (rear + 1) % slots(layout);
         return report;
     }
 
@@ -94,10 +386,59 @@ public:
 
         - elements: array containing the elements of the buffer
      */
-    const report_t peek_rear(report_t* elements)
+    const report_t peek_rear(uint8_t* elements)
+    {
+        return peek(elements, 0);
+    }
+
+    /*
+        Returns the element at a position in the buffer, counted from the rear
+        (position 0 is the element at the rear).
+
+        - elements: array containing the elements of the buffer
+        - position: the position of the element to return
+     */
+    const report_t peek(uint8_t* elements, int position)
+    {
+        return unpack(element(elements, (rear + position) % slots(layout)), layout);
+    }
+
+    /*
+        Removes a number of elements from the rear of the buffer.
+
+        - count: the number of elements to remove
+     */
+    void discard_rear(int count)
+    {
+        if (count > this->count())
+            count = this->count();
+        rear = (rear + count) % slots(layout);
+    }
+
+    /*
+        Removes a range of elements, moving the elements in front of the range
+        back to close the gap.
+
+        - elements: array containing the elements of the buffer
+        - position: the position of the first element to remove, counted from
+        the rear
+        - count: the number of elements to remove
+     */
+    void discard_range(uint8_t* elements, int position, int count)
     {
-        return elements[rear];
+        if (position < 0 || position >= this->count()) return;
+        if (count > this->count() - position)
+            count = this->count() - position;
+
+        for (int i = position + count; i < this->count(); i++)
+        {
+            memcpy(element(elements, (rear + i - count) % slots(layout)),
+                element(elements, (rear + i) % slots(layout)),
+                element_size(layout));
+        }
+
+        front = (front + slots(layout) - count) % slots(layout);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,98 @@
+/*
+    Send-on-delta suppression of reports. While the session enables it (with a
+    max_silence above 0), a report is suppressed if its temperature and humidity
+    are both within the session's deadbands of the last stored report, unless
+    max_silence reports in a row have already been suppressed. A missing value
+    only matches another missing value. Only the means are compared for reports
+    that summarise several samples.
+
+    Each stored report holds the number of reports suppressed immediately before
+    it, so the logging server can reconstruct them exactly: they were due at
+    that many intervals before it, and their values were within the deadbands of
+    the stored report before them. A run of suppressed reports never spans a
+    change of interval (see deadband_release()). Only standard C++ is used so
+    that this can be built into other programs.
+ */
+
+#include "deadband.h"
+
+
+/*
+    Returns a boolean indicating whether a value is within a deadband of a
+    reference value, both in stored form.
+ */
+static bool is_within_deadband(int16_t value, int16_t reference, uint16_t deadband)
+{
+    if (value == PACKED_MISSING || reference == PACKED_MISSING)
+        return value == reference;
+
+    int32_t difference = (int32_t)value - reference;
+    return (difference < 0 ? -difference : difference) <= deadband;
+}
+
+/*
+    Forgets the last stored report, so that the next report is stored.
+
+    - state: the deadband state to reset
+ */
+void deadband_reset(deadband_t* state)
+{
+    state->primed = false;
+    state->airt = PACKED_MISSING;
+    state->relh = PACKED_MISSING;
+    state->suppressed = 0;
+}
+
+/*
+    Decides whether a report is suppressed. Returns a boolean indicating whether
+    it was, otherwise it becomes the last stored report and must be stored.
+
+    - state: the deadband state
+    - session: the session, which holds the deadbands
+    - report: the report, which is given the number of reports suppressed before
+    it if it is not suppressed
+ */
+bool deadband_filter(deadband_t* state, const session_t& session, report_t* report)
+{
+    int16_t airt = pack_value(report->airt);
+    int16_t relh = pack_value(report->relh);
+
+    if (session.max_silence > 0 && state->primed &&
+        state->suppressed < session.max_silence &&
+        is_within_deadband(airt, state->airt, session.airt_deadband) &&
+        is_within_deadband(relh, state->relh, session.relh_deadband))
+    {
+        state->suppressed++;
+        state->latest = *report;
+        return true;
+    }
+
+    report->suppressed = state->suppressed;
+    state->primed = true;
+    state->airt = airt;
+    state->relh = relh;
+    state->suppressed = 0;
+    return false;
+}
+
+/*
+    Takes back the suppression of the latest report, so that no suppressed
+    reports are left waiting for a stored report (e.g. before the interval
+    changes). Returns a boolean indicating whether the latest report passed to
+    deadband_filter() was suppressed, in which case it must now be stored.
+
+    - state: the deadband state
+    - report_out: will be set to the latest report, with the number of reports
+    suppressed before it
+ */
+bool deadband_release(deadband_t* state, report_t* report_out)
+{
+    if (state->suppressed == 0) return false;
+
+    *report_out = state->latest;
+    report_out->suppressed = state->suppressed - 1;
+    state->airt = pack_value(report_out->airt);
+    state->relh = pack_value(report_out->relh);
+    state->suppressed = 0;
+    return true;
+}
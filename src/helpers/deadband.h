@@ -0,0 +1,27 @@
+/*
+    Send-on-delta suppression of reports whose values have barely moved since the
+    last report that was stored. See deadband.cpp.
+ */
+
+#include <stdint.h>
+
+#include "helpers.h"
+
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+// The last report that was stored, which later reports are compared with
+struct deadband_t
+{
+    bool primed; // Whether a report has been stored since the last reset
+    int16_t airt; // Stored form (see pack_value())
+    int16_t relh;
+    uint8_t suppressed; // Number of reports suppressed since it was stored
+    report_t latest; // The latest report suppressed
+};
+
+
+void deadband_reset(deadband_t*);
+bool deadband_filter(deadband_t*, const session_t&, report_t*);
+bool deadband_release(deadband_t*, report_t*);
+#endif
@@ -0,0 +1,121 @@
+/*
+    Frames for streaming reports over the serial connection in bulk, so that a
+    node holding a lot of reports can be emptied onto a computer quickly. Only
+    standard C++ is used so that the decoder can be built into other programs
+    (see tools/dump_decoder.cpp).
+
+    Layout: a 10 byte header, the payload, then a 4 byte trailer, with all values
+    little-endian:
+
+    - header: DUMP_MAGIC_0 and DUMP_MAGIC_1 (uint8 each), position of the first
+    report covered by the frame (uint32), number of positions covered (uint16),
+    payload length in bytes (uint16)
+    - payload: a batch of the covered reports in the binary or binary summary
+    layout (see encoding.cpp), missing any that were corrupt
+    - trailer: CRC-32 of the header and payload
+
+    Positions count the pending reports from the oldest (position 0), so a
+    transfer that was interrupted can be resumed from the position after the
+    last frame received intact. The last frame of a transfer has an empty
+    payload and covers no positions, and its position is the number of pending
+    reports.
+ */
+
+#include <string.h>
+
+#include "dump.h"
+
+
+/*
+    Writes a 16 bit value into a buffer in little-endian order.
+ */
+static void put_uint16(uint8_t* data, uint16_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+/*
+    Writes a 32 bit value into a buffer in little-endian order.
+ */
+static void put_uint32(uint8_t* data, uint32_t value)
+{
+    put_uint16(data, value & 0xFFFF);
+    put_uint16(data + 2, value >> 16);
+}
+
+/*
+    Reads a 16 bit little-endian value from a buffer.
+ */
+static uint16_t get_uint16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/*
+    Reads a 32 bit little-endian value from a buffer.
+ */
+static uint32_t get_uint32(const uint8_t* data)
+{
+    return get_uint16(data) | ((uint32_t)get_uint16(data + 2) << 16);
+}
+
+
+/*
+    Builds a frame around a payload. Returns the number of bytes written.
+
+    - frame_out: destination buffer (must hold DUMP_HEADER_SIZE plus
+    DUMP_TRAILER_SIZE bytes more than the payload)
+    - position: position of the first report covered by the frame
+    - span: the number of positions covered by the frame
+    - payload: the encoded reports
+    - length: the number of bytes in the payload (at most DUMP_MAX_PAYLOAD)
+ */
+int encode_dump_frame(uint8_t* frame_out, uint32_t position, uint16_t span,
+    const uint8_t* payload, int length)
+{
+    frame_out[0] = DUMP_MAGIC_0;
+    frame_out[1] = DUMP_MAGIC_1;
+    put_uint32(frame_out + 2, position);
+    put_uint16(frame_out + 6, span);
+    put_uint16(frame_out + 8, length);
+    if (length > 0) memcpy(frame_out + DUMP_HEADER_SIZE, payload, length);
+
+    int crc_position = DUMP_HEADER_SIZE + length;
+    put_uint32(frame_out + crc_position, crc32(frame_out, crc_position));
+    return crc_position + DUMP_TRAILER_SIZE;
+}
+
+/*
+    Finds the frame at the start of a stream of received bytes. Returns the
+    number of bytes the frame occupies, 0 if more bytes are needed to complete
+    it, or -1 if the stream does not start with a valid frame (in which case the
+    first byte should be dropped to search for the next frame).
+
+    - data: the received bytes
+    - length: the number of received bytes
+    - position_out: will be set to the position of the first report covered
+    - span_out: will be set to the number of positions covered
+    - payload_out: will be set to point to the payload within data
+    - payload_length_out: will be set to the number of bytes in the payload
+ */
+int decode_dump_frame(const uint8_t* data, int length, uint32_t* position_out,
+    uint16_t* span_out, const uint8_t** payload_out, int* payload_length_out)
+{
+    if (length >= 1 && data[0] != DUMP_MAGIC_0) return -1;
+    if (length >= 2 && data[1] != DUMP_MAGIC_1) return -1;
+    if (length < DUMP_HEADER_SIZE) return 0;
+
+    int payload_length = get_uint16(data + 8);
+    if (payload_length > DUMP_MAX_PAYLOAD) return -1;
+
+    int crc_position = DUMP_HEADER_SIZE + payload_length;
+    if (length < crc_position + DUMP_TRAILER_SIZE) return 0;
+    if (get_uint32(data + crc_position) != crc32(data, crc_position)) return -1;
+
+    *position_out = get_uint32(data + 2);
+    *span_out = get_uint16(data + 6);
+    *payload_out = data + DUMP_HEADER_SIZE;
+    *payload_length_out = payload_length;
+    return crc_position + DUMP_TRAILER_SIZE;
+}
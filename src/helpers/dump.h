@@ -0,0 +1,30 @@
+/*
+    Frames for streaming reports over the serial connection in bulk. See dump.cpp
+    for the layout.
+ */
+
+#include <stdint.h>
+
+#include "helpers.h"
+#include "encoding.h"
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#define DUMP_MAGIC_0 'P' // First byte of every frame
+#define DUMP_MAGIC_1 'D' // Second byte of every frame
+#define DUMP_HEADER_SIZE 10 // Number of bytes in the header of a frame
+#define DUMP_TRAILER_SIZE 4 // Number of bytes after the payload of a frame
+#define DUMP_FRAME_REPORTS 32 // Maximum number of reports in a frame
+#define DUMP_MAX_PAYLOAD \
+    (BINARY_HEADER_SIZE + BINARY_DEADBAND_SIZE * DUMP_FRAME_REPORTS)
+#define DUMP_MAX_FRAME (DUMP_HEADER_SIZE + DUMP_MAX_PAYLOAD + DUMP_TRAILER_SIZE)
+#define DUMP_DEFAULT_BAUD 921600 // Baud rate to stream frames at if none is given
+#define DUMP_SWITCH_DELAY 100 // Number of milliseconds to wait after changing the
+// baud rate before sending anything
+
+
+int encode_dump_frame(uint8_t*, uint32_t, uint16_t, const uint8_t*, int);
+int decode_dump_frame(const uint8_t*, int, uint32_t*, uint16_t*, const uint8_t**,
+    int*);
+#endif
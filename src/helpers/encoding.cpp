@@ -0,0 +1,627 @@
+/*
+    Compact binary encodings of reports. The decoders only use standard C++ so
+    they can be built into other programs.
+
+    Binary layout: a 4 byte header followed by a 10 byte record per report, with
+    all values little-endian:
+
+    - header: version (uint8), session ID (uint16), report count (uint8)
+    - record: time in seconds since 2000-01-01 (uint32), air temperature in
+    hundredths of a degree (int16), relative humidity in hundredths of a percent
+    (uint16), battery voltage in millivolts (uint16)
+
+    Missing values are encoded as the BINARY_MISSING_ values in encoding.h.
+
+    Binary summary layout: the binary layout with a different version, and 13
+    more bytes at the end of each record: number of samples (uint8), then the
+    minimum, maximum and standard deviation of the air temperature, then of the
+    relative humidity, encoded as the values are (the standard deviations as
+    uint16, or BINARY_MISSING_SPREAD if missing). Used when any report in the
+    batch summarises more than one sample.
+
+    Binary deadband layout: the binary summary layout with a different version,
+    and 1 more byte at the end of each record: the number of reports suppressed
+    immediately before the report (uint8, see deadband.cpp). Used when any report
+    in the batch has suppressed reports before it.
+
+    Delta layout: a 10 byte header followed by a variable length record per
+    report. Multi-byte header values are little-endian:
+
+    - header: version (uint8), session ID (uint16), report count (uint8), time of
+    the first report in seconds since 2000-01-01 (uint32), interval between
+    reports in seconds (uint16)
+    - record: a varint holding (time code << 3) | missing flags, then for each
+    value that is not missing, a zig-zag varint holding the difference from the
+    previous non-missing value of the same kind (starting from 0)
+
+    The time code is the number of intervals since the previous report plus one
+    (or since the first report's time, for the first report). A time code of 0
+    means that the time is not on the interval and is followed by a zig-zag
+    varint of the difference in seconds from the previous report. The missing
+    flags are bit 0 for air temperature, bit 1 for relative humidity and bit 2
+    for battery voltage. Values are air temperature in hundredths of a degree,
+    relative humidity in hundredths of a percent and battery voltage in
+    hundredths of a volt. Varints are unsigned LEB128.
+
+    Delta summary layout: the delta layout with a different version, where the
+    record starts with a varint holding (time code << 4) | flags. Flag bits 0 to
+    2 are the missing flags and bit 3 means that the spread follows the values:
+    a varint of the number of samples, then for each of the air temperature and
+    relative humidity that is not missing, zig-zag varints of the value minus
+    the minimum and the maximum minus the value, and a varint of the standard
+    deviation plus one (0 if missing), all in hundredths. Used when any report in
+    the batch summarises more than one sample.
+
+    Delta deadband layout: the delta summary layout with a different version,
+    where the record starts with a varint holding (time code << 5) | flags. Flag
+    bit 4 means that a varint of the number of reports suppressed immediately
+    before the report follows the rest of the record. Used when any report in
+    the batch has suppressed reports before it.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "encoding.h"
+
+
+/*
+    Writes a 16 bit value into a buffer in little-endian order.
+ */
+static void put_uint16(uint8_t* data, uint16_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+/*
+    Writes a 32 bit value into a buffer in little-endian order.
+ */
+static void put_uint32(uint8_t* data, uint32_t value)
+{
+    put_uint16(data, value & 0xFFFF);
+    put_uint16(data + 2, value >> 16);
+}
+
+/*
+    Reads a 16 bit little-endian value from a buffer.
+ */
+static uint16_t get_uint16(const uint8_t* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+/*
+    Reads a 32 bit little-endian value from a buffer.
+ */
+static uint32_t get_uint32(const uint8_t* data)
+{
+    return get_uint16(data) | ((uint32_t)get_uint16(data + 2) << 16);
+}
+
+
+/*
+    Returns a boolean indicating whether any report in a batch summarises more
+    than one sample, so needs a summary layout.
+
+    - reports: the reports
+    - count: the number of reports
+ */
+bool has_summaries(const report_t* reports, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (reports[i].samples > 1) return true;
+    }
+
+    return false;
+}
+
+/*
+    Returns a boolean indicating whether any report in a batch has suppressed
+    reports before it, so needs a deadband layout.
+
+    - reports: the reports
+    - count: the number of reports
+ */
+bool has_suppressed(const report_t* reports, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (reports[i].suppressed > 0) return true;
+    }
+
+    return false;
+}
+
+/*
+    Encodes an air temperature in the binary layout.
+ */
+static uint16_t encode_airt(float airt)
+{
+    return airt != -99 ?
+        (uint16_t)(int16_t)lroundf(airt * 100) : BINARY_MISSING_AIRT;
+}
+
+/*
+    Encodes a relative humidity in the binary layout.
+ */
+static uint16_t encode_relh(float relh)
+{
+    return relh != -99 ? (uint16_t)lroundf(relh * 100) : BINARY_MISSING_RELH;
+}
+
+/*
+    Encodes a batch of reports into the binary layout, or the binary summary or
+    deadband layout if needed (see has_summaries() and has_suppressed()). Returns
+    the number of bytes written.
+
+    - data_out: destination buffer (must hold BINARY_HEADER_SIZE bytes plus
+    BINARY_DEADBAND_SIZE bytes per report)
+    - session_id: ID of the session the reports belong to
+    - reports: the reports to encode
+    - count: the number of reports to encode (at most 255)
+ */
+int encode_reports_binary(uint8_t* data_out, uint16_t session_id,
+    const report_t* reports, int count)
+{
+    bool suppressed = has_suppressed(reports, count);
+    bool summaries = suppressed || has_summaries(reports, count);
+    if (suppressed) data_out[0] = BINARY_DEADBAND_VERSION;
+    else if (summaries) data_out[0] = BINARY_SUMMARY_VERSION;
+    else data_out[0] = BINARY_REPORTS_VERSION;
+    put_uint16(data_out + 1, session_id);
+    data_out[3] = count;
+
+    uint8_t* record = data_out + BINARY_HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        const report_t& report = reports[i];
+        put_uint32(record, report.time);
+
+        put_uint16(record + 4, encode_airt(report.airt));
+        put_uint16(record + 6, encode_relh(report.relh));
+        put_uint16(record + 8, report.batv != -99 ?
+            (uint16_t)lroundf(report.batv * 1000) : BINARY_MISSING_BATV);
+
+        if (!summaries)
+        {
+            record += BINARY_REPORT_SIZE;
+            continue;
+        }
+
+        // Reports of single samples have no spread
+        bool spread = report.samples > 1;
+        const value_stats_t& airt = report.airt_stats;
+        const value_stats_t& relh = report.relh_stats;
+
+        record[10] = report.samples;
+        put_uint16(record + 11, encode_airt(spread ? airt.minimum : -99));
+        put_uint16(record + 13, encode_airt(spread ? airt.maximum : -99));
+        put_uint16(record + 15, spread && airt.deviation != -99 ?
+            (uint16_t)lroundf(airt.deviation * 100) : BINARY_MISSING_SPREAD);
+        put_uint16(record + 17, encode_relh(spread ? relh.minimum : -99));
+        put_uint16(record + 19, encode_relh(spread ? relh.maximum : -99));
+        put_uint16(record + 21, spread && relh.deviation != -99 ?
+            (uint16_t)lroundf(relh.deviation * 100) : BINARY_MISSING_SPREAD);
+
+        if (!suppressed)
+        {
+            record += BINARY_SUMMARY_SIZE;
+            continue;
+        }
+
+        record[23] = report.suppressed;
+        record += BINARY_DEADBAND_SIZE;
+    }
+
+    return record - data_out;
+}
+
+/*
+    Decodes an air temperature from the binary layout.
+ */
+static float decode_airt(uint16_t airt)
+{
+    return (int16_t)airt != BINARY_MISSING_AIRT ? (int16_t)airt / 100.0f : -99;
+}
+
+/*
+    Decodes a relative humidity from the binary layout.
+ */
+static float decode_relh(uint16_t relh)
+{
+    return relh != BINARY_MISSING_RELH ? relh / 100.0f : -99;
+}
+
+/*
+    Decodes a standard deviation from the binary summary layout.
+ */
+static float decode_spread(uint16_t deviation)
+{
+    return deviation != BINARY_MISSING_SPREAD ? deviation / 100.0f : -99;
+}
+
+/*
+    Decodes a batch of reports from the binary, binary summary or binary deadband
+    layout. Returns the number of reports decoded, or -1 if the data is not a
+    valid batch.
+
+    - data: the encoded batch
+    - length: the number of bytes in the encoded batch
+    - session_id_out: will be set to the ID of the session the reports belong to
+    - reports_out: destination array for the decoded reports
+    - capacity: the number of reports that reports_out can hold
+ */
+int decode_reports_binary(const uint8_t* data, int length, uint16_t* session_id_out,
+    report_t* reports_out, int capacity)
+{
+    if (length < BINARY_HEADER_SIZE) return -1;
+    if (data[0] != BINARY_REPORTS_VERSION && data[0] != BINARY_SUMMARY_VERSION &&
+        data[0] != BINARY_DEADBAND_VERSION)
+    { return -1; }
+
+    bool suppressed = data[0] == BINARY_DEADBAND_VERSION;
+    bool summaries = suppressed || data[0] == BINARY_SUMMARY_VERSION;
+    int record_size = BINARY_REPORT_SIZE;
+    if (suppressed) record_size = BINARY_DEADBAND_SIZE;
+    else if (summaries) record_size = BINARY_SUMMARY_SIZE;
+
+    int count = data[3];
+    if (count > capacity || length != BINARY_HEADER_SIZE + count * record_size)
+        return -1;
+
+    *session_id_out = get_uint16(data + 1);
+
+    const uint8_t* record = data + BINARY_HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        report_t& report = reports_out[i];
+        report.time = get_uint32(record);
+
+        uint16_t airt = get_uint16(record + 4);
+        uint16_t relh = get_uint16(record + 6);
+        uint16_t batv = get_uint16(record + 8);
+
+        report.airt = decode_airt(airt);
+        report.relh = decode_relh(relh);
+        report.batv = batv != BINARY_MISSING_BATV ? batv / 1000.0f : -99;
+        report.samples = summaries ? record[10] : 0;
+        report.suppressed = suppressed ? record[23] : 0;
+
+        // A report of a single sample has no spread, as in the delta layout
+        value_stats_t none = { -99, -99, -99 };
+        report.airt_stats = none;
+        report.relh_stats = none;
+
+        if (summaries)
+        {
+            report.airt_stats.minimum = decode_airt(get_uint16(record + 11));
+            report.airt_stats.maximum = decode_airt(get_uint16(record + 13));
+            report.airt_stats.deviation = decode_spread(get_uint16(record + 15));
+            report.relh_stats.minimum = decode_relh(get_uint16(record + 17));
+            report.relh_stats.maximum = decode_relh(get_uint16(record + 19));
+            report.relh_stats.deviation = decode_spread(get_uint16(record + 21));
+        }
+
+        record += record_size;
+    }
+
+    return count;
+}
+
+
+/*
+    Starts a new batch in the delta layout, or the delta summary or deadband
+    layout.
+
+    - data_out: destination buffer (must hold DELTA_HEADER_SIZE bytes plus
+    DELTA_REPORT_MAX_SIZE bytes per report, or DELTA_SUMMARY_MAX_SIZE or
+    DELTA_DEADBAND_MAX_SIZE bytes if using the summary or deadband layout)
+    - session_id: ID of the session the reports belong to
+    - interval: the interval between reports in seconds
+    - summaries: whether to use the summary layout (see has_summaries())
+    - suppressed: whether to use the deadband layout (see has_suppressed()),
+    which takes precedence
+ */
+void delta_encoder_t::begin(uint8_t* data_out, uint16_t session_id,
+    uint16_t interval, bool summaries, bool suppressed)
+{
+    data = data_out;
+    length = DELTA_HEADER_SIZE;
+    count = 0;
+    this->interval = interval;
+    this->summaries = summaries || suppressed;
+    this->suppressed = suppressed;
+
+    for (int i = 0; i < 3; i++)
+        previous_values[i] = 0;
+
+    if (suppressed) data[0] = DELTA_DEADBAND_VERSION;
+    else if (summaries) data[0] = DELTA_SUMMARY_VERSION;
+    else data[0] = DELTA_REPORTS_VERSION;
+    put_uint16(data + 1, session_id);
+    put_uint16(data + 8, interval);
+}
+
+/*
+    Adds a report to the batch. At most 255 reports can be added.
+
+    - report: the report to add
+ */
+void delta_encoder_t::add(const report_t& report)
+{
+    if (count == 0)
+    {
+        put_uint32(data + 4, report.time);
+        previous_time = report.time;
+    }
+
+    int32_t values[3] = {
+        (int32_t)lroundf(report.airt * 100),
+        (int32_t)lroundf(report.relh * 100),
+        (int32_t)lroundf(report.batv * 100)
+    };
+
+    uint8_t flags = 0;
+    if (report.airt == -99) flags |= 1;
+    if (report.relh == -99) flags |= 2;
+    if (report.batv == -99) flags |= 4;
+
+    // Reports of single samples have no spread
+    int flag_bits = 3;
+    if (summaries)
+    {
+        if (report.samples > 1) flags |= 8;
+        flag_bits = 4;
+    }
+
+    if (suppressed)
+    {
+        if (report.suppressed > 0) flags |= 16;
+        flag_bits = 5;
+    }
+
+    // Reports are normally a whole number of intervals apart
+    int32_t time_delta = report.time - previous_time;
+    if (interval > 0 && time_delta >= 0 && time_delta % interval == 0)
+        put_varint(((time_delta / interval + 1) << flag_bits) | flags);
+    else
+    {
+        put_varint(flags);
+        put_signed_varint(time_delta);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (flags & (1 << i)) continue;
+
+        put_signed_varint(values[i] - previous_values[i]);
+        previous_values[i] = values[i];
+    }
+
+    if (flags & 8)
+    {
+        put_varint(report.samples);
+        if (report.airt != -99) put_spread(report.airt, report.airt_stats);
+        if (report.relh != -99) put_spread(report.relh, report.relh_stats);
+    }
+
+    if (flags & 16) put_varint(report.suppressed);
+
+    previous_time = report.time;
+    count++;
+}
+
+/*
+    Completes the batch. Returns the number of bytes in the batch.
+ */
+int delta_encoder_t::finish()
+{
+    data[3] = count;
+    return length;
+}
+
+/*
+    Appends an unsigned LEB128 varint to the batch.
+ */
+void delta_encoder_t::put_varint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        data[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    data[length++] = value;
+}
+
+/*
+    Appends a zig-zag encoded signed varint to the batch.
+ */
+void delta_encoder_t::put_signed_varint(int32_t value)
+{
+    put_varint(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+/*
+    Appends the spread of a summarised value to the batch.
+
+    - value: the value (the mean of the samples)
+    - stats: the spread of the samples
+ */
+void delta_encoder_t::put_spread(float value, const value_stats_t& stats)
+{
+    int32_t mean = lroundf(value * 100);
+    put_signed_varint(mean - lroundf(stats.minimum * 100));
+    put_signed_varint(lroundf(stats.maximum * 100) - mean);
+    put_varint(stats.deviation != -99 ? lroundf(stats.deviation * 100) + 1 : 0);
+}
+
+
+/*
+    Reads an unsigned LEB128 varint from a buffer. Returns a boolean indicating
+    success or failure, and fails if the varint runs past the end of the buffer.
+
+    - data: the buffer
+    - length: the number of bytes in the buffer
+    - position: the position to read from, which is advanced past the varint
+    - value_out: will be set to the value read
+ */
+static bool get_varint(const uint8_t* data, int length, int* position,
+    uint32_t* value_out)
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*position >= length) return false;
+
+        uint8_t next = data[(*position)++];
+        value |= (uint32_t)(next & 0x7F) << shift;
+
+        if (!(next & 0x80))
+        {
+            *value_out = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+    Reads a zig-zag encoded signed varint from a buffer. See get_varint().
+ */
+static bool get_signed_varint(const uint8_t* data, int length, int* position,
+    int32_t* value_out)
+{
+    uint32_t value;
+    if (!get_varint(data, length, position, &value)) return false;
+
+    *value_out = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    return true;
+}
+
+/*
+    Reads the spread of a summarised value from a buffer. Returns a boolean
+    indicating success or failure. See get_varint().
+
+    - value: the value (the mean of the samples) in hundredths
+    - stats_out: will be set to the spread of the samples
+ */
+static bool get_spread(const uint8_t* data, int length, int* position,
+    int32_t value, value_stats_t* stats_out)
+{
+    int32_t below, above;
+    uint32_t deviation;
+    if (!get_signed_varint(data, length, position, &below) ||
+        !get_signed_varint(data, length, position, &above) ||
+        !get_varint(data, length, position, &deviation))
+    { return false; }
+
+    stats_out->minimum = (value - below) / 100.0f;
+    stats_out->maximum = (value + above) / 100.0f;
+    stats_out->deviation = deviation != 0 ? (deviation - 1) / 100.0f : -99;
+    return true;
+}
+
+/*
+    Decodes a batch of reports from the delta, delta summary or delta deadband
+    layout. Returns the number of reports decoded, or -1 if the data is not a
+    valid batch.
+
+    - data: the encoded batch
+    - length: the number of bytes in the encoded batch
+    - session_id_out: will be set to the ID of the session the reports belong to
+    - reports_out: destination array for the decoded reports
+    - capacity: the number of reports that reports_out can hold
+ */
+int decode_reports_delta(const uint8_t* data, int length, uint16_t* session_id_out,
+    report_t* reports_out, int capacity)
+{
+    if (length < DELTA_HEADER_SIZE) return -1;
+    if (data[0] != DELTA_REPORTS_VERSION && data[0] != DELTA_SUMMARY_VERSION &&
+        data[0] != DELTA_DEADBAND_VERSION)
+    { return -1; }
+
+    int flag_bits = 3;
+    if (data[0] == DELTA_DEADBAND_VERSION) flag_bits = 5;
+    else if (data[0] == DELTA_SUMMARY_VERSION) flag_bits = 4;
+
+    int count = data[3];
+    if (count > capacity) return -1;
+
+    *session_id_out = get_uint16(data + 1);
+    uint32_t time = get_uint32(data + 4);
+    uint16_t interval = get_uint16(data + 8);
+    int32_t values[3] = { 0, 0, 0 };
+
+    int position = DELTA_HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t header;
+        if (!get_varint(data, length, &position, &header)) return -1;
+
+        uint32_t time_code = header >> flag_bits;
+        if (time_code == 0)
+        {
+            int32_t time_delta;
+            if (!get_signed_varint(data, length, &position, &time_delta))
+                return -1;
+            time += time_delta;
+        }
+        else time += (time_code - 1) * interval;
+
+        float decoded[3];
+        for (int j = 0; j < 3; j++)
+        {
+            if (header & (1 << j))
+            {
+                decoded[j] = -99;
+                continue;
+            }
+
+            int32_t delta;
+            if (!get_signed_varint(data, length, &position, &delta)) return -1;
+
+            values[j] += delta;
+            decoded[j] = values[j] / 100.0f;
+        }
+
+        report_t& report = reports_out[i];
+        report.time = time;
+        report.airt = decoded[0];
+        report.relh = decoded[1];
+        report.batv = decoded[2];
+        report.samples = 0;
+        report.suppressed = 0;
+
+        // A missing value has no spread
+        value_stats_t none = { -99, -99, -99 };
+        report.airt_stats = none;
+        report.relh_stats = none;
+
+        if (flag_bits >= 4 && (header & 8))
+        {
+            uint32_t samples;
+            if (!get_varint(data, length, &position, &samples)) return -1;
+            report.samples = samples;
+
+            if (!(header & 1) && !get_spread(
+                data, length, &position, values[0], &report.airt_stats))
+            { return -1; }
+            if (!(header & 2) && !get_spread(
+                data, length, &position, values[1], &report.relh_stats))
+            { return -1; }
+        }
+
+        if (flag_bits == 5 && (header & 16))
+        {
+            uint32_t suppressed;
+            if (!get_varint(data, length, &position, &suppressed)) return -1;
+            report.suppressed = suppressed;
+        }
+    }
+
+    return position == length ? count : -1;
+}
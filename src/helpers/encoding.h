@@ -0,0 +1,77 @@
+/*
+    Compact binary encodings of reports for transmission to the logging server,
+    as alternatives to JSON. See encoding.cpp for the layouts.
+ */
+
+#include <stdint.h>
+
+#include "helpers.h"
+
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#define BINARY_REPORTS_VERSION 1 // Version number of the binary report layout
+#define BINARY_HEADER_SIZE 4 // Number of bytes in the header of a binary batch
+#define BINARY_REPORT_SIZE 10 // Number of bytes per report in a binary batch
+#define BINARY_MISSING_AIRT INT16_MIN // Encoded value of a missing temperature
+#define BINARY_MISSING_RELH UINT16_MAX // Encoded value of a missing humidity
+#define BINARY_MISSING_BATV UINT16_MAX // Encoded value of a missing voltage
+#define BINARY_SUMMARY_VERSION 3 // Version number of the binary report layout
+// with the spread of summarised values
+#define BINARY_SUMMARY_SIZE 23 // Number of bytes per report in a binary batch with
+// the spread of summarised values
+#define BINARY_MISSING_SPREAD UINT16_MAX // Encoded value of a missing standard
+// deviation
+#define BINARY_DEADBAND_VERSION 5 // Version number of the binary report layout
+// with the number of reports suppressed before each report
+#define BINARY_DEADBAND_SIZE 24 // Number of bytes per report in a binary batch with
+// the number of reports suppressed before each report
+
+#define DELTA_REPORTS_VERSION 2 // Version number of the delta report layout
+// (distinct from BINARY_REPORTS_VERSION so that the layouts can be told apart)
+#define DELTA_HEADER_SIZE 10 // Number of bytes in the header of a delta batch
+#define DELTA_REPORT_MAX_SIZE 21 // Maximum number of bytes per report in a
+// delta batch
+#define DELTA_SUMMARY_VERSION 4 // Version number of the delta report layout with
+// the spread of summarised values
+#define DELTA_SUMMARY_MAX_SIZE 41 // Maximum number of bytes per report in a delta
+// batch with the spread of summarised values
+#define DELTA_DEADBAND_VERSION 6 // Version number of the delta report layout with
+// the number of reports suppressed before each report
+#define DELTA_DEADBAND_MAX_SIZE 43 // Maximum number of bytes per report in a delta
+// batch with the number of reports suppressed before each report
+
+
+/*
+    Encodes a batch of reports into the delta layout one report at a time, so
+    that reports can be fed straight from the report buffer.
+ */
+struct delta_encoder_t
+{
+private:
+    uint8_t* data;
+    int length;
+    int count;
+    uint32_t interval;
+    uint32_t previous_time;
+    int32_t previous_values[3];
+    bool summaries;
+    bool suppressed;
+
+    void put_varint(uint32_t);
+    void put_signed_varint(int32_t);
+    void put_spread(float, const value_stats_t&);
+
+public:
+    void begin(uint8_t*, uint16_t, uint16_t, bool, bool);
+    void add(const report_t&);
+    int finish();
+};
+
+
+bool has_summaries(const report_t*, int);
+bool has_suppressed(const report_t*, int);
+int encode_reports_binary(uint8_t*, uint16_t, const report_t*, int);
+int decode_reports_binary(const uint8_t*, int, uint16_t*, report_t*, int);
+int decode_reports_delta(const uint8_t*, int, uint16_t*, report_t*, int);
+#endif
@@ -3,6 +3,7 @@
     definitions of various structs and global configurable values.
  */
 
+#include <math.h>
 #include <RtcDS3231.h>
 
 #include "helpers.h"
@@ -36,4 +37,103 @@ void format_time(char* time_out, const RtcDateTime& time)
 {
     sprintf(time_out, "%04u-%02u-%02uT%02u:%02u:%02uZ", time.Year(),
         time.Month(), time.Day(), time.Hour(), time.Minute(), time.Second());
+}
+
+
+/*
+    Converts a temperature or humidity value to the fixed point form used for
+    storage (hundredths, with PACKED_MISSING for a missing value).
+
+    - value: the value to convert
+ */
+int16_t pack_value(float value)
+{
+    if (value == -99) return PACKED_MISSING;
+
+    long packed = lroundf(value * 100);
+    if (packed < -INT16_MAX) return -INT16_MAX;
+    return packed > INT16_MAX ? INT16_MAX : packed;
+}
+
+/*
+    Converts a temperature or humidity value back from its stored form.
+
+    - packed: the value to convert
+ */
+float unpack_value(int16_t packed)
+{
+    return packed != PACKED_MISSING ? packed / 100.0f : -99;
+}
+
+/*
+    Converts a battery voltage to the form used for storage (hundredths of a volt
+    above 2V, with PACKED_MISSING_BATV for a missing value).
+
+    - batv: the voltage to convert
+ */
+uint8_t pack_batv(float batv)
+{
+    if (batv == -99) return PACKED_MISSING_BATV;
+
+    long packed = lroundf((batv - 2) * 100);
+    if (packed < 0) return 0;
+    return packed >= PACKED_MISSING_BATV ? PACKED_MISSING_BATV - 1 : packed;
+}
+
+/*
+    Converts a battery voltage back from its stored form.
+
+    - packed: the voltage to convert
+ */
+float unpack_batv(uint8_t packed)
+{
+    return packed != PACKED_MISSING_BATV ? 2 + packed / 100.0f : -99;
+}
+
+/*
+    Converts the spread of a value's samples to the form used for storage (see
+    pack_value()).
+
+    - stats: the spread to convert
+ */
+packed_stats_t pack_stats(const value_stats_t& stats)
+{
+    packed_stats_t packed;
+    packed.minimum = pack_value(stats.minimum);
+    packed.maximum = pack_value(stats.maximum);
+    packed.deviation = pack_value(stats.deviation);
+    return packed;
+}
+
+/*
+    Converts the spread of a value's samples back from its stored form.
+
+    - packed: the spread to convert
+ */
+value_stats_t unpack_stats(const packed_stats_t& packed)
+{
+    value_stats_t stats;
+    stats.minimum = unpack_value(packed.minimum);
+    stats.maximum = unpack_value(packed.maximum);
+    stats.deviation = unpack_value(packed.deviation);
+    return stats;
+}
+
+/*
+    Calculates the CRC-32 (as used by zlib) of a block of data.
+
+    - data: the data to calculate the CRC of
+    - length: the number of bytes of data
+ */
+uint32_t crc32(const uint8_t* data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
 }
\ No newline at end of file
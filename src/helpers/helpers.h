@@ -4,37 +4,146 @@
 #define HELPERS_H
 
 #define SERIAL_TIMEOUT 5 // Number of seconds to wait for serial data at power on
+#define SERIAL_BAUD 9600 // Baud rate of the serial connection for commands
 #define SESSION_CHECKS 15 // Number of times to attempt to get the active session
 #define ALLOWED_INTERVALS { 1, 2, 5, 10, 15, 20, 30 } // The allowed intervals
 // between reports in minutes
 #define ALLOWED_INTERVALS_LEN 7 // Number of elements in ALLOWED_INTERVALS
-#define BUFFER_CAPACITY 208 // Maximum number of reports to store in the buffer
+#define ALLOWED_SAMPLE_PERIODS { 0, 10, 12, 15, 20, 30 } // The allowed periods
+// between samples in seconds when reports summarise several samples (0 takes
+// one sample per report)
+#define ALLOWED_SAMPLE_PERIODS_LEN 6 // Number of elements in ALLOWED_SAMPLE_PERIODS
+#define ALLOWED_REPORT_PERIODS { 0, 5, 10, 15, 20, 30 } // The allowed periods
+// between reports in seconds in high-frequency mode (0 takes one report per
+// interval)
+#define ALLOWED_REPORT_PERIODS_LEN 6 // Number of elements in ALLOWED_REPORT_PERIODS
+#ifndef HIGH_FREQUENCY_CAPACITY // (lowered by the tests, see test/run_tests.sh)
+#define HIGH_FREQUENCY_CAPACITY 360 // Maximum number of reports taken in one
+// interval in high-frequency mode, which are held in RAM until transmitted or
+// the interval ends (30 minutes at 5 seconds)
+#endif
+#define HIGH_FREQUENCY_POLL_TIMEOUT 5000000 // Maximum number of microseconds to
+// poll the RTC for the start of a second in high-frequency mode
+#define LIGHT_SLEEP_MIN_TIME 2000 // Minimum number of microseconds worth going
+// into light sleep for
+#define BUFFER_MEMORY 3344 // Number of bytes of sleep memory to use for the buffer
+#define BUFFER_CAPACITY ((int)(BUFFER_MEMORY / sizeof(packed_report_t)) - 1) //
+// Maximum number of reports to store in the buffer, when they are single
+// samples (one element is kept free, see buffer.h)
+#define BUFFER_MAGIC 0x42534E50 // Marks the report buffer as sealed before going
+// to sleep, so that it can be trusted after a reset (changes with its layout)
+#define UPLOAD_BATCH_SIZE 16 // Maximum number of reports to transmit in a single
+// message to the logging server
+#define SPOOL_SPILL_COUNT 64 // Number of reports to move from the buffer into flash
+// memory at once when the buffer is full
+#define TRANSMIT_WINDOW 4 // Maximum number of report batches that can be awaiting a
+// response from the logging server at once
+#define TRANSMIT_QUEUE_LEN 2 // Maximum number of serialised batches that can be
+// waiting to be transmitted
+#define REPORT_PAYLOAD_SIZE 256 // Maximum number of bytes in a serialised report
+#define BATCH_PAYLOAD_SIZE (UPLOAD_BATCH_SIZE * REPORT_PAYLOAD_SIZE) // Maximum
+// number of bytes in a serialised batch of reports
+#define FAST_CONNECT_TIMEOUT 2000 // Number of milliseconds to wait for a connection
+// to the WiFi network using the details of the previous connection
+#define NETWORK_CACHE_LIFETIME 43200 // Number of seconds to reuse the details of a
+// connection to the WiFi network for (should be less than the DHCP lease time)
 #define RTC_SQUARE_WAVE_PIN GPIO_NUM_35 // The pin connected to the RTC SQW pin
 #define ALARM_SET_THRESHOLD 2 // Number of seconds of sleep to guarantee before an
 // alarm fires (precaution to ensure device sleeps properly before alarm triggers)
+#define PACKED_MISSING INT16_MIN // Stored value of a missing temperature or humidity
+#define PACKED_MISSING_BATV 255 // Stored value of a missing battery voltage
+#define PACKED_MAX_TIME 0xFFFFFF // Largest time offset that a stored report can hold
 
 
 // The possible results of transmissions to the logging server
 enum RequestResult { Success, Fail, NoSession };
 
+// The possible formats for reports transmitted to the logging server
+enum ReportEncoding { Json, Binary, Delta };
+
+// The possible orders to transmit pending reports in (see transmit_reports())
+enum UploadOrder { OldestFirst, NewestFirst };
+
 // Represents a session (tells the sensor node how to record and transmit reports)
 struct session_t
 {
     uint16_t session_id;
     uint8_t interval;
     uint8_t batch_size;
+    uint8_t encoding;
+    uint8_t sample_period;
+    uint16_t airt_deadband; // Hundredths of a degree
+    uint16_t relh_deadband; // Hundredths of a percent
+    uint8_t max_silence; // Most reports to suppress in a row (0 disables
+    // suppression, see deadband.cpp)
+    uint16_t transmit_slot; // Slot of the interval to transmit in (see slots.cpp)
+    uint8_t upload_order; // Order to transmit pending reports in (see UploadOrder)
+    uint8_t report_period; // Seconds between reports in high-frequency mode (0
+    // for one report per interval, see high_frequency_routine())
+};
+
+// Represents the spread of the samples that a value in a report is the mean of
+struct value_stats_t
+{
+    float minimum;
+    float maximum;
+    float deviation; // Standard deviation
 };
 
-// Represents a collection of sensor values for a specific time (a report)
+// Represents a collection of sensor values for a specific time (a report). If
+// samples is more than 1, the temperature and humidity are the means of that
+// many samples taken over the interval ending at the time. Suppressed is the
+// number of reports suppressed immediately before this one (see deadband.cpp)
 struct report_t
 {
     uint32_t time;
     float airt;
     float relh;
     float batv;
+    uint8_t samples;
+    value_stats_t airt_stats;
+    value_stats_t relh_stats;
+    uint8_t suppressed;
+};
+
+// Represents the spread of a value in the compact form that is stored in the
+// report buffer, in the same form as the value
+struct __attribute__((packed)) packed_stats_t
+{
+    int16_t minimum;
+    int16_t maximum;
+    int16_t deviation;
+};
+
+// Represents a report in the compact form that is stored in the report buffer.
+// The number of samples, their spread and the number of reports suppressed
+// before the report follow it if the buffer needs them (see buffer.h)
+struct __attribute__((packed)) packed_report_t
+{
+    uint8_t time[3]; // Seconds since the buffer's base time (little-endian)
+    int16_t airt; // Hundredths of a degree, or PACKED_MISSING
+    int16_t relh; // Hundredths of a percent, or PACKED_MISSING
+    uint8_t batv; // Hundredths of a volt above 2V, or PACKED_MISSING_BATV
+};
+
+// Represents the number of samples in a report and their spread, in the compact
+// form that is stored in the report buffer
+struct __attribute__((packed)) packed_summary_t
+{
+    uint8_t samples;
+    packed_stats_t airt_stats;
+    packed_stats_t relh_stats;
 };
 
 
 int round_up_multiple(int, int);
 void format_time(char*, const RtcDateTime&);
+
+int16_t pack_value(float);
+float unpack_value(int16_t);
+uint8_t pack_batv(float);
+float unpack_batv(uint8_t);
+packed_stats_t pack_stats(const value_stats_t&);
+value_stats_t unpack_stats(const packed_stats_t&);
+uint32_t crc32(const uint8_t*, size_t);
 #endif
\ No newline at end of file
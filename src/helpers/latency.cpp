@@ -0,0 +1,103 @@
+/*
+    Derives the deadline for each wait from the latencies observed at earlier
+    wakes. The rules:
+
+    - The mean and mean deviation of the latency are smoothed with exponentially
+    weighted moving averages (gains of 1/8 and 1/4, as for TCP's retransmission
+    timer), so that the estimate follows a link that gets slower or faster
+    without being thrown by a single slow wait
+    - The mean plus LATENCY_DEVIATIONS mean deviations is taken as the high
+    percentile of the latency, and the deadline is LATENCY_MARGIN_PERCENT of it,
+    so that a wait that is going to succeed almost always does while a dead link
+    is given up on as soon as it is clearly out of the ordinary
+    - Until LATENCY_MIN_SAMPLES latencies have been observed, and whenever the
+    derived deadline would exceed it, the configured maximum is used
+    - Each consecutive timeout doubles the deadline (up to the maximum), so a
+    link that has become much slower is still waited for long enough to observe
+    its new latency. A successful wait resets this
+ */
+
+#include "latency.h"
+
+
+/*
+    Forgets the latencies observed so far, e.g. when the network is changed.
+
+    - estimate: the estimate to clear
+ */
+void latency_reset(latency_estimate_t* estimate)
+{
+    estimate->mean = 0;
+    estimate->deviation = 0;
+    estimate->samples = 0;
+    estimate->timeouts = 0;
+}
+
+/*
+    Adds the latency of a successful wait to the estimate.
+
+    - estimate: the estimate of the phase
+    - latency: the number of milliseconds the wait took
+ */
+void latency_record(latency_estimate_t* estimate, uint32_t latency)
+{
+    int32_t sample = (int32_t)(latency * LATENCY_SCALE);
+
+    if (estimate->samples == 0)
+    {
+        estimate->mean = sample;
+        estimate->deviation = sample / 2;
+    }
+    else
+    {
+        int32_t error = sample - (int32_t)estimate->mean;
+        int32_t magnitude = error < 0 ? -error : error;
+        estimate->mean += error / 8;
+        estimate->deviation += (magnitude - (int32_t)estimate->deviation) / 4;
+    }
+
+    if (estimate->samples < UINT8_MAX) estimate->samples++;
+    estimate->timeouts = 0;
+}
+
+/*
+    Records that a wait timed out. The latency is unknown (only that it was
+    longer than the deadline) so the estimate itself is left unchanged.
+
+    - estimate: the estimate of the phase
+ */
+void latency_record_timeout(latency_estimate_t* estimate)
+{
+    if (estimate->timeouts < UINT8_MAX) estimate->timeouts++;
+}
+
+/*
+    Returns the high percentile of the latency in milliseconds, or 0 if no
+    latencies have been observed.
+
+    - estimate: the estimate of the phase
+ */
+uint32_t latency_percentile(const latency_estimate_t& estimate)
+{
+    if (estimate.samples == 0) return 0;
+    return (estimate.mean + LATENCY_DEVIATIONS * estimate.deviation +
+        LATENCY_SCALE - 1) / LATENCY_SCALE;
+}
+
+/*
+    Returns the number of milliseconds to wait before giving up on a phase.
+
+    - estimate: the estimate of the phase
+    - maximum: the configured timeout in milliseconds, which is never exceeded
+ */
+uint32_t latency_deadline(const latency_estimate_t& estimate, uint32_t maximum)
+{
+    if (estimate.samples < LATENCY_MIN_SAMPLES) return maximum;
+
+    uint32_t deadline = latency_percentile(estimate) * LATENCY_MARGIN_PERCENT / 100;
+    if (deadline < LATENCY_MIN_DEADLINE) deadline = LATENCY_MIN_DEADLINE;
+
+    for (int i = 0; i < estimate.timeouts && deadline < maximum; i++)
+        deadline *= 2;
+    return deadline < maximum ? deadline : maximum;
+}
@@ -0,0 +1,53 @@
+/*
+    Estimates how long each phase of connecting and talking to the logging
+    server usually takes, from the latencies observed at earlier wakes (kept in
+    sleep memory), and derives the deadline for each wait from them. See
+    latency.cpp for the rules.
+
+    This has no dependencies on the device so that it can be built and run on
+    the host (see tools/latency_sim.cpp).
+ */
+
+#include <stdint.h>
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#define LATENCY_SCALE 8 // Fixed-point scale of the estimates (1/8 millisecond)
+#define LATENCY_MIN_SAMPLES 4 // Number of latencies to observe before the
+// deadline is derived from them rather than set to the configured maximum
+#define LATENCY_DEVIATIONS 4 // Number of mean deviations above the mean taken as
+// the high percentile of the latency
+#define LATENCY_MARGIN_PERCENT 150 // Deadline as a percentage of the high
+// percentile of the latency
+#define LATENCY_MIN_DEADLINE 500 // Minimum deadline in milliseconds
+
+
+// The waits that are timed
+enum LatencyPhase
+{
+    NetworkFull, // WiFi connection with a scan and DHCP
+    NetworkFast, // WiFi connection with a known access point and IP address
+    LoggerConnack, // Connection acknowledgement from the broker
+    LoggerSuback, // Subscription acknowledgement from the broker
+    LoggerReply, // Response from the logging server to a request
+    LATENCY_PHASES // Number of phases
+};
+
+// Smoothed latency of one phase, kept in sleep memory between wakes
+struct latency_estimate_t
+{
+    uint32_t mean; // Scaled by LATENCY_SCALE
+    uint32_t deviation; // Mean absolute deviation, scaled by LATENCY_SCALE
+    uint8_t samples; // Number of latencies observed (saturates)
+    uint8_t timeouts; // Number of consecutive waits that timed out
+};
+
+
+void latency_reset(latency_estimate_t*);
+void latency_record(latency_estimate_t*, uint32_t);
+void latency_record_timeout(latency_estimate_t*);
+uint32_t latency_percentile(const latency_estimate_t&);
+uint32_t latency_deadline(const latency_estimate_t&, uint32_t);
+
+#endif
@@ -0,0 +1,558 @@
+/*
+    The protocol spoken with the logging server over MQTT. All messages are
+    published with QoS 0, and each node uses the topics under nodes/<mac>/, where
+    <mac> is its MAC address as set by setup(). Messages from the node end in an
+    ID that increases with each message (wrapping at 65535), and the logging
+    server responds on nodes/<mac>/inbound/<id> with the same ID.
+
+    - nodes/<mac>/outbound/<id>: "get_session" asks for the active session. The
+    response is "no_session", "error", or a JSON object holding the session (see
+    parse_session() for the fields)
+    - nodes/<mac>/reports/<id>: a batch of reports in the session's encoding (a
+    JSON array, or a binary or delta batch, see encoding.cpp). The response is
+    "ok" to accept the whole batch, "ok <n>" to accept only the first n reports,
+    "no_session" if the session has ended, or "error". Either form of "ok" can
+    be followed by a JSON object holding changes to the session
+    - nodes/<mac>/telemetry/<id>: the timings of earlier wakes (see trace.cpp).
+    There is no response
+
+    The node subscribes to nodes/<mac>/inbound/#, using a persistent session so
+    that the subscription is kept between connections.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "encoding.h"
+#include "slots.h"
+
+
+/*
+    Builds the topic for a message to or from the logging server.
+
+    - topic_out: destination string (must hold TOPIC_LENGTH characters)
+    - mac_address: the node's MAC address as a string
+    - kind: the kind of message (outbound, reports, telemetry or inbound)
+    - message_id: the ID of the message
+ */
+void format_topic(char* topic_out, const char* mac_address, const char* kind,
+    uint16_t message_id)
+{
+    snprintf(topic_out, TOPIC_LENGTH, "nodes/%s/%s/%u", mac_address, kind,
+        message_id);
+}
+
+/*
+    Returns the message ID held in the final element of a topic.
+
+    - topic: the topic of the message
+ */
+uint16_t topic_message_id(const char* topic)
+{
+    const char* separator = strrchr(topic, '/');
+    return (uint16_t)strtoul(separator != NULL ? separator + 1 : topic, NULL, 10);
+}
+
+
+/*
+    Serialises a report into a JSON string ready for transmission to the logging
+    server.
+
+    - report_out: destination string
+    - report: the report to serialise
+    - session_id: the ID of the session the report belongs to
+ */
+void serialise_report(char* report_out, const report_t& report,
+    uint16_t session_id)
+{
+    int length = 0;
+    length += sprintf(report_out, "{\"session_id\":%d", session_id);
+
+    char formatted_time[32] = { '\0' };
+    format_time(formatted_time, RtcDateTime(report.time));
+    length += sprintf(report_out + length, ",\"time\":\"%s\"", formatted_time);
+
+    // The mean of several samples has the precision of its spread, so that it
+    // does not round to outside the range of the samples
+    int precision = report.samples > 1 ? 2 : 1;
+
+    if (report.airt != -99)
+    {
+        length += sprintf(
+            report_out + length, ",\"airt\":%.*f", precision, report.airt);
+    }
+    else length += sprintf(report_out + length, ",\"airt\":null");
+
+    if (report.relh != -99)
+    {
+        length += sprintf(
+            report_out + length, ",\"relh\":%.*f", precision, report.relh);
+    }
+    else length += sprintf(report_out + length, ",\"relh\":null");
+
+    if (report.batv != -99)
+        length += sprintf(report_out + length, ",\"batv\":%.2f", report.batv);
+    else length += sprintf(report_out + length, ",\"batv\":null");
+
+    // Reports that summarise several samples also hold the spread of the samples
+    if (report.samples > 1)
+    {
+        length += sprintf(report_out + length, ",\"samples\":%u", report.samples);
+        if (report.airt != -99)
+            length += serialise_stats(report_out + length, "airt", report.airt_stats);
+        if (report.relh != -99)
+            length += serialise_stats(report_out + length, "relh", report.relh_stats);
+    }
+
+    // The logging server fills in the reports suppressed before this one
+    if (report.suppressed > 0)
+    {
+        length += sprintf(
+            report_out + length, ",\"suppressed\":%u", report.suppressed);
+    }
+
+    strcat(report_out + length, "}");
+}
+
+/*
+    Serialises the spread of a value's samples into JSON members to add to a
+    report. Returns the number of characters written.
+
+    - stats_out: destination string
+    - name: the name of the value
+    - stats: the spread of the value's samples
+ */
+int serialise_stats(char* stats_out, const char* name, const value_stats_t& stats)
+{
+    int length = sprintf(stats_out, ",\"%s_min\":%.2f,\"%s_max\":%.2f", name,
+        stats.minimum, name, stats.maximum);
+
+    if (stats.deviation != -99)
+        length += sprintf(stats_out + length, ",\"%s_sd\":%.2f", name, stats.deviation);
+    else length += sprintf(stats_out + length, ",\"%s_sd\":null", name);
+    return length;
+}
+
+/*
+    Serialises a batch of reports ready for transmission to the logging server,
+    in the encoding set by the session (a JSON array, or a binary or delta batch,
+    see encoding.cpp). Returns the number of bytes written.
+
+    - reports_out: destination buffer (must hold REPORT_PAYLOAD_SIZE bytes per
+    report)
+    - session: the active session, which sets the encoding
+    - session_id: the ID of the session the reports belong to (reports taken
+    before a change of session belong to the earlier one)
+    - batch: the reports to serialise
+    - count: the number of reports to serialise
+ */
+int serialise_reports(char* reports_out, const session_t& session,
+    uint16_t session_id, const report_t* batch, int count)
+{
+    if (session.encoding == ReportEncoding::Binary)
+    {
+        return encode_reports_binary(
+            (uint8_t*)reports_out, session_id, batch, count);
+    }
+    else if (session.encoding == ReportEncoding::Delta)
+    {
+        delta_encoder_t encoder;
+        encoder.begin((uint8_t*)reports_out, session_id,
+            session.report_period != 0 ?
+            session.report_period : session.interval * 60,
+            has_summaries(batch, count),
+            has_suppressed(batch, count));
+
+        for (int i = 0; i < count; i++)
+            encoder.add(batch[i]);
+        return encoder.finish();
+    }
+
+    int length = 0;
+    reports_out[length++] = '[';
+
+    for (int i = 0; i < count; i++)
+    {
+        if (i > 0) reports_out[length++] = ',';
+
+        serialise_report(reports_out + length, batch[i], session_id);
+        length += strlen(reports_out + length);
+    }
+
+    strcpy(reports_out + length++, "]");
+    return length;
+}
+
+/*
+    Serialises a session into a JSON object, as sent by the logging server in
+    response to "get_session". The optional fields are left out when they hold
+    their defaults. Returns the number of characters written.
+
+    - session_out: destination string (must hold 256 characters)
+    - session: the session to serialise
+ */
+int serialise_session(char* session_out, const session_t& session)
+{
+    int length = sprintf(session_out,
+        "{\"session_id\":%u,\"interval\":%u,\"batch_size\":%u",
+        session.session_id, session.interval, session.batch_size);
+
+    if (session.encoding != ReportEncoding::Json)
+        length += sprintf(session_out + length, ",\"encoding\":%u", session.encoding);
+    if (session.sample_period != 0)
+    {
+        length += sprintf(session_out + length, ",\"sample_period\":%u",
+            session.sample_period);
+    }
+
+    if (session.max_silence != 0)
+    {
+        length += sprintf(session_out + length,
+            ",\"airt_deadband\":%.2f,\"relh_deadband\":%.2f,\"max_silence\":%u",
+            session.airt_deadband / 100.0, session.relh_deadband / 100.0,
+            session.max_silence);
+    }
+
+    if (session.transmit_slot != SLOT_FROM_KEY)
+    {
+        length += sprintf(session_out + length, ",\"transmit_slot\":%u",
+            session.transmit_slot);
+    }
+
+    if (session.upload_order != UploadOrder::OldestFirst)
+    {
+        length += sprintf(session_out + length, ",\"upload_order\":%u",
+            session.upload_order);
+    }
+
+    if (session.report_period != 0)
+    {
+        length += sprintf(session_out + length, ",\"report_period\":%u",
+            session.report_period);
+    }
+
+    strcpy(session_out + length++, "}");
+    return length;
+}
+
+
+/*
+    Parses the logging server's response to "get_session". Returns an enum
+    indicating the status, which is a failure if the session is malformed,
+    missing a required field or invalid.
+
+    - message: the response
+    - session_out: will be set to the session upon success
+ */
+RequestResult parse_session_reply(const char* message, session_t* session_out)
+{
+    if (strcmp(message, "no_session") == 0) return RequestResult::NoSession;
+    if (strcmp(message, "error") == 0) return RequestResult::Fail;
+
+    // Deserialise the JSON containing the session
+    StaticJsonDocument<JSON_OBJECT_SIZE(11)> document;
+    if (deserializeJson(document, message) != DeserializationError::Ok)
+        return RequestResult::Fail;
+
+    // The report encoding, sample period, deadbands, transmit slot, upload
+    // order and report period are optional and default to JSON, one sample per
+    // report, no suppression, a slot derived from the MAC address, oldest first
+    // and one report per interval
+    session_t session;
+    session.encoding = ReportEncoding::Json;
+    session.sample_period = 0;
+    session.airt_deadband = 0;
+    session.relh_deadband = 0;
+    session.max_silence = 0;
+    session.transmit_slot = SLOT_FROM_KEY;
+    session.upload_order = UploadOrder::OldestFirst;
+    session.report_period = 0;
+
+    int fields = parse_session(document.as<JsonObject>(), &session);
+    if (fields == -1 || (fields & SESSION_FIELDS_REQUIRED) !=
+        SESSION_FIELDS_REQUIRED || !is_session_valid(session))
+    { return RequestResult::Fail; }
+
+    *session_out = session;
+    return RequestResult::Success;
+}
+
+/*
+    Parses the logging server's response to a batch of reports. Returns an enum
+    indicating the status. The logging server may accept only the first part of
+    a batch, in which case the status is a failure and the number of accepted
+    reports is still set. A malformed change to the session is ignored but the
+    reports are still accepted.
+
+    - message: the response
+    - count: the number of reports in the batch
+    - accepted_out: will be set to the number of reports (counted from the start
+    of the batch) that the logging server accepted
+    - update_out: will be set to the changes to the session, if there are any
+    - fields_out: will be set to a combination of the SESSION_FIELD flags
+    indicating which fields of update_out were changed (0 if none)
+ */
+RequestResult parse_report_reply(const char* message, int count,
+    int* accepted_out, session_t* update_out, int* fields_out)
+{
+    *accepted_out = 0;
+    *fields_out = 0;
+
+    if (strcmp(message, "no_session") == 0)
+    {
+        // Reports for an ended session are discarded by the caller
+        *accepted_out = count;
+        return RequestResult::NoSession;
+    }
+
+    // A plain "ok" accepts the whole batch, "ok <n>" accepts only the first n
+    // reports in the batch. Either can be followed by a JSON object containing
+    // changes to the session
+    if (strncmp(message, "ok", 2) != 0 || (message[2] != '\0' && message[2] != ' '))
+        return RequestResult::Fail;
+
+    const char* remainder = message + 2;
+    *accepted_out = count;
+
+    if (*remainder == ' ' && remainder[1] != '{')
+    {
+        char* end;
+        long accepted = strtol(remainder + 1, &end, 10);
+        *accepted_out = accepted < 0 ? 0 : accepted > count ? count : accepted;
+        remainder = end;
+    }
+
+    while (*remainder == ' ') remainder++;
+    if (*remainder == '{')
+    {
+        StaticJsonDocument<JSON_OBJECT_SIZE(11)> document;
+        if (deserializeJson(document, remainder) == DeserializationError::Ok)
+        {
+            int fields = parse_session(document.as<JsonObject>(), update_out);
+            if (fields != -1) *fields_out = fields;
+        }
+    }
+
+    return *accepted_out == count ? RequestResult::Success : RequestResult::Fail;
+}
+
+/*
+    Reads the session fields present in a JSON object into a session. Returns a
+    combination of the SESSION_FIELD flags indicating which fields were present,
+    or -1 if any field has the wrong type. Fields not present are left unchanged.
+
+    - json_object: the JSON object containing the session fields
+    - session: the session to read the fields into
+ */
+int parse_session(JsonObject json_object, session_t* session)
+{
+    int fields = 0;
+
+    if (json_object.containsKey("session_id"))
+    {
+        JsonVariant value = json_object.getMember("session_id");
+
+        if (value.is<uint16_t>())
+            session->session_id = value;
+        else return -1;
+        fields |= SESSION_FIELD_ID;
+    }
+
+    if (json_object.containsKey("interval"))
+    {
+        JsonVariant value = json_object.getMember("interval");
+
+        if (value.is<uint8_t>())
+            session->interval = value;
+        else return -1;
+        fields |= SESSION_FIELD_INTERVAL;
+    }
+
+    if (json_object.containsKey("batch_size"))
+    {
+        JsonVariant value = json_object.getMember("batch_size");
+
+        if (value.is<uint8_t>())
+            session->batch_size = value;
+        else return -1;
+        fields |= SESSION_FIELD_BATCH_SIZE;
+    }
+
+    if (json_object.containsKey("encoding"))
+    {
+        JsonVariant value = json_object.getMember("encoding");
+
+        if (value.is<uint8_t>())
+            session->encoding = value;
+        else return -1;
+        fields |= SESSION_FIELD_ENCODING;
+    }
+
+    if (json_object.containsKey("sample_period"))
+    {
+        JsonVariant value = json_object.getMember("sample_period");
+
+        if (value.is<uint8_t>())
+            session->sample_period = value;
+        else return -1;
+        fields |= SESSION_FIELD_SAMPLE_PERIOD;
+    }
+
+    if (json_object.containsKey("airt_deadband"))
+    {
+        if (!parse_deadband(json_object.getMember("airt_deadband"),
+            &session->airt_deadband)) return -1;
+        fields |= SESSION_FIELD_AIRT_DEADBAND;
+    }
+
+    if (json_object.containsKey("relh_deadband"))
+    {
+        if (!parse_deadband(json_object.getMember("relh_deadband"),
+            &session->relh_deadband)) return -1;
+        fields |= SESSION_FIELD_RELH_DEADBAND;
+    }
+
+    if (json_object.containsKey("max_silence"))
+    {
+        JsonVariant value = json_object.getMember("max_silence");
+
+        if (value.is<uint8_t>())
+            session->max_silence = value;
+        else return -1;
+        fields |= SESSION_FIELD_MAX_SILENCE;
+    }
+
+    if (json_object.containsKey("transmit_slot"))
+    {
+        JsonVariant value = json_object.getMember("transmit_slot");
+
+        if (value.is<uint16_t>())
+            session->transmit_slot = value;
+        else return -1;
+        fields |= SESSION_FIELD_TRANSMIT_SLOT;
+    }
+
+    if (json_object.containsKey("upload_order"))
+    {
+        JsonVariant value = json_object.getMember("upload_order");
+
+        if (value.is<uint8_t>())
+            session->upload_order = value;
+        else return -1;
+        fields |= SESSION_FIELD_UPLOAD_ORDER;
+    }
+
+    if (json_object.containsKey("report_period"))
+    {
+        JsonVariant value = json_object.getMember("report_period");
+
+        if (value.is<uint8_t>())
+            session->report_period = value;
+        else return -1;
+        fields |= SESSION_FIELD_REPORT_PERIOD;
+    }
+
+    return fields;
+}
+
+/*
+    Reads a deadband (a temperature in degrees or a humidity in percent) into
+    its stored form in hundredths. Returns a boolean indicating success or
+    failure, and fails if the value is not a number from 0 to
+    SESSION_MAX_DEADBAND.
+
+    - value: the JSON value holding the deadband
+    - deadband_out: will be set to the deadband in hundredths
+ */
+bool parse_deadband(JsonVariant value, uint16_t* deadband_out)
+{
+    if (!value.is<float>()) return false;
+
+    float deadband = value;
+    if (deadband < 0 || deadband > SESSION_MAX_DEADBAND) return false;
+
+    *deadband_out = lroundf(deadband * 100);
+    return true;
+}
+
+/*
+    Copies some of the fields of one session into another.
+
+    - session: the session to copy the fields into
+    - source: the session to copy the fields from
+    - fields: a combination of the SESSION_FIELD flags indicating which fields
+    to copy
+ */
+void apply_session_fields(session_t* session, const session_t& source, int fields)
+{
+    if (fields & SESSION_FIELD_ID)
+        session->session_id = source.session_id;
+    if (fields & SESSION_FIELD_INTERVAL)
+        session->interval = source.interval;
+    if (fields & SESSION_FIELD_BATCH_SIZE)
+        session->batch_size = source.batch_size;
+    if (fields & SESSION_FIELD_ENCODING)
+        session->encoding = source.encoding;
+    if (fields & SESSION_FIELD_SAMPLE_PERIOD)
+        session->sample_period = source.sample_period;
+    if (fields & SESSION_FIELD_AIRT_DEADBAND)
+        session->airt_deadband = source.airt_deadband;
+    if (fields & SESSION_FIELD_RELH_DEADBAND)
+        session->relh_deadband = source.relh_deadband;
+    if (fields & SESSION_FIELD_MAX_SILENCE)
+        session->max_silence = source.max_silence;
+    if (fields & SESSION_FIELD_TRANSMIT_SLOT)
+        session->transmit_slot = source.transmit_slot;
+    if (fields & SESSION_FIELD_UPLOAD_ORDER)
+        session->upload_order = source.upload_order;
+    if (fields & SESSION_FIELD_REPORT_PERIOD)
+        session->report_period = source.report_period;
+}
+
+/*
+    Checks that the values in a session are within the allowed ranges. Returns a
+    boolean indicating validity.
+
+    - session: the session to check
+ */
+bool is_session_valid(const session_t& session)
+{
+    if (session.batch_size < 1 || session.batch_size > BUFFER_CAPACITY ||
+        session.encoding > ReportEncoding::Delta ||
+        session.upload_order > UploadOrder::NewestFirst)
+    { return false; }
+
+    bool sample_period_allowed = false;
+    int allowed_sample_periods[] = ALLOWED_SAMPLE_PERIODS;
+    for (int i = 0; i < ALLOWED_SAMPLE_PERIODS_LEN; i++)
+    {
+        if (allowed_sample_periods[i] == session.sample_period)
+            sample_period_allowed = true;
+    }
+
+    if (!sample_period_allowed) return false;
+
+    // Reports in high-frequency mode are single samples
+    bool report_period_allowed = false;
+    int allowed_report_periods[] = ALLOWED_REPORT_PERIODS;
+    for (int i = 0; i < ALLOWED_REPORT_PERIODS_LEN; i++)
+    {
+        if (allowed_report_periods[i] == session.report_period)
+            report_period_allowed = true;
+    }
+
+    if (!report_period_allowed ||
+        (session.report_period != 0 && session.sample_period != 0))
+    { return false; }
+
+    int allowed_intervals[] = ALLOWED_INTERVALS;
+    for (int i = 0; i < ALLOWED_INTERVALS_LEN; i++)
+    {
+        if (allowed_intervals[i] == session.interval) return true;
+    }
+
+    return false;
+}
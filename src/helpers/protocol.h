@@ -0,0 +1,51 @@
+/*
+    The messages exchanged with the logging server: the topics they are published
+    on, the serialised reports, and the parsing of the responses. See
+    protocol.cpp for a description of the protocol.
+
+    This has no dependencies on the device other than ArduinoJson so that it can
+    be built and run on the host (see tools/reference_logger.cpp and
+    tools/load_generator.cpp).
+ */
+
+#include <ArduinoJson.h>
+
+#include "helpers.h"
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#define TOPIC_LENGTH 64 // Maximum number of characters in a topic
+
+// Flags indicating which session fields were present in a JSON object
+#define SESSION_FIELD_ID (1 << 0)
+#define SESSION_FIELD_INTERVAL (1 << 1)
+#define SESSION_FIELD_BATCH_SIZE (1 << 2)
+#define SESSION_FIELD_ENCODING (1 << 3)
+#define SESSION_FIELD_SAMPLE_PERIOD (1 << 4)
+#define SESSION_FIELD_AIRT_DEADBAND (1 << 5)
+#define SESSION_FIELD_RELH_DEADBAND (1 << 6)
+#define SESSION_FIELD_MAX_SILENCE (1 << 7)
+#define SESSION_FIELD_TRANSMIT_SLOT (1 << 8)
+#define SESSION_FIELD_UPLOAD_ORDER (1 << 9)
+#define SESSION_FIELD_REPORT_PERIOD (1 << 10)
+#define SESSION_FIELDS_REQUIRED \
+    (SESSION_FIELD_ID | SESSION_FIELD_INTERVAL | SESSION_FIELD_BATCH_SIZE)
+#define SESSION_MAX_DEADBAND 100 // Largest deadband in degrees or percent
+
+
+void format_topic(char*, const char*, const char*, uint16_t);
+uint16_t topic_message_id(const char*);
+
+void serialise_report(char*, const report_t&, uint16_t);
+int serialise_stats(char*, const char*, const value_stats_t&);
+int serialise_reports(char*, const session_t&, uint16_t, const report_t*, int);
+int serialise_session(char*, const session_t&);
+
+RequestResult parse_session_reply(const char*, session_t*);
+RequestResult parse_report_reply(const char*, int, int*, session_t*, int*);
+int parse_session(JsonObject, session_t*);
+bool parse_deadband(JsonVariant, uint16_t*);
+void apply_session_fields(session_t*, const session_t&, int);
+bool is_session_valid(const session_t&);
+#endif
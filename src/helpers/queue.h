@@ -0,0 +1,96 @@
+/*
+    A fixed-size circular queue that is safe to use between exactly two tasks
+    without locking: one task (the producer) adds elements to the front and the
+    other (the consumer) removes them from the rear. Each side only writes its
+    own index, and the indices are atomic so that an element is fully written
+    before the other side can see it.
+
+    Elements are written and read in place rather than copied, which suits large
+    elements such as serialised batches of reports. The producer calls reserve(),
+    fills in the element, then calls push(). The consumer calls peek(), uses the
+    element, then calls pop().
+ */
+
+#include <atomic>
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+template <typename T, int N>
+struct spsc_queue_t
+{
+private:
+    /*
+        The elements of the queue. One element is kept free to tell a full queue
+        apart from an empty one.
+     */
+    T elements[N + 1];
+
+    /*
+        Points to the front of the queue (the index that the next element to be
+        pushed will occupy). Only written by the producer.
+     */
+    std::atomic<int> front;
+
+    /*
+        Points to the rear of the queue (the index that holds the oldest
+        element). Only written by the consumer.
+     */
+    std::atomic<int> rear;
+
+public:
+    spsc_queue_t() : front(0), rear(0) { }
+
+    /*
+        Empties the queue. Must only be called when neither task is using it.
+     */
+    void clear()
+    {
+        front.store(0);
+        rear.store(0);
+    }
+
+    /*
+        Returns the element that the next push will add, or NULL if the queue is
+        full. Producer only.
+     */
+    T* reserve()
+    {
+        int current = front.load(std::memory_order_relaxed);
+        if ((current + 1) % (N + 1) == rear.load(std::memory_order_acquire))
+            return NULL;
+        return &elements[current];
+    }
+
+    /*
+        Adds the element returned by reserve() to the front of the queue.
+        Producer only.
+     */
+    void push()
+    {
+        int current = front.load(std::memory_order_relaxed);
+        front.store((current + 1) % (N + 1), std::memory_order_release);
+    }
+
+    /*
+        Returns the element at the rear of the queue, or NULL if the queue is
+        empty. Consumer only.
+     */
+    T* peek()
+    {
+        int current = rear.load(std::memory_order_relaxed);
+        if (current == front.load(std::memory_order_acquire)) return NULL;
+        return &elements[current];
+    }
+
+    /*
+        Removes the element at the rear of the queue. Consumer only.
+     */
+    void pop()
+    {
+        int current = rear.load(std::memory_order_relaxed);
+        rear.store((current + 1) % (N + 1), std::memory_order_release);
+    }
+};
+
+#endif
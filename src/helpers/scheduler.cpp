@@ -0,0 +1,126 @@
+/*
+    Decides whether to transmit at a wake. The rules, in order of precedence:
+
+    - After a failed connection attempt, no further attempts are made until a
+    backoff period has passed. The period doubles with each consecutive failure
+    up to SCHEDULE_BACKOFF_MAX, and is reset by a successful connection
+    - If reports have been moved into flash memory and the last connection
+    succeeded, transmit at every wake until the backlog is gone
+    - If the report buffer is more than SCHEDULE_FLUSH_PERCENT full, transmit
+    before it overflows into flash memory
+    - Otherwise transmit once the batch size is reached. The batch size is
+    doubled when the battery is low and again when recent connections have been
+    slow, so that the cost of each connection is spread over more reports
+ */
+
+#include "scheduler.h"
+
+
+/*
+    Clears the history, e.g. at the start of a new session.
+
+    - history: the history to clear
+ */
+void schedule_reset(schedule_history_t* history)
+{
+    for (int i = 0; i < SCHEDULE_HISTORY_LEN; i++)
+        history->connect_times[i] = 0;
+
+    history->connect_index = 0;
+    history->connect_count = 0;
+    history->failure_streak = 0;
+    history->retry_time = 0;
+}
+
+/*
+    Returns the reason for transmitting or not transmitting at a wake (see
+    schedule_should_transmit).
+
+    - history: the history of connection attempts
+    - input: the state of the node at this wake
+ */
+ScheduleReason schedule_decide(
+    const schedule_history_t& history, const schedule_input_t& input)
+{
+    if (input.pending == 0) return ScheduleReason::BelowThreshold;
+    if (history.failure_streak > 0 && input.time < history.retry_time)
+        return ScheduleReason::BackingOff;
+
+    if (input.pending > input.buffered && history.failure_streak == 0)
+        return ScheduleReason::Drain;
+
+    int flush_count = input.buffer_capacity * SCHEDULE_FLUSH_PERCENT / 100;
+    if (input.buffered >= flush_count) return ScheduleReason::Flush;
+
+    int threshold = input.batch_size;
+    if (input.batv != -99 && input.batv < SCHEDULE_LOW_BATTERY) threshold *= 2;
+    if (schedule_mean_connect(history) > SCHEDULE_SLOW_CONNECT) threshold *= 2;
+    if (threshold > flush_count) threshold = flush_count;
+
+    return input.pending >= threshold ?
+        ScheduleReason::BatchReady : ScheduleReason::BelowThreshold;
+}
+
+/*
+    Returns a boolean indicating whether a reason returned by schedule_decide
+    means the reports should be transmitted.
+
+    - reason: the reason returned by schedule_decide
+ */
+bool schedule_should_transmit(ScheduleReason reason)
+{
+    return reason == ScheduleReason::BatchReady ||
+        reason == ScheduleReason::Flush || reason == ScheduleReason::Drain;
+}
+
+/*
+    Adds the outcome of a connection attempt to the history.
+
+    - history: the history of connection attempts
+    - time: the time of the attempt in seconds since 2000-01-01
+    - success: whether the connection was made
+    - duration: the number of milliseconds taken to connect or fail
+ */
+void schedule_record(
+    schedule_history_t* history, uint32_t time, bool success, uint32_t duration)
+{
+    if (success)
+    {
+        history->connect_times[history->connect_index] = duration;
+        history->connect_index =
+            (history->connect_index + 1) % SCHEDULE_HISTORY_LEN;
+        if (history->connect_count < SCHEDULE_HISTORY_LEN)
+            history->connect_count++;
+
+        history->failure_streak = 0;
+        history->retry_time = 0;
+    }
+    else
+    {
+        if (history->failure_streak < UINT8_MAX) history->failure_streak++;
+
+        uint32_t backoff = SCHEDULE_BACKOFF_BASE;
+        for (int i = 1; i < history->failure_streak &&
+            backoff < SCHEDULE_BACKOFF_MAX; i++)
+        { backoff *= 2; }
+
+        if (backoff > SCHEDULE_BACKOFF_MAX) backoff = SCHEDULE_BACKOFF_MAX;
+        history->retry_time = time + backoff;
+    }
+}
+
+/*
+    Returns the mean number of milliseconds taken by recent successful
+    connections, or 0 if there are none.
+
+    - history: the history of connection attempts
+ */
+uint32_t schedule_mean_connect(const schedule_history_t& history)
+{
+    if (history.connect_count == 0) return 0;
+
+    uint32_t total = 0;
+    for (int i = 0; i < history.connect_count; i++)
+        total += history.connect_times[i];
+    return total / history.connect_count;
+}
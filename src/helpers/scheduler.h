@@ -0,0 +1,65 @@
+/*
+    Decides at each wake whether the reports should be transmitted, based on a
+    history of recent connection attempts kept in sleep memory. See scheduler.cpp
+    for the rules.
+
+    This has no dependencies on the device so that it can be built and run on
+    the host (see tools/scheduler_sim.cpp).
+ */
+
+#include <stdint.h>
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#define SCHEDULE_HISTORY_LEN 8 // Number of recent connection times to remember
+#define SCHEDULE_SLOW_CONNECT 6000 // Mean connection time in milliseconds above
+// which the link is considered expensive
+#define SCHEDULE_LOW_BATTERY 3.5 // Battery voltage below which to transmit less
+// often
+#define SCHEDULE_FLUSH_PERCENT 90 // Percentage of the report buffer that can fill
+// before transmitting regardless of the batch size
+#define SCHEDULE_BACKOFF_BASE 120 // Number of seconds to wait after the first
+// failed connection attempt (doubles with each further failure)
+#define SCHEDULE_BACKOFF_MAX 3600 // Maximum number of seconds to wait between
+// connection attempts
+
+
+enum ScheduleReason
+{
+    BelowThreshold, // Not enough reports to be worth connecting
+    BackingOff, // Waiting after repeated failed connection attempts
+    BatchReady, // Enough reports to fill the adjusted batch size
+    Flush, // The report buffer is close to full
+    Drain // Reports are held in flash memory and the link is healthy
+};
+
+// The state of the node at a wake, as seen by the scheduler
+struct schedule_input_t
+{
+    uint32_t time; // Seconds since 2000-01-01
+    int pending; // Number of reports waiting to be transmitted
+    int buffered; // Number of those reports held in the report buffer
+    int buffer_capacity; // Maximum number of reports the report buffer can hold
+    int batch_size; // Batch size requested by the session
+    float batv; // Battery voltage, or -99 if unknown
+};
+
+// History of connection attempts, kept in sleep memory between wakes
+struct schedule_history_t
+{
+    uint32_t connect_times[SCHEDULE_HISTORY_LEN]; // Milliseconds, oldest overwritten
+    uint8_t connect_index;
+    uint8_t connect_count;
+    uint8_t failure_streak;
+    uint32_t retry_time; // No connection attempts before this time
+};
+
+
+void schedule_reset(schedule_history_t*);
+ScheduleReason schedule_decide(const schedule_history_t&, const schedule_input_t&);
+bool schedule_should_transmit(ScheduleReason);
+void schedule_record(schedule_history_t*, uint32_t, bool, uint32_t);
+uint32_t schedule_mean_connect(const schedule_history_t&);
+
+#endif
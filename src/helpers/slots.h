@@ -0,0 +1,26 @@
+/*
+    Spreads the connections of a fleet of nodes across the report interval, by
+    giving each node a transmit slot that starts a fixed time after each interval
+    boundary. See slots.cpp.
+
+    This has no dependencies on the device so that it can be built and run on
+    the host (see tools/slot_sim.cpp).
+ */
+
+#include <stdint.h>
+
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#define SLOT_LENGTH 1 // Number of seconds between the starts of slots when reports
+// are single samples
+#define SLOT_GUARD 20 // Number of seconds at the end of each interval in which no
+// slot starts, so that transmission can finish before the next report
+#define SLOT_FROM_KEY 0xFFFF // Session slot that means the slot is derived from the
+// node's key (see slot_key())
+
+
+uint32_t slot_key(const char*);
+int slot_count(uint32_t, uint32_t);
+uint32_t slot_offset(uint32_t, uint16_t, uint32_t, uint32_t);
+#endif
@@ -0,0 +1,348 @@
+/*
+    An append-only log of reports in flash memory. The flash memory is divided
+    into sectors that are used in turn, so that erases are spread evenly across
+    it. When the log is full, the sector holding the oldest reports is erased and
+    reused.
+
+    Each sector starts with a 16 byte header: the SPOOL_MAGIC value (uint32), a
+    sequence number that increases each time a sector is started (uint32), and
+    the sequence number of the oldest sector whose records are still part of the
+    log (uint32), followed by 4 bytes of padding. Clearing the log starts a new
+    sector that leaves all earlier sectors out, so that nothing has to be written
+    to the records being removed. The rest of the sector holds 32 byte records:
+
+    - state (uint8, see SPOOL_RECORD_ values), battery voltage (uint8), air
+    temperature (int16), relative humidity (int16), session ID (uint16), time in
+    seconds since 2000-01-01 (uint32), number of samples (uint8), minimum,
+    maximum and standard deviation of the air temperature then of the relative
+    humidity (int16 each), number of reports suppressed before it (uint8),
+    CRC-32 of the preceding 25 bytes excluding the state (uint32), 2 bytes of
+    padding
+
+    Values are little-endian and use the same stored form as the report buffer.
+    Records are marked as consumed once they are removed, by clearing the bits
+    of the state byte (which does not need an erase). Consecutive records are
+    marked in one write, which leaves the rest of each record as it is by
+    writing all bits set.
+ */
+
+#include <string.h>
+
+#include "spool.h"
+
+
+/*
+    Recovers the positions of the head and tail of the log by scanning the flash
+    memory, if this has not already been done since power on. Returns a boolean
+    indicating success or failure.
+
+    - flash: the flash memory holding the log
+ */
+bool spool_t::begin(const spool_flash_t& flash)
+{
+    if (ready) return true;
+
+    sectors = flash.size / SPOOL_SECTOR_SIZE;
+    if (sectors < 2) return false;
+
+    // The sector with the highest sequence number is the one being written to,
+    // and says which sectors are still part of the log
+    bool found = false;
+    uint32_t header[3];
+    for (int i = 0; i < sectors; i++)
+    {
+        if (!flash.read(i * SPOOL_SECTOR_SIZE, header, sizeof(header)))
+            return false;
+
+        if (header[0] == SPOOL_MAGIC &&
+            (!found || header[1] > head_sequence))
+        {
+            head_sector = i;
+            head_sequence = header[1];
+            start_sequence = header[2];
+            found = true;
+        }
+    }
+
+    head_record = SPOOL_RECORDS_PER_SECTOR;
+    tail_sector = head_sector;
+    tail_record = SPOOL_RECORDS_PER_SECTOR;
+    records = 0;
+
+    if (found)
+    {
+        // Walk the sectors from the oldest to the newest, looking for the oldest
+        // report and the first free record
+        bool tail_found = false;
+        for (int i = 1; i <= sectors; i++)
+        {
+            int sector = (head_sector + i) % sectors;
+            if (!flash.read(sector * SPOOL_SECTOR_SIZE, header, sizeof(header)))
+                return false;
+            if (header[0] != SPOOL_MAGIC || header[1] < start_sequence) continue;
+
+            for (int j = 0; j < SPOOL_RECORDS_PER_SECTOR; j++)
+            {
+                uint8_t state;
+                if (!flash.read(record_address(sector, j), &state, 1))
+                    return false;
+
+                if (state == SPOOL_RECORD_FREE)
+                {
+                    if (sector == head_sector)
+                    {
+                        head_record = j;
+                        break;
+                    } else continue;
+                }
+
+                if (!tail_found && state != SPOOL_RECORD_CONSUMED)
+                {
+                    tail_sector = sector;
+                    tail_record = j;
+                    tail_found = true;
+                }
+
+                if (tail_found) records++;
+            }
+        }
+
+        if (!tail_found)
+        {
+            tail_sector = head_sector;
+            tail_record = head_record;
+        }
+    }
+
+    ready = true;
+    return true;
+}
+
+/*
+    Removes all reports from the log, so that they are not recovered after a
+    power off either. Starts a new sector that leaves out all earlier ones,
+    rather than marking every record as consumed. Returns a boolean indicating
+    success or failure.
+
+    - flash: the flash memory holding the log
+ */
+bool spool_t::clear(const spool_flash_t& flash)
+{
+    if (!ready) return false;
+    if (records == 0) return true; // Already consumed in the flash memory
+
+    start_sequence = head_sequence + 1;
+    records = 0;
+    return advance_head(flash);
+}
+
+/*
+    Returns the number of reports in the log (including any that turn out to be
+    corrupt when read).
+ */
+int spool_t::count()
+{
+    return ready ? records : 0;
+}
+
+/*
+    Appends a number of reports to the log, writing as many as possible at once.
+    Drops the oldest reports if the log is full. Returns a boolean indicating
+    success or failure.
+
+    - flash: the flash memory holding the log
+    - reports: the reports to append
+    - count: the number of reports to append
+    - session_id: the ID of the session that the reports belong to
+ */
+bool spool_t::append(const spool_flash_t& flash, const report_t* reports,
+    int count, uint16_t session_id)
+{
+    if (!ready) return false;
+
+    uint8_t data[16 * SPOOL_RECORD_SIZE];
+    int appended = 0;
+
+    while (appended < count)
+    {
+        if (head_record == SPOOL_RECORDS_PER_SECTOR && !advance_head(flash))
+            return false;
+
+        // Write as many records as fit in the data buffer and the current sector
+        int chunk = count - appended;
+        if (chunk > SPOOL_RECORDS_PER_SECTOR - head_record)
+            chunk = SPOOL_RECORDS_PER_SECTOR - head_record;
+        if (chunk > (int)(sizeof(data) / SPOOL_RECORD_SIZE))
+            chunk = sizeof(data) / SPOOL_RECORD_SIZE;
+
+        for (int i = 0; i < chunk; i++)
+        {
+            const report_t& report = reports[appended + i];
+            uint8_t* record = data + i * SPOOL_RECORD_SIZE;
+
+            int16_t airt = pack_value(report.airt);
+            int16_t relh = pack_value(report.relh);
+
+            packed_stats_t airt_stats = pack_stats(report.airt_stats);
+            packed_stats_t relh_stats = pack_stats(report.relh_stats);
+
+            record[0] = SPOOL_RECORD_WRITTEN;
+            record[1] = pack_batv(report.batv);
+            memcpy(record + 2, &airt, 2);
+            memcpy(record + 4, &relh, 2);
+            memcpy(record + 6, &session_id, 2);
+            memcpy(record + 8, &report.time, 4);
+            record[12] = report.samples;
+            memcpy(record + 13, &airt_stats, 6);
+            memcpy(record + 19, &relh_stats, 6);
+            record[25] = report.suppressed;
+
+            uint32_t crc = crc32(record + 1, 25);
+            memcpy(record + 26, &crc, 4);
+            memset(record + 30, 0xFF, 2);
+        }
+
+        if (!flash.write(record_address(head_sector, head_record), data,
+            chunk * SPOOL_RECORD_SIZE)) return false;
+
+        head_record += chunk;
+        records += chunk;
+        appended += chunk;
+    }
+
+    return true;
+}
+
+/*
+    Reads a report from the log. Returns a boolean indicating success or failure,
+    and fails if the record is corrupt.
+
+    - flash: the flash memory holding the log
+    - position: the position of the report, counted from the oldest (position 0)
+    - report_out: will be set to the report
+    - session_id_out: will be set to the ID of the session the report belongs to
+ */
+bool spool_t::peek(const spool_flash_t& flash, int position, report_t* report_out,
+    uint16_t* session_id_out)
+{
+    if (!ready || position >= records) return false;
+
+    // Records are contiguous from the tail onwards, apart from sector headers
+    int index = tail_record + position;
+    int sector = (tail_sector + index / SPOOL_RECORDS_PER_SECTOR) % sectors;
+
+    uint8_t record[SPOOL_RECORD_SIZE];
+    if (!flash.read(record_address(sector, index % SPOOL_RECORDS_PER_SECTOR),
+        record, SPOOL_RECORD_SIZE)) return false;
+
+    uint32_t crc;
+    memcpy(&crc, record + 26, 4);
+    if (record[0] != SPOOL_RECORD_WRITTEN || crc != crc32(record + 1, 25))
+        return false;
+
+    int16_t airt, relh;
+    memcpy(&airt, record + 2, 2);
+    memcpy(&relh, record + 4, 2);
+    memcpy(session_id_out, record + 6, 2);
+    memcpy(&report_out->time, record + 8, 4);
+
+    report_out->airt = unpack_value(airt);
+    report_out->relh = unpack_value(relh);
+    report_out->batv = unpack_batv(record[1]);
+    report_out->samples = record[12];
+
+    packed_stats_t airt_stats, relh_stats;
+    memcpy(&airt_stats, record + 13, 6);
+    memcpy(&relh_stats, record + 19, 6);
+    report_out->airt_stats = unpack_stats(airt_stats);
+    report_out->relh_stats = unpack_stats(relh_stats);
+    report_out->suppressed = record[25];
+    return true;
+}
+
+/*
+    Removes a number of the oldest reports from the log, marking their records as
+    consumed, as many at once as possible.
+
+    - flash: the flash memory holding the log
+    - count: the number of reports to remove
+ */
+void spool_t::discard(const spool_flash_t& flash, int count)
+{
+    if (!ready) return;
+    if (count > records) count = records;
+
+    uint8_t data[16 * SPOOL_RECORD_SIZE];
+    while (count > 0)
+    {
+        // Mark as many records as fit in the data buffer and the tail's sector
+        int chunk = count;
+        if (chunk > SPOOL_RECORDS_PER_SECTOR - tail_record)
+            chunk = SPOOL_RECORDS_PER_SECTOR - tail_record;
+        if (chunk > (int)(sizeof(data) / SPOOL_RECORD_SIZE))
+            chunk = sizeof(data) / SPOOL_RECORD_SIZE;
+
+        memset(data, 0xFF, chunk * SPOOL_RECORD_SIZE);
+        for (int i = 0; i < chunk; i++)
+            data[i * SPOOL_RECORD_SIZE] = SPOOL_RECORD_CONSUMED;
+
+        flash.write(record_address(tail_sector, tail_record), data,
+            chunk * SPOOL_RECORD_SIZE);
+        advance_tail(chunk);
+        count -= chunk;
+    }
+}
+
+
+/*
+    Returns the address of a record in the flash memory.
+ */
+uint32_t spool_t::record_address(int sector, int record)
+{
+    return sector * SPOOL_SECTOR_SIZE + SPOOL_HEADER_SIZE +
+        record * SPOOL_RECORD_SIZE;
+}
+
+/*
+    Moves the head into the next sector, erasing it and dropping any reports that
+    it still holds. Returns a boolean indicating success or failure.
+ */
+bool spool_t::advance_head(const spool_flash_t& flash)
+{
+    int next_sector = (head_sector + 1) % sectors;
+
+    // The log is full, so drop the reports in the oldest sector
+    if (records > 0 && tail_sector == next_sector)
+        advance_tail(SPOOL_RECORDS_PER_SECTOR - tail_record);
+
+    if (!flash.erase_sector(next_sector * SPOOL_SECTOR_SIZE)) return false;
+
+    uint32_t header[3] = { SPOOL_MAGIC, head_sequence + 1, start_sequence };
+    if (!flash.write(next_sector * SPOOL_SECTOR_SIZE, header, sizeof(header)))
+        return false;
+
+    head_sector = next_sector;
+    head_record = 0;
+    head_sequence++;
+
+    if (records == 0)
+    {
+        tail_sector = head_sector;
+        tail_record = 0;
+    }
+
+    return true;
+}
+
+/*
+    Moves the tail forward past a number of records.
+ */
+void spool_t::advance_tail(int count)
+{
+    if (count > records) count = records;
+
+    int index = tail_record + count;
+    tail_sector = (tail_sector + index / SPOOL_RECORDS_PER_SECTOR) % sectors;
+    tail_record = index % SPOOL_RECORDS_PER_SECTOR;
+    records -= count;
+}
\ No newline at end of file
@@ -0,0 +1,90 @@
+/*
+    An append-only log of reports in flash memory, used to hold reports that no
+    longer fit in the report buffer. See spool.cpp for the layout.
+
+    The flash memory is accessed through a spool_flash_t, so that the log can
+    run on any storage that behaves like NOR flash. This must be passed into any
+    functions that access the log.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "helpers.h"
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#define SPOOL_PARTITION_SUBTYPE 0x40 // Subtype of the flash partition for the log
+#define SPOOL_SECTOR_SIZE 4096 // Number of bytes in an erasable flash sector
+#define SPOOL_HEADER_SIZE 16 // Number of bytes in the header of a sector
+#define SPOOL_RECORD_SIZE 32 // Number of bytes in a record
+#define SPOOL_RECORDS_PER_SECTOR \
+    ((SPOOL_SECTOR_SIZE - SPOOL_HEADER_SIZE) / SPOOL_RECORD_SIZE)
+#define SPOOL_MAGIC 0x344C5053 // Marks a sector as belonging to the log ("SPL4",
+// changed whenever the layout changes so that older sectors are not read)
+#define SPOOL_RECORD_FREE 0xFF // State of a record that has not been written
+#define SPOOL_RECORD_WRITTEN 0xFE // State of a record that holds a report
+#define SPOOL_RECORD_CONSUMED 0x00 // State of a record that has been removed
+
+
+// Functions for accessing the flash memory that holds the log
+struct spool_flash_t
+{
+    bool (*read)(uint32_t address, void* data, size_t length);
+    bool (*write)(uint32_t address, const void* data, size_t length);
+    bool (*erase_sector)(uint32_t address);
+    uint32_t size;
+};
+
+struct spool_t
+{
+private:
+    /*
+        Whether the positions below have been recovered from the flash memory.
+     */
+    bool ready = false;
+
+    /*
+        The number of sectors in the flash memory.
+     */
+    int sectors = 0;
+
+    /*
+        The sector and record that the next record to be appended will occupy,
+        and the sequence number of that sector.
+     */
+    int head_sector = 0;
+    int head_record = SPOOL_RECORDS_PER_SECTOR;
+    uint32_t head_sequence = 0;
+
+    /*
+        The sequence number of the oldest sector whose records are still part of
+        the log (earlier sectors were cleared).
+     */
+    uint32_t start_sequence = 0;
+
+    /*
+        The sector and record that hold the oldest report in the log.
+     */
+    int tail_sector = 0;
+    int tail_record = 0;
+
+    /*
+        The number of records between the tail and the head.
+     */
+    int records = 0;
+
+    uint32_t record_address(int, int);
+    bool advance_head(const spool_flash_t&);
+    void advance_tail(int);
+
+public:
+    bool begin(const spool_flash_t&);
+    bool clear(const spool_flash_t&);
+    int count();
+    bool append(const spool_flash_t&, const report_t*, int, uint16_t);
+    bool peek(const spool_flash_t&, int, report_t*, uint16_t*);
+    void discard(const spool_flash_t&, int);
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+/*
+    Streaming statistics of a series of samples. Samples are added one at a time
+    into integer accumulators that take a few bytes of sleep memory, and can be
+    added by the wake stub, which cannot use floating point. The mean and spread
+    are worked out from the accumulators when the summary is complete. Only
+    standard C++ is used so that this can be built into other programs.
+ */
+
+#include <math.h>
+
+#include "summary.h"
+
+
+/*
+    Empties a summary.
+
+    - summary: the summary to empty
+ */
+void SUMMARY_ATTR summary_reset(summary_t* summary)
+{
+    summary->count = 0;
+    summary->origin = 0;
+    summary->minimum = 0;
+    summary->maximum = 0;
+    summary->sum = 0;
+    summary->sum_squares = 0;
+}
+
+/*
+    Adds a sample to a summary. Samples beyond SUMMARY_MAX_SAMPLES are ignored.
+
+    - summary: the summary to add to
+    - value: the sample in hundredths
+ */
+void SUMMARY_ATTR summary_add(summary_t* summary, int16_t value)
+{
+    if (summary->count >= SUMMARY_MAX_SAMPLES) return;
+
+    if (summary->count == 0)
+    {
+        summary->origin = value;
+        summary->minimum = value;
+        summary->maximum = value;
+    }
+    else
+    {
+        if (value < summary->minimum) summary->minimum = value;
+        if (value > summary->maximum) summary->maximum = value;
+    }
+
+    int32_t offset = (int32_t)value - summary->origin;
+    uint32_t magnitude = offset < 0 ? -offset : offset;
+    uint32_t square = magnitude * magnitude;
+    summary->sum += offset;
+    summary->sum_squares = square > UINT32_MAX - summary->sum_squares ?
+        UINT32_MAX : summary->sum_squares + square;
+    summary->count++;
+}
+
+/*
+    Returns the mean of the samples in a summary, or -99 if it has none.
+
+    - summary: the summary
+ */
+float summary_mean(const summary_t& summary)
+{
+    if (summary.count == 0) return -99;
+    return (summary.origin + (double)summary.sum / summary.count) / 100;
+}
+
+/*
+    Returns the minimum, maximum and standard deviation (population) of the
+    samples in a summary. Values that cannot be worked out are -99.
+
+    - summary: the summary
+ */
+value_stats_t summary_stats(const summary_t& summary)
+{
+    value_stats_t stats = { -99, -99, -99 };
+    if (summary.count == 0) return stats;
+
+    stats.minimum = summary.minimum / 100.0f;
+    stats.maximum = summary.maximum / 100.0f;
+
+    if (summary.sum_squares != UINT32_MAX)
+    {
+        double mean = (double)summary.sum / summary.count;
+        double variance = (double)summary.sum_squares / summary.count - mean * mean;
+        stats.deviation = sqrt(variance > 0 ? variance : 0) / 100;
+    }
+
+    return stats;
+}
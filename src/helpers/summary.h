@@ -0,0 +1,45 @@
+/*
+    Streaming statistics of a series of samples, used to summarise the samples
+    taken over a report interval. See summary.cpp.
+ */
+
+#include <stdint.h>
+
+#include "helpers.h"
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+// summary_reset() and summary_add() are called by the wake stub, so must be in
+// RTC memory on the device
+#ifdef ESP_PLATFORM
+#include <esp_attr.h>
+#define SUMMARY_ATTR RTC_IRAM_ATTR
+#else
+#define SUMMARY_ATTR
+#endif
+
+#define SUMMARY_MAX_SAMPLES 255 // Maximum number of samples in a summary
+
+
+/*
+    Integer accumulators for a series of samples in hundredths (the same form as
+    pack_value()). Sums are kept relative to the first sample so that they stay
+    small, and the sum of squares saturates rather than overflowing.
+ */
+struct summary_t
+{
+    uint8_t count;
+    int16_t origin;
+    int16_t minimum;
+    int16_t maximum;
+    int32_t sum;
+    uint32_t sum_squares;
+};
+
+
+void SUMMARY_ATTR summary_reset(summary_t*);
+void SUMMARY_ATTR summary_add(summary_t*, int16_t);
+float summary_mean(const summary_t&);
+value_stats_t summary_stats(const summary_t&);
+#endif
@@ -0,0 +1,215 @@
+/*
+    Predicts when the RTC's seconds start on the local clock. The local clock
+    counts from the crystal while the device is awake, which is accurate, but
+    from the sleep timer while in light sleep, which can drift by a few percent
+    with temperature. The rules:
+
+    - Each wake starts from the second the RTC alarm woke the device in. The
+    local clock only starts partway through booting, so when that second started
+    on the local clock is learnt from the first second observed in each wake
+    (and until it is, is only known to TIMEBASE_BOOT_ERROR)
+    - The device wakes TIMEBASE_GUARD_ERRORS mean prediction errors (at least
+    TIMEBASE_MIN_GUARD, and allowing for TIMEBASE_MAX_DRIFT until the drift has
+    been measured) before the predicted start of the next second it needs, then
+    polls the RTC for the exact start. Each observed start anchors the next
+    prediction, so errors never accumulate from one sample to the next
+    - The time asleep between two exactly observed seconds gives the drift of the
+    sleep timer, which is smoothed with an exponentially weighted moving average
+    and kept between wakes. The gain grows with the time asleep (about 1/8 for
+    5 seconds, 1/2 for 30), as the polling resolution matters less over a longer
+    sleep and fewer measurements are made to follow a changing drift with. The
+    sleep before each second is corrected by the drift, which is what lets the
+    guard shrink to a few milliseconds
+    - If the device wakes after the second has already started, the prediction
+    error is doubled (up to TIMEBASE_MAX_ERROR) so that it wakes earlier next
+    time, and the drift is not measured
+ */
+
+#include "timebase.h"
+
+
+/*
+    Adds a prediction error to a mean error, falling quickly to a smaller error
+    but rising only slowly after a one-off.
+
+    - mean: the mean error in microseconds
+    - error: the prediction error in microseconds
+ */
+static void smooth_error(uint32_t* mean, uint32_t error)
+{
+    if (error < *mean) *mean = (*mean + error) / 2;
+    else *mean += (error - *mean) / 4;
+}
+
+/*
+    Forgets the drift and the prediction error, e.g. at the start of a new
+    session.
+
+    - timebase: the timebase to clear
+ */
+void timebase_reset(timebase_t* timebase)
+{
+    timebase->drift = 0;
+    timebase->drift_samples = 0;
+    timebase->error = TIMEBASE_BOOT_ERROR;
+    timebase->boot_offset = 0;
+    timebase->boot_error = TIMEBASE_BOOT_ERROR;
+    timebase->boot_samples = 0;
+    timebase_begin(timebase, 0);
+}
+
+/*
+    Anchors the timebase to the second the device woke in, keeping what was
+    learnt in earlier wakes. Should be called early in each wake.
+
+    - timebase: the timebase
+    - second: the RTC time the device woke at (the alarm time)
+ */
+void timebase_begin(timebase_t* timebase, uint32_t second)
+{
+    timebase->edge_local = timebase->boot_offset;
+    timebase->edge_second = second;
+    timebase->edge_exact = false;
+    timebase->edge_boot = true;
+    timebase->slept = 0;
+    timebase->predicted_second = 0;
+    if (timebase->error < timebase->boot_error)
+        timebase->error = timebase->boot_error;
+}
+
+/*
+    Returns the local time to wake up at to catch the start of an RTC second,
+    which is the predicted start less the guard (or now, if that has passed).
+
+    - timebase: the timebase
+    - second: the RTC second to catch the start of
+    - now: the local time
+ */
+int64_t timebase_wake_time(timebase_t* timebase, uint32_t second, int64_t now)
+{
+    // The time asleep since the last second was counted by the sleep timer, so
+    // less than it appears if the timer runs fast
+    int64_t drift = timebase->drift;
+    int64_t slept = timebase->slept * 1000000000LL / (1000000000LL + drift);
+    int64_t elapsed = now - timebase->edge_local - timebase->slept + slept;
+    int64_t remaining = (int64_t)(second - timebase->edge_second) * 1000000 -
+        elapsed;
+
+    // Until the drift has been measured, the sleep timer could be off by as
+    // much as TIMEBASE_MAX_DRIFT
+    int64_t guard = timebase_guard(*timebase);
+    if (timebase->drift_samples == 0 && remaining > 0)
+        guard += remaining * TIMEBASE_MAX_DRIFT / 1000000000LL;
+
+    int64_t sleep = remaining > guard ? remaining - guard : 0;
+    int64_t awake = remaining - sleep;
+
+    // Only the sleep is counted by the sleep timer, the guard is spent awake
+    int64_t sleep_local = sleep + sleep * drift / 1000000000LL;
+    timebase->predicted_local = now + sleep_local + awake;
+    timebase->predicted_second = second;
+    return now + sleep_local;
+}
+
+/*
+    Adds time spent in light sleep since the last second started.
+
+    - timebase: the timebase
+    - duration: the number of microseconds slept (as counted by the local clock)
+ */
+void timebase_slept(timebase_t* timebase, int64_t duration)
+{
+    timebase->slept += duration;
+}
+
+/*
+    Records the start of an RTC second, which the next predictions are made from.
+
+    - timebase: the timebase
+    - second: the RTC time of the second
+    - local: the local time it was seen to start at
+    - exact: whether the start was observed (by polling the RTC from before it),
+    rather than only found to have passed
+ */
+void timebase_edge(timebase_t* timebase, uint32_t second, int64_t local,
+    bool exact)
+{
+    if (!exact)
+    {
+        uint32_t error = timebase->error * 2;
+        timebase->error = error < TIMEBASE_MAX_ERROR ? error : TIMEBASE_MAX_ERROR;
+    }
+    else if (timebase->predicted_second == second)
+    {
+        int64_t offset = local - timebase->predicted_local;
+        if (offset > TIMEBASE_MAX_ERROR) offset = TIMEBASE_MAX_ERROR;
+        if (offset < -TIMEBASE_MAX_ERROR) offset = -TIMEBASE_MAX_ERROR;
+        uint32_t error = offset < 0 ? -offset : offset;
+
+        // A prediction from the second the device woke in was off mostly by how
+        // far into booting the local clock started. It says nothing about the
+        // predictions over longer sleeps, so leaves their error as it is
+        if (timebase->edge_boot)
+        {
+            timebase->boot_offset += timebase->boot_samples == 0 ?
+                offset : offset / 4;
+            smooth_error(&timebase->boot_error, error);
+            if (timebase->boot_samples < UINT8_MAX) timebase->boot_samples++;
+        }
+        else smooth_error(&timebase->error, error);
+    }
+
+    // The drift of the sleep timer is measured over the time asleep between
+    // two exactly observed seconds (the time awake is counted accurately)
+    int64_t awake = local - timebase->edge_local - timebase->slept;
+    int64_t slept = (int64_t)(second - timebase->edge_second) * 1000000 - awake;
+    if (exact && timebase->edge_exact && slept >= TIMEBASE_MIN_SLEEP)
+    {
+        int64_t drift = (timebase->slept - slept) * 1000000000LL / slept;
+        if (drift > TIMEBASE_MAX_DRIFT) drift = TIMEBASE_MAX_DRIFT;
+        if (drift < -TIMEBASE_MAX_DRIFT) drift = -TIMEBASE_MAX_DRIFT;
+
+        if (timebase->drift_samples == 0) timebase->drift = drift;
+        else
+        {
+            timebase->drift += (drift - timebase->drift) * slept /
+                (slept + TIMEBASE_DRIFT_WINDOW);
+        }
+        if (timebase->drift_samples < UINT8_MAX) timebase->drift_samples++;
+    }
+
+    timebase->edge_local = local;
+    timebase->edge_second = second;
+    timebase->edge_exact = exact;
+    timebase->edge_boot = false;
+    timebase->slept = 0;
+    timebase->predicted_second = 0;
+}
+
+/*
+    Returns the number of microseconds to light sleep for (as counted by the
+    sleep timer) to be sure of sleeping for at least a duration, e.g. while a
+    measurement finishes. The local clock then reads later than it should by
+    the drift, which the next second observed corrects.
+
+    - timebase: the timebase
+    - duration: the number of microseconds
+ */
+int64_t timebase_sleep_time(const timebase_t& timebase, int64_t duration)
+{
+    int64_t drift = timebase.drift_samples == 0 ?
+        TIMEBASE_MAX_DRIFT : timebase.drift;
+    return duration + duration * drift / 1000000000LL;
+}
+
+/*
+    Returns the number of microseconds to wake before the predicted start of a
+    second.
+
+    - timebase: the timebase
+ */
+uint32_t timebase_guard(const timebase_t& timebase)
+{
+    uint32_t guard = TIMEBASE_GUARD_ERRORS * timebase.error;
+    return guard > TIMEBASE_MIN_GUARD ? guard : TIMEBASE_MIN_GUARD;
+}
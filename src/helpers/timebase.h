@@ -0,0 +1,61 @@
+/*
+    Keeps the light sleep timer on the schedule of the RTC in high-frequency
+    mode, by learning how far the timer drifts from the RTC (kept in sleep
+    memory) and waking shortly before each second that a sample is due at. See
+    timebase.cpp for the rules.
+
+    This has no dependencies on the device so that it can be built and run on
+    the host (see tools/timebase_sim.cpp).
+ */
+
+#include <stdint.h>
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#define TIMEBASE_BOOT_ERROR 50000 // Number of microseconds the start of the
+// second the device woke in is assumed to be known to, until it is learnt
+#define TIMEBASE_MAX_ERROR 500000 // Largest prediction error in microseconds to
+// allow for
+#define TIMEBASE_GUARD_ERRORS 4 // Number of mean prediction errors to wake before
+// a predicted second
+#define TIMEBASE_MIN_GUARD 2000 // Minimum number of microseconds to wake before a
+// predicted second
+#define TIMEBASE_MIN_SLEEP 1000000 // Minimum number of microseconds of sleep
+// between two seconds for the drift to be measured from them
+#define TIMEBASE_DRIFT_WINDOW 30000000 // Number of microseconds of sleep at which
+// a measurement of the drift counts for as much as the estimate so far
+#define TIMEBASE_MAX_DRIFT 50000000 // Largest drift in parts per billion that the
+// sleep timer is assumed to have
+
+
+// The relation between the local clock (microseconds since waking, which runs
+// from the sleep timer while in light sleep) and the RTC
+struct timebase_t
+{
+    int64_t edge_local; // Local time at which the last second started
+    uint32_t edge_second; // RTC time of that second
+    bool edge_exact; // Whether the start of that second was observed exactly
+    int64_t slept; // Microseconds of light sleep (local) since that second
+    int64_t predicted_local; // Local time the next second was predicted to start
+    uint32_t predicted_second; // RTC time of that second (0 if none)
+    bool edge_boot; // Whether that second is the one the device woke in
+    int32_t drift; // Parts per billion that the sleep timer runs fast by
+    uint8_t drift_samples; // Number of times the drift was measured (saturates)
+    uint32_t error; // Mean prediction error in microseconds
+    int32_t boot_offset; // Local time the second the device woke in started at
+    // (negative, as the local clock starts partway through booting)
+    uint32_t boot_error; // Mean error of boot_offset in microseconds
+    uint8_t boot_samples; // Number of times boot_offset was measured (saturates)
+};
+
+
+void timebase_reset(timebase_t*);
+void timebase_begin(timebase_t*, uint32_t);
+int64_t timebase_wake_time(timebase_t*, uint32_t, int64_t);
+void timebase_slept(timebase_t*, int64_t);
+void timebase_edge(timebase_t*, uint32_t, int64_t, bool);
+int64_t timebase_sleep_time(const timebase_t&, int64_t);
+uint32_t timebase_guard(const timebase_t&);
+
+#endif
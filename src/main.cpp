@@ -11,15 +11,53 @@
 #include "helpers/globals.h"
 #include "helpers/helpers.h"
 #include "helpers/buffer.h"
+#include "helpers/spool.h"
+#include "helpers/deadband.h"
+#include "helpers/slots.h"
+#include "helpers/protocol.h"
+#include "helpers/scheduler.h"
+#include "helpers/timebase.h"
 #include "serial.h"
+#include "storage.h"
 #include "transmit.h"
+#include "trace.h"
+#include "energy.h"
+#include "wake_stub.h"
 
 
 RTC_DATA_ATTR int boot_mode = 0;
 RTC_DATA_ATTR int session_check_count = 0;
 RTC_DATA_ATTR session_t session;
-RTC_DATA_ATTR report_buffer_t buffer;
-RTC_DATA_ATTR report_t reports[BUFFER_CAPACITY + 1];
+RTC_NOINIT_ATTR report_buffer_t buffer; // Not cleared by a reset (see
+// recover_buffer())
+RTC_NOINIT_ATTR uint8_t reports[BUFFER_MEMORY];
+RTC_NOINIT_ATTR uint32_t buffer_magic;
+RTC_NOINIT_ATTR uint16_t buffer_session_id; // Session the buffered reports
+// belong to
+RTC_NOINIT_ATTR uint32_t buffer_crc;
+RTC_DATA_ATTR spool_t spool;
+RTC_DATA_ATTR schedule_history_t schedule;
+RTC_DATA_ATTR deadband_t deadband;
+RTC_DATA_ATTR uint32_t transmit_time = 0; // Time to transmit at, or 0 if not
+// waiting to transmit
+RTC_DATA_ATTR bool slot_alarm = false; // Whether the next alarm is only for the
+// transmit slot
+RTC_DATA_ATTR timebase_t timebase;
+
+spool_flash_t spool_flash;
+bool spool_open = false;
+Adafruit_BME680 bme680;
+bool bme680_reading = false;
+report_t held_reports[HIGH_FREQUENCY_CAPACITY]; // Reports taken in this wake in
+// high-frequency mode that are yet to be stored
+int held_count = 0;
+int held_dropped = 0; // Reports dropped since the held reports were last stored
+uint32_t next_sample = 0; // Time the next report is due in high-frequency mode
+// (0 if not in it)
+uint32_t high_frequency_end = 0; // Time to stop taking reports at in
+// high-frequency mode
+uint32_t light_sleep_time = 0; // Number of microseconds spent in light sleep
+// in this wake
 
 
 /*
@@ -28,9 +66,22 @@ RTC_DATA_ATTR report_t reports[BUFFER_CAPACITY + 1];
  */
 void setup()
 {
+    uint32_t boot_time = trace_time();
     rtc.Begin();
+    uint32_t rtc_time = trace_time();
+
+    RtcDateTime wake_time = rtc.GetDateTime();
+    trace_wake(wake_time, boot_mode);
+    energy_begin(wake_time);
+    trace_record(TracePhase::Boot, 0, boot_time, TraceOutcome::Succeeded);
+    trace_record(TracePhase::RtcBegin, boot_time, rtc_time, TraceOutcome::Succeeded);
+
     if (boot_mode == 0) // Booted from power off
     {
+        // The report buffer survives a reset, so that its reports can still be
+        // dumped in serial mode, and transmitted if the session is unchanged
+        recover_buffer();
+
         uint8_t mac_temp[6];
         esp_efuse_mac_get_default(mac_temp);
 
@@ -38,13 +89,13 @@ void setup()
             mac_temp[2], mac_temp[3], mac_temp[4], mac_temp[5]);
 
         bool config_valid;
-        if (!load_configuration(&config_valid)) esp_deep_sleep_start();
+        if (!load_configuration(&config_valid)) go_to_sleep();
 
         // Permanently enter serial mode if received serial data
         try_serial_mode();
 
-        if (!config_valid) esp_deep_sleep_start();
-        if (!is_rtc_time_valid()) esp_deep_sleep_start();
+        if (!config_valid) go_to_sleep();
+        if (!is_rtc_time_valid()) go_to_sleep();
         rtc.SetSquareWavePin(DS3231SquareWavePin_ModeAlarmOne);
 
         RtcDateTime alarm_time = rtc.GetDateTime() + 60;
@@ -54,12 +105,12 @@ void setup()
         {
             boot_mode = 1;
             esp_sleep_enable_ext0_wakeup(RTC_SQUARE_WAVE_PIN, 0);
-            esp_deep_sleep_start();
+            go_to_sleep();
         } else set_first_alarm();
     }
     else if (boot_mode == 1) // Woken from sleep but has no session
     {
-        if (!is_rtc_time_valid()) esp_deep_sleep_start();
+        if (!is_rtc_time_valid()) go_to_sleep();
 
         session_check_count++;
         RtcDateTime alarm_time = rtc.GetDateTime() + 60;
@@ -69,7 +120,7 @@ void setup()
         {
             if (session_check_count < SESSION_CHECKS)
                 esp_sleep_enable_ext0_wakeup(RTC_SQUARE_WAVE_PIN, 0);
-            esp_deep_sleep_start();
+            go_to_sleep();
         } else set_first_alarm();
     }
     else reporting_routine(); // Woken from sleep and must report
@@ -81,7 +132,7 @@ void setup()
  */
 void try_serial_mode()
 {
-    Serial.begin(9600);
+    Serial.begin(SERIAL_BAUD);
     bool serial_mode = true;
     delay(1000);
 
@@ -106,15 +157,31 @@ void try_serial_mode()
  */
 bool connect_and_get_session()
 {
-    if (!network_connect() || !logger_connect()) return false;
-    if (!logger_subscribe()) return false;
+    uint32_t start = trace_time();
+    bool success = network_connect();
+    trace_record(TracePhase::NetworkConnect, start, trace_time(),
+        success ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+    if (!success) return false;
+
+    start = trace_time();
+    success = logger_connect();
+    trace_record(TracePhase::LoggerConnect, start, trace_time(),
+        success ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+    if (!success) return false;
 
+    start = trace_time();
+    success = logger_subscribe();
+    trace_record(TracePhase::LoggerSubscribe, start, trace_time(),
+        success ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+    if (!success) return false;
+
+    start = trace_time();
     RequestResult session_status = logger_get_session(&session);
-    if (session_status == RequestResult::Fail ||
-        session_status == RequestResult::NoSession)
-    { return false; }
+    success = session_status == RequestResult::Success;
+    trace_record(TracePhase::GetSession, start, trace_time(),
+        success ? TraceOutcome::Succeeded : TraceOutcome::Failed);
 
-    return true;
+    return success;
 }
 
 /*
@@ -125,128 +192,903 @@ void set_first_alarm()
 {
     boot_mode = 2;
 
-    RtcDateTime first_alarm = rtc.GetDateTime();
-    first_alarm += (60 - first_alarm.Second()); // Move to start of next minute
-    first_alarm = round_up_multiple(first_alarm, session.interval * 60); // Round
-    // up to next multiple of the interval (e.g. a 5 minute interval rounds to
-    // the next minute ending in a 0 or 5)
-
-    // Advance to next interval if currently too close to first available interval
-    if (first_alarm - rtc.GetDateTime() <= ALARM_SET_THRESHOLD)
-        first_alarm += session.interval * 60;
+    // Reports kept from before power off or a reset are only transmitted if
+    // they belong to the session that was gotten
+    if (session.session_id != buffer_session_id)
+    {
+        int dropped = buffer.count();
+        buffer.discard_rear(dropped);
+        if (open_spool())
+        {
+            dropped += spool.count();
+            spool.clear(spool_flash);
+        }
+        trace_lost(dropped);
+    }
+    schedule_reset(&schedule);
+    stub_reset_summary();
+    deadband_reset(&deadband);
+    timebase_reset(&timebase);
+    transmit_time = 0;
+    slot_alarm = false;
 
-    set_rtc_alarm(first_alarm);
+    set_rtc_alarm(get_aligned_alarm());
     esp_sleep_enable_ext0_wakeup(RTC_SQUARE_WAVE_PIN, 0);
-    esp_deep_sleep_start();
+    go_to_sleep();
 }
 
 void loop() { }
 
+/*
+    Accounts for the energy used in this wake (see energy.cpp), then goes to
+    sleep.
+ */
+void go_to_sleep()
+{
+    energy_end(rtc.GetDateTime(), trace_time(), light_sleep_time,
+        network_radio_time(), logger_transmitted_bytes());
+    seal_buffer();
+    esp_deep_sleep_start();
+}
+
+/*
+    Marks the report buffer as complete, along with the ID of the session its
+    reports belong to, so that it can be recovered if the device is reset while
+    asleep (see recover_buffer()). Should be called just before going to sleep,
+    as any later change to the buffer breaks the seal.
+ */
+void seal_buffer()
+{
+    buffer_magic = BUFFER_MAGIC;
+    buffer_session_id = session.session_id;
+    buffer_crc = buffer_checksum();
+}
+
+/*
+    Checks the report buffer after the device was reset, which keeps it (unlike
+    the rest of sleep memory) if it was sealed and not changed since, in which
+    case the session ID is set to that of its reports until a session is gotten
+    (see set_first_alarm()). Otherwise the buffer is emptied, as it was never set
+    up or was changed after being sealed.
+ */
+void recover_buffer()
+{
+    if (buffer_magic == BUFFER_MAGIC && buffer_crc == buffer_checksum())
+    {
+        session.session_id = buffer_session_id;
+        return;
+    }
+
+    buffer = report_buffer_t();
+    buffer_magic = 0;
+    buffer_session_id = 0;
+}
+
+/*
+    Returns a checksum of the report buffer, its elements and the ID of the
+    session its reports belong to.
+ */
+uint32_t buffer_checksum()
+{
+    return crc32((const uint8_t*)&buffer, sizeof(buffer)) ^
+        crc32(reports, BUFFER_MEMORY) ^ buffer_session_id;
+}
+
 
 /*
-    Sets alarm to trigger the next report, generates a report, transmits all
-    reports in the buffer, then goes to sleep.
+    Sets alarm to trigger the next sample, generates a report if one is due,
+    transmits all reports in the buffer in this node's transmit slot, then goes
+    to sleep.
  */
 void reporting_routine()
 {
-    if (!is_rtc_time_valid()) esp_deep_sleep_start();
-    
-    // Set alarm to trigger the next report
+    if (!is_rtc_time_valid()) go_to_sleep();
+
+    // Add the reports taken by the wake stub since the last full boot
+    collect_stub_reports();
     RtcDateTime now = rtc.GetDateTime();
-    RtcDateTime next_alarm = now + (session.interval * 60);
+
+    // Woken between samples only to transmit in the slot
+    if (slot_alarm)
+    {
+        slot_alarm = false;
+        energy_add_slot_wake();
+        RtcDateTime next_alarm =
+            round_up_multiple(now + ALARM_SET_THRESHOLD, get_sample_period());
+        set_rtc_alarm(next_alarm);
+
+        network_begin();
+        transmit_start();
+        next_alarm = finish_transmission(now, next_alarm);
+        sleep_until(next_alarm, sample_battery_voltage());
+    }
+
+    // Reports more often than every minute are taken without going into deep
+    // sleep in between
+    if (session.report_period != 0) high_frequency_routine(now);
+
+    // Set alarm to trigger the next sample
+    RtcDateTime next_alarm = now + get_sample_period();
     set_rtc_alarm(next_alarm);
 
-    generate_report(now);
+    uint32_t measure_start = trace_time();
+    report_t report = begin_report(now);
+    bool slot_reached = transmit_time != 0 && (uint32_t)now >= transmit_time;
 
-    // Transmit all reports in the report buffer if there's a enough of them
-    if (buffer.count() >= session.batch_size && network_connect() && logger_connect()
-        && logger_subscribe())
+    // Wakes between reports only add a sample to the summary of the interval
+    // (the wake stub normally takes these), and transmit if the slot has come
+    if (!is_report_due(now))
     {
-        // Only transmit if there's enough time before the next alarm
-        while (!buffer.is_empty() && next_alarm - rtc.GetDateTime() >= logger_timeout
-            + ALARM_SET_THRESHOLD)
+        if (slot_reached)
         {
-            report_t report = buffer.peek_rear(reports);
-            char report_json[128] = { '\0' };
-            serialise_report(report_json, report);
+            network_begin();
+            transmit_start();
+        }
+        finish_report(&report, false);
+        trace_record(TracePhase::Measure, measure_start, trace_time(),
+            TraceOutcome::Succeeded);
 
-            RequestResult report_status = logger_transmit_report(report_json);
-            if (report_status != RequestResult::Fail)
-            {
-                buffer.pop_rear(reports);
+        if (slot_reached) next_alarm = finish_transmission(now, next_alarm);
+        sleep_until(next_alarm, report.batv);
+    }
+
+    // A suppressed report leaves nothing new to transmit, so if the session
+    // suppresses reports, the measurement is finished before deciding
+    bool suppressing = session.max_silence > 0;
+    if (suppressing) finish_report(&report, true);
 
-                // The active session for this sensor node has ended
-                if (report_status == RequestResult::NoSession)
-                    esp_deep_sleep_start();
-            } else break;
+    // Let the scheduler decide whether it is worth connecting in this interval
+    int unstored = suppressing ? 0 : 1;
+    schedule_input_t input = { (uint32_t)now, pending_count() + unstored,
+        buffer.count() + unstored, buffer.capacity(), session.batch_size,
+        report.batv };
+    bool transmit = slot_reached ||
+        schedule_should_transmit(schedule_decide(schedule, input));
+
+    // Wait for the slot if it is later in the interval (see slots.cpp)
+    if (transmit && !slot_reached)
+    {
+        uint32_t interval = session.interval * 60;
+        uint32_t slot = (uint32_t)now - (uint32_t)now % interval + get_slot_offset();
+        if (slot > (uint32_t)now)
+        {
+            transmit_time = slot;
+            transmit = false;
         }
     }
 
+    // Connect to the network on the other core while the sensor measurement
+    // finishes
+    if (transmit)
+    {
+        network_begin();
+        transmit_start();
+    }
+    if (!suppressing) finish_report(&report, true);
+    trace_record(TracePhase::Measure, measure_start, trace_time(),
+        report.airt != -99 ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+    energy_add_report(session.interval * 60, report.batv);
+
+    if (transmit) next_alarm = finish_transmission(now, next_alarm);
+    sleep_until(next_alarm, report.batv);
+}
+
+/*
+    Transmits the pending reports over the connection started by
+    transmit_start(), records the attempt for the scheduler and applies any
+    changes to the session sent along with the responses. Returns the time of
+    the next alarm, which moves onto the schedule of a new interval if the
+    interval changed.
+
+    - now: the time of the wake
+    - next_alarm: the time of the next alarm
+ */
+RtcDateTime finish_transmission(const RtcDateTime& now, RtcDateTime next_alarm)
+{
+    transmit_time = 0;
+    bool connected = transmit_reports(next_alarm);
+    schedule_record(&schedule, (uint32_t)now, connected, transmit_connect_time());
+    if (!connected) return next_alarm;
+
+    session_t updated_session = session;
+    if (!logger_get_session_update(&updated_session)) return next_alarm;
+
+    bool interval_changed =
+        updated_session.interval != session.interval ||
+        updated_session.sample_period != session.sample_period ||
+        updated_session.report_period != session.report_period;
+    bool session_changed = updated_session.session_id != session.session_id;
+
+    if (interval_changed || session_changed)
+    {
+        // A run of suppressed reports must not span a change of interval or
+        // session, so the latest report is stored after all
+        flush_held_reports();
+        report_t report;
+        if (deadband_release(&deadband, &report))
+        {
+            make_room(report);
+            buffer.push_front(reports, report);
+        }
+        deadband_reset(&deadband);
+    }
+
+    // The report buffer only holds reports of the current session, so its
+    // reports are moved into the spool under the ID of their own session
+    if (session_changed) spill_session_reports();
+
+    session = updated_session;
+    if (!interval_changed) return next_alarm;
+
+    next_alarm = get_aligned_alarm();
+    set_rtc_alarm(next_alarm);
+    return next_alarm;
+}
+
+/*
+    Goes to sleep until the next alarm, or until the transmit slot if it comes
+    first, in which case the wake stub is left disarmed so that the device boots
+    fully at the slot.
+
+    - next_alarm: the time of the next alarm (must already be set)
+    - batv: the latest battery voltage
+ */
+void sleep_until(const RtcDateTime& next_alarm, float batv)
+{
+    if (transmit_time != 0 && transmit_time < (uint32_t)next_alarm)
+    {
+        set_rtc_alarm(RtcDateTime(transmit_time));
+        slot_alarm = true;
+    }
+    else arm_wake_stub(next_alarm, batv);
+
+    trace_record(TracePhase::Awake, 0, trace_time(), TraceOutcome::Succeeded);
     esp_sleep_enable_ext0_wakeup(RTC_SQUARE_WAVE_PIN, 0);
-    esp_deep_sleep_start();
+    go_to_sleep();
+}
+
+/*
+    Takes a report every report period until the end of the interval, light
+    sleeping in between on a timer that is kept on the schedule of the RTC (see
+    timebase.cpp) rather than going into deep sleep and rebooting for each one.
+    The reports are held in memory and stored in the report buffer in one go in
+    the transmit slot, where they are transmitted if the scheduler decides to,
+    and at the end of the interval. Then goes to sleep until the alarm at the
+    next interval boundary, which starts the wake for the next interval.
+
+    - now: the time of the wake
+ */
+void high_frequency_routine(const RtcDateTime& now)
+{
+    uint32_t interval = session.interval * 60;
+    RtcDateTime next_alarm =
+        round_up_multiple(now + ALARM_SET_THRESHOLD, interval);
+    set_rtc_alarm(next_alarm);
+
+    timebase_begin(&timebase, now);
+    transmit_time = 0;
+    next_sample = round_up_multiple(now, session.report_period);
+    high_frequency_end = next_alarm;
+
+    uint32_t slot = (uint32_t)now - (uint32_t)now % interval + get_slot_offset();
+    bool deciding = true; // Whether the scheduler is yet to decide on transmitting
+
+    while (next_sample < high_frequency_end)
+    {
+        if (held_count == HIGH_FREQUENCY_CAPACITY) flush_held_reports();
+
+        RtcDateTime time =
+            next_sample > (uint32_t)now ? await_second(next_sample) : now;
+        report_t report = take_sample(time, true);
+        if (!deciding || report.time < slot) continue;
+
+        deciding = false;
+        flush_held_reports();
+        schedule_input_t input = { report.time, pending_count(), buffer.count(),
+            buffer.capacity(), session.batch_size, report.batv };
+        if (!schedule_should_transmit(schedule_decide(schedule, input))) continue;
+
+        // The reports that come due while transmitting are taken by
+        // transmit_reports()
+        network_begin();
+        transmit_start();
+        next_alarm = finish_transmission(time, next_alarm);
+        network_end();
+
+        // Carry on until the alarm for a new interval, on the schedule of a new
+        // report period
+        high_frequency_end = next_alarm;
+        if (session.report_period == 0) break;
+        next_sample = round_up_multiple(next_sample, session.report_period);
+    }
+
+    flush_held_reports();
+    next_sample = 0;
+
+    trace_record(TracePhase::Awake, 0, trace_time(), TraceOutcome::Succeeded);
+    esp_sleep_enable_ext0_wakeup(RTC_SQUARE_WAVE_PIN, 0);
+    go_to_sleep();
+}
+
+/*
+    Light sleeps until shortly before an RTC second starts, then polls the RTC
+    for the start of the second, which keeps the timebase on the schedule of
+    the RTC (see timebase.cpp). Returns the RTC time, which is past the second
+    if it had already started on waking up.
+
+    - second: the RTC time to wait for
+ */
+RtcDateTime await_second(uint32_t second)
+{
+    // The start of the second the device woke in is only roughly known, so the
+    // start of the one after it is caught first, which the sleep to this second
+    // (and the drift measured over it) can then be timed from
+    if (timebase.edge_boot && second > timebase.edge_second + 1)
+        await_second(timebase.edge_second + 1);
+
+    int64_t now = esp_timer_get_time();
+    int64_t wake = timebase_wake_time(&timebase, second, now);
+    if (wake - now >= LIGHT_SLEEP_MIN_TIME) light_sleep(wake - now);
+
+    int64_t poll_start = esp_timer_get_time();
+    RtcDateTime time = rtc.GetDateTime();
+    bool exact = (uint32_t)time < second;
+
+    // Give up on the RTC if the second never comes, rather than waking late
+    // for every report after it
+    while ((uint32_t)time < second)
+    {
+        if (esp_timer_get_time() - poll_start > HIGH_FREQUENCY_POLL_TIMEOUT)
+            return time;
+        time = rtc.GetDateTime();
+    }
+
+    timebase_edge(&timebase, time, esp_timer_get_time(), exact);
+    return time;
+}
+
+/*
+    Goes into light sleep, which keeps the contents of memory and resumes where
+    it left off, for a number of microseconds as counted by the sleep timer.
+
+    - duration: the number of microseconds to sleep for
+ */
+void light_sleep(int64_t duration)
+{
+    int64_t start = esp_timer_get_time();
+    esp_sleep_enable_timer_wakeup(duration);
+    esp_light_sleep_start();
+
+    // The timer must not also wake the device from deep sleep
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+
+    int64_t slept = esp_timer_get_time() - start;
+    timebase_slept(&timebase, slept);
+    light_sleep_time += slept;
+}
+
+/*
+    Takes a report in high-frequency mode and holds it in memory until
+    flush_held_reports() is called. The report is given the latest time it was
+    due at, as it may be taken late. If HIGH_FREQUENCY_CAPACITY reports are
+    already held, the report is dropped (and recorded as lost in the trace once
+    the held reports are stored).
+    Returns the report.
+
+    - time: the RTC time, which must be at or after the time the next report is
+    due at
+    - sleep: whether to light sleep while the measurement finishes (not while
+    the radio is on)
+ */
+report_t take_sample(const RtcDateTime& time, bool sleep)
+{
+    uint32_t period = session.report_period;
+    report_t report = { (uint32_t)time - ((uint32_t)time - next_sample) % period,
+        -99, -99, -99 };
+    next_sample = report.time + period;
+
+    start_measurement();
+    report.batv = sample_battery_voltage();
+
+    int64_t remaining = bme680_reading ? bme680.remainingReadingMillis() * 1000 : 0;
+    if (sleep && remaining >= LIGHT_SLEEP_MIN_TIME)
+        light_sleep(timebase_sleep_time(timebase, remaining));
+
+    finish_report(&report, false);
+    stub_finish_summary(&report);
+    energy_add_report(period, report.batv);
+
+    if (held_count < HIGH_FREQUENCY_CAPACITY) held_reports[held_count++] = report;
+    else held_dropped++;
+    return report;
+}
+
+/*
+    Takes the report that is due in high-frequency mode, if there is one, while
+    something else keeps the device awake (see transmit_reports()). The report
+    is late by up to the time between calls, as nothing waits for the start of
+    its second.
+ */
+void take_due_sample()
+{
+    if (next_sample == 0) return;
+
+    RtcDateTime now = rtc.GetDateTime();
+    if ((uint32_t)now >= next_sample && (uint32_t)now < high_frequency_end)
+        take_sample(now, false);
+}
+
+/*
+    Stores the reports held in memory in high-frequency mode (see
+    store_report()), oldest first, and records any that were dropped because
+    too many were held.
+ */
+void flush_held_reports()
+{
+    for (int i = 0; i < held_count; i++)
+        store_report(&held_reports[i]);
+
+    held_count = 0;
+    if (held_dropped > 0) trace_lost(held_dropped);
+    held_dropped = 0;
+}
+
+/*
+    Transmits the pending reports (see peek_pending()) in batches, oldest first.
+    If the session asks for newest first, the newest reports in the report
+    buffer are transmitted in a batch of their own ahead of the rest, so that
+    the latest readings arrive even if there is not time to transmit a backlog
+    in full. The batches are serialised here and handed to the transmit task
+    (see transmit_task()), which connects and publishes them on the other core,
+    so the next batch is serialised while earlier ones are awaiting a response.
+    Reports are only removed once they and all reports before them in their
+    batch have been accepted. Reports that come due in high-frequency mode are
+    taken in the meantime. Returns a boolean indicating whether connecting
+    succeeded. Goes to sleep if the active session has ended. Should be called
+    after transmit_start().
+
+    - next_alarm: the time of the next alarm (transmission stops in time for it)
+ */
+bool transmit_reports(const RtcDateTime& next_alarm)
+{
+    int sent = 0; // Number of pending reports handed to the transmit task
+    bool submitting = true;
+
+    // Number of the newest reports handed to the transmit task ahead of the
+    // rest, and whether they are yet to be (there is no need with a backlog
+    // that fits in one batch)
+    int newest = 0;
+    bool newest_first = session.upload_order == UploadOrder::NewestFirst &&
+        pending_count() > UPLOAD_BATCH_SIZE && !buffer.is_empty();
+
+    while (true)
+    {
+        // Read the state before the responses so none are missed if the task
+        // finishes in between
+        TransmitState state = transmit_state();
+
+        batch_result_t result;
+        while (transmit_take_result(&result))
+        {
+            // The newest reports were the first batch submitted, so this is
+            // their response. They are all in the report buffer
+            if (newest > 0)
+            {
+                buffer.discard_range(
+                    reports, buffer.count() - newest, result.accepted);
+                newest = 0;
+
+                if (result.result == RequestResult::NoSession) go_to_sleep();
+                else if (result.result == RequestResult::Fail) submitting = false;
+                continue;
+            }
+
+            // Only remove the reports that the logging server accepted (and any
+            // corrupt reports that were skipped before them)
+            int accepted_count = result.count;
+            if (result.accepted < result.valid)
+            {
+                accepted_count = 0;
+                for (int valid = 0; valid < result.accepted; accepted_count++)
+                {
+                    report_t report;
+                    uint16_t session_id;
+                    if (peek_pending(accepted_count, &report, &session_id))
+                        valid++;
+                }
+            }
+
+            discard_pending(accepted_count);
+            sent -= result.count;
+
+            // The active session for this sensor node has ended
+            if (result.result == RequestResult::NoSession)
+                go_to_sleep();
+            else if (result.result == RequestResult::Fail) submitting = false;
+        }
+
+        if (state == TransmitState::ConnectFailed ||
+            state == TransmitState::Finished)
+        {
+            transmit_stop();
+            return state == TransmitState::Finished;
+        }
+
+        // Stop submitting once all reports are submitted or there's not enough
+        // time left before the next alarm
+        if (sent >= pending_count() - newest ||
+            next_alarm - rtc.GetDateTime() <
+            (logger_reply_timeout() + 999) / 1000 + ALARM_SET_THRESHOLD)
+        { submitting = false; }
+
+        batch_slot_t* slot = submitting ? transmit_reserve_batch() : NULL;
+        if (slot != NULL && newest_first)
+        {
+            // The batch is still in time order, which the delta encoding needs
+            // to stay compact
+            newest = min(min(buffer.count(), (int)session.batch_size),
+                UPLOAD_BATCH_SIZE);
+            newest_first = false;
+
+            report_t batch[UPLOAD_BATCH_SIZE];
+            uint16_t session_id;
+            slot->valid = gather_reports(batch, pending_count() - newest, newest,
+                &slot->count, &session_id);
+            slot->length = serialise_reports(
+                slot->payload, session, session_id, batch, slot->valid);
+
+            transmit_submit_batch();
+            continue;
+        }
+        else if (slot != NULL)
+        {
+            report_t batch[UPLOAD_BATCH_SIZE];
+            uint16_t session_id;
+            slot->valid = gather_reports(batch, sent,
+                min(pending_count() - newest - sent, UPLOAD_BATCH_SIZE),
+                &slot->count, &session_id);
+            slot->length = serialise_reports(
+                slot->payload, session, session_id, batch, slot->valid);
+
+            transmit_submit_batch();
+            sent += slot->count;
+            continue;
+        }
+
+        if (!submitting) transmit_end_batches();
+
+        // The reports taken in the meantime are held in memory, so they are
+        // stored before the next one would be dropped. As long as the spool is
+        // available this only moves reports from the report buffer into the
+        // spool, which keeps the positions of the pending reports handed to the
+        // transmit task, but not those of the newest reports handed to it ahead
+        // of the rest
+        if (held_count == HIGH_FREQUENCY_CAPACITY && newest == 0)
+            flush_held_reports();
+        take_due_sample();
+        transmit_wait(TRANSMIT_POLL_TIME);
+    }
+}
+
+/*
+    Adds the reports taken by the wake stub (see wake_stub.cpp) to the report
+    buffer and stops the stub taking any more.
+ */
+void collect_stub_reports()
+{
+    for (int i = 0; i < stub_count(); i++)
+    {
+        report_t report = stub_get_report(i);
+        store_report(&report);
+    }
+
+    energy_add_stub_wakes(stub_wake_count(), stub_count());
+    stub_disarm();
 }
 
 /*
-    Samples the sensors, creates a report and pushes it onto the report buffer.
+    Lets the wake stub take the reports at the following wakes, for as long as
+    the scheduler would not transmit and the report buffer has room, so that
+    the device only fully boots when it needs to.
+
+    - next_alarm: the time of the next alarm
+    - batv: the latest battery voltage
+ */
+void arm_wake_stub(const RtcDateTime& next_alarm, float batv)
+{
+    schedule_input_t input =
+        { 0, 0, 0, buffer.capacity(), session.batch_size, batv };
+    uint32_t interval = session.interval * 60;
+    uint32_t next_report = round_up_multiple(next_alarm, interval);
+
+    int budget = 0;
+    while (budget < STUB_CAPACITY && buffer.count() + budget < buffer.capacity())
+    {
+        input.time = next_report + budget * interval;
+        input.pending = pending_count() + budget + 1;
+        input.buffered = buffer.count() + budget + 1;
+
+        if (schedule_should_transmit(schedule_decide(schedule, input))) break;
+        budget++;
+    }
+
+    stub_arm(next_alarm, get_sample_period(), interval, budget, transmit_time);
+}
+
+/*
+    Makes room in the report buffer, samples the battery voltage and starts a
+    temperature and humidity measurement without waiting for it to finish, so
+    that other work can be done in the meantime. Returns the report, which is
+    completed by finish_report.
 
     - time: the time of the report
  */
-void generate_report(const RtcDateTime& time)
+report_t begin_report(const RtcDateTime& time)
 {
     report_t report = { (uint32_t)time, -99, -99, -99 };
+    start_measurement();
+    report.batv = sample_battery_voltage();
+
+    // Make room in the buffer rather than overwriting the oldest report
+    if (buffer.is_full()) spill_reports();
+    return report;
+}
 
-    // Sample temperature and humidity
-    Adafruit_BME680 bme680;
+/*
+    Starts a temperature and humidity measurement without waiting for it to
+    finish (see finish_report()).
+ */
+void start_measurement()
+{
+    bme680_reading = false;
     if (bme680.begin(0x76))
     {
         bme680.setGasHeater(0, 0);
         bme680.setTemperatureOversampling(BME680_OS_8X);
         bme680.setHumidityOversampling(BME680_OS_2X);
+        bme680_reading = bme680.beginReading() != 0;
+    }
+}
 
-        if (bme680.performReading())
-        {
-            report.airt = bme680.temperature;
-            report.relh = bme680.humidity;
-        }
+/*
+    Waits for the measurement started by begin_report to finish (blocking) and
+    adds it to the summary of the current interval. If the report is due, gives
+    the report the temperature and humidity from the summary and stores it (see
+    store_report()).
+
+    - report: the report returned by begin_report
+    - report_due: whether the report is due (see is_report_due())
+ */
+void finish_report(report_t* report, bool report_due)
+{
+    if (bme680_reading && bme680.endReading())
+        stub_add_sample(bme680.temperature, bme680.humidity);
+
+    bme680_reading = false;
+    if (!report_due) return;
+
+    stub_finish_summary(report);
+    store_report(report);
+}
+
+/*
+    Pushes a report onto the report buffer, unless it is suppressed because its
+    values have barely moved since the last stored report (see deadband.cpp).
+    Makes room in the buffer first if it is full.
+
+    - report: the report, which is given the number of reports suppressed
+    before it
+ */
+void store_report(report_t* report)
+{
+    if (deadband_filter(&deadband, session, report)) return;
+
+    make_room(*report);
+    buffer.push_front(reports, *report);
+}
+
+/*
+    Spills reports from the report buffer into the spool until a report can be
+    pushed onto the buffer without dropping any, which takes more than one spill
+    if the report needs the buffer's elements to be widened (see buffer.h).
+
+    - report: the report about to be pushed
+ */
+void make_room(const report_t& report)
+{
+    while (!buffer.has_room(report))
+    {
+        int count = buffer.count();
+        spill_reports();
+        if (buffer.count() == count) break;
     }
+}
+
+/*
+    Moves the oldest SPOOL_SPILL_COUNT reports from the report buffer into the
+    spool in flash memory in one go, to make room for new reports. Nothing is
+    moved if the spool is not available.
+ */
+void spill_reports()
+{
+    if (!open_spool()) return;
 
-    // Sample battery voltage
-    // report.batv = ...
+    int count = min(buffer.count(), SPOOL_SPILL_COUNT);
+    report_t spilled[SPOOL_SPILL_COUNT];
+    for (int i = 0; i < count; i++)
+        spilled[i] = buffer.peek(reports, i);
 
-    buffer.push_front(reports, report);
+    if (spool.append(spool_flash, spilled, count, session.session_id))
+        buffer.discard_rear(count);
 }
 
 /*
-    Serialises a report into a JSON string ready for transmission to the logging
-    server.
+    Moves all reports from the report buffer into the spool in flash memory,
+    where they keep the ID of the current session. Used before the session ID
+    changes, since the reports in the buffer are given the ID of the current
+    session when transmitted (see peek_pending()). Reports that cannot be moved
+    (if the spool is not available) are dropped rather than transmitted under
+    the new session's ID, and the number dropped is recorded in the trace.
+ */
+void spill_session_reports()
+{
+    while (buffer.count() > 0)
+    {
+        int count = buffer.count();
+        spill_reports();
+        if (buffer.count() == count) break;
+    }
 
-    - report_out: destination string
-    - report: the report to serialise
+    trace_lost(buffer.count());
+    buffer.discard_rear(buffer.count());
+}
+
+/*
+    Prepares the spool in flash memory for use, if not already done since waking
+    up. Returns a boolean indicating whether the spool is available.
  */
-void serialise_report(char* report_out, const report_t& report)
+bool open_spool()
 {
-    int length = 0;
-    length += sprintf(report_out, "{\"session_id\":%d", session.session_id);
+    if (!spool_open)
+        spool_open = storage_begin(&spool_flash) && spool.begin(spool_flash);
+    return spool_open;
+}
 
-    char formatted_time[32] = { '\0' };
-    format_time(formatted_time, RtcDateTime(report.time));
-    length += sprintf(report_out + length, ",\"time\":\"%s\"", formatted_time);
 
-    if (report.airt != -99)
-        length += sprintf(report_out + length, ",\"airt\":%.1f", report.airt);
-    else length += sprintf(report_out + length, ",\"airt\":null");
+/*
+    Returns the number of reports waiting to be transmitted (the reports in the
+    spool followed by the reports in the report buffer).
+ */
+int pending_count()
+{
+    return spool.count() + buffer.count();
+}
+
+/*
+    Gets a report that is waiting to be transmitted. Returns a boolean indicating
+    success or failure, and fails if the report is corrupt.
+
+    - position: the position of the report, counted from the oldest (position 0)
+    - report_out: will be set to the report
+    - session_id_out: will be set to the ID of the session the report belongs to
+ */
+bool peek_pending(int position, report_t* report_out, uint16_t* session_id_out)
+{
+    if (position < spool.count())
+    {
+        return open_spool() &&
+            spool.peek(spool_flash, position, report_out, session_id_out);
+    }
 
-    if (report.relh != -99)
-        length += sprintf(report_out + length, ",\"relh\":%.1f", report.relh);
-    else length += sprintf(report_out + length, ",\"relh\":null");
+    // The report buffer only holds reports of the current session (see
+    // spill_session_reports())
+    *report_out = buffer.peek(reports, position - spool.count());
+    *session_id_out = session.session_id;
+    return true;
+}
 
-    if (report.batv != -99)
-        length += sprintf(report_out + length, ",\"batv\":%.2f", report.batv);
-    else length += sprintf(report_out + length, ",\"batv\":null");
+/*
+    Removes a number of the oldest reports that are waiting to be transmitted.
 
-    strcat(report_out + length, "}");
+    - count: the number of reports to remove
+ */
+void discard_pending(int count)
+{
+    int spooled = min(count, spool.count());
+    if (spooled > 0 && open_spool())
+        spool.discard(spool_flash, spooled);
+
+    buffer.discard_rear(count - spooled);
 }
 
+/*
+    Gets a number of consecutive reports that are waiting to be transmitted,
+    ending early at a change of session since a batch's reports share a session
+    ID. Corrupt reports are covered but left out. Returns the number of reports
+    gotten.
+
+    - batch_out: destination array for the reports
+    - start: position of the first report, counted from the oldest
+    - count: the most positions to cover
+    - span_out: will be set to the number of positions covered
+    - session_id_out: will be set to the ID of the session the reports belong to
+ */
+int gather_reports(report_t* batch_out, int start, int count, int* span_out,
+    uint16_t* session_id_out)
+{
+    *session_id_out = session.session_id;
+    int valid = 0;
+    int span = 0;
+
+    while (span < count)
+    {
+        uint16_t session_id;
+        if (peek_pending(start + span, &batch_out[valid], &session_id))
+        {
+            if (valid > 0 && session_id != *session_id_out) break;
+
+            *session_id_out = session_id;
+            valid++;
+        }
+
+        span++;
+    }
+
+    *span_out = span;
+    return valid;
+}
+
+
+/*
+    Returns the time of the next report that lies on a multiple of the session
+    interval (e.g. a 5 minute interval gives the next minute ending in a 0 or 5).
+ */
+RtcDateTime get_aligned_alarm()
+{
+    RtcDateTime alarm = rtc.GetDateTime();
+    alarm += (60 - alarm.Second()); // Move to start of next minute
+    alarm = round_up_multiple(alarm, session.interval * 60); // Round up to
+    // next multiple of the interval
+
+    // Advance to next interval if currently too close to first available interval
+    if (alarm - rtc.GetDateTime() <= ALARM_SET_THRESHOLD)
+        alarm += session.interval * 60;
+
+    return alarm;
+}
+
+/*
+    Returns the number of seconds between samples: the session's sample period,
+    or the interval if reports are single samples.
+ */
+uint32_t get_sample_period()
+{
+    return session.sample_period != 0 ?
+        session.sample_period : session.interval * 60;
+}
+
+/*
+    Returns the number of seconds after each interval boundary that this node
+    transmits at (see slots.cpp). In high-frequency mode the slot starts at a
+    report.
+ */
+uint32_t get_slot_offset()
+{
+    return slot_offset(slot_key(mac_address), session.transmit_slot,
+        session.interval * 60, session.report_period != 0 ?
+        session.report_period : get_sample_period());
+}
+
+/*
+    Returns a boolean indicating whether a report is due at a wake, which is the
+    case for the first sample at or after the end of each interval.
+
+    - time: the time of the wake
+ */
+bool is_report_due(const RtcDateTime& time)
+{
+    return (uint32_t)time % (session.interval * 60) < get_sample_period();
+}
 
 /*
     Returns a boolean indicating whether the RTC holds a valid timestamp or not
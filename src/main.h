@@ -8,11 +8,41 @@ void try_serial_mode();
 bool connect_and_get_session();
 void set_first_alarm();
 void loop();
+void go_to_sleep();
+void seal_buffer();
+void recover_buffer();
+uint32_t buffer_checksum();
 
 void reporting_routine();
-void generate_report(const RtcDateTime&);
-void serialise_report(char*, const report_t&);
+RtcDateTime finish_transmission(const RtcDateTime&, RtcDateTime);
+void sleep_until(const RtcDateTime&, float);
+void high_frequency_routine(const RtcDateTime&);
+RtcDateTime await_second(uint32_t);
+void light_sleep(int64_t);
+report_t take_sample(const RtcDateTime&, bool);
+void take_due_sample();
+void flush_held_reports();
+bool transmit_reports(const RtcDateTime&);
+void collect_stub_reports();
+void arm_wake_stub(const RtcDateTime&, float);
+report_t begin_report(const RtcDateTime&);
+void start_measurement();
+void finish_report(report_t*, bool);
+void store_report(report_t*);
+void make_room(const report_t&);
+void spill_reports();
+void spill_session_reports();
+bool open_spool();
 
+int pending_count();
+bool peek_pending(int, report_t*, uint16_t*);
+void discard_pending(int);
+int gather_reports(report_t*, int, int, int*, uint16_t*);
 
+
+RtcDateTime get_aligned_alarm();
+uint32_t get_sample_period();
+uint32_t get_slot_offset();
+bool is_report_due(const RtcDateTime&);
 bool is_rtc_time_valid();
 void set_rtc_alarm(const RtcDateTime&);
\ No newline at end of file
@@ -7,8 +7,13 @@
 #include <ArduinoJson.h>
 
 #include "serial.h"
+#include "main.h"
+#include "transmit.h"
 #include "helpers/globals.h"
 #include "helpers/helpers.h"
+#include "helpers/encoding.h"
+#include "helpers/dump.h"
+#include "energy.h"
 
 
 /*
@@ -22,19 +27,28 @@ void serial_routine()
         char command[200] = { '\0' };
         int position = 0;
         bool line_ended = false;
+        bool overflowed = false;
 
         // Store received characters until we receive a new line character
         while (!line_ended)
         {
-            while (Serial.available())
+            if (!Serial.available())
             {
-                char new_char = Serial.read();
-                if (new_char != '\n')
-                    command[position++] = new_char;
-                else line_ended = true;
+                delay(1); // Let other tasks run while waiting
+                continue;
             }
+
+            char new_char = Serial.read();
+            if (new_char == '\n')
+                line_ended = true;
+            else if (position < (int)sizeof(command) - 1)
+                command[position++] = new_char;
+            else overflowed = true;
         }
 
+        // Ignore commands too long to be valid rather than running part of one
+        if (overflowed) continue;
+
         // Process the received command
         if (strncmp(command, "psn_pn", 6) == 0)
             process_pn_command();
@@ -46,6 +60,10 @@ void serial_routine()
             process_rt_command();
         else if (strncmp(command, "psn_wt", 6) == 0)
             process_wt_command(command);
+        else if (strncmp(command, "psn_re", 6) == 0)
+            process_re_command();
+        else if (strncmp(command, "psn_bd", 6) == 0)
+            process_bd_command(command);
     }
 }
 
@@ -229,6 +247,7 @@ void process_wc_command(const char* command)
     preferences.putUChar("tlog", new_logger_timeout);
     preferences.end();
 
+    network_forget();
     Serial.write("psn_wcs\n");
 }
 
@@ -293,4 +312,162 @@ void process_wt_command(const char* command)
             Serial.write(rtc.LastError() ? "psn_wtf\n" : "psn_wts\n");
         } else Serial.write("psn_wtf\n");
     } else Serial.write("psn_wtf\n");
+}
+
+/*
+    Processes and responds to the read energy command. Sends the charge used in
+    each way since the battery was connected (see energy.cpp) in milliamp hours,
+    the number of wakes only to transmit in the slot, and the number of days the
+    battery is projected to last at the current rate of reports, in JSON format.
+ */
+void process_re_command()
+{
+    energy_t totals;
+    if (!energy_read(&totals))
+    {
+        Serial.write("psn_ref\n");
+        return;
+    }
+
+    const char* format = "psn_re {\"qslp\":%.3f,\"qcpu\":%.3f,\"qrrx\":%.3f,"
+        "\"qrtx\":%.3f,\"qstb\":%.3f,\"qlsp\":%.3f,\"qtot\":%.3f,\"rpts\":%u,"
+        "\"slwk\":%u,\"intv\":%u,\"rprd\":%u,\"batv\":%.2f,\"days\":%.1f}\n";
+
+    char response[335] = { '\0' };
+    sprintf(response, format, totals.charge[DeepSleep], totals.charge[CpuActive],
+        totals.charge[RadioReceive], totals.charge[RadioTransmit],
+        totals.charge[WakeStub], totals.charge[LightSleep], energy_total(totals),
+        totals.reports, totals.slot_wakes, totals.period / 60, totals.period,
+        totals.batv, energy_projected_days(totals));
+
+    Serial.write(response);
+}
+
+/*
+    Processes and responds to the bulk dump command. Switches the serial
+    connection to a higher baud rate and streams the pending reports (see
+    peek_pending()) from a position as frames (see dump.cpp), then switches back.
+    Reports are not removed from the device.
+
+    - command: a JSON string optionally containing the baud rate to stream at and
+    the position of the first report to stream (to resume an earlier transfer)
+ */
+void process_bd_command(const char* command)
+{
+    // Check if there's at least the first character of a JSON object
+    if (strncmp(command, "psn_bd {", 8) != 0)
+    {
+        Serial.write("psn_bdf\n");
+        return;
+    }
+
+    // Deserialise the JSON containing the transfer options
+    StaticJsonDocument<JSON_OBJECT_SIZE(32)> document;
+    DeserializationError json_status = deserializeJson(document, command + 7);
+
+    if (json_status != DeserializationError::Ok)
+    {
+        Serial.write("psn_bdf\n");
+        return;
+    }
+
+    JsonObject json_object = document.as<JsonObject>();
+    bool field_error = false;
+
+    uint32_t baud = DUMP_DEFAULT_BAUD;
+    if (json_object.containsKey("baud"))
+    {
+        JsonVariant value = json_object.getMember("baud");
+        if (value.is<uint32_t>() && (uint32_t)value > 0)
+            baud = value;
+        else field_error = true;
+    }
+
+    uint32_t position = 0;
+    if (json_object.containsKey("offs"))
+    {
+        JsonVariant value = json_object.getMember("offs");
+        if (value.is<uint32_t>())
+            position = value;
+        else field_error = true;
+    }
+
+    // Serial mode is only entered after a reset or power off, so the pending
+    // reports are those of the report buffer if it was kept (see
+    // recover_buffer()) and those spooled to flash if readable
+    open_spool();
+    uint32_t count = pending_count();
+
+    if (field_error || position > count)
+    {
+        Serial.write("psn_bdf\n");
+        return;
+    }
+
+    char response[64] = { '\0' };
+    sprintf(response, "psn_bds {\"cont\":%u,\"baud\":%u}\n", count, baud);
+    Serial.write(response);
+
+    // Give the computer time to switch to the new baud rate
+    Serial.flush();
+    Serial.updateBaudRate(baud);
+    delay(DUMP_SWITCH_DELAY);
+
+    uint8_t frame[DUMP_MAX_FRAME];
+    while (position < count)
+    {
+        uint16_t span;
+        int length = build_dump_frame(frame, position, count, &span);
+        Serial.write(frame, length);
+        position += span;
+    }
+
+    // The final frame marks the end of the transfer
+    int length = encode_dump_frame(frame, count, 0, nullptr, 0);
+    Serial.write(frame, length);
+
+    Serial.flush();
+    delay(DUMP_SWITCH_DELAY);
+    Serial.updateBaudRate(SERIAL_BAUD);
+}
+
+/*
+    Builds a frame holding the pending reports from a position, ending early at a
+    change of session since a frame's reports share a session ID. Corrupt reports
+    are covered by the frame but left out of it. Returns the number of bytes
+    written.
+
+    - frame_out: destination buffer (must hold DUMP_MAX_FRAME bytes)
+    - position: position of the first report to include
+    - count: the number of pending reports
+    - span_out: will be set to the number of positions covered by the frame
+ */
+int build_dump_frame(uint8_t* frame_out, uint32_t position, uint32_t count,
+    uint16_t* span_out)
+{
+    report_t batch[DUMP_FRAME_REPORTS];
+    uint16_t batch_session_id = 0;
+    int valid = 0;
+    uint16_t span = 0;
+
+    while (position + span < count && span < DUMP_FRAME_REPORTS)
+    {
+        report_t report;
+        uint16_t session_id;
+        if (peek_pending(position + span, &report, &session_id))
+        {
+            if (valid > 0 && session_id != batch_session_id) break;
+
+            batch_session_id = session_id;
+            batch[valid++] = report;
+        }
+
+        span++;
+    }
+
+    uint8_t payload[DUMP_MAX_PAYLOAD];
+    int length = encode_reports_binary(payload, batch_session_id, batch, valid);
+
+    *span_out = span;
+    return encode_dump_frame(frame_out, position, span, payload, length);
 }
\ No newline at end of file
@@ -4,4 +4,7 @@ void process_pn_command();
 void process_rc_command();
 void process_wc_command(const char*);
 void process_rt_command();
-void process_wt_command(const char*);
\ No newline at end of file
+void process_wt_command(const char*);
+void process_re_command();
+void process_bd_command(const char*);
+int build_dump_frame(uint8_t*, uint32_t, uint32_t, uint16_t*);
\ No newline at end of file
@@ -0,0 +1,69 @@
+/*
+    Deals with the flash partition that holds the spool of reports that did not
+    fit in the report buffer (see partitions.csv).
+ */
+
+#include <esp_partition.h>
+
+#include "storage.h"
+
+
+const esp_partition_t* spool_partition = NULL;
+
+
+/*
+    Finds the spool partition and sets up the functions for accessing it. Returns
+    a boolean indicating success or failure.
+
+    - flash_out: will be set up to access the spool partition
+ */
+bool storage_begin(spool_flash_t* flash_out)
+{
+    spool_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+        (esp_partition_subtype_t)SPOOL_PARTITION_SUBTYPE, "spool");
+    if (spool_partition == NULL) return false;
+
+    flash_out->read = storage_read;
+    flash_out->write = storage_write;
+    flash_out->erase_sector = storage_erase_sector;
+    flash_out->size = spool_partition->size;
+    return true;
+}
+
+/*
+    Reads data from the spool partition. Returns a boolean indicating success or
+    failure.
+
+    - address: the offset into the partition to read from
+    - data: destination for the data
+    - length: the number of bytes to read
+ */
+bool storage_read(uint32_t address, void* data, size_t length)
+{
+    return esp_partition_read(spool_partition, address, data, length) == ESP_OK;
+}
+
+/*
+    Writes data to the spool partition (can only clear bits that are set).
+    Returns a boolean indicating success or failure.
+
+    - address: the offset into the partition to write to
+    - data: the data to write
+    - length: the number of bytes to write
+ */
+bool storage_write(uint32_t address, const void* data, size_t length)
+{
+    return esp_partition_write(spool_partition, address, data, length) == ESP_OK;
+}
+
+/*
+    Erases a sector of the spool partition (sets all bits). Returns a boolean
+    indicating success or failure.
+
+    - address: the offset into the partition of the start of the sector
+ */
+bool storage_erase_sector(uint32_t address)
+{
+    return esp_partition_erase_range(
+        spool_partition, address, SPOOL_SECTOR_SIZE) == ESP_OK;
+}
\ No newline at end of file
@@ -0,0 +1,7 @@
+#include "helpers/spool.h"
+
+
+bool storage_begin(spool_flash_t*);
+bool storage_read(uint32_t, void*, size_t);
+bool storage_write(uint32_t, const void*, size_t);
+bool storage_erase_sector(uint32_t);
\ No newline at end of file
@@ -0,0 +1,177 @@
+/*
+    Records how long each phase of a wake takes into a ring of records in sleep
+    memory, so that they can be sent to the logging server as telemetry with a
+    later upload. When the ring is full the oldest records are overwritten. Both
+    cores record phases, so the ring is guarded by a spinlock.
+
+    Telemetry layout: a 4 byte header followed by a 10 byte record per phase,
+    with all values little-endian:
+
+    - header: version (uint8), record count (uint8), number of records
+    overwritten before they could be sent (uint16)
+    - record: phase (uint8, see TracePhase), outcome (uint8, see TraceOutcome),
+    start in microseconds since waking (uint32), duration in microseconds
+    (uint32)
+
+    Each wake starts with a Wake record, whose start is the RTC time in seconds
+    since 2000-01-01 and whose outcome is the boot mode. The records that follow
+    belong to that wake. A ReportsLost record holds the number of reports that
+    were dropped in place of its duration, so that no report is lost without a
+    trace.
+ */
+
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <atomic>
+
+#include "trace.h"
+
+
+RTC_DATA_ATTR trace_record_t trace_records[TRACE_CAPACITY];
+RTC_DATA_ATTR uint32_t trace_next = 0; // Sequence number of the next record
+RTC_DATA_ATTR uint32_t trace_first = 0; // Sequence number of the oldest record
+RTC_DATA_ATTR uint16_t trace_dropped = 0;
+
+std::atomic_flag trace_lock = ATOMIC_FLAG_INIT;
+
+
+static void lock()
+{
+    while (trace_lock.test_and_set(std::memory_order_acquire));
+}
+
+static void unlock()
+{
+    trace_lock.clear(std::memory_order_release);
+}
+
+static void put_uint16(uint8_t* data, uint16_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = value >> 8;
+}
+
+static void put_uint32(uint8_t* data, uint32_t value)
+{
+    put_uint16(data, value & 0xFFFF);
+    put_uint16(data + 2, value >> 16);
+}
+
+static void add_record(const trace_record_t& record)
+{
+    lock();
+    if (trace_next - trace_first >= TRACE_CAPACITY)
+    {
+        trace_first++;
+        if (trace_dropped < UINT16_MAX) trace_dropped++;
+    }
+
+    trace_records[trace_next++ % TRACE_CAPACITY] = record;
+    unlock();
+}
+
+
+/*
+    Returns the number of microseconds since waking, for timing phases with
+    trace_record().
+ */
+uint32_t trace_time()
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+/*
+    Marks the start of a wake. The records added after this belong to it.
+
+    - time: the RTC time
+    - boot_mode: the boot mode that the device woke in
+ */
+void trace_wake(uint32_t time, int boot_mode)
+{
+    trace_record_t record = { time, 0, TracePhase::Wake, (uint8_t)boot_mode };
+    add_record(record);
+}
+
+/*
+    Records the timing of a phase of the current wake.
+
+    - phase: the phase
+    - start: the time the phase started (see trace_time())
+    - end: the time the phase ended
+    - outcome: how the phase ended
+ */
+void trace_record(TracePhase phase, uint32_t start, uint32_t end,
+    TraceOutcome outcome)
+{
+    trace_record_t record =
+        { start, end - start, (uint8_t)phase, (uint8_t)outcome };
+    add_record(record);
+}
+
+/*
+    Records that reports were dropped before they could be stored or
+    transmitted.
+
+    - count: the number of reports dropped
+ */
+void trace_lost(int count)
+{
+    if (count <= 0) return;
+
+    trace_record_t record = { trace_time(), (uint32_t)count,
+        TracePhase::ReportsLost, TraceOutcome::Failed };
+    add_record(record);
+}
+
+/*
+    Encodes the records into a telemetry message (see the layout above). Returns
+    the number of bytes written, or 0 if there are no records. The records stay
+    in the ring until discarded with trace_discard().
+
+    - data_out: destination buffer (must hold TRACE_PAYLOAD_SIZE bytes)
+    - last_out: will be set to the sequence number of the last record encoded
+ */
+int trace_encode(uint8_t* data_out, uint32_t* last_out)
+{
+    lock();
+    int count = trace_next - trace_first;
+
+    data_out[0] = TRACE_VERSION;
+    data_out[1] = count;
+    put_uint16(data_out + 2, trace_dropped);
+
+    uint8_t* data = data_out + TRACE_HEADER_SIZE;
+    for (uint32_t i = trace_first; i != trace_next; i++)
+    {
+        const trace_record_t& record = trace_records[i % TRACE_CAPACITY];
+        data[0] = record.phase;
+        data[1] = record.outcome;
+        put_uint32(data + 2, record.start);
+        put_uint32(data + 6, record.duration);
+        data += TRACE_RECORD_SIZE;
+    }
+
+    *last_out = trace_next - 1;
+    unlock();
+    return count > 0 ? data - data_out : 0;
+}
+
+/*
+    Removes the records that have been sent, up to and including a sequence
+    number. Records added since they were encoded are kept.
+
+    - last: the sequence number returned by trace_encode()
+ */
+void trace_discard(uint32_t last)
+{
+    lock();
+
+    // Some of the sent records may already have been overwritten
+    if ((int32_t)(last + 1 - trace_first) > 0)
+    {
+        trace_first = last + 1;
+        trace_dropped = 0;
+    }
+
+    unlock();
+}
@@ -0,0 +1,57 @@
+/*
+    A ring of trace records in sleep memory, holding how long each phase of the
+    recent wakes took and the number of any reports dropped, across deep sleeps.
+    The records are published as a telemetry message at the start of each
+    transmission (see logger_publish_telemetry()) and discarded once a batch of
+    reports sent after them is accepted, which shows that they arrived. If the
+    ring fills before then, the oldest records are overwritten and counted. See
+    trace.cpp for the layout.
+ */
+
+#include <stdint.h>
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_CAPACITY 48 // Number of trace records kept in sleep memory
+#define TRACE_VERSION 1 // Version number of the telemetry layout
+#define TRACE_HEADER_SIZE 4 // Number of bytes in the header of a telemetry message
+#define TRACE_RECORD_SIZE 10 // Number of bytes per record in a telemetry message
+#define TRACE_PAYLOAD_SIZE (TRACE_HEADER_SIZE + TRACE_CAPACITY * TRACE_RECORD_SIZE)
+
+// The phases of a wake that are timed
+enum TracePhase
+{
+    Wake, // Marks the start of a wake (holds the RTC time and the boot mode)
+    Boot,
+    RtcBegin,
+    Measure,
+    NetworkConnect,
+    LoggerConnect,
+    LoggerSubscribe,
+    GetSession,
+    PublishBatch, // A batch of reports, from publishing to the response
+    Awake, // The whole wake, up to going to sleep
+    ReportsLost // Reports dropped before they could be stored or transmitted
+    // (holds the number dropped in place of the duration)
+};
+
+enum TraceOutcome { Failed, Succeeded, Reconnected };
+
+struct trace_record_t
+{
+    uint32_t start; // Microseconds since waking (seconds since 2000-01-01 for Wake)
+    uint32_t duration; // Microseconds
+    uint8_t phase;
+    uint8_t outcome;
+};
+
+
+uint32_t trace_time();
+void trace_wake(uint32_t, int);
+void trace_record(TracePhase, uint32_t, uint32_t, TraceOutcome);
+void trace_lost(int);
+int trace_encode(uint8_t*, uint32_t*);
+void trace_discard(uint32_t);
+
+#endif
@@ -5,36 +5,70 @@
 
 #include <WiFi.h>
 #include <esp_wpa2.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <AsyncMqttClient.h>
 #include <ArduinoJson.h>
+#include <atomic>
 
 #include "transmit.h"
 #include "helpers/globals.h"
 #include "helpers/helpers.h"
-
-
-bool awaiting_subscribe = false;
-uint16_t subscribe_id;
+#include "helpers/latency.h"
+#include "trace.h"
+#include "energy.h"
+
+
+EventGroupHandle_t transmit_events = NULL;
+RTC_DATA_ATTR network_cache_t network_cache;
+bool used_network_cache = false;
+bool network_started = false;
+uint32_t network_start_time;
+uint32_t network_start_rtc;
+uint32_t network_start_trace;
+uint32_t network_radio_total = 0; // Microseconds the radio was on for before
+// the latest call to network_begin
+
+char logger_client_id[24] = { '\0' };
+bool logger_session_present = false;
+RTC_DATA_ATTR bool logger_subscribed = false;
+std::atomic<uint16_t> subscribe_packet_id(0); // ID of the subscription being
+// waited for
+std::atomic<uint16_t> suback_packet_id(0); // ID of the latest subscription
+// acknowledged
+RTC_DATA_ATTR latency_estimate_t latency[LATENCY_PHASES];
 
 uint16_t publish_id = -1;
-bool awaiting_session = false;
+std::atomic<uint32_t> transmitted_bytes(0);
+std::atomic<bool> awaiting_session(false); // Also read by the MQTT client's task
 RequestResult session_result;
 session_t new_session;
-bool awaiting_report = false;
-RequestResult report_result;
+report_request_t report_requests[TRANSMIT_WINDOW];
+session_t session_update;
+int session_update_fields = 0;
+
+TaskHandle_t main_task = NULL;
+TaskHandle_t transmit_task_handle = NULL; // Only written by the calling task, so
+// that the transmit task is not deleted while it might still be notified
+std::atomic<int> transmit_task_state(TransmitState::Finished);
+std::atomic<bool> batches_ended(false);
+uint32_t transmit_start_time;
+std::atomic<uint32_t> transmit_connect_millis(0);
+spsc_queue_t<batch_slot_t, TRANSMIT_QUEUE_LEN> batch_queue;
+spsc_queue_t<batch_result_t, TRANSMIT_WINDOW> result_queue;
 
 AsyncMqttClient logger;
 
 
 /*
-    Connects to the WiFi network or times out (blocking). Returns a boolean
-    indicating success or failure.
-
-    NOTE: I cannot guarantee that this function will work properly when called
-    multiple times. The only way to ensure the system is not left in an
-    unrecoverable state is to perform a restart before calling this again.
+    Starts connecting to the WiFi network without waiting for the connection to
+    be made, so that other work can be done in the meantime. If a previous
+    connection was successful then tries to reconnect to the same access point
+    using the same IP address, which skips the channel scan and DHCP. The
+    connection is completed by network_connect.
  */
-bool network_connect()
+void network_begin()
 {
     // Configure for enterprise WiFi network if required
     if (is_enterprise_network)
@@ -48,18 +82,99 @@ bool network_connect()
         esp_wifi_sta_wpa2_ent_enable(&config);
     }
 
-    WiFi.begin(network_name, network_password);
-    delay(1000);
+    if (transmit_events == NULL)
+        transmit_events = xEventGroupCreate();
+    xEventGroupClearBits(transmit_events, NETWORK_CONNECTED_BIT);
+
+    WiFi.persistent(false); // Don't write the WiFi configuration to flash
+    WiFi.onEvent(network_on_event, SYSTEM_EVENT_STA_GOT_IP);
+
+    // Try reconnecting using the details of the previous connection
+    uint32_t now = rtc.GetDateTime();
+    used_network_cache = network_cache.valid &&
+        now - network_cache.time < NETWORK_CACHE_LIFETIME;
+
+    if (used_network_cache)
+    {
+        WiFi.config(IPAddress(network_cache.ip), IPAddress(network_cache.gateway),
+            IPAddress(network_cache.subnet), IPAddress(network_cache.dns));
+        WiFi.begin(network_name, network_password, network_cache.channel,
+            network_cache.bssid);
+    }
+    else WiFi.begin(network_name, network_password);
+
+    network_started = true;
+    network_start_time = millis();
+    network_start_rtc = now;
+    network_start_trace = trace_time();
+}
+
+/*
+    Connects to the WiFi network or times out (blocking). Returns a boolean
+    indicating success or failure. Completes a connection started by
+    network_begin, or starts one if there is none. If reconnecting using the
+    details of the previous connection fails then falls back to a full
+    connection. Timeouts are measured from when the connection was started, and
+    are shortened to what earlier connections suggest is enough (see
+    latency.cpp).
+
+    NOTE: I cannot guarantee that this function will work properly when called
+    multiple times. The only way to ensure the system is not left in an
+    unrecoverable state is to perform a restart before calling this again.
+ */
+bool network_connect()
+{
+    if (!network_started) network_begin();
+
+    if (used_network_cache)
+    {
+        uint32_t elapsed = millis() - network_start_time;
+        uint32_t timeout = latency_deadline(latency[LatencyPhase::NetworkFast],
+            min(FAST_CONNECT_TIMEOUT, network_timeout * 1000));
+        if (wait_for_event(NETWORK_CONNECTED_BIT,
+            elapsed < timeout ? timeout - elapsed : 0))
+        {
+            latency_record(&latency[LatencyPhase::NetworkFast],
+                millis() - network_start_time);
+            return true;
+        }
+
+        latency_record_timeout(&latency[LatencyPhase::NetworkFast]);
+
+        // The access point or network may have changed
+        used_network_cache = false;
+        network_cache.valid = false;
+        WiFi.disconnect();
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        xEventGroupClearBits(transmit_events, NETWORK_CONNECTED_BIT);
+
+        WiFi.begin(network_name, network_password);
+        network_start_time = millis();
+    }
 
-    // Check connection status and time out after set time
-    int checks = 1;
-    while (WiFi.status() != WL_CONNECTED)
+    // Wait for an IP address and time out after set time
+    uint32_t elapsed = millis() - network_start_time;
+    uint32_t timeout = latency_deadline(
+        latency[LatencyPhase::NetworkFull], network_timeout * 1000);
+    if (!wait_for_event(NETWORK_CONNECTED_BIT,
+        elapsed < timeout ? timeout - elapsed : 0))
     {
-        if (checks++ >= network_timeout)
-            return false;
-        else delay(1000);
+        latency_record_timeout(&latency[LatencyPhase::NetworkFull]);
+        return false;
     }
 
+    latency_record(&latency[LatencyPhase::NetworkFull],
+        millis() - network_start_time);
+
+    // Remember the connection details for next time
+    memcpy(network_cache.bssid, WiFi.BSSID(), 6);
+    network_cache.channel = WiFi.channel();
+    network_cache.ip = WiFi.localIP();
+    network_cache.gateway = WiFi.gatewayIP();
+    network_cache.subnet = WiFi.subnetMask();
+    network_cache.dns = WiFi.dnsIP();
+    network_cache.time = network_start_rtc;
+    network_cache.valid = true;
     return true;
 }
 
@@ -72,10 +187,52 @@ bool is_network_connected()
     return WiFi.status() == WL_CONNECTED;
 }
 
+/*
+    Disconnects from the logging server and the WiFi network and turns the radio
+    off, so that the device can stay awake without it (see network_radio_time()).
+    Should only be called once the transmit task has finished.
+ */
+void network_end()
+{
+    if (!network_started) return;
+
+    logger.disconnect();
+    WiFi.disconnect(true);
+    WiFi.mode(WIFI_OFF);
+
+    network_radio_total += trace_time() - network_start_trace;
+    network_started = false;
+}
+
+/*
+    Returns the number of microseconds the radio has been on for since waking,
+    from starting to connect to the WiFi network. The radio stays on until
+    network_end() is called or the device goes to sleep.
+ */
+uint32_t network_radio_time()
+{
+    return network_radio_total +
+        (network_started ? trace_time() - network_start_trace : 0);
+}
+
+/*
+    Forgets the cached details of the last connection and the latencies observed
+    so far, which no longer apply once the network or logging server has been
+    changed.
+ */
+void network_forget()
+{
+    network_cache.valid = false;
+    for (int i = 0; i < LATENCY_PHASES; i++)
+        latency_reset(&latency[i]);
+}
+
 
 /*
     Connects to the logging server or times out (blocking). Returns a boolean
-    indicating success or failure.
+    indicating success or failure. Uses a persistent session with a client ID
+    derived from the MAC address, so that the subscription to the inbound topic
+    is kept by the logging server between connections.
 
     NOTE: I cannot guarantee that this function will work properly when called
     multiple times. The only way to ensure the system is not left in an
@@ -85,19 +242,32 @@ bool logger_connect()
 {
     if (WiFi.status() != WL_CONNECTED) return false;
 
+    xEventGroupClearBits(transmit_events, LOGGER_CONNECTED_BIT);
+
+    // Build the client ID from the MAC address without the separators
+    int length = snprintf(logger_client_id, sizeof(logger_client_id), "psn-");
+    for (const char* c = mac_address;
+        *c != '\0' && length < (int)sizeof(logger_client_id) - 1; c++)
+    {
+        if (*c != ':') logger_client_id[length++] = *c;
+    }
+    logger_client_id[length] = '\0';
+
+    logger.setClientId(logger_client_id);
+    logger.setCleanSession(false);
+    logger.onConnect(logger_on_connect);
     logger.onSubscribe(logger_on_subscribe);
     logger.onMessage(logger_on_message);
     logger.setServer(logger_address, logger_port);
+    uint32_t start = millis();
     logger.connect();
-    delay(1000);
 
-    // Check connection status and time out after set time
-    int checks = 1;
-    while (!logger.connected())
+    // Wait for the connection acknowledgement and time out after set time
+    if (!timed_wait(LatencyPhase::LoggerConnack, LOGGER_CONNECTED_BIT, start))
     {
-        if (checks++ >= logger_timeout)
-            return false;
-        else delay(1000);
+        // The reused IP address may no longer be valid on the network
+        if (used_network_cache) network_cache.valid = false;
+        return false;
     }
 
     return true;
@@ -116,35 +286,34 @@ bool is_logger_connected()
 /*
     Subscribes to the inbound topic on the logging server, then waits for
     response or times out (blocking). Returns a boolean indicating success or
-    failure.
+    failure. Does nothing if the logging server kept the session (and so the
+    subscription) from a previous connection.
  */
 bool logger_subscribe()
 {
-    char inbound_topic[64] = { '\0' };
-    sprintf(inbound_topic, "nodes/%s/inbound/#", mac_address);
+    if (logger_session_present && logger_subscribed) return true;
 
-    uint16_t packet_id = logger.subscribe(inbound_topic, 0);
+    char inbound_topic[TOPIC_LENGTH] = { '\0' };
+    snprintf(inbound_topic, TOPIC_LENGTH, "nodes/%s/inbound/#", mac_address);
 
-    // Check if successfully sent message
-    if (packet_id)
-    {
-        subscribe_id = packet_id;
-        awaiting_subscribe = true;
-    } else return false;
-    delay(1000);
-
-    // Check result status and time out after set time
-    int checks = 1;
-    while (awaiting_subscribe)
-    {
-        if (checks++ >= logger_timeout)
-        {
-            awaiting_subscribe = false;
-            return false;
-        } else delay(1000);
-    }
+    subscribe_packet_id.store(0);
+    xEventGroupClearBits(transmit_events, SUBSCRIBED_BIT);
 
-    return true;
+    // Check if successfully sent message
+    uint32_t start = millis();
+    uint16_t packet_id = logger.subscribe(inbound_topic, 0);
+    if (!packet_id) return false;
+
+    // The acknowledgement may have arrived before the ID was known, in which
+    // case the callback left the bit for this to set
+    subscribe_packet_id.store(packet_id);
+    if (suback_packet_id.load() == packet_id)
+        xEventGroupSetBits(transmit_events, SUBSCRIBED_BIT);
+
+    // Wait for the subscription acknowledgement and time out after set time
+    logger_subscribed =
+        timed_wait(LatencyPhase::LoggerSuback, SUBSCRIBED_BIT, start);
+    return logger_subscribed;
 }
 
 /*
@@ -155,26 +324,28 @@ bool logger_subscribe()
  */
 RequestResult logger_get_session(session_t* session_out)
 {
-    char outbound_topic[64] = { '\0' };
-    sprintf(outbound_topic, "nodes/%s/outbound/%u", mac_address, ++publish_id);
+    char outbound_topic[TOPIC_LENGTH] = { '\0' };
+    format_topic(outbound_topic, mac_address, "outbound", ++publish_id);
+
+    xEventGroupClearBits(transmit_events, SESSION_RECEIVED_BIT);
+    awaiting_session = true;
 
+    uint32_t start = millis();
     uint16_t packet_id = logger.publish(outbound_topic, 0, false, "get_session");
+    transmitted_bytes += strlen(outbound_topic) + 11 + MESSAGE_OVERHEAD;
 
     // Check if successfully sent message
     if (!packet_id)
+    {
+        awaiting_session = false;
         return RequestResult::Fail;
-    else awaiting_session = true;
-    delay(1000);
+    }
 
-    // Check result status and time out after set time
-    int checks = 1;
-    while (awaiting_session)
+    // Wait for the response and time out after set time
+    if (!timed_wait(LatencyPhase::LoggerReply, SESSION_RECEIVED_BIT, start))
     {
-        if (checks++ >= logger_timeout)
-        {
-            awaiting_session = false;
-            return RequestResult::Fail;
-        } else delay(1000);
+        awaiting_session = false;
+        return RequestResult::Fail;
     }
 
     if (session_result == RequestResult::Success)
@@ -183,163 +354,554 @@ RequestResult logger_get_session(session_t* session_out)
 }
 
 /*
-    Transmits a report, then waits for a response or times out (blocking). Returns
-    an enum indicating the status.
+    Transmits a batch of reports without waiting for a response. Returns a
+    boolean indicating success or failure, and fails if TRANSMIT_WINDOW batches
+    are already awaiting a response.
+
+    - reports: the reports to transmit, encoded as set by the session
+    - length: the number of bytes in the encoded reports
+    - count: the number of reports in the batch
+    - message_id_out: will be set to the ID of the message, for use with
+    logger_await_report()
+ */
+bool logger_publish_report(const char* reports, size_t length, int count,
+    uint16_t* message_id_out)
+{
+    // Find a free slot to track the response in
+    report_request_t* request = NULL;
+    for (int i = 0; i < TRANSMIT_WINDOW; i++)
+    {
+        if (!report_requests[i].in_use.load())
+        {
+            request = &report_requests[i];
+            break;
+        }
+    }
+
+    if (request == NULL) return false;
+
+    char reports_topic[TOPIC_LENGTH] = { '\0' };
+    format_topic(reports_topic, mac_address, "reports", ++publish_id);
+
+    request->message_id = publish_id;
+    request->count = count;
+    request->accepted = 0;
+    request->sent_time = millis();
+    request->awaiting.store(true);
+    request->in_use.store(true);
+
+    uint16_t packet_id = logger.publish(reports_topic, 0, false, reports, length);
+    transmitted_bytes += strlen(reports_topic) + length + MESSAGE_OVERHEAD;
 
-    - report: the report to transmit in JSON format
+    // Check if successfully sent message
+    if (!packet_id)
+    {
+        request->in_use.store(false);
+        return false;
+    }
+
+    *message_id_out = publish_id;
+    return true;
+}
+
+/*
+    Transmits the timings recorded by the trace (see trace.cpp) as a telemetry
+    message, without waiting for a response (the logging server does not send
+    one). Returns a boolean indicating whether a message was transmitted. The
+    records are kept until the caller knows that the message arrived, which it
+    has once a later message gets a response.
+
+    - last_record_out: will be set to the sequence number of the last record
+    transmitted, for use with trace_discard()
  */
-RequestResult logger_transmit_report(const char* report)
+bool logger_publish_telemetry(uint32_t* last_record_out)
 {
-    char reports_topic[64] = { '\0' };
-    sprintf(reports_topic, "nodes/%s/reports/%u", mac_address, ++publish_id);
+    uint8_t telemetry[TRACE_PAYLOAD_SIZE];
+    int length = trace_encode(telemetry, last_record_out);
+    if (length == 0) return false;
+
+    char telemetry_topic[TOPIC_LENGTH] = { '\0' };
+    format_topic(telemetry_topic, mac_address, "telemetry", ++publish_id);
 
-    uint16_t packet_id = logger.publish(reports_topic, 0, false, report);
+    transmitted_bytes += strlen(telemetry_topic) + length + MESSAGE_OVERHEAD;
 
     // Check if successfully sent message
-    if (packet_id)
-        awaiting_report = true;
-    else return RequestResult::Fail;
-    delay(1000);
-
-    // Check result status and time out after set time
-    int checks = 1;
-    while (awaiting_report)
+    return logger.publish(
+        telemetry_topic, 0, false, (const char*)telemetry, length) != 0;
+}
+
+/*
+    Returns the number of bytes of messages (including an estimate of the
+    protocol headers) transmitted to the logging server since waking.
+ */
+uint32_t logger_transmitted_bytes()
+{
+    return transmitted_bytes.load();
+}
+
+/*
+    Waits for the response to a batch of reports transmitted with
+    logger_publish_report() or times out (blocking). Returns an enum indicating
+    the status. The logging server may accept only the first part of a batch, in
+    which case the status is a failure and the number of accepted reports is
+    still reported.
+
+    - message_id: the ID of the message containing the batch
+    - accepted_out: will be set to the number of reports (counted from the start
+    of the batch) that the logging server accepted
+ */
+RequestResult logger_await_report(uint16_t message_id, int* accepted_out)
+{
+    *accepted_out = 0;
+
+    report_request_t* request = find_report_request(message_id);
+    if (request == NULL) return RequestResult::Fail;
+
+    // Wait for the response and time out after set time (measured from when
+    // the batch was transmitted). Responses to other batches also wake this up
+    uint32_t timeout = logger_reply_timeout();
+    while (request->awaiting.load())
     {
-        if (checks++ >= logger_timeout)
+        uint32_t elapsed = millis() - request->sent_time;
+        if (elapsed >= timeout ||
+            !wait_for_event(REPORT_RECEIVED_BIT, timeout - elapsed))
         {
-            awaiting_report = false;
-            return RequestResult::Fail;
-        } else delay(1000);
+            if (request->awaiting.load())
+            {
+                latency_record_timeout(&latency[LatencyPhase::LoggerReply]);
+                request->in_use.store(false);
+                return RequestResult::Fail;
+            }
+        }
     }
 
-    return report_result;
+    // The response may have arrived while an earlier batch was awaited
+    latency_record(&latency[LatencyPhase::LoggerReply],
+        request->received_time - request->sent_time);
+    request->in_use.store(false);
+    *accepted_out = request->accepted;
+    return request->result;
 }
 
-
 /*
-    Callback for when a subscription acknowledgement is received from the logging
-    server (see Async MQTT Client library).
+    Returns the number of milliseconds to wait for a response from the logging
+    server, which is the configured timeout shortened to what earlier responses
+    suggest is enough (see latency.cpp).
  */
-void logger_on_subscribe(uint16_t packet_id, uint8_t qos)
+uint32_t logger_reply_timeout()
 {
-    if (awaiting_subscribe && packet_id == subscribe_id)
-        awaiting_subscribe = false;
+    return latency_deadline(
+        latency[LatencyPhase::LoggerReply], logger_timeout * 1000UL);
 }
 
 /*
-    Callback for when message is received from the logging server (see Async MQTT
-    client library).
+    Applies any changes to the session that were sent by the logging server
+    along with its responses to transmitted batches. Returns a boolean
+    indicating whether the session was changed. Changes that would produce an
+    invalid session are discarded.
+
+    - session: the current session, which is updated in place
  */
-void logger_on_message(char* topic, char* payload,
-    AsyncMqttClientMessageProperties properties, size_t length, size_t index,
-    size_t total)
+bool logger_get_session_update(session_t* session)
 {
-    // Get ID of received message from the final topic element
-    uint16_t message_id = (uint16_t)strtoul(
-        topic + std::string(topic).find_last_of('/') + 1, NULL, 10);
+    if (session_update_fields == 0) return false;
+
+    session_t temp_session = *session;
+    apply_session_fields(&temp_session, session_update, session_update_fields);
+
+    session_update_fields = 0;
+    if (!is_session_valid(temp_session)) return false;
+
+    if (temp_session.session_id == session->session_id &&
+        temp_session.interval == session->interval &&
+        temp_session.batch_size == session->batch_size &&
+        temp_session.encoding == session->encoding &&
+        temp_session.sample_period == session->sample_period &&
+        temp_session.airt_deadband == session->airt_deadband &&
+        temp_session.relh_deadband == session->relh_deadband &&
+        temp_session.max_silence == session->max_silence &&
+        temp_session.transmit_slot == session->transmit_slot &&
+        temp_session.upload_order == session->upload_order &&
+        temp_session.report_period == session->report_period)
+    { return false; }
+
+    *session = temp_session;
+    return true;
+}
 
-    if (message_id != publish_id) return;
+/*
+    Returns the in-use report request slot for a message ID, or NULL if there is
+    none.
 
-    // Copy message into memory to remove unwanted trailing characters
-    char* message = (char*)calloc(length + 1, sizeof(char));
-    memcpy(message, payload, length);
+    - message_id: the ID of the message containing the batch
+ */
+report_request_t* find_report_request(uint16_t message_id)
+{
+    for (int i = 0; i < TRANSMIT_WINDOW; i++)
+    {
+        if (report_requests[i].in_use.load() &&
+            report_requests[i].message_id == message_id)
+        { return &report_requests[i]; }
+    }
+
+    return NULL;
+}
 
 
-    // Process the received message
-    if (awaiting_session)
+/*
+    Starts the transmit task (see transmit_task()) on the core that runs the WiFi
+    stack. The calling task then hands it serialised batches with
+    transmit_reserve_batch() and transmit_submit_batch(), and collects the
+    responses with transmit_take_result(), then calls transmit_stop() once the
+    task has finished. Should be called after network_begin().
+ */
+void transmit_start()
+{
+    main_task = xTaskGetCurrentTaskHandle();
+    xEventGroupClearBits(transmit_events, TRANSMIT_DONE_BIT);
+    batch_queue.clear();
+    result_queue.clear();
+    batches_ended.store(false);
+    transmit_connect_millis.store(0);
+    transmit_task_state.store(TransmitState::Connecting);
+    transmit_start_time = millis();
+
+    if (xTaskCreatePinnedToCore(transmit_task, "transmit", TRANSMIT_TASK_STACK,
+        NULL, TRANSMIT_TASK_PRIORITY, &transmit_task_handle,
+        TRANSMIT_TASK_CORE) != pdPASS)
     {
-        if (strcmp(message, "no_session") == 0)
-            session_result = RequestResult::NoSession;
-        else if (strcmp(message, "error") == 0)
-            session_result = RequestResult::Fail;
+        transmit_task_handle = NULL;
+        transmit_task_state.store(TransmitState::ConnectFailed);
+    }
+}
 
-        else
-        {
-            // Deserialise the JSON containing the session
-            StaticJsonDocument<JSON_OBJECT_SIZE(3)> document;
-            DeserializationError json_status = deserializeJson(document, message);
-            
-            if (json_status != DeserializationError::Ok)
-            {
-                session_result = RequestResult::Fail;
-                awaiting_session = false;
+/*
+    Returns the progress of the transmit task.
+ */
+TransmitState transmit_state()
+{
+    return (TransmitState)transmit_task_state.load();
+}
 
-                free(message);
-                return;
-            }
+/*
+    Returns the number of milliseconds the transmit task took to connect to the
+    logging server (or to fail to), measured from when it was started.
+ */
+uint32_t transmit_connect_time()
+{
+    return transmit_connect_millis.load();
+}
 
+/*
+    Returns a free batch slot to serialise a batch into, or NULL if the queue of
+    batches is full.
+ */
+batch_slot_t* transmit_reserve_batch()
+{
+    return batch_queue.reserve();
+}
+
+/*
+    Hands the batch in the slot returned by transmit_reserve_batch() to the
+    transmit task.
+ */
+void transmit_submit_batch()
+{
+    batch_queue.push();
+    if (transmit_task_handle != NULL) xTaskNotifyGive(transmit_task_handle);
+}
 
-            JsonObject json_object = document.as<JsonObject>();
+/*
+    Tells the transmit task that no more batches will be submitted, so it can
+    finish once the queued batches have been responded to.
+ */
+void transmit_end_batches()
+{
+    if (batches_ended.exchange(true)) return;
+    if (transmit_task_handle != NULL) xTaskNotifyGive(transmit_task_handle);
+}
 
-            bool field_error = false;
-            session_t temp_session;
+/*
+    Takes the oldest response to a transmitted batch. Returns a boolean
+    indicating whether there was one. Responses are in the order the batches
+    were submitted.
 
-            // Check that all values are present in the JSON
-            if (json_object.containsKey("session_id"))
-            {
-                JsonVariant value = json_object.getMember("session_id");
+    - result_out: the response
+ */
+bool transmit_take_result(batch_result_t* result_out)
+{
+    batch_result_t* result = result_queue.peek();
+    if (result == NULL) return false;
 
-                if (value.is<uint16_t>())
-                    temp_session.session_id = value;
-                else field_error = true;
-            } else field_error = true;
+    *result_out = *result;
+    result_queue.pop();
 
-            if (json_object.containsKey("interval"))
-            {
-                JsonVariant value = json_object.getMember("interval");
-                
-                if (value.is<uint8_t>())
-                    temp_session.interval = value;
-                else field_error = true;
-            } else field_error = true;
-
-            if (json_object.containsKey("batch_size"))
-            {
-                JsonVariant value = json_object.getMember("batch_size");
-                
-                if (value.is<uint8_t>())
-                    temp_session.batch_size = value;
-                else field_error = true;
-            } else field_error = true;
+    // The transmit task may be waiting for room in the queue
+    if (transmit_task_handle != NULL) xTaskNotifyGive(transmit_task_handle);
+    return true;
+}
+
+/*
+    Waits until the transmit task makes progress or times out (blocking).
+
+    - timeout: the maximum number of milliseconds to wait
+ */
+void transmit_wait(uint32_t timeout)
+{
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeout));
+}
+
+/*
+    Deletes the transmit task once it has finished (see transmit_state()), which
+    is left to the calling task so that the transmit task is never notified
+    after it is deleted. Waits for the transmit task to signal that it is done
+    with the queues first (blocking).
+ */
+void transmit_stop()
+{
+    if (transmit_task_handle == NULL) return;
 
+    xEventGroupWaitBits(transmit_events, TRANSMIT_DONE_BIT, pdTRUE, pdTRUE,
+        portMAX_DELAY);
+    vTaskDelete(transmit_task_handle);
+    transmit_task_handle = NULL;
+}
 
-            // Validate the values
-            if (!field_error)
+/*
+    Connects to the WiFi network and the logging server, then transmits the
+    submitted batches, keeping up to TRANSMIT_WINDOW batches awaiting a response
+    at once. Responses are passed back in order. Stops after the first batch
+    that is not fully accepted, or once no more batches will be submitted and
+    all have been responded to. Runs as a FreeRTOS task, which suspends itself
+    when done and is deleted by transmit_stop().
+ */
+void transmit_task(void* parameters)
+{
+    bool connected = network_connect();
+    trace_record(TracePhase::NetworkConnect, network_start_trace, trace_time(),
+        !connected ? TraceOutcome::Failed :
+        used_network_cache ? TraceOutcome::Reconnected : TraceOutcome::Succeeded);
+
+    uint32_t start = trace_time();
+    connected = connected && logger_connect();
+    trace_record(TracePhase::LoggerConnect, start, trace_time(),
+        connected ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+
+    start = trace_time();
+    connected = connected && logger_subscribe();
+    trace_record(TracePhase::LoggerSubscribe, start, trace_time(),
+        connected ? TraceOutcome::Succeeded : TraceOutcome::Failed);
+    transmit_connect_millis.store(millis() - transmit_start_time);
+    transmit_task_state.store(
+        connected ? TransmitState::Connected : TransmitState::ConnectFailed);
+    xTaskNotifyGive(main_task);
+
+    if (connected)
+    {
+        uint16_t window_ids[TRANSMIT_WINDOW];
+        int window_counts[TRANSMIT_WINDOW];
+        int window_valid[TRANSMIT_WINDOW];
+        uint32_t window_times[TRANSMIT_WINDOW];
+        int window_length = 0;
+        bool failed = false;
+
+        // Send the timings of earlier wakes ahead of the reports. Messages
+        // arrive in order, so they have arrived once a batch is accepted
+        uint32_t telemetry_last;
+        bool telemetry_sent = logger_publish_telemetry(&telemetry_last);
+
+        while (true)
+        {
+            // Transmit queued batches while there is room in the window
+            batch_slot_t* slot;
+            while (!failed && window_length < TRANSMIT_WINDOW &&
+                (slot = batch_queue.peek()) != NULL)
             {
-                int allowed_intervals[] = ALLOWED_INTERVALS;
-                for (int i = 0; i < ALLOWED_INTERVALS_LEN - 1; i++)
+                if (!logger_publish_report(slot->payload, slot->length,
+                    slot->valid, &window_ids[window_length]))
                 {
-                    // If the interval is valid then perform the rest of the checks
-                    if (allowed_intervals[i] == temp_session.interval)
-                    {
-                        if (temp_session.batch_size >= 1 &&
-                            temp_session.batch_size <= BUFFER_CAPACITY)
-                        {
-                            new_session = temp_session;
-                            session_result = RequestResult::Success;
-                            awaiting_session = false;
-
-                            free(message);
-                            return;
-                        } else session_result = RequestResult::Fail;
-                    }
+                    failed = true;
+                    break;
                 }
 
-                session_result = RequestResult::Fail;
-            } else session_result = RequestResult::Fail;
+                window_counts[window_length] = slot->count;
+                window_times[window_length] = trace_time();
+                window_valid[window_length++] = slot->valid;
+                batch_queue.pop();
+                xTaskNotifyGive(main_task);
+            }
+
+            if (window_length == 0)
+            {
+                if (failed || (batches_ended.load() && batch_queue.peek() == NULL))
+                    break;
+
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TRANSMIT_POLL_TIME));
+                continue;
+            }
+
+            // Wait for the response to the oldest batch (responses to later
+            // batches are held until it is their turn)
+            batch_result_t result;
+            result.count = window_counts[0];
+            result.valid = window_valid[0];
+            result.result = logger_await_report(window_ids[0], &result.accepted);
+            trace_record(TracePhase::PublishBatch, window_times[0], trace_time(),
+                result.result == RequestResult::Success ?
+                TraceOutcome::Succeeded : TraceOutcome::Failed);
+
+            window_length--;
+            for (int i = 0; i < window_length; i++)
+            {
+                window_ids[i] = window_ids[i + 1];
+                window_counts[i] = window_counts[i + 1];
+                window_valid[i] = window_valid[i + 1];
+                window_times[i] = window_times[i + 1];
+            }
+
+            if (telemetry_sent && result.result == RequestResult::Success)
+            {
+                trace_discard(telemetry_last);
+                telemetry_sent = false;
+            }
+
+            batch_result_t* result_slot;
+            while ((result_slot = result_queue.reserve()) == NULL)
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TRANSMIT_POLL_TIME));
+
+            *result_slot = result;
+            result_queue.push();
+            xTaskNotifyGive(main_task);
+
+            if (result.result != RequestResult::Success) break;
         }
 
-        awaiting_session = false;
+        transmit_task_state.store(TransmitState::Finished);
     }
-    else if (awaiting_report)
+
+    xTaskNotifyGive(main_task);
+    xEventGroupSetBits(transmit_events, TRANSMIT_DONE_BIT);
+    vTaskSuspend(NULL);
+}
+
+
+/*
+    Waits for an event bit to be set by one of the callbacks or times out
+    (blocking). Returns a boolean indicating whether the bit was set. The bit is
+    cleared again before returning.
+
+    - bit: the event bit to wait for
+    - timeout: the maximum number of milliseconds to wait
+ */
+bool wait_for_event(EventBits_t bit, uint32_t timeout)
+{
+    EventBits_t bits = xEventGroupWaitBits(
+        transmit_events, bit, pdTRUE, pdTRUE, pdMS_TO_TICKS(timeout));
+    return (bits & bit) != 0;
+}
+
+/*
+    Waits for the event bit that completes a phase of talking to the logging
+    server or times out (blocking), and adds the outcome to the latency estimate
+    of the phase. Returns a boolean indicating whether the bit was set.
+
+    - phase: the phase being waited for
+    - bit: the event bit to wait for
+    - start: the time in milliseconds that the request was sent
+ */
+bool timed_wait(LatencyPhase phase, EventBits_t bit, uint32_t start)
+{
+    uint32_t timeout = phase == LatencyPhase::LoggerReply ?
+        logger_reply_timeout() :
+        latency_deadline(latency[phase], logger_timeout * 1000UL);
+
+    uint32_t elapsed = millis() - start;
+    if (!wait_for_event(bit, elapsed < timeout ? timeout - elapsed : 0))
     {
-        if (strcmp(message, "ok") == 0)
-            report_result = RequestResult::Success;
-        else if (strcmp(message, "no_session") == 0)
-            report_result = RequestResult::NoSession;
-        else report_result = RequestResult::Fail;
+        latency_record_timeout(&latency[phase]);
+        return false;
+    }
+
+    latency_record(&latency[phase], millis() - start);
+    return true;
+}
+
 
-        awaiting_report = false;
+/*
+    Callback for when the device is given an IP address by the WiFi network (see
+    WiFi library).
+ */
+void network_on_event(WiFiEvent_t event)
+{
+    xEventGroupSetBits(transmit_events, NETWORK_CONNECTED_BIT);
+}
+
+/*
+    Callback for when a connection acknowledgement is received from the logging
+    server (see Async MQTT Client library). If the logging server has lost the
+    session then the inbound topic will be subscribed to again.
+ */
+void logger_on_connect(bool session_present)
+{
+    logger_session_present = session_present;
+    xEventGroupSetBits(transmit_events, LOGGER_CONNECTED_BIT);
+}
+
+/*
+    Callback for when a subscription acknowledgement is received from the logging
+    server (see Async MQTT Client library). Only the acknowledgement of the
+    subscription being waited for completes the wait, not a stale one.
+ */
+void logger_on_subscribe(uint16_t packet_id, uint8_t qos)
+{
+    suback_packet_id.store(packet_id);
+    if (packet_id == subscribe_packet_id.load())
+        xEventGroupSetBits(transmit_events, SUBSCRIBED_BIT);
+}
+
+/*
+    Callback for when message is received from the logging server (see Async MQTT
+    client library).
+ */
+void logger_on_message(char* topic, char* payload,
+    AsyncMqttClientMessageProperties properties, size_t length, size_t index,
+    size_t total)
+{
+    // Get ID of received message from the final topic element
+    uint16_t message_id = topic_message_id(topic);
+
+    report_request_t* request = find_report_request(message_id);
+    if (message_id != publish_id && request == NULL) return;
+
+    // Copy message into memory to remove unwanted trailing characters
+    char* message = (char*)calloc(length + 1, sizeof(char));
+    memcpy(message, payload, length);
+
+
+    // Process the received message
+    if (awaiting_session && message_id == publish_id)
+    {
+        session_t temp_session;
+        session_result = parse_session_reply(message, &temp_session);
+        if (session_result == RequestResult::Success) new_session = temp_session;
+
+        awaiting_session = false;
+        xEventGroupSetBits(transmit_events, SESSION_RECEIVED_BIT);
+    }
+    else if (request != NULL && request->awaiting.load())
+    {
+        session_t temp_session;
+        int fields;
+        request->result = parse_report_reply(message, request->count,
+            &request->accepted, &temp_session, &fields);
+
+        // Later updates take precedence over earlier ones
+        apply_session_fields(&session_update, temp_session, fields);
+        session_update_fields |= fields;
+
+        request->received_time = millis();
+        request->awaiting.store(false);
+        xEventGroupSetBits(transmit_events, REPORT_RECEIVED_BIT);
     }
 
     free(message);
@@ -1,18 +1,118 @@
+#include <WiFi.h>
 #include <AsyncMqttClient.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <atomic>
 
 #include "helpers/helpers.h"
+#include "helpers/latency.h"
+#include "helpers/protocol.h"
+#include "helpers/queue.h"
 
 
+// Event bits set by the callbacks to signal the completion of blocking operations
+#define NETWORK_CONNECTED_BIT (1 << 0)
+#define LOGGER_CONNECTED_BIT (1 << 1)
+#define SUBSCRIBED_BIT (1 << 2)
+#define SESSION_RECEIVED_BIT (1 << 3)
+#define REPORT_RECEIVED_BIT (1 << 4)
+#define TRANSMIT_DONE_BIT (1 << 5) // Set by the transmit task once it has finished
+
+#define TRANSMIT_TASK_CORE 0 // Core to run the transmit task on (the WiFi stack
+// also runs on this core)
+#define TRANSMIT_TASK_STACK 8192 // Number of bytes of stack for the transmit task
+#define TRANSMIT_TASK_PRIORITY 1 // Priority of the transmit task
+#define TRANSMIT_POLL_TIME 100 // Maximum number of milliseconds that either side of
+// the transmit pipeline waits before checking the queues again
+
+// Details of the last successful connection to the WiFi network
+struct network_cache_t
+{
+    bool valid;
+    uint32_t time;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+// Represents a batch of reports transmitted to the logging server. The flags
+// are also read and written by the MQTT client's task, and publish the other
+// fields: in_use once they are set for a new batch, awaiting once the response
+// has been stored in them
+struct report_request_t
+{
+    std::atomic<bool> in_use;
+    std::atomic<bool> awaiting;
+    uint16_t message_id;
+    uint32_t sent_time;
+    uint32_t received_time; // Time the response arrived, for the latency estimate
+    int count;
+    int accepted;
+    RequestResult result;
+};
+
+// Progress of the transmit task
+enum TransmitState { Connecting, Connected, ConnectFailed, Finished };
+
+// A serialised batch of reports waiting to be transmitted
+struct batch_slot_t
+{
+    char payload[BATCH_PAYLOAD_SIZE];
+    size_t length;
+    int count; // Number of pending reports covered by the batch
+    int valid; // Number of those that were not corrupt (and are in the payload)
+};
+
+// The logging server's response to a transmitted batch
+struct batch_result_t
+{
+    int count;
+    int valid;
+    int accepted;
+    RequestResult result;
+};
+
+
+void network_begin();
 bool network_connect();
 bool is_network_connected();
+void network_end();
+uint32_t network_radio_time();
+void network_forget();
 
 bool logger_connect();
 bool is_logger_connected();
 
 bool logger_subscribe();
 RequestResult logger_get_session(session_t*);
-RequestResult logger_transmit_report(const char*);
+bool logger_publish_report(const char*, size_t, int, uint16_t*);
+bool logger_publish_telemetry(uint32_t*);
+uint32_t logger_transmitted_bytes();
+RequestResult logger_await_report(uint16_t, int*);
+uint32_t logger_reply_timeout();
+report_request_t* find_report_request(uint16_t);
+bool logger_get_session_update(session_t*);
+
+void transmit_start();
+TransmitState transmit_state();
+uint32_t transmit_connect_time();
+batch_slot_t* transmit_reserve_batch();
+void transmit_submit_batch();
+void transmit_end_batches();
+bool transmit_take_result(batch_result_t*);
+void transmit_wait(uint32_t);
+void transmit_stop();
+void transmit_task(void*);
+
+bool wait_for_event(EventBits_t, uint32_t);
+bool timed_wait(LatencyPhase, EventBits_t, uint32_t);
 
+void network_on_event(WiFiEvent_t);
+void logger_on_connect(bool);
 void logger_on_subscribe(uint16_t, uint8_t);
 void logger_on_message(char*, char*,
     AsyncMqttClientMessageProperties, size_t, size_t, size_t);
\ No newline at end of file
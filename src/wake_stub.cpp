@@ -0,0 +1,441 @@
+/*
+    A deep sleep wake stub that takes reports without booting the application,
+    for wakes where the reports would not be transmitted anyway. The stub runs
+    from RTC memory straight after waking, so it can only use RTC memory, ROM
+    functions and registers (not the Arduino libraries). It talks to the sensor
+    and the RTC by bit-banging the I2C bus.
+
+    At each wake the stub starts a BME680 measurement, moves the RTC alarm on by
+    one sample period, waits for the measurement and adds the compensated
+    readings to the summary of the current interval (see summary.cpp), then goes
+    back to sleep. At the end of each interval it stores the summary as a
+    report. The sample period is the interval unless reports summarise several
+    samples. Once it has taken the number of reports it was allowed when armed,
+    or the node's transmit slot has come (or anything fails), it lets the device
+    boot fully, which adds the reports to the report buffer.
+ */
+
+#include <esp_attr.h>
+#include <esp_sleep.h>
+#include <rom/gpio.h>
+#include <rom/ets_sys.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/timer_group_reg.h>
+#include <Wire.h>
+
+#include "wake_stub.h"
+
+
+RTC_DATA_ATTR bool stub_enabled = false;
+RTC_DATA_ATTR int stub_budget = 0;
+RTC_DATA_ATTR uint32_t stub_next_time = 0;
+RTC_DATA_ATTR uint32_t stub_period = 0;
+RTC_DATA_ATTR uint32_t stub_interval = 0;
+RTC_DATA_ATTR uint32_t stub_slot = 0;
+RTC_DATA_ATTR int stub_wakes = 0;
+RTC_DATA_ATTR int stub_reports_count = 0;
+RTC_DATA_ATTR stub_report_t stub_reports[STUB_CAPACITY];
+
+// The samples taken so far in the current interval, by the stub or a full boot
+RTC_DATA_ATTR summary_t summary_airt;
+RTC_DATA_ATTR summary_t summary_relh;
+
+RTC_DATA_ATTR bool bme680_calibrated = false;
+RTC_DATA_ATTR bme680_calibration_t bme680_calibration;
+
+
+/*
+    Releases (high) or drives low a line of the I2C bus. The lines are pulled up
+    externally, so they are never driven high.
+ */
+static void RTC_IRAM_ATTR stub_i2c_line(int pin, bool high)
+{
+    if (high) gpio_output_set(0, 0, 0, 1 << pin);
+    else gpio_output_set(0, 1 << pin, 1 << pin, 0);
+    ets_delay_us(STUB_I2C_DELAY);
+}
+
+static bool RTC_IRAM_ATTR stub_i2c_write_byte(uint8_t value)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        stub_i2c_line(STUB_SDA_PIN, (value >> i) & 1);
+        stub_i2c_line(STUB_SCL_PIN, true);
+        stub_i2c_line(STUB_SCL_PIN, false);
+    }
+
+    // Read the acknowledgement
+    stub_i2c_line(STUB_SDA_PIN, true);
+    stub_i2c_line(STUB_SCL_PIN, true);
+    bool ack = (gpio_input_get() & (1 << STUB_SDA_PIN)) == 0;
+    stub_i2c_line(STUB_SCL_PIN, false);
+    return ack;
+}
+
+static uint8_t RTC_IRAM_ATTR stub_i2c_read_byte(bool ack)
+{
+    uint8_t value = 0;
+    stub_i2c_line(STUB_SDA_PIN, true);
+
+    for (int i = 0; i < 8; i++)
+    {
+        stub_i2c_line(STUB_SCL_PIN, true);
+        value = (value << 1) | ((gpio_input_get() >> STUB_SDA_PIN) & 1);
+        stub_i2c_line(STUB_SCL_PIN, false);
+    }
+
+    stub_i2c_line(STUB_SDA_PIN, !ack);
+    stub_i2c_line(STUB_SCL_PIN, true);
+    stub_i2c_line(STUB_SCL_PIN, false);
+    stub_i2c_line(STUB_SDA_PIN, true);
+    return value;
+}
+
+static void RTC_IRAM_ATTR stub_i2c_start()
+{
+    stub_i2c_line(STUB_SDA_PIN, true);
+    stub_i2c_line(STUB_SCL_PIN, true);
+    stub_i2c_line(STUB_SDA_PIN, false);
+    stub_i2c_line(STUB_SCL_PIN, false);
+}
+
+static void RTC_IRAM_ATTR stub_i2c_stop()
+{
+    stub_i2c_line(STUB_SDA_PIN, false);
+    stub_i2c_line(STUB_SCL_PIN, true);
+    stub_i2c_line(STUB_SDA_PIN, true);
+}
+
+static bool RTC_IRAM_ATTR stub_write(
+    uint8_t address, uint8_t reg, const uint8_t* data, int length)
+{
+    stub_i2c_start();
+    bool ack = stub_i2c_write_byte(address << 1) && stub_i2c_write_byte(reg);
+    for (int i = 0; ack && i < length; i++)
+        ack = stub_i2c_write_byte(data[i]);
+
+    stub_i2c_stop();
+    return ack;
+}
+
+static bool RTC_IRAM_ATTR stub_read(
+    uint8_t address, uint8_t reg, uint8_t* data, int length)
+{
+    stub_i2c_start();
+    bool ack = stub_i2c_write_byte(address << 1) && stub_i2c_write_byte(reg);
+
+    // Repeated start, then read
+    if (ack)
+    {
+        stub_i2c_start();
+        ack = stub_i2c_write_byte((address << 1) | 1);
+    }
+
+    for (int i = 0; ack && i < length; i++)
+        data[i] = stub_i2c_read_byte(i < length - 1);
+
+    stub_i2c_stop();
+    return ack;
+}
+
+static uint8_t RTC_IRAM_ATTR stub_to_bcd(uint32_t value)
+{
+    return ((value / 10) << 4) | (value % 10);
+}
+
+/*
+    The wake stub (replaces the default one provided by ESP-IDF). Returns to let
+    the device boot fully, otherwise goes back to sleep without returning.
+ */
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void)
+{
+    esp_default_wake_deep_sleep();
+    if (!stub_enabled) return;
+
+    // A report that is over the budget is taken by the full boot
+    uint32_t time = stub_next_time;
+    bool report_due = time % stub_interval < stub_period;
+    if (report_due && stub_reports_count >= stub_budget) return;
+
+    // The full boot transmits in the slot
+    if (stub_slot != 0 && time >= stub_slot) return;
+
+    gpio_pad_select_gpio(STUB_SDA_PIN);
+    gpio_pad_select_gpio(STUB_SCL_PIN);
+    stub_i2c_line(STUB_SDA_PIN, true);
+    stub_i2c_line(STUB_SCL_PIN, true);
+
+    // Start a forced mode measurement with the same oversampling as the full
+    // boot (2x humidity, 8x temperature, no pressure)
+    uint8_t value = 0x02;
+    bool measuring = stub_write(STUB_BME680_ADDRESS, 0x72, &value, 1);
+    value = 0x81;
+    measuring = measuring && stub_write(STUB_BME680_ADDRESS, 0x74, &value, 1);
+
+    // Move the alarm (minutes and seconds match) on to the next sample and
+    // clear the alarm flag, while the measurement runs
+    uint32_t next_time = stub_next_time + stub_period;
+    uint8_t alarm[2] =
+        { stub_to_bcd(next_time % 60), stub_to_bcd((next_time / 60) % 60) };
+    uint8_t status;
+
+    if (!stub_write(STUB_DS3231_ADDRESS, 0x07, alarm, 2) ||
+        !stub_read(STUB_DS3231_ADDRESS, 0x0F, &status, 1))
+    {
+        stub_enabled = false;
+        return;
+    }
+
+    status &= ~0x01;
+    if (!stub_write(STUB_DS3231_ADDRESS, 0x0F, &status, 1))
+    {
+        stub_enabled = false;
+        return;
+    }
+
+    stub_next_time = next_time;
+
+    // Wait for the measurement and read the temperature and humidity registers
+    for (int i = 0; measuring && i < STUB_MEASURE_TIMEOUT; i++)
+    {
+        REG_WRITE(TIMG_WDTFEED_REG(0), 1);
+
+        uint8_t status;
+        if (!stub_read(STUB_BME680_ADDRESS, 0x1D, &status, 1)) break;
+
+        if (status & 0x80)
+        {
+            uint8_t data[5];
+            if (stub_read(STUB_BME680_ADDRESS, 0x22, data, 5))
+            {
+                uint32_t temp_adc = ((uint32_t)data[0] << 12) |
+                    ((uint32_t)data[1] << 4) | (data[2] >> 4);
+                uint16_t hum_adc = ((uint16_t)data[3] << 8) | data[4];
+
+                int16_t airt, relh;
+                bme680_compensate(temp_adc, hum_adc, &airt, &relh);
+                summary_add(&summary_airt, airt);
+                summary_add(&summary_relh, relh);
+            }
+            break;
+        }
+
+        ets_delay_us(1000);
+    }
+
+    stub_wakes++;
+    if (report_due)
+    {
+        stub_report_t* report = &stub_reports[stub_reports_count++];
+        report->time = time;
+        report->airt = summary_airt;
+        report->relh = summary_relh;
+        summary_reset(&summary_airt);
+        summary_reset(&summary_relh);
+    }
+
+    // Go back to sleep, running this stub again on the next wake
+    REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)(uintptr_t)&esp_wake_deep_sleep);
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+    while (true);
+}
+
+
+/*
+    Allows the wake stub to take samples and reports at the next wakes instead of
+    fully booting. Returns a boolean indicating whether the stub was armed. Must
+    be called after the BME680 has been set up and any reports taken by the stub
+    have been collected.
+
+    - next_time: the time of the next alarm (the RTC alarm must already be set)
+    - period: the number of seconds between samples
+    - interval: the number of seconds between reports (a multiple of period)
+    - budget: the number of reports the stub may take before fully booting
+    - slot: the time of the transmit slot to fully boot at, or 0 if none
+ */
+bool stub_arm(uint32_t next_time, uint32_t period, uint32_t interval, int budget,
+    uint32_t slot)
+{
+    stub_disarm();
+
+    // With no reports allowed, the stub can still take the samples before the
+    // next report
+    if (budget <= 0 && period == interval) return false;
+    if (!bme680_calibrated && !bme680_read_calibration()) return false;
+
+    stub_next_time = next_time;
+    stub_period = period;
+    stub_interval = interval;
+    stub_slot = slot;
+    stub_budget = max(0, min(budget, STUB_CAPACITY));
+    stub_enabled = true;
+    return true;
+}
+
+/*
+    Stops the wake stub taking reports and discards any it has taken.
+ */
+void stub_disarm()
+{
+    stub_enabled = false;
+    stub_wakes = 0;
+    stub_reports_count = 0;
+}
+
+/*
+    Returns the number of reports taken by the wake stub since it was armed.
+ */
+int stub_count()
+{
+    return stub_reports_count;
+}
+
+/*
+    Returns the number of times the wake stub has run since it was armed.
+ */
+int stub_wake_count()
+{
+    return stub_wakes;
+}
+
+/*
+    Returns a report taken by the wake stub.
+
+    - position: the position of the report (0 is the oldest)
+ */
+report_t stub_get_report(int position)
+{
+    const stub_report_t& stub_report = stub_reports[position];
+    report_t report = { stub_report.time, -99, -99, -99 };
+
+    report.airt = summary_mean(stub_report.airt);
+    report.relh = summary_mean(stub_report.relh);
+    report.samples = stub_report.airt.count;
+    report.airt_stats = summary_stats(stub_report.airt);
+    report.relh_stats = summary_stats(stub_report.relh);
+    return report;
+}
+
+
+/*
+    Adds a sample taken by a full boot to the summary of the current interval.
+
+    - airt: the temperature, or -99 if the measurement failed
+    - relh: the relative humidity, or -99 if the measurement failed
+ */
+void stub_add_sample(float airt, float relh)
+{
+    if (airt == -99 || relh == -99) return;
+
+    summary_add(&summary_airt, pack_value(airt));
+    summary_add(&summary_relh, pack_value(relh));
+}
+
+/*
+    Completes a report from the summary of the current interval, then starts the
+    summary of the next interval.
+
+    - report: the report, which is given the temperature and humidity
+ */
+void stub_finish_summary(report_t* report)
+{
+    report->airt = summary_mean(summary_airt);
+    report->relh = summary_mean(summary_relh);
+    report->samples = summary_airt.count;
+    report->airt_stats = summary_stats(summary_airt);
+    report->relh_stats = summary_stats(summary_relh);
+    stub_reset_summary();
+}
+
+/*
+    Discards the samples taken so far in the current interval.
+ */
+void stub_reset_summary()
+{
+    summary_reset(&summary_airt);
+    summary_reset(&summary_relh);
+}
+
+
+/*
+    Reads the calibration values from the BME680 into sleep memory. Returns a
+    boolean indicating success or failure.
+ */
+bool bme680_read_calibration()
+{
+    uint8_t coeff1[25];
+    uint8_t coeff2[16];
+    uint8_t* blocks[] = { coeff1, coeff2 };
+    uint8_t registers[] = { 0x89, 0xE1 };
+    uint8_t lengths[] = { 25, 16 };
+
+    for (int i = 0; i < 2; i++)
+    {
+        Wire.beginTransmission(STUB_BME680_ADDRESS);
+        Wire.write(registers[i]);
+        if (Wire.endTransmission(false) != 0) return false;
+
+        if (Wire.requestFrom((uint8_t)STUB_BME680_ADDRESS, lengths[i]) != lengths[i])
+            return false;
+        for (int j = 0; j < lengths[i]; j++)
+            blocks[i][j] = Wire.read();
+    }
+
+    bme680_calibration.par_t1 = coeff2[8] | (coeff2[9] << 8);
+    bme680_calibration.par_t2 = coeff1[1] | (coeff1[2] << 8);
+    bme680_calibration.par_t3 = coeff1[3];
+    bme680_calibration.par_h1 = (coeff2[2] << 4) | (coeff2[1] & 0x0F);
+    bme680_calibration.par_h2 = (coeff2[0] << 4) | (coeff2[1] >> 4);
+    bme680_calibration.par_h3 = coeff2[3];
+    bme680_calibration.par_h4 = coeff2[4];
+    bme680_calibration.par_h5 = coeff2[5];
+    bme680_calibration.par_h6 = coeff2[6];
+    bme680_calibration.par_h7 = coeff2[7];
+
+    bme680_calibrated = true;
+    return true;
+}
+
+/*
+    Converts uncompensated BME680 readings into a temperature and relative
+    humidity, using the integer formulas from the BME680 datasheet. Runs in RTC
+    memory so that the wake stub can use it.
+
+    - temp_adc: the uncompensated temperature reading
+    - hum_adc: the uncompensated humidity reading
+    - airt_out: the temperature in hundredths of a degree Celsius
+    - relh_out: the relative humidity in hundredths of a percent
+ */
+void RTC_IRAM_ATTR bme680_compensate(
+    uint32_t temp_adc, uint16_t hum_adc, int16_t* airt_out, int16_t* relh_out)
+{
+    const bme680_calibration_t& cal = bme680_calibration;
+
+    int32_t var1 = ((int32_t)temp_adc >> 3) - ((int32_t)cal.par_t1 << 1);
+    int32_t var2 = (var1 * (int32_t)cal.par_t2) >> 11;
+    int32_t var3 = ((var1 >> 1) * (var1 >> 1)) >> 12;
+    var3 = (var3 * ((int32_t)cal.par_t3 << 4)) >> 14;
+    int32_t t_fine = var2 + var3;
+    int32_t temp_comp = ((t_fine * 5) + 128) >> 8; // Hundredths of a degree
+
+    int32_t temp_scaled = temp_comp;
+    var1 = (int32_t)(hum_adc - ((int32_t)cal.par_h1 * 16)) -
+        (((temp_scaled * (int32_t)cal.par_h3) / 100) >> 1);
+    var2 = ((int32_t)cal.par_h2 * (((temp_scaled * (int32_t)cal.par_h4) / 100) +
+        (((temp_scaled * ((temp_scaled * (int32_t)cal.par_h5) / 100)) >> 6) / 100) +
+        (int32_t)(1 << 14))) >> 10;
+    var3 = var1 * var2;
+    int32_t var4 = (int32_t)cal.par_h6 << 7;
+    var4 = (var4 + ((temp_scaled * (int32_t)cal.par_h7) / 100)) >> 4;
+    int32_t var5 = ((var3 >> 14) * (var3 >> 14)) >> 10;
+    int32_t var6 = (var4 * var5) >> 1;
+    int32_t hum_comp = (((var3 + var6) >> 10) * 1000) >> 12; // Thousandths of a
+    // percent
+
+    if (hum_comp > 100000) hum_comp = 100000;
+    else if (hum_comp < 0) hum_comp = 0;
+
+    *airt_out = temp_comp;
+    *relh_out = (hum_comp + 5) / 10;
+}
@@ -0,0 +1,58 @@
+#include <stdint.h>
+
+#include "helpers/helpers.h"
+#include "helpers/summary.h"
+
+#ifndef WAKE_STUB_H
+#define WAKE_STUB_H
+
+#define STUB_CAPACITY 32 // Maximum number of reports the wake stub can take before
+// the device must fully boot
+#define STUB_SDA_PIN 21 // The I2C data pin
+#define STUB_SCL_PIN 22 // The I2C clock pin
+#define STUB_I2C_DELAY 5 // Number of microseconds per half clock cycle of the I2C
+// bus (roughly 100 kHz)
+#define STUB_MEASURE_TIMEOUT 100 // Number of milliseconds to wait for a BME680
+// measurement
+#define STUB_BME680_ADDRESS 0x76
+#define STUB_DS3231_ADDRESS 0x68
+
+// A report taken by the wake stub, holding the summaries of the samples taken
+// over its interval
+struct stub_report_t
+{
+    uint32_t time;
+    summary_t airt;
+    summary_t relh;
+};
+
+// Calibration values read from the BME680, used to compensate the readings
+struct bme680_calibration_t
+{
+    uint16_t par_t1;
+    int16_t par_t2;
+    int8_t par_t3;
+    uint16_t par_h1;
+    uint16_t par_h2;
+    int8_t par_h3;
+    int8_t par_h4;
+    int8_t par_h5;
+    uint8_t par_h6;
+    int8_t par_h7;
+};
+
+
+bool stub_arm(uint32_t, uint32_t, uint32_t, int, uint32_t);
+void stub_disarm();
+int stub_count();
+int stub_wake_count();
+report_t stub_get_report(int);
+
+void stub_add_sample(float, float);
+void stub_finish_summary(report_t*);
+void stub_reset_summary();
+
+bool bme680_read_calibration();
+void bme680_compensate(uint32_t, uint16_t, int16_t*, int16_t*);
+
+#endif
@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# Builds and runs the host tests, which cover the parts of the firmware that do
+# not depend on the device (see the top of each test for what it checks), and
+# scenarios that run the whole firmware in the simulator (see sim/). Run from
+# the root of the repository, with ArduinoJson 6 from the native
+# environment's dependencies (pio pkg install -e native), or with ARDUINOJSON set
+# to the directory holding ArduinoJson.h:
+#
+#     sh test/run_tests.sh [name...]
+#
+# Exits with a non-zero status if any test fails to build or fails.
+
+ARDUINOJSON=${ARDUINOJSON:-.pio/libdeps/native/ArduinoJson/src}
+BUILD=${BUILD:-.pio/build/test}
+FLAGS="-std=gnu++11 -O2 -Wall -I src/helpers -I sim/include -I $ARDUINOJSON"
+HELPERS="src/helpers/helpers.cpp"
+
+mkdir -p "$BUILD" || exit 1
+failed=0
+
+# Builds a test from its sources and runs it, unless names were given and it is
+# not one of them
+run_test()
+{
+    name=$1
+    shift
+
+    if [ -n "$SELECTED" ] && ! echo " $SELECTED " | grep -q " $name "; then
+        return
+    fi
+
+    echo "== $name"
+    if ! g++ $FLAGS "$@" -o "$BUILD/$name" -pthread; then
+        failed=1
+    elif ! "$BUILD/$name"; then
+        failed=1
+    fi
+}
+
+# Builds the firmware against the simulator (as the native environment does)
+# with extra compiler flags, and runs a scenario in it, which fails if any
+# report is lost or recorded as lost, unless names were given and it is not one
+# of them
+run_sim()
+{
+    name=$1
+    defines=$2
+    shift 2
+
+    if [ -n "$SELECTED" ] && ! echo " $SELECTED " | grep -q " $name "; then
+        return
+    fi
+
+    echo "== $name"
+    if ! g++ $FLAGS -I src $defines src/*.cpp src/helpers/*.cpp sim/src/*.cpp \
+        -o "$BUILD/$name" -pthread; then
+        failed=1
+    elif ! "$BUILD/$name" "$@" > "$BUILD/$name.out"; then
+        cat "$BUILD/$name.out"
+        failed=1
+    else
+        grep -E "^(reports|telemetry):" "$BUILD/$name.out"
+        if ! grep -q ", 0 lost," "$BUILD/$name.out" ||
+            ! grep -q " 0 reports recorded as lost" "$BUILD/$name.out"; then
+            failed=1
+        fi
+    fi
+}
+
+SELECTED="$*"
+
+run_test test_batches test/test_batches.cpp src/helpers/protocol.cpp \
+    src/helpers/encoding.cpp $HELPERS
+run_test test_encoding test/test_encoding.cpp src/helpers/encoding.cpp $HELPERS
+run_test test_buffer test/test_buffer.cpp $HELPERS
+run_test test_spool test/test_spool.cpp src/helpers/spool.cpp $HELPERS
+run_test test_dump test/test_dump.cpp src/helpers/dump.cpp \
+    src/helpers/encoding.cpp $HELPERS
+run_test test_queue test/test_queue.cpp
+run_test test_latency test/test_latency.cpp src/helpers/latency.cpp
+run_test test_timebase test/test_timebase.cpp src/helpers/timebase.cpp
+run_test test_summary test/test_summary.cpp src/helpers/summary.cpp $HELPERS
+
+# A backlog upload at five second reports that lasts longer than the reports
+# that can be held in memory while transmitting (five minutes of them here)
+run_sim test_held_reports -DHIGH_FREQUENCY_CAPACITY=60 --interval 30 \
+    --report-period 5 --days 2 --outage 3600,43200 --rtt-ms 3000 --reply-loss 0
+
+if [ $failed -ne 0 ]; then
+    echo "FAILED"
+    exit 1
+fi
+echo "PASSED"
@@ -0,0 +1,54 @@
+/*
+    Checks for the host tests in this directory. Each test is a program that runs
+    its checks, prints the ones that fail, and exits with a non-zero status if any
+    did (see run_tests.sh).
+ */
+
+#include <stdio.h>
+
+#ifndef TEST_H
+#define TEST_H
+
+static int test_checks = 0; // Number of checks made
+static int test_failures = 0; // Number of checks that failed
+
+
+// Checks that a condition holds
+#define CHECK(condition) \
+    do { \
+        test_checks++; \
+        if (!(condition)) \
+        { \
+            test_failures++; \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+// Checks that two integers are equal, printing both if not
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        test_checks++; \
+        long long test_expected = (long long)(expected); \
+        long long test_actual = (long long)(actual); \
+        if (test_expected != test_actual) \
+        { \
+            test_failures++; \
+            printf("%s:%d: failed: %s == %s (%lld != %lld)\n", __FILE__, \
+                __LINE__, #expected, #actual, test_expected, test_actual); \
+        } \
+    } while (0)
+
+
+/*
+    Prints the number of checks that failed. Returns the exit status for the
+    test.
+
+    - name: the name of the test
+ */
+static int test_result(const char* name)
+{
+    printf("%s: %d of %d checks failed\n", name, test_failures, test_checks);
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif
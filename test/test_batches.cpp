@@ -0,0 +1,407 @@
+/*
+    Tests transmitting the report buffer in batches against a stand-in for the
+    logging server: the batches are serialised in each encoding (see
+    serialise_reports()), decoded and answered by the stand-in, and the replies
+    are parsed as the node parses them (see parse_report_reply()). Only the
+    reports that the logging server accepted may be removed from the buffer, so
+    every report must arrive exactly once and in order, however the batches are
+    answered.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include -I .pio/libdeps/native/ArduinoJson/src \
+            test/test_batches.cpp src/helpers/protocol.cpp \
+            src/helpers/encoding.cpp src/helpers/helpers.cpp -o test_batches
+        ./test_batches
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "test.h"
+#include "protocol.h"
+#include "encoding.h"
+#include "buffer.h"
+
+#define TEST_SESSION_ID 42
+#define TEST_START_TIME 700000000 // Time of the first report
+
+
+// The ways the stand-in logging server answers a batch
+enum Reply { AcceptAll, AcceptSome, Reject, EndSession };
+
+// A stand-in for the logging server, which keeps the reports it accepts
+struct standin_logger_t
+{
+    std::vector<report_t> accepted;
+    int batches;
+};
+
+
+/*
+    Returns the report with a given index in the test series. Every seventh
+    report is missing its temperature and humidity, as when the sensor fails.
+ */
+static report_t make_report(int index, uint32_t interval)
+{
+    report_t report = { TEST_START_TIME + index * interval, -99, -99, -99 };
+    if (index % 7 != 3)
+    {
+        report.airt = 21.5f + (index % 40) * 0.13f;
+        report.relh = 55.0f - (index % 25) * 0.21f;
+    }
+    report.batv = 3.9f - index * 0.001f;
+    report.samples = 1;
+    return report;
+}
+
+/*
+    Decodes a JSON batch the way the logging server would. Returns the number of
+    reports, or -1 if the batch is malformed.
+ */
+static int decode_json(const char* payload, uint16_t* session_id_out,
+    report_t* reports_out, int capacity)
+{
+    DynamicJsonDocument document(
+        JSON_ARRAY_SIZE(capacity) + capacity * JSON_OBJECT_SIZE(16) + 2048);
+    if (deserializeJson(document, payload) != DeserializationError::Ok)
+        return -1;
+
+    int count = 0;
+    for (JsonObject object : document.as<JsonArray>())
+    {
+        if (count == capacity) return -1;
+        *session_id_out = object["session_id"];
+
+        // The time is compared in the form it was sent in
+        const char* time = object["time"];
+        report_t report = { 0, -99, -99, -99 };
+        for (uint32_t t = TEST_START_TIME; time != NULL && report.time == 0;
+            t += 60)
+        {
+            char formatted[32];
+            format_time(formatted, RtcDateTime(t));
+            if (strcmp(formatted, time) == 0) report.time = t;
+        }
+
+        if (object["airt"].is<float>()) report.airt = object["airt"];
+        if (object["relh"].is<float>()) report.relh = object["relh"];
+        if (object["batv"].is<float>()) report.batv = object["batv"];
+        reports_out[count++] = report;
+    }
+
+    return count;
+}
+
+/*
+    Receives a batch, keeps the reports it accepts and returns the reply.
+
+    - logger: the stand-in logging server
+    - session: the session the batch was serialised for
+    - payload: the serialised batch
+    - length: the number of bytes in the batch
+    - reply: how to answer the batch
+    - reply_out: destination string for the reply
+ */
+static void receive_batch(standin_logger_t* logger, const session_t& session,
+    const char* payload, int length, Reply reply, char* reply_out)
+{
+    report_t batch[UPLOAD_BATCH_SIZE];
+    uint16_t session_id = 0;
+    int count;
+
+    if (session.encoding == ReportEncoding::Binary)
+    {
+        count = decode_reports_binary((const uint8_t*)payload, length,
+            &session_id, batch, UPLOAD_BATCH_SIZE);
+    }
+    else if (session.encoding == ReportEncoding::Delta)
+    {
+        count = decode_reports_delta((const uint8_t*)payload, length,
+            &session_id, batch, UPLOAD_BATCH_SIZE);
+    }
+    else count = decode_json(payload, &session_id, batch, UPLOAD_BATCH_SIZE);
+
+    CHECK(count > 0);
+    CHECK_EQUAL(TEST_SESSION_ID, session_id);
+    logger->batches++;
+
+    int accepted = 0;
+    if (reply == Reply::AcceptAll) accepted = count;
+    else if (reply == Reply::AcceptSome) accepted = count / 2;
+
+    for (int i = 0; i < accepted; i++)
+        logger->accepted.push_back(batch[i]);
+
+    if (reply == Reply::AcceptAll) strcpy(reply_out, "ok");
+    else if (reply == Reply::AcceptSome) sprintf(reply_out, "ok %d", accepted);
+    else if (reply == Reply::Reject) strcpy(reply_out, "error");
+    else strcpy(reply_out, "no_session");
+}
+
+/*
+    Transmits the reports in the buffer in batches as the node does, until the
+    buffer is empty or a batch is not fully accepted. Returns the result of the
+    last batch.
+
+    - replies: how the stand-in answers each batch in turn (the last is
+    repeated)
+ */
+static RequestResult upload(standin_logger_t* logger, const session_t& session,
+    report_buffer_t* buffer, uint8_t* reports,
+    const std::vector<Reply>& replies)
+{
+    RequestResult result = RequestResult::Success;
+    size_t next_reply = 0;
+
+    while (!buffer->is_empty())
+    {
+        int count = buffer->count();
+        if (count > session.batch_size) count = session.batch_size;
+        if (count > UPLOAD_BATCH_SIZE) count = UPLOAD_BATCH_SIZE;
+
+        report_t batch[UPLOAD_BATCH_SIZE];
+        for (int i = 0; i < count; i++)
+            batch[i] = buffer->peek(reports, i);
+
+        static char payload[BATCH_PAYLOAD_SIZE];
+        int length = serialise_reports(
+            payload, session, session.session_id, batch, count);
+        CHECK(length > 0 && length <= BATCH_PAYLOAD_SIZE);
+
+        char reply[32];
+        receive_batch(logger, session, payload, length, replies[next_reply],
+            reply);
+        if (next_reply + 1 < replies.size()) next_reply++;
+
+        int accepted;
+        session_t update;
+        int fields;
+        result = parse_report_reply(reply, count, &accepted, &update, &fields);
+        buffer->discard_rear(accepted);
+
+        if (result != RequestResult::Success) break;
+    }
+
+    return result;
+}
+
+/*
+    Returns a session with a given encoding and batch size.
+ */
+static session_t make_session(uint8_t encoding, uint8_t batch_size)
+{
+    session_t session;
+    memset(&session, 0, sizeof(session));
+    session.session_id = TEST_SESSION_ID;
+    session.interval = 5;
+    session.batch_size = batch_size;
+    session.encoding = encoding;
+    return session;
+}
+
+/*
+    Checks that the stand-in received a number of reports of the test series in
+    order, with their values intact (to the precision of the encoding).
+ */
+static void check_received(const standin_logger_t& logger, int count,
+    uint32_t interval, float tolerance)
+{
+    CHECK_EQUAL(count, logger.accepted.size());
+
+    for (int i = 0; i < count && i < (int)logger.accepted.size(); i++)
+    {
+        report_t expected = make_report(i, interval);
+        const report_t& actual = logger.accepted[i];
+
+        CHECK_EQUAL(expected.time, actual.time);
+        CHECK((expected.airt == -99) == (actual.airt == -99));
+        CHECK((expected.relh == -99) == (actual.relh == -99));
+        CHECK(fabsf(expected.airt - actual.airt) <= tolerance);
+        CHECK(fabsf(expected.relh - actual.relh) <= tolerance);
+        CHECK(fabsf(expected.batv - actual.batv) <= 0.011f);
+    }
+}
+
+/*
+    Fills a buffer with a number of reports of the test series.
+ */
+static void fill_buffer(report_buffer_t* buffer, uint8_t* reports,
+    int count, uint32_t interval)
+{
+    *buffer = report_buffer_t();
+    for (int i = 0; i < count; i++)
+        buffer->push_front(reports, make_report(i, interval));
+}
+
+
+/*
+    A buffer transmitted in full arrives in order in as few batches as the batch
+    size allows, in every encoding.
+ */
+static void test_accept_all()
+{
+    static uint8_t reports[BUFFER_MEMORY];
+    const float tolerances[] = { 0.051f, 0.006f, 0.006f }; // JSON has 1 decimal
+
+    for (uint8_t encoding = 0; encoding < 3; encoding++)
+    {
+        session_t session = make_session(encoding, UPLOAD_BATCH_SIZE);
+        report_buffer_t buffer;
+        fill_buffer(&buffer, reports, 100, session.interval * 60);
+
+        standin_logger_t logger = { std::vector<report_t>(), 0 };
+        RequestResult result = upload(&logger, session, &buffer, reports,
+            std::vector<Reply>(1, Reply::AcceptAll));
+
+        CHECK_EQUAL(RequestResult::Success, result);
+        CHECK(buffer.is_empty());
+        CHECK_EQUAL((100 + UPLOAD_BATCH_SIZE - 1) / UPLOAD_BATCH_SIZE,
+            logger.batches);
+        check_received(logger, 100, session.interval * 60, tolerances[encoding]);
+    }
+}
+
+/*
+    Only the reports that the logging server accepted are removed, so the rest
+    of the batch is transmitted again at the next attempt.
+ */
+static void test_accept_some()
+{
+    static uint8_t reports[BUFFER_MEMORY];
+    session_t session = make_session(ReportEncoding::Binary, 8);
+    report_buffer_t buffer;
+    fill_buffer(&buffer, reports, 20, 300);
+
+    standin_logger_t logger = { std::vector<report_t>(), 0 };
+    std::vector<Reply> replies;
+    replies.push_back(Reply::AcceptAll);
+    replies.push_back(Reply::AcceptSome);
+
+    RequestResult result = upload(&logger, session, &buffer, reports, replies);
+    CHECK_EQUAL(RequestResult::Fail, result);
+    CHECK_EQUAL(2, logger.batches);
+    CHECK_EQUAL(20 - 8 - 4, buffer.count());
+    CHECK_EQUAL(make_report(12, 300).time, buffer.peek_rear(reports).time);
+
+    // The next attempt picks up from the first report that was not accepted
+    result = upload(&logger, session, &buffer, reports,
+        std::vector<Reply>(1, Reply::AcceptAll));
+    CHECK_EQUAL(RequestResult::Success, result);
+    CHECK(buffer.is_empty());
+    check_received(logger, 20, 300, 0.006f);
+}
+
+/*
+    An error removes nothing, and the end of the session removes the whole batch
+    (the reports belong to a session that no longer exists).
+ */
+static void test_error_and_no_session()
+{
+    static uint8_t reports[BUFFER_MEMORY];
+    session_t session = make_session(ReportEncoding::Json, 8);
+    report_buffer_t buffer;
+    fill_buffer(&buffer, reports, 20, 300);
+
+    standin_logger_t logger = { std::vector<report_t>(), 0 };
+    RequestResult result = upload(&logger, session, &buffer, reports,
+        std::vector<Reply>(1, Reply::Reject));
+    CHECK_EQUAL(RequestResult::Fail, result);
+    CHECK_EQUAL(20, buffer.count());
+    CHECK_EQUAL(0, logger.accepted.size());
+
+    result = upload(&logger, session, &buffer, reports,
+        std::vector<Reply>(1, Reply::EndSession));
+    CHECK_EQUAL(RequestResult::NoSession, result);
+    CHECK_EQUAL(12, buffer.count());
+    CHECK_EQUAL(make_report(8, 300).time, buffer.peek_rear(reports).time);
+}
+
+/*
+    Over many wakes, each answered with a random mix of replies, every report
+    taken arrives exactly once and in order, in every encoding.
+ */
+static void test_random_replies()
+{
+    static uint8_t reports[BUFFER_MEMORY];
+    srand(1);
+
+    for (uint8_t encoding = 0; encoding < 3; encoding++)
+    {
+        session_t session = make_session(encoding, 1 + rand() % UPLOAD_BATCH_SIZE);
+        report_buffer_t buffer;
+        standin_logger_t logger = { std::vector<report_t>(), 0 };
+        int taken = 0;
+
+        for (int wake = 0; wake < 500; wake++)
+        {
+            buffer.push_front(reports, make_report(taken++, 300));
+
+            std::vector<Reply> replies;
+            for (int i = 0; i < 4; i++)
+            {
+                int choice = rand() % 10;
+                replies.push_back(choice < 6 ? Reply::AcceptAll :
+                    choice < 8 ? Reply::AcceptSome : Reply::Reject);
+            }
+
+            // Transmit only every few wakes, as the scheduler does
+            if (rand() % 4 == 0)
+                upload(&logger, session, &buffer, reports, replies);
+        }
+
+        upload(&logger, session, &buffer, reports,
+            std::vector<Reply>(1, Reply::AcceptAll));
+        CHECK(buffer.is_empty());
+        check_received(logger, taken, 300, encoding == 0 ? 0.051f : 0.006f);
+    }
+}
+
+/*
+    Changes to the session sent along with an acknowledgement are parsed, and do
+    not stop the reports being accepted.
+ */
+static void test_session_update()
+{
+    int accepted;
+    session_t update;
+    int fields;
+
+    RequestResult result = parse_report_reply(
+        "ok 3 {\"interval\":10,\"batch_size\":4}", 5, &accepted, &update, &fields);
+    CHECK_EQUAL(RequestResult::Fail, result);
+    CHECK_EQUAL(3, accepted);
+    CHECK_EQUAL(SESSION_FIELD_INTERVAL | SESSION_FIELD_BATCH_SIZE, fields);
+    CHECK_EQUAL(10, update.interval);
+    CHECK_EQUAL(4, update.batch_size);
+
+    result = parse_report_reply("ok {\"session_id\":7}", 5, &accepted, &update,
+        &fields);
+    CHECK_EQUAL(RequestResult::Success, result);
+    CHECK_EQUAL(5, accepted);
+    CHECK_EQUAL(SESSION_FIELD_ID, fields);
+    CHECK_EQUAL(7, update.session_id);
+
+    // A malformed change is ignored, but the reports are still accepted
+    result = parse_report_reply("ok {\"interval\":", 5, &accepted, &update,
+        &fields);
+    CHECK_EQUAL(RequestResult::Success, result);
+    CHECK_EQUAL(5, accepted);
+    CHECK_EQUAL(0, fields);
+
+    result = parse_report_reply("okay", 5, &accepted, &update, &fields);
+    CHECK_EQUAL(RequestResult::Fail, result);
+    CHECK_EQUAL(0, accepted);
+}
+
+int main()
+{
+    test_accept_all();
+    test_accept_some();
+    test_error_and_no_session();
+    test_random_replies();
+    test_session_update();
+    return test_result("test_batches");
+}
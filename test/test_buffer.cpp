@@ -0,0 +1,225 @@
+/*
+    Tests the report buffer (see buffer.h): reports must come back as they were
+    pushed, to the precision of the packed form, single samples must take the
+    narrowest elements, and widening the elements for a summary or a run of
+    suppressed reports must keep the reports already in the buffer.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include test/test_buffer.cpp \
+            src/helpers/helpers.cpp -o test_buffer
+        ./test_buffer
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "buffer.h"
+
+#define TEST_START_TIME 700000000 // Time of the first report
+
+
+uint8_t elements[BUFFER_MEMORY];
+
+
+/*
+    Returns the report with a given index in the test series, holding a single
+    sample (or none, for every 13th report).
+ */
+static report_t make_single(int index)
+{
+    report_t report;
+    memset(&report, 0, sizeof(report));
+    report.time = TEST_START_TIME + index * 60;
+    report.airt = 10 + (index % 90) * 0.13f;
+    report.relh = 30 + (index % 70) * 0.7f;
+    report.batv = 3.5f + (index % 50) * 0.01f;
+    report.samples = 1;
+
+    report.airt_stats = value_stats_t { report.airt, report.airt, 0 };
+    report.relh_stats = value_stats_t { report.relh, report.relh, 0 };
+
+    if (index % 13 == 0)
+    {
+        report.airt = report.relh = -99;
+        report.samples = 0;
+        report.airt_stats = report.relh_stats = value_stats_t { -99, -99, -99 };
+    }
+
+    return report;
+}
+
+/*
+    Returns the report with a given index in the test series, summarising
+    several samples.
+ */
+static report_t make_summary(int index)
+{
+    report_t report = make_single(index);
+    if (report.samples == 0) return report;
+
+    report.samples = 2 + index % 30;
+    report.airt_stats =
+        value_stats_t { report.airt - 0.4f, report.airt + 0.3f, 0.12f };
+    report.relh_stats = value_stats_t { report.relh - 2, report.relh + 1, -99 };
+    return report;
+}
+
+/*
+    Checks that a report came back from the buffer as it was pushed.
+ */
+static void check_report(const report_t& expected, const report_t& actual)
+{
+    CHECK_EQUAL(expected.time, actual.time);
+    CHECK_EQUAL(pack_value(expected.airt), pack_value(actual.airt));
+    CHECK_EQUAL(pack_value(expected.relh), pack_value(actual.relh));
+    CHECK_EQUAL(pack_batv(expected.batv), pack_batv(actual.batv));
+    CHECK_EQUAL(expected.samples, actual.samples);
+    CHECK_EQUAL(pack_value(expected.airt_stats.minimum),
+        pack_value(actual.airt_stats.minimum));
+    CHECK_EQUAL(pack_value(expected.airt_stats.maximum),
+        pack_value(actual.airt_stats.maximum));
+    CHECK_EQUAL(pack_value(expected.airt_stats.deviation),
+        pack_value(actual.airt_stats.deviation));
+    CHECK_EQUAL(pack_value(expected.relh_stats.minimum),
+        pack_value(actual.relh_stats.minimum));
+    CHECK_EQUAL(pack_value(expected.relh_stats.deviation),
+        pack_value(actual.relh_stats.deviation));
+    CHECK_EQUAL(expected.suppressed, actual.suppressed);
+}
+
+
+/*
+    Single samples take 8 bytes each, so the buffer holds BUFFER_CAPACITY of
+    them, and drops the oldest when pushed onto while full.
+ */
+static void test_single_samples()
+{
+    report_buffer_t buffer;
+    CHECK_EQUAL(8, (int)sizeof(packed_report_t));
+    CHECK_EQUAL(BUFFER_MEMORY / 8 - 1, BUFFER_CAPACITY);
+
+    for (int i = 0; i < BUFFER_CAPACITY + 10; i++)
+    {
+        CHECK_EQUAL(i < BUFFER_CAPACITY, buffer.has_room(make_single(i)));
+        buffer.push_front(elements, make_single(i));
+    }
+
+    CHECK_EQUAL(BUFFER_CAPACITY, buffer.capacity());
+    CHECK_EQUAL(BUFFER_CAPACITY, buffer.count());
+    CHECK(buffer.is_full());
+
+    for (int i = 0; i < buffer.count(); i++)
+        check_report(make_single(i + 10), buffer.peek(elements, i));
+}
+
+/*
+    Pushing a summary or a report after suppressed reports widens the elements,
+    keeping the reports already in the buffer (which may wrap around the end of
+    the memory), and the buffer goes back to single samples once empty.
+ */
+static void test_widening()
+{
+    report_buffer_t buffer;
+
+    // Make the reports wrap around the end of the memory
+    for (int i = 0; i < 300; i++)
+        buffer.push_front(elements, make_single(i));
+    buffer.discard_rear(260);
+    for (int i = 300; i < 400; i++)
+        buffer.push_front(elements, make_single(i));
+    CHECK_EQUAL(140, buffer.count());
+
+    report_t suppressed = make_single(400);
+    suppressed.suppressed = 7;
+    CHECK(buffer.has_room(suppressed));
+    buffer.push_front(elements, suppressed);
+    CHECK_EQUAL(BUFFER_MEMORY / 9 - 1, buffer.capacity());
+
+    report_t summary = make_summary(401);
+    CHECK(buffer.has_room(summary));
+    buffer.push_front(elements, summary);
+    CHECK_EQUAL(BUFFER_MEMORY / 22 - 1, buffer.capacity());
+    CHECK_EQUAL(142, buffer.count());
+
+    for (int i = 0; i < 140; i++)
+        check_report(make_single(i + 260), buffer.peek(elements, i));
+    check_report(suppressed, buffer.peek(elements, 140));
+    check_report(summary, buffer.peek(elements, 141));
+
+    // Single samples stay in the wider elements while the buffer holds
+    // summaries
+    buffer.push_front(elements, make_single(402));
+    CHECK_EQUAL(BUFFER_MEMORY / 22 - 1, buffer.capacity());
+    check_report(make_single(402), buffer.peek(elements, 142));
+
+    buffer.discard_rear(buffer.count());
+    buffer.push_front(elements, make_single(403));
+    CHECK_EQUAL(BUFFER_CAPACITY, buffer.capacity());
+}
+
+/*
+    A buffer too full for its elements to be widened has no room for a report
+    that needs them, and widening regardless drops the oldest reports.
+ */
+static void test_widening_when_full()
+{
+    report_buffer_t buffer;
+    for (int i = 0; i < 300; i++)
+        buffer.push_front(elements, make_single(i));
+
+    report_t summary = make_summary(300);
+    CHECK(!buffer.has_room(summary));
+    CHECK(buffer.has_room(make_single(300)));
+
+    buffer.push_front(elements, summary);
+    int capacity = BUFFER_MEMORY / 21 - 1;
+    CHECK_EQUAL(capacity, buffer.capacity());
+    CHECK_EQUAL(capacity, buffer.count());
+
+    for (int i = 0; i < capacity - 1; i++)
+        check_report(make_single(300 - capacity + 1 + i), buffer.peek(elements, i));
+    check_report(summary, buffer.peek(elements, capacity - 1));
+}
+
+/*
+    Summaries pushed onto an empty buffer come back intact, including after
+    removing a range and after the base time moves.
+ */
+static void test_summaries()
+{
+    report_buffer_t buffer;
+    for (int i = 0; i < 100; i++)
+    {
+        report_t report = make_summary(i);
+        report.suppressed = i % 3;
+        buffer.push_front(elements, report);
+    }
+
+    buffer.discard_range(elements, 40, 20);
+    CHECK_EQUAL(80, buffer.count());
+    for (int i = 0; i < 80; i++)
+    {
+        int index = i < 40 ? i : i + 20;
+        report_t expected = make_summary(index);
+        expected.suppressed = index % 3;
+        check_report(expected, buffer.peek(elements, i));
+    }
+
+    // A report too far from the oldest reports for the stored times drops them
+    report_t late = make_summary(100);
+    late.time += PACKED_MAX_TIME - 3000;
+    buffer.push_front(elements, late);
+    CHECK_EQUAL(41, buffer.count());
+    CHECK_EQUAL(make_summary(60).time, buffer.peek_rear(elements).time);
+    check_report(late, buffer.peek(elements, 40));
+}
+
+int main()
+{
+    test_single_samples();
+    test_widening();
+    test_widening_when_full();
+    test_summaries();
+    return test_result("test_buffer");
+}
@@ -0,0 +1,400 @@
+/*
+    Tests the frames for streaming reports over the serial connection (see
+    dump.cpp) in a loopback: frames are built the way build_dump_frame() builds
+    them, joined into a stream with noise between them, then fed in pieces
+    through decode_dump_frame() the way tools/dump_decoder.cpp reads the port.
+    Every report must come out once and in order, noise must be skipped, and a
+    corrupted frame must be rejected so that the transfer resumes from it.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include test/test_dump.cpp src/helpers/dump.cpp \
+            src/helpers/encoding.cpp src/helpers/helpers.cpp -o test_dump
+        ./test_dump
+ */
+
+#include <string.h>
+#include <vector>
+
+#include "test.h"
+#include "dump.h"
+
+#define TEST_REPORTS 300 // Number of pending reports
+#define TEST_SESSION_CHANGE 200 // Position of the first report of a later session
+#define TEST_START_TIME 700000000 // Time of the first report
+
+
+// A report as the node holds it, with the session it belongs to. Corrupt
+// reports are covered by a frame but left out of it
+struct test_pending_t
+{
+    report_t report;
+    uint16_t session_id;
+    bool corrupt;
+};
+
+// A report as received from the stream
+struct test_received_t
+{
+    report_t report;
+    uint16_t session_id;
+};
+
+std::vector<test_pending_t> pending;
+uint64_t random_state = 1;
+
+
+/*
+    Returns the next number from a repeatable random sequence, below a limit.
+ */
+static uint32_t next_random(uint32_t limit)
+{
+    random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (random_state >> 33) % limit;
+}
+
+/*
+    Fills in the pending reports: a series with missing values, summaries,
+    suppressed reports, a few corrupt reports and a change of session.
+ */
+static void make_pending()
+{
+    for (int i = 0; i < TEST_REPORTS; i++)
+    {
+        test_pending_t item;
+        memset(&item, 0, sizeof(item));
+
+        report_t& report = item.report;
+        report.time = TEST_START_TIME + i * 300;
+        report.airt = i % 17 == 3 ? -99 : 18 + (i % 40) * 0.25f;
+        report.relh = 55 + (i % 20) * 0.5f;
+        report.batv = 3.9f - (i / 10) * 0.01f;
+        report.samples = 1 + i % 5;
+
+        value_stats_t none = { -99, -99, -99 };
+        value_stats_t airt_stats = { report.airt - 0.5f, report.airt + 0.5f, 0.2f };
+        value_stats_t relh_stats = { report.relh - 1, report.relh + 1, 0.4f };
+        // Reports of single samples have no spread
+        report.airt_stats =
+            report.airt != -99 && report.samples > 1 ? airt_stats : none;
+        report.relh_stats = report.samples > 1 ? relh_stats : none;
+        report.suppressed = i % 7 == 0 ? 3 : 0;
+
+        item.session_id = i < TEST_SESSION_CHANGE ? 41 : 42;
+        item.corrupt = i % 53 == 20;
+        pending.push_back(item);
+    }
+}
+
+/*
+    Builds a frame holding the pending reports from a position, like
+    build_dump_frame(). Returns the number of bytes written.
+
+    - frame_out: destination buffer (must hold DUMP_MAX_FRAME bytes)
+    - position: position of the first report to include
+    - span_out: will be set to the number of positions covered by the frame
+ */
+static int build_frame(uint8_t* frame_out, uint32_t position, uint16_t* span_out)
+{
+    report_t batch[DUMP_FRAME_REPORTS];
+    uint16_t batch_session_id = 0;
+    int valid = 0;
+    uint16_t span = 0;
+
+    while (position + span < pending.size() && span < DUMP_FRAME_REPORTS)
+    {
+        const test_pending_t& item = pending[position + span];
+        if (!item.corrupt)
+        {
+            if (valid > 0 && item.session_id != batch_session_id) break;
+
+            batch_session_id = item.session_id;
+            batch[valid++] = item.report;
+        }
+
+        span++;
+    }
+
+    uint8_t payload[DUMP_MAX_PAYLOAD];
+    int length = encode_reports_binary(payload, batch_session_id, batch, valid);
+
+    *span_out = span;
+    return encode_dump_frame(frame_out, position, span, payload, length);
+}
+
+/*
+    Appends noise to the stream: random bytes, stray magic bytes, and headers
+    that look valid but whose frames are not.
+ */
+static void add_noise(std::vector<uint8_t>* stream)
+{
+    int kind = next_random(4);
+    int count = next_random(12);
+
+    for (int i = 0; i < count; i++)
+        stream->push_back(next_random(256));
+
+    if (kind == 1) stream->push_back(DUMP_MAGIC_0);
+    else if (kind == 2)
+    {
+        stream->push_back(DUMP_MAGIC_0);
+        stream->push_back(DUMP_MAGIC_1);
+    }
+    else if (kind == 3)
+    {
+        // A header with an impossible payload length
+        uint8_t header[DUMP_HEADER_SIZE] =
+            { DUMP_MAGIC_0, DUMP_MAGIC_1, 0, 0, 0, 0, 1, 0, 0xFF, 0xFF };
+        stream->insert(stream->end(), header, header + DUMP_HEADER_SIZE);
+    }
+}
+
+/*
+    Builds the stream sent in reply to a request to dump from a position: the
+    frames, noise between them if asked, and the final empty frame. Returns the
+    offsets of the frames in the stream.
+
+    - stream: the stream to append to
+    - position: the position to start from
+    - noise: whether to add noise between frames
+ */
+static std::vector<size_t> build_stream(std::vector<uint8_t>* stream,
+    uint32_t position, bool noise)
+{
+    std::vector<size_t> offsets;
+    uint8_t frame[DUMP_MAX_FRAME];
+
+    while (position < pending.size())
+    {
+        if (noise) add_noise(stream);
+
+        uint16_t span;
+        int length = build_frame(frame, position, &span);
+        offsets.push_back(stream->size());
+        stream->insert(stream->end(), frame, frame + length);
+        position += span;
+    }
+
+    if (noise) add_noise(stream);
+    int length = encode_dump_frame(frame, pending.size(), 0, NULL, 0);
+    stream->insert(stream->end(), frame, frame + length);
+    return offsets;
+}
+
+/*
+    Reads a stream in pieces of random sizes, as tools/dump_decoder.cpp reads
+    the port, decoding the reports of each frame. Returns a boolean indicating
+    whether the transfer completed intact, as opposed to stopping at a frame
+    that was lost.
+
+    - stream: the received bytes
+    - position: the position the transfer was requested from, which is set to
+    the position to resume from
+    - received: the reports received are appended to this
+ */
+static bool receive(const std::vector<uint8_t>& stream, uint32_t* position,
+    std::vector<test_received_t>* received)
+{
+    uint8_t buffer[DUMP_MAX_FRAME * 2];
+    int length = 0;
+    size_t offset = 0;
+    bool intact = true;
+
+    while (true)
+    {
+        if (offset == stream.size() && length == 0) return false;
+
+        int piece = 1 + next_random(DUMP_MAX_FRAME);
+        if (piece > (int)sizeof(buffer) - length)
+            piece = sizeof(buffer) - length;
+        if (piece > (int)(stream.size() - offset))
+            piece = stream.size() - offset;
+
+        memcpy(buffer + length, &stream[offset], piece);
+        length += piece;
+        offset += piece;
+
+        while (length > 0)
+        {
+            uint32_t frame_position;
+            uint16_t span;
+            const uint8_t* payload;
+            int payload_length;
+            int frame_length = decode_dump_frame(buffer, length,
+                &frame_position, &span, &payload, &payload_length);
+
+            if (frame_length == 0)
+            {
+                // The rest of the stream cannot complete the frame
+                if (offset < stream.size()) break;
+                frame_length = 1;
+            }
+            else if (frame_length < 0)
+                frame_length = 1;
+            else if (span == 0 && payload_length == 0)
+                return intact && frame_position == *position;
+            else if (intact && frame_position == *position)
+            {
+                uint16_t session_id;
+                report_t reports[DUMP_FRAME_REPORTS];
+                int count = decode_reports_binary(payload, payload_length,
+                    &session_id, reports, DUMP_FRAME_REPORTS);
+
+                if (count >= 0)
+                {
+                    for (int i = 0; i < count; i++)
+                        received->push_back(test_received_t { reports[i], session_id });
+                    *position += span;
+                }
+                else intact = false;
+            }
+            else intact = false;
+
+            length -= frame_length;
+            memmove(buffer, buffer + frame_length, length);
+        }
+    }
+}
+
+/*
+    Checks that the received reports are the pending reports that are not
+    corrupt, in order and with their sessions.
+ */
+static void check_received(const std::vector<test_received_t>& received)
+{
+    size_t next = 0;
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        const test_pending_t& item = pending[i];
+        if (item.corrupt) continue;
+
+        if (next == received.size())
+        {
+            CHECK(false);
+            return;
+        }
+
+        const test_received_t& actual = received[next++];
+        CHECK_EQUAL(item.session_id, actual.session_id);
+        CHECK_EQUAL(item.report.time, actual.report.time);
+        CHECK_EQUAL(pack_value(item.report.airt), pack_value(actual.report.airt));
+        CHECK_EQUAL(pack_value(item.report.relh), pack_value(actual.report.relh));
+        CHECK_EQUAL(pack_batv(item.report.batv), pack_batv(actual.report.batv));
+        CHECK_EQUAL(item.report.samples, actual.report.samples);
+        CHECK_EQUAL(pack_value(item.report.airt_stats.minimum),
+            pack_value(actual.report.airt_stats.minimum));
+        CHECK_EQUAL(pack_value(item.report.relh_stats.maximum),
+            pack_value(actual.report.relh_stats.maximum));
+        CHECK_EQUAL(item.report.suppressed, actual.report.suppressed);
+    }
+
+    CHECK_EQUAL(next, received.size());
+}
+
+
+/*
+    Frames only complete once all of their bytes have arrived, and any change to
+    a frame is detected.
+ */
+static void test_frame()
+{
+    uint8_t frame[DUMP_MAX_FRAME];
+    uint16_t span;
+    int length = build_frame(frame, 0, &span);
+    CHECK_EQUAL(DUMP_FRAME_REPORTS, span);
+
+    uint32_t position;
+    uint16_t decoded_span;
+    const uint8_t* payload;
+    int payload_length;
+    for (int i = 0; i < length; i++)
+    {
+        CHECK_EQUAL(0, decode_dump_frame(frame, i, &position, &decoded_span,
+            &payload, &payload_length));
+    }
+
+    CHECK_EQUAL(length, decode_dump_frame(frame, length, &position,
+        &decoded_span, &payload, &payload_length));
+    CHECK_EQUAL(0, position);
+    CHECK_EQUAL(span, decoded_span);
+    CHECK_EQUAL(length - DUMP_HEADER_SIZE - DUMP_TRAILER_SIZE, payload_length);
+
+    for (int i = 2; i < length; i++)
+    {
+        frame[i] ^= 0x10;
+        CHECK(decode_dump_frame(frame, length, &position, &decoded_span,
+            &payload, &payload_length) != length);
+        frame[i] ^= 0x10;
+    }
+}
+
+/*
+    All reports arrive in order from a clean stream, and from one with noise
+    between the frames.
+ */
+static void test_loopback()
+{
+    for (int noise = 0; noise <= 1; noise++)
+    {
+        std::vector<uint8_t> stream;
+        build_stream(&stream, 0, noise);
+
+        uint32_t position = 0;
+        std::vector<test_received_t> received;
+        CHECK(receive(stream, &position, &received));
+        CHECK_EQUAL(TEST_REPORTS, position);
+        check_received(received);
+    }
+}
+
+/*
+    A corrupted frame is rejected and nothing after it is used, and the transfer
+    resumed from the position it stopped at completes the reports.
+ */
+static void test_corrupted_frame()
+{
+    std::vector<uint8_t> stream;
+    std::vector<size_t> offsets = build_stream(&stream, 0, true);
+    CHECK(offsets.size() > 4);
+
+    // Corrupt a byte in the payload of the fourth frame
+    stream[offsets[3] + DUMP_HEADER_SIZE + 5] ^= 0x01;
+
+    uint32_t position = 0;
+    std::vector<test_received_t> received;
+    CHECK(!receive(stream, &position, &received));
+
+    uint32_t expected = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        uint16_t span;
+        uint8_t frame[DUMP_MAX_FRAME];
+        build_frame(frame, expected, &span);
+        expected += span;
+    }
+    CHECK_EQUAL(expected, position);
+
+    std::vector<uint8_t> resumed;
+    build_stream(&resumed, position, true);
+    CHECK(receive(resumed, &position, &received));
+    CHECK_EQUAL(TEST_REPORTS, position);
+    check_received(received);
+
+    // A stream cut off before the final frame does not complete
+    std::vector<uint8_t> cut;
+    build_stream(&cut, 0, false);
+    cut.resize(cut.size() - 1);
+    position = 0;
+    received.clear();
+    CHECK(!receive(cut, &position, &received));
+    CHECK_EQUAL(TEST_REPORTS, position);
+}
+
+int main()
+{
+    make_pending();
+    test_frame();
+    test_loopback();
+    test_corrupted_frame();
+    return test_result("test_dump");
+}
@@ -0,0 +1,418 @@
+/*
+    Tests the binary and delta report encodings (see encoding.cpp): batches
+    encoded by the node must decode to the same reports, to the precision of the
+    layout, with missing values kept missing, and malformed batches must be
+    rejected.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include test/test_encoding.cpp \
+            src/helpers/encoding.cpp src/helpers/helpers.cpp -o test_encoding
+        ./test_encoding
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "test.h"
+#include "encoding.h"
+#include "buffer.h"
+
+#define TEST_SESSION_ID 513 // Needs both bytes
+#define TEST_START_TIME 700000000 // Time of the first report
+
+
+/*
+    Returns a report holding a single sample.
+ */
+static report_t make_report(uint32_t time, float airt, float relh, float batv)
+{
+    report_t report;
+    memset(&report, 0, sizeof(report));
+    report.time = time;
+    report.airt = airt;
+    report.relh = relh;
+    report.batv = batv;
+    report.samples = 1;
+    return report;
+}
+
+/*
+    Returns a report summarising several samples. A missing value has no
+    spread, as in stub_finish_summary().
+ */
+static report_t make_summary(uint32_t time, float airt, float relh,
+    uint8_t samples, float spread, float deviation)
+{
+    report_t report = make_report(time, airt, relh, 3.7f);
+    report.samples = samples;
+    report.airt_stats.minimum = airt - spread;
+    report.airt_stats.maximum = airt + spread * 2;
+    report.airt_stats.deviation = deviation;
+    report.relh_stats.minimum = relh - spread * 3;
+    report.relh_stats.maximum = relh + spread;
+    report.relh_stats.deviation = deviation;
+
+    value_stats_t none = { -99, -99, -99 };
+    if (airt == -99) report.airt_stats = none;
+    if (relh == -99) report.relh_stats = none;
+    return report;
+}
+
+/*
+    Checks that a value survived encoding, to a tolerance (a missing value must
+    stay missing).
+ */
+static void check_value(float expected, float actual, float tolerance)
+{
+    if (expected == -99) CHECK(actual == -99);
+    else CHECK(actual != -99 && fabsf(expected - actual) <= tolerance);
+}
+
+/*
+    Checks that a report survived encoding. Reports of single samples decode
+    without a spread, in every layout.
+ */
+static void check_report(const report_t& expected, const report_t& actual)
+{
+    CHECK_EQUAL(expected.time, actual.time);
+    check_value(expected.airt, actual.airt, 0.005f);
+    check_value(expected.relh, actual.relh, 0.005f);
+    check_value(expected.batv, actual.batv, 0.0005f);
+    CHECK_EQUAL(expected.suppressed, actual.suppressed);
+
+    if (expected.samples > 1)
+    {
+        CHECK_EQUAL(expected.samples, actual.samples);
+        check_value(expected.airt_stats.minimum, actual.airt_stats.minimum, 0.005f);
+        check_value(expected.airt_stats.maximum, actual.airt_stats.maximum, 0.005f);
+        check_value(expected.airt_stats.deviation, actual.airt_stats.deviation,
+            0.005f);
+        check_value(expected.relh_stats.minimum, actual.relh_stats.minimum, 0.005f);
+        check_value(expected.relh_stats.maximum, actual.relh_stats.maximum, 0.005f);
+        check_value(expected.relh_stats.deviation, actual.relh_stats.deviation,
+            0.005f);
+    }
+    else
+    {
+        CHECK(actual.samples <= 1);
+        if (actual.samples == 0)
+        {
+            CHECK(actual.airt_stats.minimum == -99);
+            CHECK(actual.airt_stats.maximum == -99);
+            CHECK(actual.airt_stats.deviation == -99);
+            CHECK(actual.relh_stats.minimum == -99);
+            CHECK(actual.relh_stats.maximum == -99);
+            CHECK(actual.relh_stats.deviation == -99);
+        }
+    }
+}
+
+/*
+    Encodes a batch in the binary layout, checks its size and version, and
+    checks that it decodes to the same reports.
+
+    - version: the layout the batch should be encoded in
+    - record_size: the number of bytes per report in that layout
+ */
+static void check_binary(const report_t* reports, int count, uint8_t version,
+    int record_size)
+{
+    uint8_t data[BINARY_HEADER_SIZE + BINARY_DEADBAND_SIZE * 255];
+    int length = encode_reports_binary(data, TEST_SESSION_ID, reports, count);
+    CHECK_EQUAL(BINARY_HEADER_SIZE + count * record_size, length);
+    CHECK_EQUAL(version, data[0]);
+
+    report_t decoded[255];
+    uint16_t session_id = 0;
+    CHECK_EQUAL(count,
+        decode_reports_binary(data, length, &session_id, decoded, 255));
+    CHECK_EQUAL(TEST_SESSION_ID, session_id);
+
+    for (int i = 0; i < count; i++)
+        check_report(reports[i], decoded[i]);
+}
+
+
+/*
+    Reports of single samples, including the extremes of the sensor's range and
+    every combination of missing values.
+ */
+static void test_binary_reports()
+{
+    report_t reports[16];
+    int count = 0;
+    reports[count++] = make_report(TEST_START_TIME, 21.37f, 48.22f, 3.912f);
+    reports[count++] = make_report(TEST_START_TIME + 300, -40.0f, 0.0f, 2.0f);
+    reports[count++] = make_report(TEST_START_TIME + 600, 85.0f, 100.0f, 4.2f);
+    reports[count++] = make_report(TEST_START_TIME + 900, -0.01f, 0.01f, 0.001f);
+
+    // -99 is the sentinel for a missing value, which must not be confused with
+    // a reading
+    for (int missing = 1; missing < 8; missing++)
+    {
+        reports[count] = make_report(TEST_START_TIME + count * 300,
+            missing & 1 ? -99 : 18.5f, missing & 2 ? -99 : 71.25f,
+            missing & 4 ? -99 : 3.5f);
+        count++;
+    }
+
+    check_binary(reports, count, BINARY_REPORTS_VERSION, BINARY_REPORT_SIZE);
+
+    // An empty batch is still a valid batch
+    check_binary(reports, 0, BINARY_REPORTS_VERSION, BINARY_REPORT_SIZE);
+
+    // The largest batch the header can count
+    report_t many[255];
+    for (int i = 0; i < 255; i++)
+        many[i] = make_report(TEST_START_TIME + i * 60, i * 0.1f, 100 - i * 0.3f, 3);
+    check_binary(many, 255, BINARY_REPORTS_VERSION, BINARY_REPORT_SIZE);
+}
+
+/*
+    Reports that summarise several samples use the summary layout, and a batch
+    with any suppressed reports uses the deadband layout.
+ */
+static void test_binary_summaries()
+{
+    report_t reports[5];
+    reports[0] = make_summary(TEST_START_TIME, 22.4f, 60.1f, 20, 0.35f, 0.12f);
+    reports[1] = make_summary(TEST_START_TIME + 300, -5.5f, 90.0f, 2, 0.01f, 0);
+    reports[2] = make_summary(TEST_START_TIME + 600, 19.0f, 40.0f, 30, 1.5f, -99);
+    reports[3] = make_report(TEST_START_TIME + 900, 19.2f, 40.5f, 3.6f);
+    reports[4] = make_summary(TEST_START_TIME + 1200, -99, -99, 30, 0.2f, 0.1f);
+
+    check_binary(reports, 5, BINARY_SUMMARY_VERSION, BINARY_SUMMARY_SIZE);
+
+    reports[1].suppressed = 1;
+    reports[3].suppressed = 255;
+    check_binary(reports, 5, BINARY_DEADBAND_VERSION, BINARY_DEADBAND_SIZE);
+}
+
+/*
+    Batches that are truncated, padded, of an unknown version or larger than the
+    destination are rejected rather than decoded into garbage.
+ */
+static void test_binary_malformed()
+{
+    report_t reports[4];
+    for (int i = 0; i < 4; i++)
+        reports[i] = make_report(TEST_START_TIME + i * 300, 20, 50, 3.8f);
+
+    uint8_t data[BINARY_HEADER_SIZE + BINARY_REPORT_SIZE * 4 + 1];
+    int length = encode_reports_binary(data, TEST_SESSION_ID, reports, 4);
+
+    report_t decoded[4];
+    uint16_t session_id;
+    CHECK_EQUAL(-1, decode_reports_binary(data, length - 1, &session_id,
+        decoded, 4));
+    CHECK_EQUAL(-1, decode_reports_binary(data, length + 1, &session_id,
+        decoded, 4));
+    CHECK_EQUAL(-1, decode_reports_binary(data, 2, &session_id, decoded, 4));
+    CHECK_EQUAL(-1, decode_reports_binary(data, length, &session_id, decoded, 3));
+
+    data[0] = DELTA_REPORTS_VERSION;
+    CHECK_EQUAL(-1, decode_reports_binary(data, length, &session_id, decoded, 4));
+}
+
+/*
+    Encodes a batch in the delta layout, checks its version, and checks that it
+    decodes to the same reports. Returns the number of bytes in the batch.
+
+    - interval: the interval between reports in seconds
+    - version: the layout the batch should be encoded in
+ */
+static int check_delta(const report_t* reports, int count, uint16_t interval,
+    uint8_t version)
+{
+    uint8_t data[DELTA_HEADER_SIZE + DELTA_DEADBAND_MAX_SIZE * 255];
+    delta_encoder_t encoder;
+    encoder.begin(data, TEST_SESSION_ID, interval,
+        has_summaries(reports, count), has_suppressed(reports, count));
+
+    for (int i = 0; i < count; i++)
+        encoder.add(reports[i]);
+    int length = encoder.finish();
+
+    int max_size = DELTA_REPORT_MAX_SIZE;
+    if (version == DELTA_DEADBAND_VERSION) max_size = DELTA_DEADBAND_MAX_SIZE;
+    else if (version == DELTA_SUMMARY_VERSION) max_size = DELTA_SUMMARY_MAX_SIZE;
+    CHECK(length <= DELTA_HEADER_SIZE + count * max_size);
+    CHECK_EQUAL(version, data[0]);
+
+    report_t decoded[255];
+    uint16_t session_id = 0;
+    CHECK_EQUAL(count,
+        decode_reports_delta(data, length, &session_id, decoded, 255));
+    CHECK_EQUAL(TEST_SESSION_ID, session_id);
+
+    for (int i = 0; i < count; i++)
+    {
+        // Battery voltages are only sent in hundredths of a volt
+        report_t expected = reports[i];
+        if (expected.batv != -99) expected.batv = roundf(expected.batv * 100) / 100;
+        check_report(expected, decoded[i]);
+    }
+
+    return length;
+}
+
+
+/*
+    A regular series on the interval takes a few bytes per report, and every
+    combination of missing values (including at the start, where there is no
+    previous value to take the difference from) decodes as missing.
+ */
+static void test_delta_reports()
+{
+    report_t reports[255];
+    for (int i = 0; i < 255; i++)
+    {
+        reports[i] = make_report(TEST_START_TIME + i * 300,
+            20 + sinf(i * 0.05f) * 5, 60 - sinf(i * 0.05f) * 10, 3.9f - i * 0.001f);
+    }
+
+    int length = check_delta(reports, 255, 300, DELTA_REPORTS_VERSION);
+    CHECK(length < DELTA_HEADER_SIZE + 255 * 6);
+
+    for (int missing = 0; missing < 8; missing++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            reports[i] = make_report(TEST_START_TIME + i * 300,
+                (missing & 1) && i % 2 == 0 ? -99 : 18.5f - i,
+                (missing & 2) && i % 3 == 0 ? -99 : 71.25f + i * 2,
+                (missing & 4) && i < 4 ? -99 : 3.5f);
+        }
+
+        check_delta(reports, 8, 300, DELTA_REPORTS_VERSION);
+    }
+
+    // The extremes of the sensor's range, one after the other
+    reports[0] = make_report(TEST_START_TIME, -40, 0, 2);
+    reports[1] = make_report(TEST_START_TIME + 300, 85, 100, 4.2f);
+    reports[2] = make_report(TEST_START_TIME + 600, -40, 0, 2);
+    check_delta(reports, 3, 300, DELTA_REPORTS_VERSION);
+
+    check_delta(reports, 0, 300, DELTA_REPORTS_VERSION);
+}
+
+/*
+    Times that are off the interval, go backwards (the clock was set) or skip
+    intervals, and batches with no interval, all decode to the right times.
+ */
+static void test_delta_times()
+{
+    const uint32_t offsets[] = { 0, 300, 900, 901, 1200, 1100, 1100, 86400 * 30,
+        86400 * 30 + 300, 5 };
+
+    report_t reports[10];
+    for (int i = 0; i < 10; i++)
+        reports[i] = make_report(TEST_START_TIME + offsets[i], 21, 55, 3.8f);
+
+    check_delta(reports, 10, 300, DELTA_REPORTS_VERSION);
+    check_delta(reports, 10, 0, DELTA_REPORTS_VERSION);
+    check_delta(reports, 10, 7, DELTA_REPORTS_VERSION);
+}
+
+/*
+    Reports that summarise several samples use the summary layout, and a batch
+    with any suppressed reports uses the deadband layout.
+ */
+static void test_delta_summaries()
+{
+    report_t reports[5];
+    reports[0] = make_summary(TEST_START_TIME, 22.4f, 60.1f, 20, 0.35f, 0.12f);
+    reports[1] = make_summary(TEST_START_TIME + 300, -5.5f, 90.0f, 2, 0.01f, 0);
+    reports[2] = make_summary(TEST_START_TIME + 600, 19.0f, 40.0f, 30, 1.5f, -99);
+    reports[3] = make_report(TEST_START_TIME + 900, 19.2f, 40.5f, 3.6f);
+    reports[4] = make_summary(TEST_START_TIME + 1200, -99, -99, 30, 0.2f, 0.1f);
+
+    check_delta(reports, 5, 300, DELTA_SUMMARY_VERSION);
+
+    reports[1].suppressed = 1;
+    reports[3].suppressed = 255;
+    check_delta(reports, 5, 300, DELTA_DEADBAND_VERSION);
+}
+
+/*
+    Reports fed to the encoder straight from the report buffer, as the node does,
+    decode to what was pushed onto the buffer.
+ */
+static void test_delta_from_buffer()
+{
+    static uint8_t elements[BUFFER_MEMORY];
+    report_buffer_t buffer;
+    report_t pushed[UPLOAD_BATCH_SIZE];
+
+    for (int i = 0; i < UPLOAD_BATCH_SIZE; i++)
+    {
+        pushed[i] = make_report(TEST_START_TIME + i * 600, 15 + i * 0.37f,
+            i % 5 == 0 ? -99 : 80 - i * 1.1f, 3.71f);
+        buffer.push_front(elements, pushed[i]);
+    }
+
+    uint8_t data[DELTA_HEADER_SIZE + DELTA_REPORT_MAX_SIZE * UPLOAD_BATCH_SIZE];
+    delta_encoder_t encoder;
+    encoder.begin(data, TEST_SESSION_ID, 600, false, false);
+    for (int i = 0; i < buffer.count(); i++)
+        encoder.add(buffer.peek(elements, i));
+    int length = encoder.finish();
+
+    report_t decoded[UPLOAD_BATCH_SIZE];
+    uint16_t session_id;
+    CHECK_EQUAL(UPLOAD_BATCH_SIZE, decode_reports_delta(data, length, &session_id,
+        decoded, UPLOAD_BATCH_SIZE));
+
+    for (int i = 0; i < UPLOAD_BATCH_SIZE; i++)
+        check_report(pushed[i], decoded[i]);
+}
+
+/*
+    Every truncation of a batch is rejected, as are batches with bytes left
+    over, of an unknown version or larger than the destination.
+ */
+static void test_delta_malformed()
+{
+    report_t reports[6];
+    for (int i = 0; i < 6; i++)
+    {
+        reports[i] = make_summary(TEST_START_TIME + i * 300 + (i == 3),
+            20 + i, 50 - i, 10, 0.5f, 0.2f);
+    }
+    reports[2].suppressed = 3;
+
+    uint8_t data[DELTA_HEADER_SIZE + DELTA_DEADBAND_MAX_SIZE * 6 + 1];
+    delta_encoder_t encoder;
+    encoder.begin(data, TEST_SESSION_ID, 300, true, true);
+    for (int i = 0; i < 6; i++)
+        encoder.add(reports[i]);
+    int length = encoder.finish();
+
+    report_t decoded[6];
+    uint16_t session_id;
+    for (int i = 0; i < length; i++)
+        CHECK_EQUAL(-1, decode_reports_delta(data, i, &session_id, decoded, 6));
+
+    CHECK_EQUAL(6, decode_reports_delta(data, length, &session_id, decoded, 6));
+    data[length] = 0;
+    CHECK_EQUAL(-1, decode_reports_delta(data, length + 1, &session_id,
+        decoded, 6));
+    CHECK_EQUAL(-1, decode_reports_delta(data, length, &session_id, decoded, 5));
+
+    data[0] = BINARY_REPORTS_VERSION;
+    CHECK_EQUAL(-1, decode_reports_delta(data, length, &session_id, decoded, 6));
+}
+
+int main()
+{
+    test_binary_reports();
+    test_binary_summaries();
+    test_binary_malformed();
+    test_delta_reports();
+    test_delta_times();
+    test_delta_summaries();
+    test_delta_from_buffer();
+    test_delta_malformed();
+    return test_result("test_encoding");
+}
@@ -0,0 +1,172 @@
+/*
+    Tests the latency estimator (see latency.cpp): the deadline must be the
+    configured maximum until enough latencies have been observed, a dead link
+    must then be given up on well before the maximum, each consecutive timeout
+    must double the deadline up to the maximum, and forgetting the estimate must
+    start the warm-up again.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers test/test_latency.cpp src/helpers/latency.cpp \
+            -o test_latency
+        ./test_latency
+ */
+
+#include "test.h"
+#include "latency.h"
+
+#define TEST_MAXIMUM 6000 // Configured timeout in milliseconds
+#define TEST_LATENCY 800 // Usual latency of the link in milliseconds
+
+
+/*
+    Waits on a link as the firmware does, recording the result in the estimate.
+    Returns the number of milliseconds spent waiting.
+
+    - estimate: the estimate of the phase
+    - latency: the number of milliseconds the response takes, or 0 if it never
+    arrives
+ */
+static uint32_t wait(latency_estimate_t* estimate, uint32_t latency)
+{
+    uint32_t deadline = latency_deadline(*estimate, TEST_MAXIMUM);
+    if (latency != 0 && latency <= deadline)
+    {
+        latency_record(estimate, latency);
+        return latency;
+    }
+
+    latency_record_timeout(estimate);
+    return deadline;
+}
+
+
+/*
+    The deadline is the configured maximum until LATENCY_MIN_SAMPLES latencies
+    have been observed, then follows the latencies with a margin.
+ */
+static void test_warm_up()
+{
+    latency_estimate_t estimate;
+    latency_reset(&estimate);
+    CHECK_EQUAL(0, latency_percentile(estimate));
+
+    for (int i = 0; i < LATENCY_MIN_SAMPLES; i++)
+    {
+        CHECK_EQUAL(TEST_MAXIMUM, latency_deadline(estimate, TEST_MAXIMUM));
+        latency_record(&estimate, TEST_LATENCY);
+    }
+
+    uint32_t deadline = latency_deadline(estimate, TEST_MAXIMUM);
+    CHECK(deadline < TEST_MAXIMUM);
+    CHECK(deadline >= TEST_LATENCY * LATENCY_MARGIN_PERCENT / 100);
+
+    // A steady link narrows the deadline down to the margin over its latency
+    // (the integer deviation stops decaying a few eighths of a millisecond
+    // above 0)
+    for (int i = 0; i < 100; i++)
+        latency_record(&estimate, TEST_LATENCY);
+    CHECK(latency_percentile(estimate) - TEST_LATENCY <= 2);
+    CHECK(latency_deadline(estimate, TEST_MAXIMUM) -
+        TEST_LATENCY * LATENCY_MARGIN_PERCENT / 100 <= 3);
+
+    // But never below the minimum, nor above the maximum
+    for (int i = 0; i < 100; i++)
+        latency_record(&estimate, 20);
+    CHECK_EQUAL(LATENCY_MIN_DEADLINE, latency_deadline(estimate, TEST_MAXIMUM));
+
+    for (int i = 0; i < 100; i++)
+        latency_record(&estimate, TEST_MAXIMUM * 2);
+    CHECK_EQUAL(TEST_MAXIMUM, latency_deadline(estimate, TEST_MAXIMUM));
+}
+
+/*
+    Once warmed up, a dead link is given up on well before the maximum, and the
+    estimate itself is left as it was.
+ */
+static void test_dead_link()
+{
+    latency_estimate_t estimate;
+    latency_reset(&estimate);
+    for (int i = 0; i < 20; i++)
+        wait(&estimate, TEST_LATENCY);
+
+    uint32_t mean = estimate.mean;
+    uint32_t deviation = estimate.deviation;
+
+    uint32_t first = wait(&estimate, 0);
+    CHECK(first < TEST_MAXIMUM / 2);
+    CHECK_EQUAL(1, estimate.timeouts);
+    CHECK_EQUAL(mean, estimate.mean);
+    CHECK_EQUAL(deviation, estimate.deviation);
+
+    // The first two waits on the dead link take less than one at the maximum
+    CHECK(first + wait(&estimate, 0) < TEST_MAXIMUM);
+}
+
+/*
+    Each consecutive timeout doubles the deadline up to the maximum, so a link
+    that has become slower is still observed, and a successful wait brings the
+    deadline back down.
+ */
+static void test_doubling()
+{
+    latency_estimate_t estimate;
+    latency_reset(&estimate);
+    for (int i = 0; i < 100; i++)
+        latency_record(&estimate, TEST_LATENCY);
+
+    uint32_t base = latency_deadline(estimate, TEST_MAXIMUM);
+    uint32_t expected = base;
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK_EQUAL(expected, latency_deadline(estimate, TEST_MAXIMUM));
+        latency_record_timeout(&estimate);
+        expected = expected * 2 < TEST_MAXIMUM ? expected * 2 : TEST_MAXIMUM;
+    }
+    CHECK_EQUAL(TEST_MAXIMUM, latency_deadline(estimate, TEST_MAXIMUM));
+
+    latency_record(&estimate, TEST_LATENCY);
+    CHECK_EQUAL(0, estimate.timeouts);
+    CHECK_EQUAL(base, latency_deadline(estimate, TEST_MAXIMUM));
+
+    // A link that is now three times slower times out once, then is observed
+    int timeouts = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        if (wait(&estimate, TEST_LATENCY * 3) != TEST_LATENCY * 3)
+            timeouts++;
+    }
+    CHECK_EQUAL(1, timeouts);
+    CHECK(latency_deadline(estimate, TEST_MAXIMUM) > TEST_LATENCY * 3);
+}
+
+/*
+    Forgetting the estimate (as when the network is changed) goes back to the
+    configured maximum until the new link has been observed.
+ */
+static void test_reset()
+{
+    latency_estimate_t estimate;
+    latency_reset(&estimate);
+    for (int i = 0; i < 20; i++)
+        latency_record(&estimate, TEST_LATENCY);
+    latency_record_timeout(&estimate);
+
+    latency_reset(&estimate);
+    CHECK_EQUAL(0, estimate.timeouts);
+    CHECK_EQUAL(0, latency_percentile(estimate));
+
+    for (int i = 0; i < LATENCY_MIN_SAMPLES; i++)
+        CHECK_EQUAL(TEST_MAXIMUM, wait(&estimate, 0));
+    CHECK_EQUAL(TEST_MAXIMUM, latency_deadline(estimate, TEST_MAXIMUM));
+}
+
+int main()
+{
+    test_warm_up();
+    test_dead_link();
+    test_doubling();
+    test_reset();
+    return test_result("test_latency");
+}
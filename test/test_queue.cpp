@@ -0,0 +1,218 @@
+/*
+    Tests the queues between the main task and the transmit task (see queue.h)
+    from two threads at once, following the same protocol as transmit_reports()
+    and transmit_task(): batches are written in place and handed over, results
+    come back in order, each side notifies the other after changing a queue,
+    and the transmit task is only deleted once it has signalled that it is done
+    (see transmit_stop()). Lost, repeated, reordered or torn batches count as
+    failures, as do results still queued when the main task sees that the
+    transmit task has finished.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -pthread -I src/helpers test/test_queue.cpp -o test_queue
+        ./test_queue
+ */
+
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "test.h"
+#include "queue.h"
+
+#define TEST_ROUNDS 200 // Number of transmissions
+#define TEST_BATCHES 500 // Number of batches per transmission
+#define TEST_PAYLOAD_SIZE 256 // Number of bytes in a batch
+#define TEST_QUEUE_LEN 3
+#define TEST_WINDOW 2
+
+
+// A stand-in for a FreeRTOS task's notification value
+struct test_task_t
+{
+    std::mutex mutex;
+    std::condition_variable condition;
+    int notifications = 0;
+
+    void give()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        notifications++;
+        condition.notify_one();
+    }
+
+    void take(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+            [this] { return notifications > 0; });
+        notifications = 0;
+    }
+};
+
+struct test_batch_t
+{
+    int sequence;
+    uint8_t payload[TEST_PAYLOAD_SIZE];
+};
+
+struct test_result_t
+{
+    int sequence;
+    uint32_t checksum;
+};
+
+enum TestState { Connected, Finished };
+
+spsc_queue_t<test_batch_t, TEST_QUEUE_LEN> batch_queue;
+spsc_queue_t<test_result_t, TEST_WINDOW> result_queue;
+std::atomic<bool> batches_ended(false);
+std::atomic<int> task_state(TestState::Connected);
+std::atomic<bool> task_done(false);
+test_task_t main_task;
+test_task_t* transmit_task = NULL; // Only written by the main thread
+int leftover_results = 0; // Results still queued after the task finished
+
+
+/*
+    Returns a checksum of a batch's payload, so that a batch read before it was
+    fully written shows up.
+ */
+static uint32_t checksum(const uint8_t* payload)
+{
+    uint32_t sum = 0;
+    for (int i = 0; i < TEST_PAYLOAD_SIZE; i++)
+        sum = sum * 31 + payload[i];
+    return sum;
+}
+
+/*
+    Takes batches and passes back results like transmit_task(), keeping up to
+    TEST_WINDOW batches "in flight", then signals that it is done.
+
+    - task: the task's own notification value
+ */
+static void run_transmit_task(test_task_t* task)
+{
+    test_result_t window[TEST_WINDOW];
+    int window_length = 0;
+
+    while (true)
+    {
+        test_batch_t* batch;
+        while (window_length < TEST_WINDOW && (batch = batch_queue.peek()) != NULL)
+        {
+            window[window_length].sequence = batch->sequence;
+            window[window_length++].checksum = checksum(batch->payload);
+            batch_queue.pop();
+            main_task.give();
+        }
+
+        if (window_length == 0)
+        {
+            if (batches_ended.load() && batch_queue.peek() == NULL) break;
+            task->take(1);
+            continue;
+        }
+
+        test_result_t* slot;
+        while ((slot = result_queue.reserve()) == NULL) task->take(1);
+
+        *slot = window[0];
+        result_queue.push();
+        main_task.give();
+
+        window_length--;
+        for (int i = 0; i < window_length; i++)
+            window[i] = window[i + 1];
+    }
+
+    task_state.store(TestState::Finished);
+    main_task.give();
+    task_done.store(true);
+}
+
+/*
+    Runs one transmission from the main task's side, like transmit_reports().
+    Returns the number of results received in order and intact.
+ */
+static int transmit(int round)
+{
+    batch_queue.clear();
+    result_queue.clear();
+    batches_ended.store(false);
+    task_state.store(TestState::Connected);
+    task_done.store(false);
+
+    transmit_task = new test_task_t();
+    std::thread thread(run_transmit_task, transmit_task);
+
+    int submitted = 0;
+    int received = 0;
+    while (true)
+    {
+        int state = task_state.load();
+
+        test_result_t* result;
+        while ((result = result_queue.peek()) != NULL)
+        {
+            test_batch_t expected;
+            expected.sequence = received;
+            for (int i = 0; i < TEST_PAYLOAD_SIZE; i++)
+                expected.payload[i] = (uint8_t)(round + received * 7 + i);
+
+            if (result->sequence == received &&
+                result->checksum == checksum(expected.payload))
+            { received++; }
+
+            result_queue.pop();
+            if (transmit_task != NULL) transmit_task->give();
+        }
+
+        if (state == TestState::Finished)
+        {
+            // The state was read before the results, so none can be left
+            if (result_queue.peek() != NULL) leftover_results++;
+
+            // As transmit_stop()
+            while (!task_done.load()) std::this_thread::yield();
+            thread.join();
+            delete transmit_task;
+            transmit_task = NULL;
+            return received;
+        }
+
+        test_batch_t* batch;
+        if (submitted < TEST_BATCHES && (batch = batch_queue.reserve()) != NULL)
+        {
+            batch->sequence = submitted;
+            for (int i = 0; i < TEST_PAYLOAD_SIZE; i++)
+                batch->payload[i] = (uint8_t)(round + submitted * 7 + i);
+
+            batch_queue.push();
+            submitted++;
+            if (transmit_task != NULL) transmit_task->give();
+            continue;
+        }
+
+        if (submitted == TEST_BATCHES && !batches_ended.exchange(true))
+        {
+            if (transmit_task != NULL) transmit_task->give();
+        }
+
+        main_task.take(1);
+    }
+}
+
+int main()
+{
+    for (int round = 0; round < TEST_ROUNDS; round++)
+        CHECK_EQUAL(TEST_BATCHES, transmit(round));
+
+    CHECK_EQUAL(0, leftover_results);
+    return test_result("test_queue");
+}
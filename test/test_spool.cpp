@@ -0,0 +1,366 @@
+/*
+    Tests the log of reports in flash memory (see spool.cpp) against a RAM-backed
+    stand-in for the flash memory, which behaves like NOR flash (writes can only
+    clear bits, erases set a whole sector) and counts the writes and erases. A
+    power off is simulated by recovering a new log from the same memory.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include test/test_spool.cpp \
+            src/helpers/spool.cpp src/helpers/helpers.cpp -o test_spool
+        ./test_spool
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "spool.h"
+
+#define TEST_SECTORS 4 // Number of sectors in the stand-in flash memory
+#define TEST_START_TIME 700000000 // Time of the first report
+
+
+// The stand-in flash memory
+uint8_t flash_memory[TEST_SECTORS * SPOOL_SECTOR_SIZE];
+int flash_writes = 0;
+int flash_erases[TEST_SECTORS];
+
+
+bool flash_read(uint32_t address, void* data, size_t length)
+{
+    if (address + length > sizeof(flash_memory)) return false;
+    memcpy(data, flash_memory + address, length);
+    return true;
+}
+
+bool flash_write(uint32_t address, const void* data, size_t length)
+{
+    if (address + length > sizeof(flash_memory)) return false;
+
+    for (size_t i = 0; i < length; i++)
+        flash_memory[address + i] &= ((const uint8_t*)data)[i];
+
+    flash_writes++;
+    return true;
+}
+
+bool flash_erase_sector(uint32_t address)
+{
+    if (address % SPOOL_SECTOR_SIZE != 0 || address >= sizeof(flash_memory))
+        return false;
+
+    memset(flash_memory + address, 0xFF, SPOOL_SECTOR_SIZE);
+    flash_erases[address / SPOOL_SECTOR_SIZE]++;
+    return true;
+}
+
+const spool_flash_t flash =
+    { flash_read, flash_write, flash_erase_sector, sizeof(flash_memory) };
+
+
+/*
+    Erases the whole stand-in flash memory, as when the partition is new.
+ */
+static void reset_flash()
+{
+    memset(flash_memory, 0xFF, sizeof(flash_memory));
+    memset(flash_erases, 0, sizeof(flash_erases));
+    flash_writes = 0;
+}
+
+/*
+    Returns the report with a given index in the test series.
+ */
+static report_t make_report(int index)
+{
+    report_t report;
+    memset(&report, 0, sizeof(report));
+    report.time = TEST_START_TIME + index * 300;
+    report.airt = index % 11 == 5 ? -99 : 20 + (index % 50) * 0.11f;
+    report.relh = 40 + (index % 30) * 0.5f;
+    report.batv = 3.6f;
+    report.samples = 1 + index % 3;
+
+    value_stats_t stats = { report.airt - 1, report.airt + 1, 0.25f };
+    report.airt_stats = report.airt != -99 ? stats : value_stats_t { -99, -99, -99 };
+    report.relh_stats = value_stats_t { report.relh - 2, report.relh + 2, -99 };
+    report.suppressed = index % 4;
+    return report;
+}
+
+/*
+    Appends a range of the test series to the log, in batches as spill_reports()
+    does.
+ */
+static void append_range(spool_t* spool, int first, int count, uint16_t session_id)
+{
+    report_t batch[SPOOL_SPILL_COUNT];
+    while (count > 0)
+    {
+        int chunk = count < SPOOL_SPILL_COUNT ? count : SPOOL_SPILL_COUNT;
+        for (int i = 0; i < chunk; i++)
+            batch[i] = make_report(first + i);
+
+        CHECK(spool->append(flash, batch, chunk, session_id));
+        first += chunk;
+        count -= chunk;
+    }
+}
+
+/*
+    Checks that the log holds a range of the test series, oldest first.
+ */
+static void check_range(spool_t* spool, int first, int count,
+    uint16_t session_id)
+{
+    CHECK_EQUAL(count, spool->count());
+
+    for (int i = 0; i < count; i++)
+    {
+        report_t expected = make_report(first + i);
+        report_t report;
+        uint16_t report_session_id;
+        if (!spool->peek(flash, i, &report, &report_session_id))
+        {
+            CHECK(false);
+            continue;
+        }
+
+        CHECK_EQUAL(session_id, report_session_id);
+        CHECK_EQUAL(expected.time, report.time);
+        CHECK_EQUAL(pack_value(expected.airt), pack_value(report.airt));
+        CHECK_EQUAL(pack_value(expected.relh), pack_value(report.relh));
+        CHECK_EQUAL(pack_batv(expected.batv), pack_batv(report.batv));
+        CHECK_EQUAL(expected.samples, report.samples);
+        CHECK_EQUAL(pack_value(expected.airt_stats.maximum),
+            pack_value(report.airt_stats.maximum));
+        CHECK_EQUAL(pack_value(expected.relh_stats.deviation),
+            pack_value(report.relh_stats.deviation));
+        CHECK_EQUAL(expected.suppressed, report.suppressed);
+    }
+}
+
+
+/*
+    Reports come out oldest first with their session, and removing them leaves
+    the rest in place.
+ */
+static void test_append_and_discard()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+    CHECK_EQUAL(0, spool.count());
+
+    append_range(&spool, 0, 100, 7);
+    check_range(&spool, 0, 100, 7);
+
+    spool.discard(flash, 30);
+    check_range(&spool, 30, 70, 7);
+
+    // Reports of a later session keep their own session ID
+    append_range(&spool, 100, 10, 8);
+    report_t report;
+    uint16_t session_id;
+    CHECK(spool.peek(flash, 69, &report, &session_id));
+    CHECK_EQUAL(7, session_id);
+    CHECK(spool.peek(flash, 70, &report, &session_id));
+    CHECK_EQUAL(8, session_id);
+    CHECK(!spool.peek(flash, 80, &report, &session_id));
+
+    spool.discard(flash, 1000);
+    CHECK_EQUAL(0, spool.count());
+}
+
+/*
+    The reports that were not removed are recovered after a power off, in the
+    same order, and appending carries on after them.
+ */
+static void test_power_off()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+    append_range(&spool, 0, 300, 7);
+    spool.discard(flash, 140);
+
+    spool_t recovered;
+    CHECK(recovered.begin(flash));
+    check_range(&recovered, 140, 160, 7);
+
+    append_range(&recovered, 300, 50, 7);
+    spool_t again;
+    CHECK(again.begin(flash));
+    check_range(&again, 140, 210, 7);
+
+    // An empty log stays empty
+    again.discard(flash, 210);
+    spool_t empty;
+    CHECK(empty.begin(flash));
+    CHECK_EQUAL(0, empty.count());
+}
+
+/*
+    Clearing the log (as at the start of a session) is kept over a power off, so
+    the reports of the earlier session are not recovered and transmitted under
+    the new one. Reports appended after the clear are recovered.
+ */
+static void test_clear()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+    append_range(&spool, 0, 200, 7);
+    spool.discard(flash, 20);
+
+    CHECK(spool.clear(flash));
+    CHECK_EQUAL(0, spool.count());
+
+    spool_t recovered;
+    CHECK(recovered.begin(flash));
+    CHECK_EQUAL(0, recovered.count());
+
+    append_range(&recovered, 1000, 40, 9);
+    spool_t again;
+    CHECK(again.begin(flash));
+    check_range(&again, 1000, 40, 9);
+
+    // Clearing an empty log needs no erase
+    again.discard(flash, 40);
+    int erases = 0;
+    for (int i = 0; i < TEST_SECTORS; i++)
+        erases += flash_erases[i];
+
+    CHECK(again.clear(flash));
+    int erases_after = 0;
+    for (int i = 0; i < TEST_SECTORS; i++)
+        erases_after += flash_erases[i];
+    CHECK_EQUAL(erases, erases_after);
+
+    // The log keeps working as it wraps around over the cleared sectors
+    append_range(&again, 2000, SPOOL_RECORDS_PER_SECTOR * TEST_SECTORS * 2, 10);
+    spool_t wrapped;
+    CHECK(wrapped.begin(flash));
+    CHECK_EQUAL(again.count(), wrapped.count());
+    int first = 2000 + SPOOL_RECORDS_PER_SECTOR * TEST_SECTORS * 2 -
+        wrapped.count();
+    check_range(&wrapped, first, wrapped.count(), 10);
+}
+
+/*
+    Removing reports marks them in as few writes as appending them took, rather
+    than one write per report.
+ */
+static void test_batched_writes()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+    append_range(&spool, 0, 64, 7);
+
+    flash_writes = 0;
+    spool.discard(flash, 16);
+    CHECK_EQUAL(1, flash_writes);
+
+    flash_writes = 0;
+    spool.discard(flash, 48);
+    CHECK_EQUAL(3, flash_writes);
+
+    spool_t recovered;
+    CHECK(recovered.begin(flash));
+    CHECK_EQUAL(0, recovered.count());
+}
+
+/*
+    When the log is full, the oldest sector's reports are dropped to make room,
+    and the sectors are erased in turn so that they wear evenly.
+ */
+static void test_wear_levelling()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+
+    int total = SPOOL_RECORDS_PER_SECTOR * TEST_SECTORS * 25 + 17;
+    append_range(&spool, 0, total, 7);
+
+    // All but the sector being written to hold the newest reports
+    CHECK(spool.count() > SPOOL_RECORDS_PER_SECTOR * (TEST_SECTORS - 2));
+    CHECK(spool.count() <= SPOOL_RECORDS_PER_SECTOR * TEST_SECTORS);
+    check_range(&spool, total - spool.count(), spool.count(), 7);
+
+    int fewest = flash_erases[0];
+    int most = flash_erases[0];
+    for (int i = 1; i < TEST_SECTORS; i++)
+    {
+        if (flash_erases[i] < fewest) fewest = flash_erases[i];
+        if (flash_erases[i] > most) most = flash_erases[i];
+    }
+    CHECK(most - fewest <= 1);
+
+    spool_t recovered;
+    CHECK(recovered.begin(flash));
+    check_range(&recovered, total - spool.count(), spool.count(), 7);
+}
+
+/*
+    A corrupt record fails to read but still counts, so that it can be skipped
+    without moving the reports after it.
+ */
+static void test_corrupt_record()
+{
+    reset_flash();
+    spool_t spool;
+    CHECK(spool.begin(flash));
+    append_range(&spool, 0, 10, 7);
+
+    // Clear the time of the fourth report, as a failed write might
+    uint32_t time = make_report(3).time;
+    uint8_t* record = NULL;
+    for (size_t i = SPOOL_HEADER_SIZE; i < sizeof(flash_memory);
+        i += SPOOL_RECORD_SIZE)
+    {
+        if (memcmp(flash_memory + i + 8, &time, 4) == 0)
+            record = flash_memory + i;
+    }
+    CHECK(record != NULL);
+    if (record != NULL) memset(record + 8, 0, 4);
+
+    report_t report;
+    uint16_t session_id;
+    CHECK(!spool.peek(flash, 3, &report, &session_id));
+    CHECK(spool.peek(flash, 4, &report, &session_id));
+    CHECK_EQUAL(make_report(4).time, report.time);
+
+    spool_t recovered;
+    CHECK(recovered.begin(flash));
+    CHECK_EQUAL(10, recovered.count());
+    CHECK(!recovered.peek(flash, 3, &report, &session_id));
+}
+
+/*
+    A partition too small to rotate through sectors is refused.
+ */
+static void test_too_small()
+{
+    reset_flash();
+    spool_flash_t small = flash;
+    small.size = SPOOL_SECTOR_SIZE;
+
+    spool_t spool;
+    CHECK(!spool.begin(small));
+    CHECK_EQUAL(0, spool.count());
+    CHECK(!spool.append(small, NULL, 0, 7));
+}
+
+int main()
+{
+    test_append_and_discard();
+    test_power_off();
+    test_clear();
+    test_batched_writes();
+    test_wear_levelling();
+    test_corrupt_record();
+    test_too_small();
+    return test_result("test_spool");
+}
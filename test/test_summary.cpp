@@ -0,0 +1,186 @@
+/*
+    Tests the summary accumulators (see summary.cpp) against statistics worked
+    out in double precision: the mean, minimum, maximum and standard deviation
+    of series of samples, a single sample, the cap on the number of samples and
+    the saturation of the sum of squares, which must leave the deviation
+    missing rather than wrong.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers -I sim/include test/test_summary.cpp \
+            src/helpers/summary.cpp src/helpers/helpers.cpp -o test_summary
+        ./test_summary
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "summary.h"
+
+#define TEST_SERIES 2000 // Number of random series
+
+
+/*
+    Checks that two values are within a tolerance of each other, printing both
+    if not.
+ */
+#define CHECK_CLOSE(expected, actual, tolerance) \
+    do { \
+        test_checks++; \
+        double test_expected = (expected); \
+        double test_actual = (actual); \
+        if (!(fabs(test_expected - test_actual) <= (tolerance))) \
+        { \
+            test_failures++; \
+            printf("%s:%d: failed: %s == %s (%f != %f)\n", __FILE__, __LINE__, \
+                #expected, #actual, test_expected, test_actual); \
+        } \
+    } while (0)
+
+
+/*
+    Adds a series of samples to a summary and checks the summary against the
+    statistics of the series worked out in double precision.
+
+    - values: the samples in hundredths
+    - count: the number of samples (at most SUMMARY_MAX_SAMPLES)
+ */
+static void check_series(const int16_t* values, int count)
+{
+    summary_t summary;
+    summary_reset(&summary);
+
+    double sum = 0;
+    int16_t minimum = values[0];
+    int16_t maximum = values[0];
+    for (int i = 0; i < count; i++)
+    {
+        summary_add(&summary, values[i]);
+        sum += values[i];
+        if (values[i] < minimum) minimum = values[i];
+        if (values[i] > maximum) maximum = values[i];
+    }
+
+    double mean = sum / count;
+    double squares = 0;
+    for (int i = 0; i < count; i++)
+        squares += (values[i] - mean) * (values[i] - mean);
+    double deviation = sqrt(squares / count);
+
+    CHECK_EQUAL(count, summary.count);
+    CHECK_CLOSE(mean / 100, summary_mean(summary), 1e-4);
+
+    value_stats_t stats = summary_stats(summary);
+    CHECK_EQUAL(minimum, pack_value(stats.minimum));
+    CHECK_EQUAL(maximum, pack_value(stats.maximum));
+
+    // The deviation is missing if the sum of squares saturated, and otherwise
+    // right to well within the hundredths it is reported in
+    if (stats.deviation != -99)
+        CHECK_CLOSE(deviation / 100, stats.deviation, 1e-4);
+    else CHECK(summary.sum_squares == UINT32_MAX);
+}
+
+
+/*
+    An empty summary has no statistics, and a single sample has itself as its
+    mean, minimum and maximum, and no spread.
+ */
+static void test_empty_and_single()
+{
+    summary_t summary;
+    summary_reset(&summary);
+    CHECK_EQUAL(-99, summary_mean(summary));
+
+    value_stats_t stats = summary_stats(summary);
+    CHECK_EQUAL(-99, stats.minimum);
+    CHECK_EQUAL(-99, stats.maximum);
+    CHECK_EQUAL(-99, stats.deviation);
+
+    summary_add(&summary, -1234);
+    CHECK_CLOSE(-12.34, summary_mean(summary), 1e-5);
+    stats = summary_stats(summary);
+    CHECK_EQUAL(-1234, pack_value(stats.minimum));
+    CHECK_EQUAL(-1234, pack_value(stats.maximum));
+    CHECK_EQUAL(0, stats.deviation);
+}
+
+/*
+    Random series of temperatures and humidities, from narrow to wide spreads,
+    match the double precision statistics.
+ */
+static void test_random_series()
+{
+    srand(1);
+    int16_t values[SUMMARY_MAX_SAMPLES];
+
+    for (int series = 0; series < TEST_SERIES; series++)
+    {
+        int count = 1 + rand() % SUMMARY_MAX_SAMPLES;
+        int centre = rand() % 8000 - 2000;
+        int spread = 1 + rand() % (series % 4 == 0 ? 6000 : 300);
+
+        for (int i = 0; i < count; i++)
+            values[i] = centre + rand() % (2 * spread + 1) - spread;
+        check_series(values, count);
+    }
+}
+
+/*
+    A constant series has no spread, and samples beyond SUMMARY_MAX_SAMPLES are
+    left out of the summary.
+ */
+static void test_constant_and_cap()
+{
+    int16_t values[SUMMARY_MAX_SAMPLES];
+    for (int i = 0; i < SUMMARY_MAX_SAMPLES; i++)
+        values[i] = 2150;
+    check_series(values, SUMMARY_MAX_SAMPLES);
+
+    summary_t summary;
+    summary_reset(&summary);
+    for (int i = 0; i < SUMMARY_MAX_SAMPLES; i++)
+        summary_add(&summary, 1000);
+    summary_add(&summary, 3000);
+
+    CHECK_EQUAL(SUMMARY_MAX_SAMPLES, summary.count);
+    CHECK_CLOSE(10, summary_mean(summary), 1e-5);
+    CHECK_EQUAL(1000, pack_value(summary_stats(summary).maximum));
+}
+
+/*
+    A sum of squares too large for the accumulator saturates, leaving the
+    deviation missing while the mean, minimum and maximum are still right.
+ */
+static void test_saturation()
+{
+    int16_t values[] = { -INT16_MAX, INT16_MAX, INT16_MAX, 0 };
+    check_series(values, 4);
+
+    summary_t summary;
+    summary_reset(&summary);
+    for (int i = 0; i < 4; i++)
+        summary_add(&summary, values[i]);
+
+    CHECK_EQUAL(UINT32_MAX, summary.sum_squares);
+    value_stats_t stats = summary_stats(summary);
+    CHECK_EQUAL(-99, stats.deviation);
+    CHECK_EQUAL(-INT16_MAX, (int)lround(stats.minimum * 100));
+    CHECK_EQUAL(INT16_MAX, (int)lround(stats.maximum * 100));
+
+    // The widest spread that a humidity can have fits
+    summary_reset(&summary);
+    for (int i = 0; i < SUMMARY_MAX_SAMPLES; i++)
+        summary_add(&summary, i % 2 == 0 ? 0 : 4000);
+    CHECK(summary_stats(summary).deviation != -99);
+}
+
+int main()
+{
+    test_empty_and_single();
+    test_random_series();
+    test_constant_and_cap();
+    test_saturation();
+    return test_result("test_summary");
+}
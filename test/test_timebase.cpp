@@ -0,0 +1,194 @@
+/*
+    Tests the timebase (see timebase.cpp) over days of high-frequency sampling
+    against a model of a light sleep timer that drifts with temperature, as in
+    tools/timebase_sim.cpp. In each scenario every sample the device wakes for
+    must be taken within TEST_MAX_ERROR of its second and without waking late,
+    the time spent polling the RTC must stay under TEST_MAX_POLLING per sample,
+    and the drift learnt must be close to that of the timer.
+
+    Build and run on the host (or see run_tests.sh):
+
+        g++ -I src/helpers test/test_timebase.cpp src/helpers/timebase.cpp \
+            -o test_timebase
+        ./test_timebase
+ */
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "timebase.h"
+
+#define TEST_SECONDS 86400 // Length of each scenario
+#define TEST_BOOT_US 40000 // Microseconds from the alarm to the local clock starting
+#define TEST_SETUP_US 180000 // Microseconds from the alarm to the first sample
+#define TEST_SAMPLE_US 150000 // Microseconds awake to take a sample
+#define TEST_POLL_US 450 // Microseconds to read the time from the RTC
+#define TEST_TRANSMIT_US 4000000 // Microseconds awake to transmit once an interval
+
+#define TEST_MAX_ERROR 1000 // Largest error of a sample in microseconds (about
+// two reads of the RTC)
+#define TEST_MAX_POLLING 4000 // Largest mean number of microseconds spent polling
+// the RTC per sample (about 70 seconds a day at a 5 second period)
+#define TEST_MAX_DRIFT_ERROR 50 // Largest error of the learnt drift in parts per
+// million at the end of a scenario (a quarter of a millisecond over 5 seconds)
+
+
+// The true time and the local clock of the device
+struct test_clock_t
+{
+    int64_t time; // Microseconds since the start
+    int64_t local; // Microseconds since the device woke
+    double drift; // Parts per million the sleep timer runs fast by, on average
+    double swing; // Parts per million the drift moves either side over a day
+    double wander; // Random walk added to the drift
+};
+
+struct test_scenario_t
+{
+    uint32_t period; // Seconds between samples
+    uint32_t interval; // Seconds between wakes by the RTC alarm
+    double drift;
+    double swing;
+};
+
+
+/*
+    Returns the parts per million that the sleep timer currently runs fast by.
+ */
+static double drift_now(const test_clock_t& clock)
+{
+    return clock.drift + clock.swing * sin(2 * M_PI * clock.time / 86400e6) +
+        clock.wander;
+}
+
+static void awake(test_clock_t* clock, int64_t duration)
+{
+    clock->time += duration;
+    clock->local += duration;
+}
+
+/*
+    Light sleeps for a number of microseconds as counted by the sleep timer.
+ */
+static void light_sleep(test_clock_t* clock, int64_t duration)
+{
+    clock->local += duration;
+    clock->time += (int64_t)(duration / (1 + drift_now(*clock) / 1e6));
+    clock->wander += (rand() / (RAND_MAX + 1.0) - 0.5) * 2;
+}
+
+static uint32_t read_rtc(test_clock_t* clock)
+{
+    awake(clock, TEST_POLL_US);
+    return (uint32_t)(clock->time / 1000000);
+}
+
+/*
+    Waits for the start of a second as await_second() in src/main.cpp does.
+    Returns the number of microseconds spent polling the RTC.
+
+    - clock: the clocks
+    - timebase: the timebase
+    - second: the second to wait for
+    - late: set if the second had already started on waking
+ */
+static int64_t await_second(test_clock_t* clock, timebase_t* timebase,
+    uint32_t second, bool* late)
+{
+    int64_t polling = 0;
+    if (timebase->edge_boot && second > timebase->edge_second + 1)
+        polling += await_second(clock, timebase, timebase->edge_second + 1, late);
+
+    int64_t sleep = timebase_wake_time(timebase, second, clock->local) - clock->local;
+    if (sleep > 0)
+    {
+        light_sleep(clock, sleep);
+        timebase_slept(timebase, sleep);
+    }
+
+    int64_t poll_start = clock->time;
+    uint32_t now = read_rtc(clock);
+    bool exact = now < second;
+    while (now < second) now = read_rtc(clock);
+
+    if (!exact) *late = true;
+    timebase_edge(timebase, second, clock->local, exact);
+    return polling + clock->time - poll_start;
+}
+
+/*
+    Runs a day of samples, checking each one the device woke for.
+
+    - scenario: the schedule and the drift of the sleep timer
+ */
+static void run_scenario(const test_scenario_t& scenario)
+{
+    test_clock_t clock = { 0, 0, scenario.drift, scenario.swing, 0 };
+    srand(1);
+    timebase_t timebase;
+    timebase_reset(&timebase);
+
+    uint32_t period = scenario.period;
+    uint32_t interval = scenario.interval;
+    int64_t polling = 0;
+    long samples = 0;
+    int64_t max_error = 0;
+    bool late = false;
+
+    for (uint32_t start = interval; start + interval <= TEST_SECONDS;
+        start += interval)
+    {
+        clock.time = (int64_t)start * 1000000 + TEST_BOOT_US;
+        clock.local = 0;
+        timebase_begin(&timebase, start);
+        awake(&clock, TEST_SETUP_US - TEST_BOOT_US + TEST_SAMPLE_US);
+        uint32_t slot = start + interval / 2 / period * period;
+
+        for (uint32_t second = start + period; second < start + interval;
+            second += period)
+        {
+            polling += await_second(&clock, &timebase, second, &late);
+            int64_t error = llabs(clock.time - (int64_t)second * 1000000);
+            if (error > max_error) max_error = error;
+            samples++;
+            awake(&clock, TEST_SAMPLE_US);
+
+            // The samples due while transmitting are taken when noticed, so
+            // are skipped here
+            if (second == slot)
+            {
+                awake(&clock, TEST_TRANSMIT_US);
+                while (second + period < start + interval &&
+                    clock.time >= (int64_t)(second + period) * 1000000)
+                { second += period; }
+            }
+        }
+    }
+
+    printf("period %2u s, interval %4u s, drift %6.0f +- %4.0f ppm: "
+        "error %4lld us max, polling %5.1f s\n", period, interval,
+        scenario.drift, scenario.swing, (long long)max_error, polling / 1e6);
+
+    CHECK(!late);
+    CHECK(max_error <= TEST_MAX_ERROR);
+    CHECK(polling <= (int64_t)samples * TEST_MAX_POLLING);
+    CHECK(fabs(timebase.drift / 1000.0 - drift_now(clock)) <= TEST_MAX_DRIFT_ERROR);
+}
+
+int main()
+{
+    const test_scenario_t scenarios[] =
+    {
+        { 5, 300, 10000, 2000 },
+        { 5, 60, 10000, 2000 },
+        { 10, 600, 0, 0 },
+        { 30, 300, 10000, 2000 },
+        { 5, 300, -20000, 5000 },
+        { 5, 1800, 40000, 5000 }
+    };
+
+    for (const test_scenario_t& scenario : scenarios)
+        run_scenario(scenario);
+    return test_result("test_timebase");
+}
@@ -0,0 +1,309 @@
+/*
+    Empties the pending reports from a node in serial mode using the bulk dump
+    command (see process_bd_command() in src/serial.cpp), and prints them as CSV.
+    A transfer that is interrupted or corrupted is resumed from the first report
+    that was not received intact.
+
+    Build and run on the host (Linux):
+
+        g++ -I src/helpers -I sim/include tools/dump_decoder.cpp \
+            src/helpers/dump.cpp src/helpers/encoding.cpp src/helpers/helpers.cpp \
+            -o dump_decoder
+        ./dump_decoder /dev/ttyUSB0 [baud] [position] > reports.csv
+
+    The node must already be in serial mode (send any command, e.g. psn_pn,
+    within SERIAL_TIMEOUT seconds of power on). If the path is a regular file
+    instead of a serial port, the frames captured in it are decoded without
+    sending any commands.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dump.h"
+#include "encoding.h"
+
+#define DECODER_ATTEMPTS 5 // Number of times to request the reports
+#define DECODER_TIMEOUT 2000 // Number of milliseconds of silence that ends a
+// transfer
+#define UNIX_TIME_OFFSET 946684800 // Seconds from 1970-01-01 to 2000-01-01
+
+
+/*
+    Converts a baud rate into the matching termios speed, or returns B0 if there
+    is none.
+ */
+speed_t get_speed(unsigned long baud)
+{
+    switch (baud)
+    {
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        default: return B0;
+    }
+}
+
+/*
+    Sets up a serial port for raw binary transfer at a baud rate. Returns a
+    boolean indicating success or failure.
+ */
+bool set_port_baud(int port, unsigned long baud)
+{
+    struct termios options;
+    if (tcgetattr(port, &options) != 0) return false;
+
+    cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    cfsetispeed(&options, get_speed(baud));
+    cfsetospeed(&options, get_speed(baud));
+    return tcsetattr(port, TCSADRAIN, &options) == 0;
+}
+
+/*
+    Reads whatever bytes arrive within a timeout. Returns the number of bytes
+    read, 0 if the timeout passed without any, or -1 on error.
+ */
+int read_timeout(int port, uint8_t* data, int capacity, int timeout)
+{
+    fd_set ports;
+    FD_ZERO(&ports);
+    FD_SET(port, &ports);
+
+    struct timeval wait = { timeout / 1000, (timeout % 1000) * 1000 };
+    int ready = select(port + 1, &ports, NULL, NULL, &wait);
+    if (ready <= 0) return ready;
+
+    int length = read(port, data, capacity);
+    return length >= 0 ? length : -1;
+}
+
+/*
+    Sends the bulk dump command and waits for the response. Returns the number of
+    pending reports on the node, or -1 if the command failed.
+ */
+long request_dump(int port, unsigned long baud, unsigned long position)
+{
+    char command[64];
+    int length = snprintf(command, sizeof(command),
+        "psn_bd {\"baud\":%lu,\"offs\":%lu}\n", baud, position);
+    if (write(port, command, length) != length) return -1;
+
+    // Skip anything before the response line
+    char line[128];
+    int line_length = 0;
+    while (true)
+    {
+        uint8_t value;
+        if (read_timeout(port, &value, 1, DECODER_TIMEOUT) != 1) return -1;
+
+        if (value != '\n')
+        {
+            if (line_length < (int)sizeof(line) - 1) line[line_length++] = value;
+            continue;
+        }
+
+        line[line_length] = '\0';
+        line_length = 0;
+
+        unsigned long count;
+        if (sscanf(line, "psn_bds {\"cont\":%lu", &count) == 1)
+            return (long)count;
+        if (strncmp(line, "psn_bdf", 7) == 0) return -1;
+    }
+}
+
+/*
+    Prints the spread of a value's samples as CSV fields.
+ */
+void print_stats(const value_stats_t& stats)
+{
+    const float values[] = { stats.minimum, stats.maximum, stats.deviation };
+    for (int i = 0; i < 3; i++)
+    {
+        if (values[i] != -99) printf(",%.2f", values[i]);
+        else printf(",");
+    }
+}
+
+/*
+    Prints the reports in a frame's payload as CSV lines. Returns a boolean
+    indicating whether the payload was a valid batch.
+ */
+bool print_reports(const uint8_t* payload, int length)
+{
+    uint16_t session_id;
+    report_t reports[DUMP_FRAME_REPORTS];
+    int count = decode_reports_binary(
+        payload, length, &session_id, reports, DUMP_FRAME_REPORTS);
+    if (count < 0) return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        char formatted_time[32];
+        time_t time = (time_t)reports[i].time + UNIX_TIME_OFFSET;
+        strftime(formatted_time, sizeof(formatted_time), "%Y-%m-%dT%H:%M:%SZ",
+            gmtime(&time));
+
+        printf("%u,%s", session_id, formatted_time);
+        if (reports[i].airt != -99) printf(",%.2f", reports[i].airt);
+        else printf(",");
+        if (reports[i].relh != -99) printf(",%.2f", reports[i].relh);
+        else printf(",");
+        if (reports[i].batv != -99) printf(",%.3f", reports[i].batv);
+        else printf(",");
+
+        // Reports that summarise several samples also hold their spread
+        if (reports[i].samples > 1)
+        {
+            printf(",%u", reports[i].samples);
+            print_stats(reports[i].airt_stats);
+            print_stats(reports[i].relh_stats);
+        }
+        else printf(",,,,,,,");
+
+        // The number of reports suppressed before this one (see deadband.cpp)
+        printf(",%u\n", reports[i].suppressed);
+    }
+
+    return true;
+}
+
+/*
+    Decodes and prints frames until the final frame or a timeout. Bytes that are
+    not part of a valid frame are skipped, and frames after a missing frame are
+    ignored so that the output stays in order. Returns a boolean indicating
+    whether the transfer completed.
+
+    - position: position of the next report expected, updated as frames arrive
+ */
+bool receive_frames(int port, unsigned long* position)
+{
+    static uint8_t received[DUMP_MAX_FRAME * 4];
+    int length = 0;
+    bool intact = true;
+
+    while (true)
+    {
+        int read_length = read_timeout(
+            port, received + length, sizeof(received) - length, DECODER_TIMEOUT);
+        if (read_length <= 0) return false;
+        length += read_length;
+
+        while (length > 0)
+        {
+            uint32_t frame_position;
+            uint16_t span;
+            const uint8_t* payload;
+            int payload_length;
+            int frame_length = decode_dump_frame(received, length,
+                &frame_position, &span, &payload, &payload_length);
+
+            if (frame_length == 0) break;
+
+            if (frame_length < 0)
+                frame_length = 1;
+            else if (span == 0 && payload_length == 0)
+                return intact && frame_position == *position;
+            else if (intact && frame_position == *position)
+            {
+                if (print_reports(payload, payload_length))
+                    *position += span;
+                else intact = false;
+            }
+            else intact = false;
+
+            length -= frame_length;
+            memmove(received, received + frame_length, length);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s port [baud] [position]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned long baud = argc > 2 ? strtoul(argv[2], NULL, 10) : DUMP_DEFAULT_BAUD;
+    unsigned long position = argc > 3 ? strtoul(argv[3], NULL, 10) : 0;
+    if (get_speed(baud) == B0)
+    {
+        fprintf(stderr, "unsupported baud rate: %lu\n", baud);
+        return 1;
+    }
+
+    int port = open(argv[1], O_RDWR | O_NOCTTY);
+    if (port < 0)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("session_id,time,airt,relh,batv,samples,airt_min,airt_max,airt_sd,"
+        "relh_min,relh_max,relh_sd,suppressed\n");
+
+    struct stat port_stat;
+    if (fstat(port, &port_stat) == 0 && S_ISREG(port_stat.st_mode))
+    {
+        bool complete = receive_frames(port, &position);
+        close(port);
+        fprintf(stderr, "%s at position %lu\n",
+            complete ? "complete" : "incomplete", position);
+        return complete ? 0 : 1;
+    }
+
+    for (int attempt = 0; attempt < DECODER_ATTEMPTS; attempt++)
+    {
+        // The node returns to the command baud rate after each transfer
+        if (!set_port_baud(port, SERIAL_BAUD))
+        {
+            perror(argv[1]);
+            return 1;
+        }
+
+        long count = request_dump(port, baud, position);
+        if (count < 0)
+        {
+            fprintf(stderr, "bulk dump command failed\n");
+            continue;
+        }
+
+        tcdrain(port);
+        set_port_baud(port, baud);
+
+        if (receive_frames(port, &position))
+        {
+            fprintf(stderr, "received %lu reports\n", position);
+            close(port);
+            return 0;
+        }
+
+        fprintf(stderr, "transfer interrupted at position %lu of %ld, resuming\n",
+            position, count);
+
+        // Wait for the rest of the transfer to finish before asking again
+        uint8_t discarded[256];
+        while (read_timeout(port, discarded, sizeof(discarded), DECODER_TIMEOUT) > 0);
+    }
+
+    close(port);
+    fprintf(stderr, "giving up at position %lu\n", position);
+    return 1;
+}
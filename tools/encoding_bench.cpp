@@ -0,0 +1,209 @@
+/*
+    Compares the report encodings that a session can select (see
+    serialise_reports()) on a realistic trace of reports: the number of bytes
+    transmitted per report and the compression ratio against JSON, and the rate
+    at which batches are encoded (and decoded, for the binary and delta
+    layouts). The trace is a week of reports from a
+    greenhouse, with a daily cycle of temperature and humidity, sensor noise, a
+    slowly falling battery voltage and occasional failed readings.
+
+    Build and run on the host, with ArduinoJson 6 from the native environment's
+    dependencies (pio pkg install -e native):
+
+        g++ -O2 -I src/helpers -I sim/include \
+            -I .pio/libdeps/native/ArduinoJson/src tools/encoding_bench.cpp \
+            src/helpers/protocol.cpp src/helpers/encoding.cpp \
+            src/helpers/helpers.cpp -o encoding_bench
+        ./encoding_bench [interval] [batch_size] [seconds]
+
+    The interval is in minutes (5 by default) and the batch size is the number
+    of reports per batch (UPLOAD_BATCH_SIZE by default). Each measurement runs
+    for about the given number of seconds (1 by default).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+
+#include "protocol.h"
+#include "encoding.h"
+
+#define BENCH_DAYS 7 // Length of the trace
+#define BENCH_SESSION_ID 1234
+#define BENCH_START_TIME 700000000 // Time of the first report
+
+
+// The result of encoding the trace in one encoding
+struct bench_result_t
+{
+    double bytes_per_report;
+    double encode_rate; // Reports per second
+    double decode_rate; // Reports per second, or 0 if not measured
+};
+
+
+/*
+    Returns the next number from a repeatable random sequence, between 0 and 1.
+ */
+static double next_random(uint64_t* state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+    Generates the trace of reports.
+
+    - interval: the number of seconds between reports
+ */
+static std::vector<report_t> make_trace(uint32_t interval)
+{
+    std::vector<report_t> trace;
+    uint64_t state = 1;
+    int count = BENCH_DAYS * 86400 / interval;
+
+    for (int i = 0; i < count; i++)
+    {
+        double day = (double)i * interval / 86400;
+        double cycle = sin(2 * M_PI * (day - 0.375));
+
+        report_t report = { BENCH_START_TIME + i * interval, -99, -99, -99 };
+        report.samples = 1;
+        report.suppressed = 0;
+
+        // Readings fail now and then, e.g. when the sensor does not respond
+        if (next_random(&state) >= 0.005)
+        {
+            report.airt = roundf((24 + 6 * cycle +
+                (next_random(&state) - 0.5) * 0.3) * 100) / 100;
+            report.relh = roundf((65 - 15 * cycle +
+                (next_random(&state) - 0.5) * 1.0) * 100) / 100;
+        }
+
+        report.batv = roundf((4.15 - 0.05 * day +
+            (next_random(&state) - 0.5) * 0.02) * 100) / 100;
+        trace.push_back(report);
+    }
+
+    return trace;
+}
+
+/*
+    Returns the number of seconds of processor time used so far.
+ */
+static double cpu_seconds()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/*
+    Encodes the trace in batches in an encoding, repeatedly for a while, and
+    measures the size of the batches and the rate of encoding and decoding.
+
+    - session: the session, which sets the encoding
+    - trace: the reports to encode
+    - batch_size: the number of reports per batch
+    - seconds: roughly how long to measure each rate for
+ */
+static bench_result_t measure(const session_t& session,
+    const std::vector<report_t>& trace, int batch_size, double seconds)
+{
+    static char payload[BATCH_PAYLOAD_SIZE];
+    bench_result_t result = { 0, 0, 0 };
+
+    long bytes = 0;
+    for (size_t i = 0; i < trace.size(); i += batch_size)
+    {
+        int count = min((int)(trace.size() - i), batch_size);
+        bytes += serialise_reports(
+            payload, session, session.session_id, &trace[i], count);
+    }
+    result.bytes_per_report = (double)bytes / trace.size();
+
+    long encoded = 0;
+    double start = cpu_seconds();
+    while (cpu_seconds() - start < seconds)
+    {
+        for (size_t i = 0; i < trace.size(); i += batch_size)
+        {
+            int count = min((int)(trace.size() - i), batch_size);
+            serialise_reports(
+                payload, session, session.session_id, &trace[i], count);
+            encoded += count;
+        }
+    }
+    result.encode_rate = encoded / (cpu_seconds() - start);
+
+    if (session.encoding == ReportEncoding::Json) return result;
+
+    // Decode a batch from the middle of the trace, as the logging server would
+    int count = min((int)trace.size() / 2, batch_size);
+    int length = serialise_reports(payload, session, session.session_id,
+        &trace[trace.size() / 2], count);
+
+    long decoded = 0;
+    report_t reports[UPLOAD_BATCH_SIZE];
+    uint16_t session_id;
+    start = cpu_seconds();
+    while (cpu_seconds() - start < seconds)
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            if (session.encoding == ReportEncoding::Binary)
+            {
+                decode_reports_binary((const uint8_t*)payload, length,
+                    &session_id, reports, UPLOAD_BATCH_SIZE);
+            }
+            else
+            {
+                decode_reports_delta((const uint8_t*)payload, length,
+                    &session_id, reports, UPLOAD_BATCH_SIZE);
+            }
+            decoded += count;
+        }
+    }
+    result.decode_rate = decoded / (cpu_seconds() - start);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t interval = argc > 1 ? atoi(argv[1]) * 60 : 300;
+    int batch_size = argc > 2 ? atoi(argv[2]) : UPLOAD_BATCH_SIZE;
+    double seconds = argc > 3 ? atof(argv[3]) : 1;
+
+    if (interval == 0 || batch_size < 1 || batch_size > UPLOAD_BATCH_SIZE ||
+        seconds <= 0)
+    {
+        fprintf(stderr, "usage: %s [interval] [batch_size] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<report_t> trace = make_trace(interval);
+    printf("%d reports over %d days, %u s interval, %d reports per batch\n",
+        (int)trace.size(), BENCH_DAYS, interval, batch_size);
+
+    session_t session = { BENCH_SESSION_ID, (uint8_t)(interval / 60),
+        (uint8_t)batch_size, ReportEncoding::Json };
+    const char* names[] = { "json", "binary", "delta" };
+    double json_bytes = 0;
+
+    for (uint8_t encoding = ReportEncoding::Json;
+        encoding <= ReportEncoding::Delta; encoding++)
+    {
+        session.encoding = encoding;
+        bench_result_t result = measure(session, trace, batch_size, seconds);
+        if (encoding == ReportEncoding::Json) json_bytes = result.bytes_per_report;
+
+        printf("%-7s %6.1f bytes per report (ratio %5.1f to JSON)  encode %9.0f "
+            "reports/s", names[encoding], result.bytes_per_report,
+            json_bytes / result.bytes_per_report, result.encode_rate);
+        if (result.decode_rate > 0)
+            printf("  decode %10.0f reports/s", result.decode_rate);
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+    Replays a recorded trace of waits for one phase (e.g. the broker's
+    connection acknowledgement) through the latency estimator
+    (src/helpers/latency.cpp) and reports how long was spent waiting, how long of
+    that was spent on waits that failed, and how many waits that would have
+    succeeded within the configured timeout were given up on too early. The same
+    trace is also replayed with the configured timeout for every wait, for
+    comparison.
+
+    Build and run on the host:
+
+        g++ -I src/helpers tools/latency_sim.cpp src/helpers/latency.cpp \
+            -o latency_sim
+        ./latency_sim trace.csv [timeout]
+
+    The trace has one line per wait, holding the number of milliseconds the
+    response took to arrive, or - if it never arrived (the link was dead or the
+    response was lost). Lines starting with # are ignored. The timeout is the
+    configured maximum in milliseconds (6000 by default).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "latency.h"
+
+#define SIM_NEVER UINT32_MAX // Latency of a response that never arrives
+
+
+struct sim_result_t
+{
+    long waits;
+    long succeeded;
+    long given_up; // Waits that would have succeeded within the timeout
+    double waited_seconds;
+    double failed_seconds; // Part of waited_seconds spent on waits that failed
+};
+
+
+/*
+    Replays the trace and returns the totals.
+
+    - trace: the latencies to replay in milliseconds
+    - timeout: the configured maximum in milliseconds
+    - adaptive: whether to use the estimator or always wait for the maximum
+ */
+sim_result_t simulate(const std::vector<uint32_t>& trace, uint32_t timeout,
+    bool adaptive)
+{
+    sim_result_t result = { 0, 0, 0, 0, 0 };
+    latency_estimate_t estimate;
+    latency_reset(&estimate);
+
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        uint32_t latency = trace[i];
+        uint32_t deadline = adaptive ? latency_deadline(estimate, timeout) : timeout;
+        result.waits++;
+
+        if (latency <= deadline)
+        {
+            result.succeeded++;
+            result.waited_seconds += latency / 1000.0;
+            latency_record(&estimate, latency);
+        }
+        else
+        {
+            if (latency <= timeout) result.given_up++;
+            result.waited_seconds += deadline / 1000.0;
+            result.failed_seconds += deadline / 1000.0;
+            latency_record_timeout(&estimate);
+        }
+    }
+
+    return result;
+}
+
+void print_result(const char* name, const sim_result_t& result)
+{
+    printf("%-9s succeeded %6ld/%-6ld  given up early %5ld  waited %9.1f s  "
+        "(%.1f s failing)\n", name, result.succeeded, result.waits,
+        result.given_up, result.waited_seconds, result.failed_seconds);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace.csv [timeout]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint32_t timeout = argc > 2 ? (uint32_t)atoi(argv[2]) : 6000;
+
+    std::vector<uint32_t> trace;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+
+        unsigned long latency;
+        if (line[0] == '-') latency = SIM_NEVER;
+        else if (sscanf(line, "%lu", &latency) != 1)
+        {
+            fprintf(stderr, "invalid trace line: %s", line);
+            fclose(file);
+            return 1;
+        }
+
+        trace.push_back((uint32_t)latency);
+    }
+    fclose(file);
+
+    print_result("fixed", simulate(trace, timeout, false));
+    print_result("adaptive", simulate(trace, timeout, true));
+    return 0;
+}
@@ -0,0 +1,561 @@
+/*
+    Runs a fleet of simulated nodes against a logging server (or
+    tools/reference_logger.cpp) through an MQTT broker, to benchmark the node
+    protocol at fleet scale without hardware. Each node has its own connection,
+    gets the active session as the firmware does, then transmits batches of
+    reports serialised by the firmware's own code (see
+    src/helpers/protocol.cpp), keeping up to a window of batches awaiting a
+    response. The responses are parsed by the firmware's code too, so changes to
+    the session are applied.
+
+    Build and run on the host (Linux), with ArduinoJson 6 from the native
+    environment's dependencies (pio pkg install -e native):
+
+        g++ -O2 -I src/helpers -I sim/include \
+            -I .pio/libdeps/native/ArduinoJson/src tools/load_generator.cpp \
+            tools/mqtt_client.cpp src/helpers/protocol.cpp \
+            src/helpers/encoding.cpp src/helpers/helpers.cpp -o load_generator
+        ./load_generator --nodes 2000 --seconds 60 --broker-pid $(pidof mosquitto)
+
+    Prints the rate of acknowledged reports, percentiles of the time from
+    publishing a batch to receiving its response, and the CPU time used by the
+    broker (if its process ID is given) and by the load generator itself. The
+    broker, logging server and load generator should run on separate cores for
+    the figures to mean much. Usage: see print_usage().
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "mqtt_client.h"
+#include "protocol.h"
+
+#define GENERATOR_START_TIME 820540800 // Time of the first report (2026-01-01)
+#define GENERATOR_CONNECT_BATCH 100 // Number of nodes to connect before handling
+// the responses to their connections
+
+
+// Settings for a run
+struct generator_config_t
+{
+    const char* host;
+    uint16_t port;
+    int nodes;
+    double seconds; // Length of the measured part of the run
+    double period; // Seconds between the batches of each node (0 to send the
+    // next batch as soon as there is room in the window)
+    int window; // Most batches awaiting a response per node
+    double timeout; // Seconds to wait for a response
+    int broker_pid; // Process to measure the CPU time of (none if 0)
+    uint64_t seed;
+};
+
+// Progress of a simulated node
+enum NodeState { Connecting, Subscribing, AwaitingSession, Running, Failed };
+
+// A batch transmitted by a simulated node that is awaiting a response
+struct pending_batch_t
+{
+    uint16_t message_id;
+    int count;
+    double sent_time;
+};
+
+struct sim_node_t
+{
+    mqtt_client_t client;
+    char mac_address[18];
+    NodeState state;
+    session_t session;
+    uint16_t publish_id;
+    double state_time; // When the node entered the state
+    double next_batch_time;
+    uint32_t report_time; // Time of the next report to take
+    float airt; // Temperature of the last report
+    std::vector<pending_batch_t> pending; // Oldest first
+};
+
+struct generator_stats_t
+{
+    uint64_t batches;
+    uint64_t accepted; // Batches accepted in full
+    uint64_t partly_accepted;
+    uint64_t no_session;
+    uint64_t errors;
+    uint64_t timeouts;
+    uint64_t reports; // Reports accepted by the logging server
+    uint64_t session_updates;
+    uint64_t bytes; // Bytes of reports transmitted
+    std::vector<float> latencies; // Milliseconds from publishing to the response
+};
+
+generator_config_t config;
+generator_stats_t stats;
+bool measuring = false;
+
+
+static void print_usage()
+{
+    fprintf(stderr,
+        "usage: load_generator [options]\n"
+        "  --host H            broker address (default localhost)\n"
+        "  --port N            broker port (default 1883)\n"
+        "  --nodes N           number of simulated nodes (default 1000)\n"
+        "  --seconds N         length of the measurement (default 30)\n"
+        "  --period N          seconds between each node's batches, or 0 to\n"
+        "                      send as fast as responses allow (default 1)\n"
+        "  --window N          most batches awaiting a response per node\n"
+        "                      (default 4, as the firmware)\n"
+        "  --timeout N         seconds to wait for a response (default 5)\n"
+        "  --broker-pid N      measure the CPU time of the broker process\n"
+        "  --seed N            random seed (default 1)\n");
+}
+
+static bool parse_arguments(int argc, char** argv)
+{
+    const option options[] = {
+        { "host", required_argument, NULL, 'h' },
+        { "port", required_argument, NULL, 'P' },
+        { "nodes", required_argument, NULL, 'n' },
+        { "seconds", required_argument, NULL, 's' },
+        { "period", required_argument, NULL, 'p' },
+        { "window", required_argument, NULL, 'w' },
+        { "timeout", required_argument, NULL, 't' },
+        { "broker-pid", required_argument, NULL, 'b' },
+        { "seed", required_argument, NULL, 'S' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    config.host = "localhost";
+    config.port = MQTT_DEFAULT_PORT;
+    config.nodes = 1000;
+    config.seconds = 30;
+    config.period = 1;
+    config.window = TRANSMIT_WINDOW;
+    config.timeout = 5;
+    config.seed = 1;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'h': config.host = optarg; break;
+        case 'P': config.port = atoi(optarg); break;
+        case 'n': config.nodes = atoi(optarg); break;
+        case 's': config.seconds = atof(optarg); break;
+        case 'p': config.period = atof(optarg); break;
+        case 'w': config.window = atoi(optarg); break;
+        case 't': config.timeout = atof(optarg); break;
+        case 'b': config.broker_pid = atoi(optarg); break;
+        case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+        default: return false;
+        }
+    }
+
+    return config.nodes > 0 && config.seconds > 0 && config.period >= 0 &&
+        config.window > 0 && config.timeout > 0;
+}
+
+/*
+    Returns the next number from a repeatable random sequence.
+ */
+static uint32_t next_random(uint64_t* state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+static double get_seconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+    Returns the CPU time in seconds used by a process so far, or -1 if it cannot
+    be read.
+ */
+static double get_process_cpu(int pid)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    char line[1024];
+    bool read = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+
+    // The user and system times are the 14th and 15th fields, and the fields
+    // after the command name (which may contain spaces) start at the 3rd
+    char* fields = read ? strrchr(line, ')') : NULL;
+    unsigned long user, system;
+    if (fields == NULL || sscanf(fields + 2,
+        "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user, &system) != 2)
+    { return -1; }
+
+    return (double)(user + system) / sysconf(_SC_CLK_TCK);
+}
+
+/*
+    Returns the CPU time in seconds used by this process so far.
+ */
+static double get_own_cpu()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/*
+    Takes the next report for a node, with a temperature that wanders slowly as
+    a real one would (so that delta encoding behaves realistically).
+ */
+static report_t take_report(sim_node_t* node, uint64_t* random)
+{
+    report_t report;
+    report.time = node->report_time;
+    node->report_time += node->session.report_period != 0 ?
+        node->session.report_period : node->session.interval * 60;
+
+    node->airt += ((int)(next_random(random) % 21) - 10) / 100.0f;
+    report.airt = node->airt;
+    report.relh = 50 + node->airt / 2;
+    report.batv = 3.7f;
+    report.samples = 1;
+    report.suppressed = 0;
+
+    // Reports that summarise several samples also hold their spread
+    if (node->session.sample_period != 0)
+    {
+        report.samples = node->session.interval * 60 / node->session.sample_period;
+        report.airt_stats = { report.airt - 0.1f, report.airt + 0.1f, 0.05f };
+        report.relh_stats = { report.relh - 0.2f, report.relh + 0.2f, 0.1f };
+    }
+
+    return report;
+}
+
+/*
+    Serialises and transmits the next batch of reports for a node.
+ */
+static void publish_batch(sim_node_t* node, uint64_t* random, double now)
+{
+    static char payload[BATCH_PAYLOAD_SIZE];
+    report_t batch[UPLOAD_BATCH_SIZE];
+    int count = std::min((int)node->session.batch_size, UPLOAD_BATCH_SIZE);
+
+    for (int i = 0; i < count; i++)
+        batch[i] = take_report(node, random);
+    int length = serialise_reports(payload, node->session,
+        node->session.session_id, batch, count);
+
+    char topic[TOPIC_LENGTH];
+    format_topic(topic, node->mac_address, "reports", ++node->publish_id);
+    if (!node->client.publish(topic, payload, length))
+    {
+        node->state = Failed;
+        return;
+    }
+
+    node->pending.push_back({ node->publish_id, count, now });
+    if (measuring)
+    {
+        stats.batches++;
+        stats.bytes += length;
+    }
+}
+
+/*
+    Handles a response from the logging server to one of a node's messages.
+ */
+static void on_message(void* context, const char* topic, const char* payload,
+    size_t length)
+{
+    sim_node_t* node = (sim_node_t*)context;
+    uint16_t message_id = topic_message_id(topic);
+
+    char message[256];
+    if (length >= sizeof(message)) length = sizeof(message) - 1;
+    memcpy(message, payload, length);
+    message[length] = '\0';
+
+    if (node->state == AwaitingSession)
+    {
+        if (message_id != node->publish_id) return;
+
+        if (parse_session_reply(message, &node->session) == RequestResult::Success)
+            node->state = Running;
+        else node->state = Failed;
+        return;
+    }
+
+    if (node->state != Running) return;
+
+    for (size_t i = 0; i < node->pending.size(); i++)
+    {
+        if (node->pending[i].message_id != message_id) continue;
+
+        session_t update;
+        int accepted;
+        int fields;
+        RequestResult result = parse_report_reply(
+            message, node->pending[i].count, &accepted, &update, &fields);
+
+        // Later updates take precedence over earlier ones, as on the node
+        session_t updated = node->session;
+        apply_session_fields(&updated, update, fields);
+        if (fields != 0 && is_session_valid(updated))
+        {
+            node->session = updated;
+            if (measuring) stats.session_updates++;
+        }
+
+        if (measuring)
+        {
+            stats.latencies.push_back(
+                (get_seconds() - node->pending[i].sent_time) * 1000);
+            stats.reports += accepted;
+
+            if (result == RequestResult::Success) stats.accepted++;
+            else if (result == RequestResult::NoSession) stats.no_session++;
+            else if (accepted > 0) stats.partly_accepted++;
+            else stats.errors++;
+        }
+
+        node->pending.erase(node->pending.begin() + i);
+        return;
+    }
+}
+
+/*
+    Moves a node through connecting, subscribing and getting the session, then
+    transmits its batches when they are due and gives up on responses that take
+    too long.
+ */
+static void update_node(sim_node_t* node, uint64_t* random, double now)
+{
+    if (node->state == Connecting && node->client.connected)
+    {
+        char inbound_topic[TOPIC_LENGTH];
+        snprintf(inbound_topic, TOPIC_LENGTH, "nodes/%s/inbound/#",
+            node->mac_address);
+        node->client.subscribe(inbound_topic);
+        node->state = Subscribing;
+        node->state_time = now;
+    }
+
+    if (node->state == Subscribing && node->client.subscribed > 0)
+    {
+        char outbound_topic[TOPIC_LENGTH];
+        format_topic(outbound_topic, node->mac_address, "outbound",
+            ++node->publish_id);
+        node->client.publish(outbound_topic, "get_session", 11);
+        node->state = AwaitingSession;
+        node->state_time = now;
+    }
+
+    if (node->state == Connecting || node->state == Subscribing ||
+        node->state == AwaitingSession)
+    {
+        if (now - node->state_time > config.timeout) node->state = Failed;
+        return;
+    }
+
+    if (node->state != Running) return;
+
+    // Responses are not retried, as the firmware would do at its next wake
+    while (!node->pending.empty() &&
+        now - node->pending.front().sent_time > config.timeout)
+    {
+        if (measuring) stats.timeouts++;
+        node->pending.erase(node->pending.begin());
+    }
+
+    if ((int)node->pending.size() < config.window && now >= node->next_batch_time)
+    {
+        publish_batch(node, random, now);
+        node->next_batch_time = config.period > 0 ?
+            std::max(node->next_batch_time + config.period, now) : now;
+    }
+}
+
+/*
+    Returns a percentile of the response latencies, which must be sorted.
+ */
+static float get_percentile(const std::vector<float>& latencies, double percentile)
+{
+    if (latencies.empty()) return 0;
+
+    size_t index = (size_t)ceil(percentile / 100 * latencies.size());
+    return latencies[index > 0 ? index - 1 : 0];
+}
+
+int main(int argc, char** argv)
+{
+    if (!parse_arguments(argc, argv))
+    {
+        print_usage();
+        return 1;
+    }
+
+    // Each node needs its own socket
+    rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    uint64_t random = config.seed;
+    std::vector<sim_node_t> nodes(config.nodes);
+    std::vector<pollfd> descriptors(config.nodes);
+    double start = get_seconds();
+
+    for (int i = 0; i < config.nodes; i++)
+    {
+        // Random but repeatable MAC addresses, formatted as by the firmware
+        sim_node_t* node = &nodes[i];
+        uint32_t value = next_random(&random);
+        sprintf(node->mac_address, "%x:%x:%x:%x:%x:%x", 0x02, i >> 8 & 0xFF,
+            i & 0xFF, value >> 16 & 0xFF, value >> 8 & 0xFF, value & 0xFF);
+
+        char client_id[24];
+        snprintf(client_id, sizeof(client_id), "load-%06d-%06x", i,
+            value & 0xFFFFFF);
+
+        node->state = Connecting;
+        node->state_time = get_seconds();
+        node->next_batch_time = INFINITY; // Set once the measurement starts
+        node->publish_id = next_random(&random);
+        node->report_time = GENERATOR_START_TIME;
+        node->airt = 15 + next_random(&random) % 1000 / 100.0f;
+        node->client.on_message = on_message;
+        node->client.context = node;
+
+        if (!node->client.open(config.host, config.port, client_id, true))
+        {
+            fprintf(stderr, "cannot connect node %d: %s\n", i, strerror(errno));
+            node->state = Failed;
+        }
+
+        descriptors[i].fd = node->client.descriptor();
+        descriptors[i].events = POLLIN;
+
+        // Keep up with the broker's responses so that it does not time out the
+        // connections
+        if (i % GENERATOR_CONNECT_BATCH == GENERATOR_CONNECT_BATCH - 1)
+        {
+            ::poll(descriptors.data(), i + 1, 0);
+            for (int j = 0; j <= i; j++)
+            {
+                if (descriptors[j].revents != 0 && !nodes[j].client.poll())
+                    nodes[j].state = Failed;
+            }
+        }
+    }
+
+    double measure_start = 0;
+    double broker_start = 0;
+    double own_start = 0;
+
+    while (true)
+    {
+        int ready = ::poll(descriptors.data(), descriptors.size(), 1);
+        double now = get_seconds();
+
+        for (int i = 0; i < config.nodes && ready > 0; i++)
+        {
+            if (descriptors[i].revents == 0) continue;
+
+            ready--;
+            if (!nodes[i].client.poll() && nodes[i].state != Failed)
+                nodes[i].state = Failed;
+        }
+
+        int setting_up = 0;
+        int running = 0;
+        for (int i = 0; i < config.nodes; i++)
+        {
+            sim_node_t* node = &nodes[i];
+            update_node(node, &random, now);
+
+            if (node->state == Running) running++;
+            else if (node->state != Failed) setting_up++;
+
+            if (node->state == Failed && node->client.descriptor() >= 0)
+                node->client.close();
+            descriptors[i].fd = node->client.descriptor();
+        }
+
+        // Start measuring once every node has its session
+        if (!measuring && setting_up == 0)
+        {
+            fprintf(stderr, "%d nodes running, %d failed to start in %.1f s\n",
+                running, config.nodes - running, now - start);
+            if (running == 0) return 1;
+
+            measuring = true;
+            measure_start = now;
+            broker_start = config.broker_pid ? get_process_cpu(config.broker_pid) : 0;
+            own_start = get_own_cpu();
+
+            // Spread the first batches of the nodes over a period
+            for (int i = 0; i < config.nodes; i++)
+            {
+                nodes[i].next_batch_time = now + (config.period > 0 ?
+                    (next_random(&random) % 1000) / 1000.0 * config.period : 0);
+            }
+        }
+
+        if (measuring && now - measure_start >= config.seconds) break;
+    }
+
+    double elapsed = get_seconds() - measure_start;
+    double broker_cpu = config.broker_pid ?
+        get_process_cpu(config.broker_pid) - broker_start : 0;
+    double own_cpu = get_own_cpu() - own_start;
+
+    std::sort(stats.latencies.begin(), stats.latencies.end());
+
+    printf("batches: %llu sent, %llu accepted, %llu partly accepted, "
+        "%llu no session, %llu errors, %llu timed out\n",
+        (unsigned long long)stats.batches, (unsigned long long)stats.accepted,
+        (unsigned long long)stats.partly_accepted,
+        (unsigned long long)stats.no_session, (unsigned long long)stats.errors,
+        (unsigned long long)stats.timeouts);
+    printf("reports: %llu accepted, %.0f reports/s, %.1f bytes per report\n",
+        (unsigned long long)stats.reports, stats.reports / elapsed,
+        stats.reports > 0 ? (double)stats.bytes / stats.reports : 0.0);
+    printf("response latency (ms): p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+        get_percentile(stats.latencies, 50), get_percentile(stats.latencies, 90),
+        get_percentile(stats.latencies, 99), get_percentile(stats.latencies, 100));
+    if (stats.session_updates > 0)
+        printf("session updates: %llu\n", (unsigned long long)stats.session_updates);
+
+    if (config.broker_pid && broker_start >= 0 && broker_cpu >= 0)
+    {
+        printf("broker cpu: %.2f s (%.1f%% of a core), %.3f ms per 1000 reports\n",
+            broker_cpu, broker_cpu / elapsed * 100,
+            stats.reports > 0 ? broker_cpu * 1e6 / stats.reports : 0.0);
+    }
+    else if (config.broker_pid) printf("broker cpu: cannot read process %d\n",
+        config.broker_pid);
+    printf("load generator cpu: %.2f s (%.1f%% of a core)\n", own_cpu,
+        own_cpu / elapsed * 100);
+
+    for (int i = 0; i < config.nodes; i++)
+        nodes[i].client.close();
+    return 0;
+}
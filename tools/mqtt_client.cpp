@@ -0,0 +1,291 @@
+/*
+    A minimal MQTT 3.1.1 client over a TCP socket (Linux). Only QoS 0 is used, so
+    the only packets that need to be handled are the acknowledgements of the
+    connection and the subscriptions, and the messages published by the broker.
+    Keep-alive is disabled, so no pings are sent.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mqtt_client.h"
+
+// Types of MQTT control packet (the upper four bits of the first byte)
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82 // Includes the flags required for the type
+#define MQTT_SUBACK 0x90
+#define MQTT_DISCONNECT 0xE0
+
+
+/*
+    Appends a string to a packet, preceded by its length.
+ */
+static void put_string(std::string* packet, const char* value, size_t length)
+{
+    packet->push_back((char)(length >> 8));
+    packet->push_back((char)(length & 0xFF));
+    packet->append(value, length);
+}
+
+/*
+    Connects to a broker and sends the connection request without waiting for
+    it to be accepted (connected is set once it is, by poll()). Returns a boolean
+    indicating whether the request was sent.
+
+    - host: the name or address of the broker
+    - port: the port of the broker
+    - client_id: the client ID to connect with
+    - clean_session: whether to discard any session the broker kept from a
+    previous connection with the same client ID
+ */
+bool mqtt_client_t::open(const char* host, uint16_t port, const char* client_id,
+    bool clean_session)
+{
+    char port_string[8];
+    snprintf(port_string, sizeof(port_string), "%u", port);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses;
+    if (getaddrinfo(host, port_string, &hints, &addresses) != 0) return false;
+
+    for (addrinfo* address = addresses; address != NULL; address = address->ai_next)
+    {
+        socket = ::socket(address->ai_family, address->ai_socktype,
+            address->ai_protocol);
+        if (socket < 0) continue;
+        if (connect(socket, address->ai_addr, address->ai_addrlen) == 0) break;
+
+        ::close(socket);
+        socket = -1;
+    }
+
+    freeaddrinfo(addresses);
+    if (socket < 0) return false;
+
+    // Messages are small and latency is what is being measured
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+
+    connected = false;
+    session_present = false;
+    subscribed = 0;
+    received.clear();
+
+    // Protocol name and level, flags, then a keep-alive of 0 (disabled)
+    std::string packet("\x00\x04MQTT\x04", 7);
+    packet.push_back(clean_session ? 0x02 : 0x00);
+    packet.append("\x00\x00", 2);
+    put_string(&packet, client_id, strlen(client_id));
+    return send_packet(MQTT_CONNECT, packet);
+}
+
+/*
+    Subscribes to a topic (which may contain wildcards) with QoS 0, without
+    waiting for the acknowledgement (subscribed is incremented once it arrives,
+    by poll()). Returns a boolean indicating whether the request was sent.
+ */
+bool mqtt_client_t::subscribe(const char* topic)
+{
+    if (++packet_id == 0) packet_id = 1;
+
+    std::string packet;
+    packet.push_back((char)(packet_id >> 8));
+    packet.push_back((char)(packet_id & 0xFF));
+    put_string(&packet, topic, strlen(topic));
+    packet.push_back(0); // QoS
+    return send_packet(MQTT_SUBSCRIBE, packet);
+}
+
+/*
+    Publishes a message with QoS 0. Returns a boolean indicating whether the
+    message was sent.
+ */
+bool mqtt_client_t::publish(const char* topic, const char* payload, size_t length)
+{
+    std::string packet;
+    put_string(&packet, topic, strlen(topic));
+    packet.append(payload, length);
+    return send_packet(MQTT_PUBLISH, packet);
+}
+
+/*
+    Reads whatever has arrived from the broker without blocking, and handles
+    each complete packet (calling on_message for each message). Returns a
+    boolean indicating whether the connection is still open.
+ */
+bool mqtt_client_t::poll()
+{
+    if (socket < 0) return false;
+
+    while (true)
+    {
+        uint8_t data[4096];
+        ssize_t length = recv(socket, data, sizeof(data), 0);
+
+        if (length > 0)
+        {
+            received.insert(received.end(), data, data + length);
+            continue;
+        }
+
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (length < 0 && errno == EINTR) continue;
+
+        close(); // Closed by the broker, or failed
+        return false;
+    }
+
+    int result;
+    while ((result = take_packet()) > 0);
+
+    if (result < 0)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Waits until something arrives from the broker or times out (blocking), then
+    handles it. Returns a boolean indicating whether the connection is still
+    open.
+
+    - timeout: the maximum number of milliseconds to wait
+ */
+bool mqtt_client_t::wait(int timeout)
+{
+    if (socket < 0) return false;
+
+    pollfd descriptor = { socket, POLLIN, 0 };
+    if (::poll(&descriptor, 1, timeout) < 0 && errno != EINTR) return false;
+    return poll();
+}
+
+/*
+    Disconnects from the broker.
+ */
+void mqtt_client_t::close()
+{
+    if (socket < 0) return;
+
+    if (connected) send_packet(MQTT_DISCONNECT, std::string());
+    ::close(socket);
+    socket = -1;
+    connected = false;
+}
+
+
+/*
+    Sends a packet, waiting for room in the socket's buffer if necessary.
+    Returns a boolean indicating success or failure.
+
+    - type: the first byte of the packet
+    - body: the rest of the packet after the remaining length
+ */
+bool mqtt_client_t::send_packet(uint8_t type, const std::string& body)
+{
+    if (socket < 0) return false;
+
+    std::string packet(1, (char)type);
+    size_t remaining = body.size();
+    do
+    {
+        uint8_t value = remaining & 0x7F;
+        remaining >>= 7;
+        packet.push_back((char)(remaining > 0 ? value | 0x80 : value));
+    } while (remaining > 0);
+    packet += body;
+
+    size_t sent = 0;
+    while (sent < packet.size())
+    {
+        ssize_t length = send(socket, packet.data() + sent, packet.size() - sent,
+            MSG_NOSIGNAL);
+
+        if (length >= 0) sent += length;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            pollfd descriptor = { socket, POLLOUT, 0 };
+            ::poll(&descriptor, 1, MQTT_CONNECT_TIMEOUT);
+        }
+        else if (errno != EINTR) return false;
+    }
+
+    return true;
+}
+
+/*
+    Handles the oldest complete packet received from the broker and removes it.
+    Returns the number of bytes in the packet, 0 if there is no complete packet,
+    or -1 if the packet is malformed or the broker refused the connection.
+ */
+int mqtt_client_t::take_packet()
+{
+    // Decode the remaining length, which is 1 to 4 bytes
+    size_t remaining = 0;
+    size_t header = 1;
+    while (true)
+    {
+        if (header >= received.size()) return 0;
+        if (header > 4) return -1;
+
+        uint8_t value = received[header];
+        remaining |= (size_t)(value & 0x7F) << (7 * (header - 1));
+        header++;
+        if ((value & 0x80) == 0) break;
+    }
+
+    if (received.size() < header + remaining) return 0;
+
+    const uint8_t* body = received.data() + header;
+    uint8_t type = received[0] & 0xF0;
+
+    if (type == MQTT_CONNACK)
+    {
+        if (remaining < 2 || body[1] != 0) return -1;
+        session_present = (body[0] & 0x01) != 0;
+        connected = true;
+    }
+    else if (type == MQTT_SUBACK)
+    {
+        if (remaining < 3 || body[2] == 0x80) return -1;
+        subscribed++;
+    }
+    else if (type == MQTT_PUBLISH)
+    {
+        if (remaining < 2) return -1;
+        size_t topic_length = (body[0] << 8) | body[1];
+
+        // Messages with a QoS above 0 also hold a packet ID
+        size_t offset = 2 + topic_length + (((received[0] >> 1) & 0x03) ? 2 : 0);
+        if (offset > remaining) return -1;
+
+        if (on_message != NULL)
+        {
+            std::string topic((const char*)body + 2, topic_length);
+            on_message(context, topic.c_str(), (const char*)body + offset,
+                remaining - offset);
+        }
+    }
+
+    int length = header + remaining;
+    received.erase(received.begin(), received.begin() + length);
+    return length;
+}
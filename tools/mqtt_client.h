@@ -0,0 +1,55 @@
+/*
+    A minimal MQTT 3.1.1 client for the host tools, which speaks only the parts
+    of the protocol that the node uses (QoS 0 publishing and subscribing, see
+    src/helpers/protocol.cpp). See mqtt_client.cpp.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#define MQTT_DEFAULT_PORT 1883
+#define MQTT_CONNECT_TIMEOUT 5000 // Number of milliseconds to wait for a broker
+// to accept a connection
+
+
+// Called for each message received on a subscribed topic
+typedef void (*mqtt_message_callback_t)(void* context, const char* topic,
+    const char* payload, size_t length);
+
+// A connection to an MQTT broker. The socket is non-blocking, so messages are
+// only received when poll() is called, which the caller should do whenever the
+// socket is readable
+struct mqtt_client_t
+{
+private:
+    int socket;
+    uint16_t packet_id;
+    std::vector<uint8_t> received; // Bytes of partly received packets
+
+    bool send_packet(uint8_t, const std::string&);
+    int take_packet();
+
+public:
+    bool connected; // Whether the broker has accepted the connection
+    bool session_present;
+    int subscribed; // Number of subscriptions acknowledged by the broker
+    mqtt_message_callback_t on_message;
+    void* context; // Passed to on_message
+
+    mqtt_client_t() : socket(-1), packet_id(0), connected(false),
+        session_present(false), subscribed(0), on_message(NULL), context(NULL) { }
+
+    int descriptor() const { return socket; }
+    bool open(const char*, uint16_t, const char*, bool);
+    bool subscribe(const char*);
+    bool publish(const char*, const char*, size_t);
+    bool poll();
+    bool wait(int);
+    void close();
+};
+#endif
@@ -0,0 +1,447 @@
+/*
+    A stand-in for the logging server, which speaks the node protocol (see
+    src/helpers/protocol.cpp) through an MQTT broker. Every node is given the
+    same session, and every batch of reports that decodes in the session's
+    encoding is accepted. Used with real nodes on a test network, or with
+    tools/load_generator.cpp to benchmark the protocol without hardware.
+
+    Build and run on the host (Linux), with ArduinoJson 6 from the native
+    environment's dependencies (pio pkg install -e native):
+
+        g++ -I src/helpers -I sim/include -I .pio/libdeps/native/ArduinoJson/src \
+            tools/reference_logger.cpp tools/mqtt_client.cpp \
+            src/helpers/protocol.cpp src/helpers/encoding.cpp \
+            src/helpers/helpers.cpp -o reference_logger
+        ./reference_logger [options] > reports.csv
+
+    Any MQTT 3.1.1 broker will do (e.g. mosquitto -p 1883). The received reports
+    are printed as CSV if --csv is given, and the message and report rates are
+    printed every few seconds. Usage: see print_usage().
+ */
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mqtt_client.h"
+#include "protocol.h"
+#include "encoding.h"
+#include "slots.h"
+
+#define LOGGER_CLIENT_ID "reference-logger"
+#define LOGGER_STATS_PERIOD 5 // Number of seconds between printing the rates
+#define UNIX_TIME_OFFSET 946684800 // Seconds from 1970-01-01 to 2000-01-01
+
+// Settings for the logging server
+struct logger_config_t
+{
+    const char* host;
+    uint16_t port;
+    session_t session;
+    bool no_session; // Respond to every request with "no_session"
+    bool csv; // Print the received reports
+    bool verbose;
+};
+
+// Counts of the messages handled since the last time the rates were printed,
+// and in total
+struct logger_stats_t
+{
+    uint64_t session_requests;
+    uint64_t batches;
+    uint64_t reports;
+    uint64_t rejected;
+    uint64_t telemetry;
+};
+
+logger_config_t config;
+logger_stats_t period_stats;
+logger_stats_t total_stats;
+volatile sig_atomic_t stopping = 0;
+
+
+static void print_usage()
+{
+    fprintf(stderr,
+        "usage: reference_logger [options]\n"
+        "  --host H            broker address (default localhost)\n"
+        "  --port N            broker port (default 1883)\n"
+        "  --session-id N      session ID (default 1)\n"
+        "  --interval N        session interval in minutes (default 5)\n"
+        "  --batch-size N      session batch size (default 1)\n"
+        "  --encoding N        0 JSON, 1 binary, 2 delta (default 0)\n"
+        "  --sample-period N   seconds between samples summarised by each report\n"
+        "                      (default 0, one sample per report)\n"
+        "  --deadband T,H,N    suppress reports within T degrees and H percent of\n"
+        "                      the last stored one, up to N in a row (default none)\n"
+        "  --transmit-slot N   slot to transmit in (default derived from the MAC\n"
+        "                      address)\n"
+        "  --newest-first      transmit the newest reports ahead of a backlog\n"
+        "  --report-period N   seconds between reports in high-frequency mode\n"
+        "                      (default 0, one report per interval)\n"
+        "  --no-session        respond that there is no active session\n"
+        "  --csv               print the received reports as CSV\n"
+        "  --verbose           log every message\n");
+}
+
+static bool parse_arguments(int argc, char** argv)
+{
+    const option options[] = {
+        { "host", required_argument, NULL, 'h' },
+        { "port", required_argument, NULL, 'P' },
+        { "session-id", required_argument, NULL, 's' },
+        { "interval", required_argument, NULL, 'i' },
+        { "batch-size", required_argument, NULL, 'b' },
+        { "encoding", required_argument, NULL, 'e' },
+        { "sample-period", required_argument, NULL, 'p' },
+        { "deadband", required_argument, NULL, 'D' },
+        { "transmit-slot", required_argument, NULL, 't' },
+        { "newest-first", no_argument, NULL, 'N' },
+        { "report-period", required_argument, NULL, 'R' },
+        { "no-session", no_argument, NULL, 'n' },
+        { "csv", no_argument, NULL, 'c' },
+        { "verbose", no_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    config.host = "localhost";
+    config.port = MQTT_DEFAULT_PORT;
+    config.session.session_id = 1;
+    config.session.interval = 5;
+    config.session.batch_size = 1;
+    config.session.encoding = ReportEncoding::Json;
+    config.session.sample_period = 0;
+    config.session.airt_deadband = 0;
+    config.session.relh_deadband = 0;
+    config.session.max_silence = 0;
+    config.session.transmit_slot = SLOT_FROM_KEY;
+    config.session.upload_order = UploadOrder::OldestFirst;
+    config.session.report_period = 0;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        unsigned int max_silence;
+        float airt, relh;
+        switch (option)
+        {
+        case 'h': config.host = optarg; break;
+        case 'P': config.port = atoi(optarg); break;
+        case 's': config.session.session_id = atoi(optarg); break;
+        case 'i': config.session.interval = atoi(optarg); break;
+        case 'b': config.session.batch_size = atoi(optarg); break;
+        case 'e': config.session.encoding = atoi(optarg); break;
+        case 'p': config.session.sample_period = atoi(optarg); break;
+        case 't': config.session.transmit_slot = atoi(optarg); break;
+        case 'N': config.session.upload_order = UploadOrder::NewestFirst; break;
+        case 'R': config.session.report_period = atoi(optarg); break;
+        case 'n': config.no_session = true; break;
+        case 'c': config.csv = true; break;
+        case 'v': config.verbose = true; break;
+
+        case 'D':
+            if (sscanf(optarg, "%f,%f,%u", &airt, &relh, &max_silence) != 3)
+                return false;
+            config.session.airt_deadband = airt * 100 + 0.5f;
+            config.session.relh_deadband = relh * 100 + 0.5f;
+            config.session.max_silence = max_silence;
+            break;
+
+        default: return false;
+        }
+    }
+
+    // The nodes would reject the session
+    if (!is_session_valid(config.session))
+    {
+        fprintf(stderr, "invalid session\n");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Reads a value from a report in a JSON array, which is -99 if missing or null.
+ */
+static float get_value(JsonObject report, const char* name)
+{
+    JsonVariant value = report[name];
+    return value.is<float>() ? value.as<float>() : -99;
+}
+
+/*
+    Parses the reports in a JSON array (see serialise_reports()). Returns the
+    number of reports, or -1 if the array is malformed or holds more than
+    capacity reports.
+
+    - payload: the JSON array (is modified, as the strings are not copied)
+    - session_id_out: will be set to the session ID of the reports
+ */
+static int decode_reports_json(char* payload, uint16_t* session_id_out,
+    report_t* reports_out, int capacity)
+{
+    DynamicJsonDocument document(
+        JSON_ARRAY_SIZE(capacity) + capacity * JSON_OBJECT_SIZE(16));
+    if (deserializeJson(document, payload) != DeserializationError::Ok ||
+        !document.is<JsonArray>())
+    { return -1; }
+
+    int count = 0;
+    for (JsonObject object : document.as<JsonArray>())
+    {
+        if (count == capacity || !object["session_id"].is<uint16_t>() ||
+            !object["time"].is<const char*>())
+        { return -1; }
+
+        uint16_t session_id = object["session_id"];
+        if (count > 0 && session_id != *session_id_out) return -1;
+        *session_id_out = session_id;
+
+        int year, month, day, hour, minute, second;
+        if (sscanf(object["time"].as<const char*>(), "%d-%d-%dT%d:%d:%dZ",
+            &year, &month, &day, &hour, &minute, &second) != 6)
+        { return -1; }
+
+        report_t* report = &reports_out[count++];
+        report->time = RtcDateTime(year, month, day, hour, minute, second);
+        report->airt = get_value(object, "airt");
+        report->relh = get_value(object, "relh");
+        report->batv = get_value(object, "batv");
+        report->samples = object["samples"] | 1;
+        report->airt_stats.minimum = get_value(object, "airt_min");
+        report->airt_stats.maximum = get_value(object, "airt_max");
+        report->airt_stats.deviation = get_value(object, "airt_sd");
+        report->relh_stats.minimum = get_value(object, "relh_min");
+        report->relh_stats.maximum = get_value(object, "relh_max");
+        report->relh_stats.deviation = get_value(object, "relh_sd");
+        report->suppressed = object["suppressed"] | 0;
+    }
+
+    return count;
+}
+
+/*
+    Prints a report as a CSV line.
+ */
+static void print_report(const char* mac_address, uint16_t session_id,
+    const report_t& report)
+{
+    char formatted_time[32];
+    time_t time = (time_t)report.time + UNIX_TIME_OFFSET;
+    strftime(formatted_time, sizeof(formatted_time), "%Y-%m-%dT%H:%M:%SZ",
+        gmtime(&time));
+
+    printf("%s,%u,%s", mac_address, session_id, formatted_time);
+    if (report.airt != -99) printf(",%.2f", report.airt);
+    else printf(",");
+    if (report.relh != -99) printf(",%.2f", report.relh);
+    else printf(",");
+    if (report.batv != -99) printf(",%.3f", report.batv);
+    else printf(",");
+    printf(",%u,%u\n", report.samples > 1 ? report.samples : 1, report.suppressed);
+}
+
+/*
+    Handles a batch of reports from a node. Returns the response.
+
+    - reports: the batch (is modified)
+    - length: the number of bytes in the batch
+ */
+static const char* receive_reports(const char* mac_address, char* reports,
+    size_t length)
+{
+    if (config.no_session) return "no_session";
+
+    static report_t decoded[UPLOAD_BATCH_SIZE];
+    uint16_t session_id = 0;
+    int count;
+
+    if (config.session.encoding == ReportEncoding::Binary)
+    {
+        count = decode_reports_binary((const uint8_t*)reports, length,
+            &session_id, decoded, UPLOAD_BATCH_SIZE);
+    }
+    else if (config.session.encoding == ReportEncoding::Delta)
+    {
+        count = decode_reports_delta((const uint8_t*)reports, length,
+            &session_id, decoded, UPLOAD_BATCH_SIZE);
+    }
+    else count = decode_reports_json(reports, &session_id, decoded, UPLOAD_BATCH_SIZE);
+
+    if (count < 0 || session_id != config.session.session_id)
+    {
+        period_stats.rejected++;
+        return "error";
+    }
+
+    if (config.csv)
+    {
+        for (int i = 0; i < count; i++)
+            print_report(mac_address, session_id, decoded[i]);
+    }
+
+    period_stats.batches++;
+    period_stats.reports += count;
+    return "ok";
+}
+
+/*
+    Handles a message from a node, and responds on the node's inbound topic with
+    the same message ID.
+ */
+static void on_message(void* context, const char* topic, const char* payload,
+    size_t length)
+{
+    mqtt_client_t* client = (mqtt_client_t*)context;
+
+    // The topic is nodes/<mac>/<kind>/<id>
+    char mac_address[32];
+    char kind[16];
+    if (sscanf(topic, "nodes/%31[^/]/%15[^/]/", mac_address, kind) != 2) return;
+    uint16_t message_id = topic_message_id(topic);
+
+    // Copy the message so that it ends in a null character
+    static char message[BATCH_PAYLOAD_SIZE + 1];
+    if (length > BATCH_PAYLOAD_SIZE) length = BATCH_PAYLOAD_SIZE;
+    memcpy(message, payload, length);
+    message[length] = '\0';
+
+    char response[256];
+    if (strcmp(kind, "outbound") == 0)
+    {
+        period_stats.session_requests++;
+        if (strcmp(message, "get_session") != 0) strcpy(response, "error");
+        else if (config.no_session) strcpy(response, "no_session");
+        else serialise_session(response, config.session);
+    }
+    else if (strcmp(kind, "reports") == 0)
+        strcpy(response, receive_reports(mac_address, message, length));
+    else
+    {
+        // Telemetry gets no response
+        if (strcmp(kind, "telemetry") == 0) period_stats.telemetry++;
+        return;
+    }
+
+    if (config.verbose)
+        fprintf(stderr, "%s (%zu bytes): %s\n", topic, length, response);
+
+    char inbound_topic[TOPIC_LENGTH];
+    format_topic(inbound_topic, mac_address, "inbound", message_id);
+    client->publish(inbound_topic, response, strlen(response));
+}
+
+/*
+    Prints the rates of the messages handled since the last time, and adds them
+    to the totals.
+
+    - seconds: the number of seconds since the last time
+ */
+static void print_rates(double seconds)
+{
+    fprintf(stderr, "%.0f reports/s, %.0f batches/s, %.1f session requests/s, "
+        "%llu rejected, %llu telemetry\n", period_stats.reports / seconds,
+        period_stats.batches / seconds, period_stats.session_requests / seconds,
+        (unsigned long long)period_stats.rejected,
+        (unsigned long long)period_stats.telemetry);
+
+    total_stats.session_requests += period_stats.session_requests;
+    total_stats.batches += period_stats.batches;
+    total_stats.reports += period_stats.reports;
+    total_stats.rejected += period_stats.rejected;
+    total_stats.telemetry += period_stats.telemetry;
+    memset(&period_stats, 0, sizeof(period_stats));
+}
+
+static double get_seconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void on_signal(int)
+{
+    stopping = 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (!parse_arguments(argc, argv))
+    {
+        print_usage();
+        return 1;
+    }
+
+    mqtt_client_t client;
+    client.on_message = on_message;
+    client.context = &client;
+
+    if (!client.open(config.host, config.port, LOGGER_CLIENT_ID, true))
+    {
+        fprintf(stderr, "cannot connect to %s:%u\n", config.host, config.port);
+        return 1;
+    }
+
+    client.subscribe("nodes/+/outbound/+");
+    client.subscribe("nodes/+/reports/+");
+    client.subscribe("nodes/+/telemetry/+");
+
+    double start = get_seconds();
+    while (client.subscribed < 3)
+    {
+        if (!client.wait(100) || get_seconds() - start > MQTT_CONNECT_TIMEOUT / 1000.0)
+        {
+            fprintf(stderr, "broker did not accept the connection\n");
+            return 1;
+        }
+    }
+
+    if (config.csv)
+    {
+        printf("mac_address,session_id,time,airt,relh,batv,samples,suppressed\n");
+        fflush(stdout);
+    }
+
+    char session[256];
+    serialise_session(session, config.session);
+    fprintf(stderr, "serving %s\n", config.no_session ? "no session" : session);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    double last_print = get_seconds();
+    start = last_print;
+
+    while (!stopping)
+    {
+        if (!client.wait(100))
+        {
+            fprintf(stderr, "connection to the broker lost\n");
+            break;
+        }
+
+        double now = get_seconds();
+        if (now - last_print >= LOGGER_STATS_PERIOD)
+        {
+            print_rates(now - last_print);
+            last_print = now;
+        }
+    }
+
+    print_rates(get_seconds() - last_print);
+    fprintf(stderr, "total: %llu reports in %llu batches (%llu rejected), "
+        "%llu session requests, %llu telemetry messages in %.0f s\n",
+        (unsigned long long)total_stats.reports,
+        (unsigned long long)total_stats.batches,
+        (unsigned long long)total_stats.rejected,
+        (unsigned long long)total_stats.session_requests,
+        (unsigned long long)total_stats.telemetry, get_seconds() - start);
+
+    client.close();
+    return stopping ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+/*
+    Replays a recorded trace of connection attempts through the transmit
+    scheduler (src/helpers/scheduler.cpp) and reports the number of seconds the
+    radio was on per 1,000 reports. The same trace is also replayed with the
+    original rule of transmitting whenever the batch size is reached, for
+    comparison.
+
+    Build and run on the host:
+
+        g++ -I src/helpers tools/scheduler_sim.cpp src/helpers/scheduler.cpp \
+            -o scheduler_sim
+        ./scheduler_sim trace.csv [interval] [batch_size] [capacity]
+
+    The trace has one line per wake, in the form "connected,milliseconds,batv":
+    whether a connection attempt at that wake would succeed, the number of
+    milliseconds it would take to connect or time out, and the battery voltage
+    (-99 if unknown). Lines starting with # are ignored. The interval is in
+    minutes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "scheduler.h"
+
+#define SIM_REPORT_MILLIS 25 // Number of milliseconds to upload one report
+
+
+struct trace_wake_t
+{
+    bool connected;
+    uint32_t duration;
+    float batv;
+};
+
+struct sim_result_t
+{
+    long reports;
+    long transmitted;
+    long attempts;
+    double radio_seconds;
+};
+
+
+/*
+    Replays the trace and returns the totals. Reports beyond the buffer capacity
+    are assumed to be held in flash memory, as on the device.
+
+    - trace: the wakes to replay
+    - interval: the number of seconds between wakes
+    - batch_size: the batch size requested by the session
+    - capacity: the capacity of the report buffer
+    - adaptive: whether to use the scheduler or the original rule
+ */
+sim_result_t simulate(const std::vector<trace_wake_t>& trace, int interval,
+    int batch_size, int capacity, bool adaptive)
+{
+    sim_result_t result = { 0, 0, 0, 0 };
+    schedule_history_t history;
+    schedule_reset(&history);
+
+    int pending = 0;
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        const trace_wake_t& wake = trace[i];
+        pending++;
+        result.reports++;
+
+        schedule_input_t input;
+        input.time = (uint32_t)(i * interval);
+        input.pending = pending;
+        input.buffered = pending < capacity ? pending : capacity;
+        input.buffer_capacity = capacity;
+        input.batch_size = batch_size;
+        input.batv = wake.batv;
+
+        bool transmit = adaptive ?
+            schedule_should_transmit(schedule_decide(history, input)) :
+            pending >= batch_size;
+        if (!transmit) continue;
+
+        result.attempts++;
+        result.radio_seconds += wake.duration / 1000.0;
+        schedule_record(&history, input.time, wake.connected, wake.duration);
+        if (!wake.connected) continue;
+
+        // Upload as many reports as fit before the next wake
+        long budget = ((long)interval * 1000 - wake.duration) / SIM_REPORT_MILLIS;
+        int sent = pending < budget ? pending : (int)(budget > 0 ? budget : 0);
+
+        pending -= sent;
+        result.transmitted += sent;
+        result.radio_seconds += sent * SIM_REPORT_MILLIS / 1000.0;
+    }
+
+    return result;
+}
+
+void print_result(const char* name, const sim_result_t& result)
+{
+    double per_thousand = result.transmitted == 0 ? 0 :
+        result.radio_seconds * 1000.0 / result.transmitted;
+
+    printf("%-9s attempts %6ld  transmitted %7ld/%-7ld  radio on %9.1f s  "
+        "%7.1f s per 1000 reports\n", name, result.attempts, result.transmitted,
+        result.reports, result.radio_seconds, per_thousand);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr,
+            "usage: %s trace.csv [interval] [batch_size] [capacity]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    int interval = argc > 2 ? atoi(argv[2]) * 60 : 60;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 1;
+    int capacity = argc > 4 ? atoi(argv[4]) : 417;
+
+    std::vector<trace_wake_t> trace;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') continue;
+
+        int connected;
+        unsigned long duration;
+        float batv = -99;
+        if (sscanf(line, "%d,%lu,%f", &connected, &duration, &batv) < 2)
+        {
+            fprintf(stderr, "invalid trace line: %s", line);
+            fclose(file);
+            return 1;
+        }
+
+        trace_wake_t wake = { connected != 0, (uint32_t)duration, batv };
+        trace.push_back(wake);
+    }
+    fclose(file);
+
+    print_result("original", simulate(trace, interval, batch_size, capacity, false));
+    print_result("adaptive", simulate(trace, interval, batch_size, capacity, true));
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+    Works out how many nodes of a fleet would be connecting to the network at
+    once if they all transmitted in every interval, with the transmit slots
+    assigned by src/helpers/slots.cpp. Compares every node connecting at the
+    interval boundary (as before slots), slots derived from the MAC addresses,
+    and slots assigned in turn by the session.
+
+    Build and run on the host:
+
+        g++ -I src/helpers tools/slot_sim.cpp src/helpers/slots.cpp -o slot_sim
+        ./slot_sim nodes [interval] [sample_period] [connect_seconds] [seed]
+
+    The interval is in minutes and the sample period in seconds (0 for one
+    sample per report). Each connection is taken to last connect_seconds
+    (default 3), starting up to a second after the slot to allow for the boot
+    time. The MAC addresses are random but repeatable for a seed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <set>
+#include <vector>
+
+#include "slots.h"
+
+#define SIM_BOOT_MILLIS 1000 // Largest delay from the slot to starting to connect
+
+
+// The ways of choosing when each node connects
+enum Allocation { Boundary, FromKey, Assigned };
+
+struct sim_result_t
+{
+    int peak; // Most nodes connecting at once
+    double mean; // Mean number of nodes connecting at once, while any are
+    int slots_used; // Number of distinct slots that nodes connect in
+};
+
+
+/*
+    Returns the next number from a repeatable random sequence.
+ */
+uint32_t next_random(uint64_t* state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+/*
+    Counts the nodes connecting at once, in millisecond steps over an interval.
+
+    - macs: the MAC addresses of the nodes
+    - boot_delays: the delay from each node's slot to it starting to connect
+    - interval: the number of seconds between reports
+    - period: the number of seconds between samples
+    - connect_millis: the number of milliseconds each connection lasts
+    - allocation: how the slots are chosen
+ */
+sim_result_t simulate(const std::vector<const char*>& macs,
+    const std::vector<uint32_t>& boot_delays, uint32_t interval, uint32_t period,
+    uint32_t connect_millis, Allocation allocation)
+{
+    // Connections that run past the end of the interval wrap into the next one
+    std::vector<int> changes(interval * 1000 + 1, 0);
+    std::set<uint32_t> offsets;
+
+    for (size_t i = 0; i < macs.size(); i++)
+    {
+        uint32_t offset = 0;
+        if (allocation == Allocation::FromKey)
+            offset = slot_offset(slot_key(macs[i]), SLOT_FROM_KEY, interval, period);
+        else if (allocation == Allocation::Assigned)
+            offset = slot_offset(0, i % slot_count(interval, period), interval, period);
+
+        uint32_t start = (offset * 1000 + boot_delays[i]) % (interval * 1000);
+        uint32_t end = start + connect_millis;
+        offsets.insert(offset);
+
+        changes[start]++;
+        if (end <= interval * 1000) changes[end]--;
+        else
+        {
+            changes[interval * 1000]--;
+            changes[0]++;
+            changes[end - interval * 1000]--;
+        }
+    }
+
+    sim_result_t result = { 0, 0, 0 };
+    long total = 0;
+    long busy = 0;
+    int connecting = 0;
+    for (uint32_t t = 0; t < interval * 1000; t++)
+    {
+        connecting += changes[t];
+        if (connecting > result.peak) result.peak = connecting;
+        if (connecting > 0)
+        {
+            total += connecting;
+            busy++;
+        }
+    }
+
+    result.mean = busy > 0 ? (double)total / busy : 0;
+    result.slots_used = offsets.size();
+    return result;
+}
+
+void print_result(const char* name, const sim_result_t& result)
+{
+    printf("%-9s peak %5d connecting  mean %7.1f  slots used %4d\n", name,
+        result.peak, result.mean, result.slots_used);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s nodes [interval] [sample_period] "
+            "[connect_seconds] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    int nodes = atoi(argv[1]);
+    uint32_t interval = argc > 2 ? atoi(argv[2]) * 60 : 300;
+    uint32_t period = argc > 3 && atoi(argv[3]) != 0 ? atoi(argv[3]) : interval;
+    uint32_t connect_millis = argc > 4 ? atof(argv[4]) * 1000 : 3000;
+    uint64_t state = argc > 5 ? strtoull(argv[5], NULL, 10) : 1;
+
+    if (nodes < 1 || interval == 0 || connect_millis == 0)
+    {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    // Formatted like the node formats its own MAC address
+    std::vector<const char*> macs;
+    std::vector<uint32_t> boot_delays;
+    for (int i = 0; i < nodes; i++)
+    {
+        char* mac = new char[18];
+        uint32_t low = next_random(&state);
+        sprintf(mac, "%x:%x:%x:%x:%x:%x", 0x24, 0x6f, 0x28, (low >> 16) & 0xFF,
+            (low >> 8) & 0xFF, low & 0xFF);
+        macs.push_back(mac);
+        boot_delays.push_back(next_random(&state) % SIM_BOOT_MILLIS);
+    }
+
+    printf("%d nodes, %u s interval, %d slots of the interval\n", nodes,
+        interval, slot_count(interval, period));
+    print_result("boundary", simulate(macs, boot_delays, interval, period,
+        connect_millis, Allocation::Boundary));
+    print_result("mac", simulate(macs, boot_delays, interval, period,
+        connect_millis, Allocation::FromKey));
+    print_result("assigned", simulate(macs, boot_delays, interval, period,
+        connect_millis, Allocation::Assigned));
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+    Runs a day of high-frequency sampling through the timebase
+    (src/helpers/timebase.cpp) against a model of a drifting sleep timer, and
+    reports how far the samples strayed from the RTC seconds they were due at
+    and how long was spent awake polling the RTC for them. For comparison, the
+    same day is also run with a plain timer (sleeping for the period after each
+    sample, as counted by the sleep timer) and with the timebase but without its
+    drift correction.
+
+    Build and run on the host:
+
+        g++ -I src/helpers tools/timebase_sim.cpp src/helpers/timebase.cpp \
+            -o timebase_sim
+        ./timebase_sim [period] [interval] [drift] [swing] [seed]
+
+    The period is the number of seconds between samples (5 by default) and the
+    interval the number of minutes between wakes by the RTC alarm (5 by
+    default), each of which restarts the local clock. The sleep timer runs fast
+    by drift parts per million (10000 by default) plus a daily cycle of swing
+    parts per million either side (2000 by default), as the temperature changes.
+    test/test_timebase.cpp runs the same model over several schedules and fails
+    if the calibrated samples stray or poll for longer than it allows.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "timebase.h"
+
+#define SIM_SECONDS 86400 // Length of the simulation
+#define SIM_BOOT_US 40000 // Microseconds from the alarm to the local clock starting
+#define SIM_SETUP_US 180000 // Microseconds from the alarm to the first sample
+#define SIM_SAMPLE_US 150000 // Microseconds awake to take a sample
+#define SIM_POLL_US 450 // Microseconds to read the time from the RTC
+#define SIM_TRANSMIT_US 4000000 // Microseconds awake to transmit once an interval
+#define SIM_TRANSMIT_POLL_US 100000 // Microseconds between checks for a due
+// sample while transmitting
+
+enum SimMode { Timer, Uncorrected, Calibrated };
+
+struct sim_result_t
+{
+    long samples;
+    long scheduled; // Samples taken by waking for them, which the errors are of
+    long late; // Samples taken after waking too late to see their second start
+    double max_error; // Milliseconds from the due second, either way
+    double total_error;
+    double polling; // Seconds awake polling the RTC
+};
+
+// The true time and the local clock of the device
+struct sim_clock_t
+{
+    int64_t time; // Microseconds since the start
+    int64_t local; // Microseconds since the device woke
+    double drift; // Parts per million the sleep timer runs fast by at the start
+    double swing;
+    double wander; // Random walk added to the drift
+};
+
+
+static double random_unit()
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+/*
+    Returns the parts per million that the sleep timer currently runs fast by.
+ */
+static double drift_now(const sim_clock_t& clock)
+{
+    double day = clock.time / 86400e6;
+    return clock.drift + clock.swing * sin(2 * M_PI * day) + clock.wander;
+}
+
+static void awake(sim_clock_t* clock, int64_t duration)
+{
+    clock->time += duration;
+    clock->local += duration;
+}
+
+/*
+    Light sleeps for a number of microseconds as counted by the sleep timer.
+ */
+static void light_sleep(sim_clock_t* clock, int64_t duration)
+{
+    if (duration <= 0) return;
+
+    clock->local += duration;
+    clock->time += (int64_t)(duration / (1 + drift_now(*clock) / 1e6));
+    clock->wander += (random_unit() - 0.5) * 2;
+}
+
+/*
+    Reads the time from the RTC, which takes SIM_POLL_US.
+ */
+static uint32_t read_rtc(sim_clock_t* clock)
+{
+    awake(clock, SIM_POLL_US);
+    return (uint32_t)(clock->time / 1000000);
+}
+
+/*
+    Counts a sample taken now that was due at the start of a second.
+
+    - result: the totals
+    - clock: the clocks at the time of the sample
+    - second: the second the sample was due at
+    - scheduled: whether the device woke for the sample, rather than taking it
+    once booted or when it noticed the sample was due while transmitting (which
+    is the same whichever way the sleeps are timed)
+ */
+static void add_sample(sim_result_t* result, const sim_clock_t& clock,
+    uint32_t second, bool scheduled)
+{
+    result->samples++;
+    if (!scheduled) return;
+
+    double error = fabs((clock.time - (int64_t)second * 1000000) / 1000.0);
+    result->scheduled++;
+    result->total_error += error;
+    if (error > result->max_error) result->max_error = error;
+}
+
+/*
+    Light sleeps until shortly before a second starts as the timebase predicts
+    it, then polls the RTC for the start, as the node does (see await_second()
+    in src/main.cpp). Returns a boolean indicating whether the start was
+    observed exactly.
+
+    - result: the totals, which the time spent polling is added to
+    - clock: the clocks
+    - timebase: the timebase
+    - second: the second to wait for
+    - mode: how the sleeps are timed (Uncorrected or Calibrated)
+ */
+static bool await_second(sim_result_t* result, sim_clock_t* clock,
+    timebase_t* timebase, uint32_t second, SimMode mode)
+{
+    // The start of the second the device woke in is only roughly known, so the
+    // start of the one after it is caught first
+    if (timebase->edge_boot && second > timebase->edge_second + 1)
+        await_second(result, clock, timebase, timebase->edge_second + 1, mode);
+
+    int64_t wake = timebase_wake_time(timebase, second, clock->local);
+    int64_t sleep = wake - clock->local;
+    light_sleep(clock, sleep);
+    if (sleep > 0) timebase_slept(timebase, sleep);
+
+    int64_t poll_start = clock->time;
+    uint32_t now = read_rtc(clock);
+    bool exact = now < second;
+    while (now < second) now = read_rtc(clock);
+    result->polling += (clock->time - poll_start) / 1e6;
+
+    timebase_edge(timebase, second, clock->local, exact);
+    if (mode == Uncorrected) timebase->drift = 0;
+    return exact;
+}
+
+/*
+    Runs the day and returns the totals.
+
+    - period: the number of seconds between samples
+    - interval: the number of seconds between wakes by the RTC alarm
+    - clock: the sleep timer's drift at the start
+    - mode: how the sleeps between samples are timed
+ */
+sim_result_t simulate(uint32_t period, uint32_t interval, sim_clock_t clock,
+    SimMode mode)
+{
+    sim_result_t result = { 0, 0, 0, 0, 0, 0 };
+    timebase_t timebase;
+    timebase_reset(&timebase);
+
+    for (uint32_t start = interval; start + interval <= SIM_SECONDS; start += interval)
+    {
+        // Woken by the alarm at the start of the interval
+        clock.time = (int64_t)start * 1000000 + SIM_BOOT_US;
+        clock.local = 0;
+        timebase_begin(&timebase, start);
+        awake(&clock, SIM_SETUP_US - SIM_BOOT_US);
+        add_sample(&result, clock, start, false);
+        awake(&clock, SIM_SAMPLE_US);
+
+        int64_t sample_local = SIM_SETUP_US - SIM_BOOT_US;
+        uint32_t slot = start + interval / 2 / period * period;
+
+        for (uint32_t second = start + period; second < start + interval;
+            second += period)
+        {
+            if (mode == Timer)
+            {
+                // Sleep for the rest of the period after the last sample
+                int64_t wake = sample_local + (int64_t)period * 1000000;
+                light_sleep(&clock, wake - clock.local);
+                sample_local = clock.local;
+            }
+            else if (!await_second(&result, &clock, &timebase, second, mode))
+                result.late++;
+
+            add_sample(&result, clock, second, true);
+            awake(&clock, SIM_SAMPLE_US);
+
+            // Transmit once an interval, taking the samples that come due in
+            // the meantime when they are noticed
+            if (second == slot)
+            {
+                int64_t end = clock.time + SIM_TRANSMIT_US;
+                while (clock.time < end)
+                {
+                    awake(&clock, SIM_TRANSMIT_POLL_US);
+                    uint32_t now = read_rtc(&clock);
+                    if (now >= second + period && second + period < start + interval)
+                    {
+                        second += period;
+                        add_sample(&result, clock, second, false);
+                        awake(&clock, SIM_SAMPLE_US);
+                        sample_local = clock.local;
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+void print_result(const char* name, const sim_result_t& result)
+{
+    printf("%-12s samples %6ld  late %5ld  error %7.1f ms mean %8.1f ms max  "
+        "polling %6.1f s\n", name, result.samples, result.late,
+        result.scheduled == 0 ? 0 : result.total_error / result.scheduled,
+        result.max_error, result.polling);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t period = argc > 1 ? atoi(argv[1]) : 5;
+    uint32_t interval = (argc > 2 ? atoi(argv[2]) : 5) * 60;
+    sim_clock_t clock = { 0, 0, 10000, 2000, 0 };
+    if (argc > 3) clock.drift = atof(argv[3]);
+    if (argc > 4) clock.swing = atof(argv[4]);
+    srand(argc > 5 ? atoi(argv[5]) : 1);
+
+    if (period == 0 || interval < period)
+    {
+        fprintf(stderr,
+            "usage: %s [period] [interval] [drift] [swing] [seed]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int seed = rand();
+    srand(seed);
+    print_result("timer", simulate(period, interval, clock, Timer));
+    srand(seed);
+    print_result("uncorrected", simulate(period, interval, clock, Uncorrected));
+    srand(seed);
+    print_result("calibrated", simulate(period, interval, clock, Calibrated));
+    return 0;
+}